@@ -22,6 +22,8 @@
 #include <selinux/android.h>
 #include <selinux/avc.h>
 
+#include <mutex>
+
 namespace android {
 
 #ifdef VENDORSERVICEMANAGER
@@ -43,22 +45,48 @@ static std::string getPidcon(pid_t pid) {
     return result;
 }
 
+// The AVC (opened by selinux_check_access without lock callbacks) is not thread safe, so
+// access checks, which happen on several binder threads, hold this while using it. Looking
+// up the target context in service_contexts, the slower part of a check, does not.
+static std::mutex gAvcLock;
+
+namespace {
+// selabel_lookup is not thread safe either, so each thread looks up service_contexts with a
+// handle of its own, which it opens again after a policy load.
+struct ThreadSehandle {
+    struct selabel_handle* handle = nullptr;
+    int policyload = -1;
+
+    ~ThreadSehandle() {
+        if (handle != nullptr) selabel_close(handle);
+    }
+};
+}  // namespace
+
 static struct selabel_handle* getSehandle() {
-    static struct selabel_handle* gSehandle = nullptr;
+    static thread_local ThreadSehandle gSehandle;
+
+    int policyload;
+    {
+        // without the status page, this reads policy loads through the AVC's netlink socket
+        std::lock_guard<std::mutex> lock(gAvcLock);
+        policyload = selinux_status_policyload();
+    }
 
-    if (gSehandle != nullptr && selinux_status_updated()) {
-        selabel_close(gSehandle);
-        gSehandle = nullptr;
+    if (gSehandle.handle != nullptr && gSehandle.policyload != policyload) {
+        selabel_close(gSehandle.handle);
+        gSehandle.handle = nullptr;
     }
 
-    if (gSehandle == nullptr) {
-        gSehandle = kIsVendor
+    if (gSehandle.handle == nullptr) {
+        gSehandle.handle = kIsVendor
             ? selinux_android_vendor_service_context_handle()
             : selinux_android_service_context_handle();
+        gSehandle.policyload = policyload;
     }
 
-    CHECK(gSehandle != nullptr);
-    return gSehandle;
+    CHECK(gSehandle.handle != nullptr);
+    return gSehandle.handle;
 }
 
 struct AuditCallbackData {
@@ -131,6 +159,7 @@ bool Access::actionAllowed(const CallingContext& sctx, const char* tctx, const c
         .tname = &tname,
     };
 
+    std::lock_guard<std::mutex> lock(gAvcLock);
     return 0 == selinux_check_access(sctx.sid.c_str(), tctx, tclass, perm,
         reinterpret_cast<void*>(&data));
 }
@@ -24,6 +24,9 @@
 #include <binder/Stability.h>
 #include <cutils/android_filesystem_config.h>
 #include <cutils/multiuser.h>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <thread>
 
 #ifndef VENDORSERVICEMANAGER
@@ -41,11 +44,27 @@ namespace android {
 
 #ifndef VENDORSERVICEMANAGER
 
-struct ManifestWithDescription {
-    std::shared_ptr<const vintf::HalManifest> manifest;
-    const char* description;
+struct AidlName {
+    std::string package;
+    std::string iface;
+    std::string instance;
+
+    static bool fill(const std::string& name, AidlName* aname) {
+        size_t firstSlash = name.find('/');
+        size_t lastDot = name.rfind('.', firstSlash);
+        if (firstSlash == std::string::npos || lastDot == std::string::npos) {
+            LOG(ERROR) << "VINTF HALs require names in the format type/instance (e.g. "
+                       << "some.package.foo.IFoo/default) but got: " << name;
+            return false;
+        }
+        aname->package = name.substr(0, lastDot);
+        aname->iface = name.substr(lastDot + 1, firstSlash - lastDot - 1);
+        aname->instance = name.substr(firstSlash + 1);
+        return true;
+    }
 };
-static std::vector<ManifestWithDescription> GetManifestsWithDescription() {
+
+std::vector<ServiceManager::ManifestWithDescription> ServiceManager::getManifestsWithDescription() {
 #ifdef __ANDROID_RECOVERY__
     auto vintfObject = vintf::VintfObjectRecovery::GetInstance();
     if (vintfObject == nullptr) {
@@ -64,132 +83,120 @@ static std::vector<ManifestWithDescription> GetManifestsWithDescription() {
 #endif
 }
 
-// func true -> stop search and forEachManifest will return true
-static bool forEachManifest(const std::function<bool(const ManifestWithDescription&)>& func) {
-    for (const ManifestWithDescription& mwd : GetManifestsWithDescription()) {
+// Every query used to walk all manifests, which is most of the cost of adding
+// VINTF services during boot. libvintf hands out the same manifest objects
+// until they are reloaded, so those are compared instead. The index is
+// replaced rather than updated, so callers may keep using the one they got.
+std::shared_ptr<const ServiceManager::VintfIndex> ServiceManager::getVintfIndex() {
+    std::lock_guard<std::mutex> lock(mVintfIndexLock);
+    std::vector<ManifestWithDescription> mwds = getManifestsWithDescription();
+
+    bool changed = mVintfIndex == nullptr || mwds.size() != mVintfIndex->manifests.size();
+    for (size_t i = 0; !changed && i < mwds.size(); i++) {
+        changed = mwds[i].manifest != mVintfIndex->manifests[i];
+    }
+    if (!changed) return mVintfIndex;
+
+    auto index = std::make_shared<VintfIndex>();
+    for (const ManifestWithDescription& mwd : mwds) {
+        index->manifests.push_back(mwd.manifest);
         if (mwd.manifest == nullptr) {
           LOG(ERROR) << "NULL VINTF MANIFEST!: " << mwd.description;
           // note, we explicitly do not retry here, so that we can detect VINTF
           // or other bugs (b/151696835)
           continue;
         }
-        if (func(mwd)) return true;
-    }
-    return false;
-}
-
-struct AidlName {
-    std::string package;
-    std::string iface;
-    std::string instance;
 
-    static bool fill(const std::string& name, AidlName* aname) {
-        size_t firstSlash = name.find('/');
-        size_t lastDot = name.rfind('.', firstSlash);
-        if (firstSlash == std::string::npos || lastDot == std::string::npos) {
-            LOG(ERROR) << "VINTF HALs require names in the format type/instance (e.g. "
-                       << "some.package.foo.IFoo/default) but got: " << name;
-            return false;
+        // first instance of each name in this manifest
+        std::set<std::string> seen;
+        // getAidlInstances() order, for this manifest
+        std::map<std::string, std::set<std::string>> instances;
+        mwd.manifest->forEachInstance([&](const auto& manifestInstance) {
+            if (manifestInstance.format() != vintf::HalFormat::AIDL) return true;
+            std::string type = manifestInstance.package() + "." + manifestInstance.interface();
+            std::string name = type + "/" + manifestInstance.instance();
+            instances[type].insert(manifestInstance.instance());
+            if (!seen.insert(name).second) return true;
+
+            auto [it, inserted] = index->declarations.try_emplace(name);
+            if (inserted) it->second.description = mwd.description;
+            it->second.updatableViaApex = manifestInstance.updatableViaApex();
+            it->second.ip = manifestInstance.ip();
+            it->second.port = manifestInstance.port();
+            return true; // continue (libvintf uses opposite convention)
+        });
+        for (auto& [type, typeInstances] : instances) {
+            std::vector<std::string>& all = index->instances[type];
+            all.insert(all.end(), typeInstances.begin(), typeInstances.end());
         }
-        aname->package = name.substr(0, lastDot);
-        aname->iface = name.substr(lastDot + 1, firstSlash - lastDot - 1);
-        aname->instance = name.substr(firstSlash + 1);
-        return true;
     }
-};
 
-static bool isVintfDeclared(const std::string& name) {
+    LOG(INFO) << "Indexed " << index->declarations.size() << " VINTF declarations.";
+    mVintfIndex = std::move(index);
+    return mVintfIndex;
+}
+
+bool ServiceManager::isVintfDeclared(const std::string& name) {
     AidlName aname;
     if (!AidlName::fill(name, &aname)) return false;
 
-    bool found = forEachManifest([&](const ManifestWithDescription& mwd) {
-        if (mwd.manifest->hasAidlInstance(aname.package, aname.iface, aname.instance)) {
-            LOG(INFO) << "Found " << name << " in " << mwd.description << " VINTF manifest.";
-            return true; // break
-        }
-        return false;  // continue
-    });
-
-    if (!found) {
-        // Although it is tested, explicitly rebuilding qualified name, in case it
-        // becomes something unexpected.
-        LOG(INFO) << "Could not find " << aname.package << "." << aname.iface << "/"
-                  << aname.instance << " in the VINTF manifest.";
+    std::shared_ptr<const VintfIndex> index = getVintfIndex();
+    if (auto it = index->declarations.find(name); it != index->declarations.end()) {
+        LOG(INFO) << "Found " << name << " in " << it->second.description << " VINTF manifest.";
+        return true;
     }
 
-    return found;
+    // Although it is tested, explicitly rebuilding qualified name, in case it
+    // becomes something unexpected.
+    LOG(INFO) << "Could not find " << aname.package << "." << aname.iface << "/"
+              << aname.instance << " in the VINTF manifest.";
+    return false;
 }
 
-static std::optional<std::string> getVintfUpdatableApex(const std::string& name) {
+std::optional<std::string> ServiceManager::getVintfUpdatableApex(const std::string& name) {
     AidlName aname;
     if (!AidlName::fill(name, &aname)) return std::nullopt;
 
-    std::optional<std::string> updatableViaApex;
-
-    forEachManifest([&](const ManifestWithDescription& mwd) {
-        mwd.manifest->forEachInstance([&](const auto& manifestInstance) {
-            if (manifestInstance.format() != vintf::HalFormat::AIDL) return true;
-            if (manifestInstance.package() != aname.package) return true;
-            if (manifestInstance.interface() != aname.iface) return true;
-            if (manifestInstance.instance() != aname.instance) return true;
-            updatableViaApex = manifestInstance.updatableViaApex();
-            return false; // break (libvintf uses opposite convention)
-        });
-        return false; // continue
-    });
-
-    return updatableViaApex;
+    std::shared_ptr<const VintfIndex> index = getVintfIndex();
+    auto it = index->declarations.find(name);
+    if (it == index->declarations.end()) return std::nullopt;
+    return it->second.updatableViaApex;
 }
 
-static std::optional<ConnectionInfo> getVintfConnectionInfo(const std::string& name) {
+std::optional<ConnectionInfo> ServiceManager::getVintfConnectionInfo(const std::string& name) {
     AidlName aname;
     if (!AidlName::fill(name, &aname)) return std::nullopt;
 
-    std::optional<std::string> ip;
-    std::optional<uint64_t> port;
-    forEachManifest([&](const ManifestWithDescription& mwd) {
-        mwd.manifest->forEachInstance([&](const auto& manifestInstance) {
-            if (manifestInstance.format() != vintf::HalFormat::AIDL) return true;
-            if (manifestInstance.package() != aname.package) return true;
-            if (manifestInstance.interface() != aname.iface) return true;
-            if (manifestInstance.instance() != aname.instance) return true;
-            ip = manifestInstance.ip();
-            port = manifestInstance.port();
-            return false; // break (libvintf uses opposite convention)
-        });
-        return false; // continue
-    });
+    std::shared_ptr<const VintfIndex> index = getVintfIndex();
+    auto it = index->declarations.find(name);
+    if (it == index->declarations.end()) return std::nullopt;
+    const VintfDeclaration& declaration = it->second;
 
-    if (ip.has_value() && port.has_value()) {
+    if (declaration.ip.has_value() && declaration.port.has_value()) {
         ConnectionInfo info;
-        info.ipAddress = *ip;
-        info.port = *port;
+        info.ipAddress = *declaration.ip;
+        info.port = *declaration.port;
         return std::make_optional<ConnectionInfo>(info);
     } else {
         return std::nullopt;
     }
 }
 
-static std::vector<std::string> getVintfInstances(const std::string& interface) {
+std::vector<std::string> ServiceManager::getVintfInstances(const std::string& interface) {
     size_t lastDot = interface.rfind('.');
     if (lastDot == std::string::npos) {
         LOG(ERROR) << "VINTF interfaces require names in Java package format (e.g. some.package.foo.IFoo) but got: " << interface;
         return {};
     }
-    const std::string package = interface.substr(0, lastDot);
-    const std::string iface = interface.substr(lastDot+1);
-
-    std::vector<std::string> ret;
-    (void)forEachManifest([&](const ManifestWithDescription& mwd) {
-        auto instances = mwd.manifest->getAidlInstances(package, iface);
-        ret.insert(ret.end(), instances.begin(), instances.end());
-        return false;  // continue
-    });
 
-    return ret;
+    std::shared_ptr<const VintfIndex> index = getVintfIndex();
+    auto it = index->instances.find(interface);
+    if (it == index->instances.end()) return {};
+    return it->second;
 }
 
-static bool meetsDeclarationRequirements(const sp<IBinder>& binder, const std::string& name) {
+bool ServiceManager::meetsDeclarationRequirements(const sp<IBinder>& binder,
+                                                  const std::string& name) {
     if (!Stability::requiresVintfDeclaration(binder)) {
         return true;
     }
@@ -198,7 +205,11 @@ static bool meetsDeclarationRequirements(const sp<IBinder>& binder, const std::s
 }
 #endif  // !VENDORSERVICEMANAGER
 
-ServiceManager::ServiceManager(std::unique_ptr<Access>&& access) : mAccess(std::move(access)) {
+ServiceManager::ServiceManager(std::unique_ptr<Access>&& access)
+      : mAccess(std::move(access)) {
+    for (auto& snapshot : mServicesSnapshots) {
+        snapshot = std::make_shared<const ServiceSnapshotMap>();
+    }
 // TODO(b/151696835): reenable performance hack when we solve bug, since with
 //     this hack and other fixes, it is unlikely we will see even an ephemeral
 //     failure when the manifest parse fails. The goal is that the manifest will
@@ -241,15 +252,51 @@ Status ServiceManager::checkService(const std::string& name, sp<IBinder>* outBin
     return Status::ok();
 }
 
+size_t ServiceManager::getServiceSnapshotShard(const std::string& name) {
+    return std::hash<std::string>{}(name) % kServiceSnapshotShards;
+}
+
+void ServiceManager::publishServiceLocked(const std::string& name) {
+    std::shared_ptr<const ServiceSnapshotMap>& current =
+            mServicesSnapshots[getServiceSnapshotShard(name)];
+    // only copies the services of one shard, so that registering every service during boot
+    // doesn't take quadratic time
+    auto snapshot = std::make_shared<ServiceSnapshotMap>(*current);
+    auto it = mNameToService.find(name);
+    if (it == mNameToService.end()) {
+        snapshot->erase(name);
+    } else {
+        (*snapshot)[name] = ServiceSnapshot{
+                .binder = it->second.binder,
+                .allowIsolated = it->second.allowIsolated,
+                .dumpPriority = it->second.dumpPriority,
+                .lookup = it->second.lookup,
+        };
+    }
+    std::atomic_store(&current, std::shared_ptr<const ServiceSnapshotMap>(snapshot));
+}
+
+std::shared_ptr<const ServiceManager::ServiceSnapshotMap> ServiceManager::getServicesSnapshot(
+        const std::string& name) const {
+    return std::atomic_load(&mServicesSnapshots[getServiceSnapshotShard(name)]);
+}
+
 sp<IBinder> ServiceManager::tryGetService(const std::string& name, bool startIfNotFound) {
     auto ctx = mAccess->getCallingContext();
 
+    // checked first, so that only binders which are handed out set guaranteeClient
+    if (!mAccess->canFind(ctx, name)) {
+        return nullptr;
+    }
+
     sp<IBinder> out;
-    Service* service = nullptr;
-    if (auto it = mNameToService.find(name); it != mNameToService.end()) {
-        service = &(it->second);
+    while (true) {
+        std::shared_ptr<const ServiceSnapshotMap> services = getServicesSnapshot(name);
+        auto it = services->find(name);
+        if (it == services->end()) break;
+        const ServiceSnapshot& service = it->second;
 
-        if (!service->allowIsolated) {
+        if (!service.allowIsolated) {
             uid_t appid = multiuser_get_app_id(ctx.uid);
             bool isIsolated = appid >= AID_ISOLATED_START && appid <= AID_ISOLATED_END;
 
@@ -257,23 +304,27 @@ sp<IBinder> ServiceManager::tryGetService(const std::string& name, bool startIfN
                 return nullptr;
             }
         }
-        out = service->binder;
-    }
 
-    if (!mAccess->canFind(ctx, name)) {
-        return nullptr;
+        // Setting this guarantee each time we hand out a binder ensures that the client-checking
+        // loop knows about the event even if the client immediately drops the service
+        service.lookup->guaranteeClient.store(true);
+
+        // tryUnregisterService marks a service before checking this guarantee, so if it isn't
+        // marked, the guarantee will be seen in time.
+        if (!service.lookup->unregistering.load()) {
+            out = service.binder;
+            break;
+        }
+
+        // The guarantee may have been set too late. tryUnregisterService holds mLock until it
+        // either keeps the service or removes it from the snapshot, so look again after that.
+        std::lock_guard<std::mutex> lock(mLock);
     }
 
     if (!out && startIfNotFound) {
         tryStartService(name);
     }
 
-    if (out) {
-        // Setting this guarantee each time we hand out a binder ensures that the client-checking
-        // loop knows about the event even if the client immediately drops the service
-        service->guaranteeClient = true;
-    }
-
     return out;
 }
 
@@ -319,6 +370,9 @@ Status ServiceManager::addService(const std::string& name, const sp<IBinder>& bi
     }
 #endif  // !VENDORSERVICEMANAGER
 
+    std::lock_guard<std::mutex> notificationLock(mNotificationLock);
+    std::unique_lock<std::mutex> lock(mLock);
+
     // implicitly unlinked when the binder is removed
     if (binder->remoteBinder() != nullptr &&
         binder->linkToDeath(sp<ServiceManager>::fromExisting(this)) != OK) {
@@ -333,14 +387,19 @@ Status ServiceManager::addService(const std::string& name, const sp<IBinder>& bi
         .dumpPriority = dumpPriority,
         .debugPid = ctx.debugPid,
     };
+    publishServiceLocked(name);
 
+    std::vector<sp<IServiceCallback>> callbacks;
     auto it = mNameToRegistrationCallback.find(name);
     if (it != mNameToRegistrationCallback.end()) {
-        for (const sp<IServiceCallback>& cb : it->second) {
-            mNameToService[name].guaranteeClient = true;
-            // permission checked in registerForNotifications
-            cb->onRegistration(name, binder);
-        }
+        mNameToService[name].lookup->guaranteeClient.store(true);
+        callbacks = it->second;
+    }
+    lock.unlock();
+
+    for (const sp<IServiceCallback>& cb : callbacks) {
+        // permission checked in registerForNotifications
+        cb->onRegistration(name, binder);
     }
 
     return Status::ok();
@@ -351,23 +410,19 @@ Status ServiceManager::listServices(int32_t dumpPriority, std::vector<std::strin
         return Status::fromExceptionCode(Status::EX_SECURITY);
     }
 
-    size_t toReserve = 0;
-    for (auto const& [name, service] : mNameToService) {
-        (void) name;
-
-        if (service.dumpPriority & dumpPriority) ++toReserve;
-    }
-
     CHECK(outList->empty());
 
-    outList->reserve(toReserve);
-    for (auto const& [name, service] : mNameToService) {
-        (void) service;
-
-        if (service.dumpPriority & dumpPriority) {
-            outList->push_back(name);
+    // Each shard is read on its own, so a list taken during changes to several services may
+    // show some of them changed and not others, as it would if they were listed one by one.
+    for (const auto& snapshot : mServicesSnapshots) {
+        std::shared_ptr<const ServiceSnapshotMap> services = std::atomic_load(&snapshot);
+        for (auto const& [name, service] : *services) {
+            if (service.dumpPriority & dumpPriority) {
+                outList->push_back(name);
+            }
         }
     }
+    std::sort(outList->begin(), outList->end());
 
     return Status::ok();
 }
@@ -389,6 +444,9 @@ Status ServiceManager::registerForNotifications(
         return Status::fromExceptionCode(Status::EX_NULL_POINTER);
     }
 
+    std::lock_guard<std::mutex> notificationLock(mNotificationLock);
+    std::unique_lock<std::mutex> lock(mLock);
+
     if (OK !=
         IInterface::asBinder(callback)->linkToDeath(
                 sp<ServiceManager>::fromExisting(this))) {
@@ -399,7 +457,8 @@ Status ServiceManager::registerForNotifications(
     mNameToRegistrationCallback[name].push_back(callback);
 
     if (auto it = mNameToService.find(name); it != mNameToService.end()) {
-        const sp<IBinder>& binder = it->second.binder;
+        sp<IBinder> binder = it->second.binder;
+        lock.unlock();
 
         // never null if an entry exists
         CHECK(binder != nullptr) << name;
@@ -416,11 +475,13 @@ Status ServiceManager::unregisterForNotifications(
         return Status::fromExceptionCode(Status::EX_SECURITY);
     }
 
+    std::lock_guard<std::mutex> lock(mLock);
+
     bool found = false;
 
     auto it = mNameToRegistrationCallback.find(name);
     if (it != mNameToRegistrationCallback.end()) {
-        removeRegistrationCallback(IInterface::asBinder(callback), &it, &found);
+        removeRegistrationCallbackLocked(IInterface::asBinder(callback), &it, &found);
     }
 
     if (!found) {
@@ -501,7 +562,7 @@ Status ServiceManager::getConnectionInfo(const std::string& name,
     return Status::ok();
 }
 
-void ServiceManager::removeRegistrationCallback(const wp<IBinder>& who,
+void ServiceManager::removeRegistrationCallbackLocked(const wp<IBinder>& who,
                                     ServiceCallbackMap::iterator* it,
                                     bool* found) {
     std::vector<sp<IServiceCallback>>& listeners = (*it)->second;
@@ -523,20 +584,27 @@ void ServiceManager::removeRegistrationCallback(const wp<IBinder>& who,
 }
 
 void ServiceManager::binderDied(const wp<IBinder>& who) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    std::vector<std::string> removedServices;
     for (auto it = mNameToService.begin(); it != mNameToService.end();) {
         if (who == it->second.binder) {
+            removedServices.push_back(it->first);
             it = mNameToService.erase(it);
         } else {
             ++it;
         }
     }
+    for (const std::string& name : removedServices) {
+        publishServiceLocked(name);
+    }
 
     for (auto it = mNameToRegistrationCallback.begin(); it != mNameToRegistrationCallback.end();) {
-        removeRegistrationCallback(who, &it, nullptr /*found*/);
+        removeRegistrationCallbackLocked(who, &it, nullptr /*found*/);
     }
 
     for (auto it = mNameToClientCallback.begin(); it != mNameToClientCallback.end();) {
-        removeClientCallback(who, &it);
+        removeClientCallbackLocked(who, &it);
     }
 }
 
@@ -565,6 +633,8 @@ Status ServiceManager::registerClientCallback(const std::string& name, const sp<
         return Status::fromExceptionCode(Status::EX_SECURITY);
     }
 
+    std::lock_guard<std::mutex> lock(mLock);
+
     auto serviceIt = mNameToService.find(name);
     if (serviceIt == mNameToService.end()) {
         LOG(ERROR) << "Could not add callback for nonexistent service: " << name;
@@ -593,8 +663,8 @@ Status ServiceManager::registerClientCallback(const std::string& name, const sp<
     return Status::ok();
 }
 
-void ServiceManager::removeClientCallback(const wp<IBinder>& who,
-                                          ClientCallbackMap::iterator* it) {
+void ServiceManager::removeClientCallbackLocked(const wp<IBinder>& who,
+                                                ClientCallbackMap::iterator* it) {
     std::vector<sp<IClientCallback>>& listeners = (*it)->second;
 
     for (auto lit = listeners.begin(); lit != listeners.end();) {
@@ -620,13 +690,21 @@ ssize_t ServiceManager::Service::getNodeStrongRefCount() {
 }
 
 void ServiceManager::handleClientCallbacks() {
-    for (const auto& [name, service] : mNameToService) {
-        handleServiceClientCallback(name, true);
+    std::lock_guard<std::mutex> notificationLock(mNotificationLock);
+    std::vector<ClientNotification> notifications;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+
+        for (const auto& [name, service] : mNameToService) {
+            handleServiceClientCallbackLocked(name, true, &notifications);
+        }
     }
+    sendClientCallbackNotifications(notifications);
 }
 
-ssize_t ServiceManager::handleServiceClientCallback(const std::string& serviceName,
-                                                    bool isCalledOnInterval) {
+ssize_t ServiceManager::handleServiceClientCallbackLocked(
+        const std::string& serviceName, bool isCalledOnInterval,
+        std::vector<ClientNotification>* notifications) {
     auto serviceIt = mNameToService.find(serviceName);
     if (serviceIt == mNameToService.end() || mNameToClientCallback.count(serviceName) < 1) {
         return -1;
@@ -640,36 +718,37 @@ ssize_t ServiceManager::handleServiceClientCallback(const std::string& serviceNa
 
     bool hasClients = count > 1; // this process holds a strong count
 
-    if (service.guaranteeClient) {
+    // guarantee is temporary
+    if (service.lookup->guaranteeClient.exchange(false)) {
         // we have no record of this client
         if (!service.hasClients && !hasClients) {
-            sendClientCallbackNotifications(serviceName, true);
+            queueClientCallbackNotificationsLocked(serviceName, true, notifications);
         }
-
-        // guarantee is temporary
-        service.guaranteeClient = false;
     }
 
     // only send notifications if this was called via the interval checking workflow
     if (isCalledOnInterval) {
         if (hasClients && !service.hasClients) {
             // client was retrieved in some other way
-            sendClientCallbackNotifications(serviceName, true);
+            queueClientCallbackNotificationsLocked(serviceName, true, notifications);
         }
 
         // there are no more clients, but the callback has not been called yet
         if (!hasClients && service.hasClients) {
-            sendClientCallbackNotifications(serviceName, false);
+            queueClientCallbackNotificationsLocked(serviceName, false, notifications);
         }
     }
 
     return count;
 }
 
-void ServiceManager::sendClientCallbackNotifications(const std::string& serviceName, bool hasClients) {
+void ServiceManager::queueClientCallbackNotificationsLocked(
+        const std::string& serviceName, bool hasClients,
+        std::vector<ClientNotification>* notifications) {
     auto serviceIt = mNameToService.find(serviceName);
     if (serviceIt == mNameToService.end()) {
-        LOG(WARNING) << "sendClientCallbackNotifications could not find service " << serviceName;
+        LOG(WARNING) << "queueClientCallbackNotificationsLocked could not find service "
+                     << serviceName;
         return;
     }
     Service& service = serviceIt->second;
@@ -681,15 +760,26 @@ void ServiceManager::sendClientCallbackNotifications(const std::string& serviceN
 
     auto ccIt = mNameToClientCallback.find(serviceName);
     CHECK(ccIt != mNameToClientCallback.end())
-        << "sendClientCallbackNotifications could not find callbacks for service ";
+        << "queueClientCallbackNotificationsLocked could not find callbacks for service ";
 
-    for (const auto& callback : ccIt->second) {
-        callback->onClients(service.binder, hasClients);
-    }
+    notifications->push_back(ClientNotification{
+            .service = service.binder,
+            .hasClients = hasClients,
+            .callbacks = ccIt->second,
+    });
 
     service.hasClients = hasClients;
 }
 
+void ServiceManager::sendClientCallbackNotifications(
+        const std::vector<ClientNotification>& notifications) {
+    for (const ClientNotification& notification : notifications) {
+        for (const auto& callback : notification.callbacks) {
+            callback->onClients(notification.service, notification.hasClients);
+        }
+    }
+}
+
 Status ServiceManager::tryUnregisterService(const std::string& name, const sp<IBinder>& binder) {
     if (binder == nullptr) {
         return Status::fromExceptionCode(Status::EX_NULL_POINTER);
@@ -700,6 +790,9 @@ Status ServiceManager::tryUnregisterService(const std::string& name, const sp<IB
         return Status::fromExceptionCode(Status::EX_SECURITY);
     }
 
+    std::lock_guard<std::mutex> notificationLock(mNotificationLock);
+    std::unique_lock<std::mutex> lock(mLock);
+
     auto serviceIt = mNameToService.find(name);
     if (serviceIt == mNameToService.end()) {
         LOG(WARNING) << "Tried to unregister " << name
@@ -720,12 +813,19 @@ Status ServiceManager::tryUnregisterService(const std::string& name, const sp<IB
         return Status::fromExceptionCode(Status::EX_ILLEGAL_STATE);
     }
 
-    if (serviceIt->second.guaranteeClient) {
+    // The service stays visible while this checks for clients. Lookups which have set
+    // guaranteeClient by now are seen below, and later ones wait on mLock for the outcome.
+    LookupState& lookup = *serviceIt->second.lookup;
+    lookup.unregistering.store(true);
+
+    if (lookup.guaranteeClient.load()) {
         LOG(INFO) << "Tried to unregister " << name << ", but there is about to be a client.";
+        lookup.unregistering.store(false);
         return Status::fromExceptionCode(Status::EX_ILLEGAL_STATE);
     }
 
-    int clients = handleServiceClientCallback(name, false);
+    std::vector<ClientNotification> notifications;
+    int clients = handleServiceClientCallbackLocked(name, false, &notifications);
 
     // clients < 0: feature not implemented or other error. Assume clients.
     // Otherwise:
@@ -736,11 +836,17 @@ Status ServiceManager::tryUnregisterService(const std::string& name, const sp<IB
         // client callbacks are either disabled or there are other clients
         LOG(INFO) << "Tried to unregister " << name << ", but there are clients: " << clients;
         // Set this flag to ensure the clients are acknowledged in the next callback
-        serviceIt->second.guaranteeClient = true;
+        lookup.guaranteeClient.store(true);
+        lookup.unregistering.store(false);
+        lock.unlock();
+        sendClientCallbackNotifications(notifications);
         return Status::fromExceptionCode(Status::EX_ILLEGAL_STATE);
     }
 
     mNameToService.erase(name);
+    publishServiceLocked(name);
+    lock.unlock();
+    sendClientCallbackNotifications(notifications);
 
     return Status::ok();
 }
@@ -750,6 +856,8 @@ Status ServiceManager::getServiceDebugInfo(std::vector<ServiceDebugInfo>* outRet
         return Status::fromExceptionCode(Status::EX_SECURITY);
     }
 
+    std::lock_guard<std::mutex> lock(mLock);
+
     outReturn->reserve(mNameToService.size());
     for (auto const& [name, service] : mNameToService) {
         ServiceDebugInfo info;
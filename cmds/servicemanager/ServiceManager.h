@@ -20,6 +20,16 @@
 #include <android/os/IClientCallback.h>
 #include <android/os/IServiceCallback.h>
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#ifndef VENDORSERVICEMANAGER
+#include <vintf/HalManifest.h>
+#endif  // !VENDORSERVICEMANAGER
+
 #include "Access.h"
 
 namespace android {
@@ -29,6 +39,13 @@ using os::IClientCallback;
 using os::IServiceCallback;
 using os::ServiceDebugInfo;
 
+// Lookups (getService, checkService, listServices and the VINTF queries) may
+// run on any number of binder threads at once. They read snapshots of the
+// service table, so they don't wait on mutations, which are serialized on
+// mLock. The table is split by name into shards, and a change only
+// republishes the snapshot of its shard. The one exception is a lookup of a
+// service which tryUnregisterService is checking for clients: it waits for
+// the outcome, and the service stays visible until it is removed.
 class ServiceManager : public os::BnServiceManager, public IBinder::DeathRecipient {
 public:
     ServiceManager(std::unique_ptr<Access>&& access);
@@ -61,13 +78,32 @@ public:
 protected:
     virtual void tryStartService(const std::string& name);
 
+#ifndef VENDORSERVICEMANAGER
+    struct ManifestWithDescription {
+        std::shared_ptr<const vintf::HalManifest> manifest;
+        const char* description;
+    };
+    // The manifests VINTF services are declared in. These are only indexed
+    // again when a different manifest is returned.
+    virtual std::vector<ManifestWithDescription> getManifestsWithDescription();
+#endif  // !VENDORSERVICEMANAGER
+
 private:
+    // what lookups and tryUnregisterService share about a service
+    struct LookupState {
+        // forces the client check to true
+        std::atomic<bool> guaranteeClient{false};
+        // set while tryUnregisterService checks for clients, lookups wait for it to finish
+        std::atomic<bool> unregistering{false};
+    };
+
     struct Service {
         sp<IBinder> binder; // not null
         bool allowIsolated;
         int32_t dumpPriority;
         bool hasClients = false; // notifications sent on true -> false.
-        bool guaranteeClient = false; // forces the client check to true
+        // shared with snapshots, since lookups use it
+        std::shared_ptr<LookupState> lookup = std::make_shared<LookupState>();
         pid_t debugPid = 0; // the process in which this service runs
 
         // the number of clients of the service, including servicemanager itself
@@ -78,20 +114,94 @@ private:
     using ClientCallbackMap = std::map<std::string, std::vector<sp<IClientCallback>>>;
     using ServiceMap = std::map<std::string, Service>;
 
+    // what lookups need of a Service
+    struct ServiceSnapshot {
+        sp<IBinder> binder; // not null
+        bool allowIsolated;
+        int32_t dumpPriority;
+        std::shared_ptr<LookupState> lookup;
+    };
+    using ServiceSnapshotMap = std::map<std::string, ServiceSnapshot>;
+    static constexpr size_t kServiceSnapshotShards = 64;
+
+    // makes the current mNameToService entry for |name|, or its absence, visible to lookups
+    // mLock must be held
+    void publishServiceLocked(const std::string& name);
+    // the snapshot of the shard holding |name|
+    std::shared_ptr<const ServiceSnapshotMap> getServicesSnapshot(const std::string& name) const;
+    static size_t getServiceSnapshotShard(const std::string& name);
+
+    // an IClientCallback::onClients call to make once mLock is released
+    struct ClientNotification {
+        sp<IBinder> service;
+        bool hasClients;
+        std::vector<sp<IClientCallback>> callbacks;
+    };
+
     // removes a callback from mNameToRegistrationCallback, removing it if the vector is empty
     // this updates iterator to the next location
-    void removeRegistrationCallback(const wp<IBinder>& who,
+    // mLock must be held
+    void removeRegistrationCallbackLocked(const wp<IBinder>& who,
                         ServiceCallbackMap::iterator* it,
                         bool* found);
-    ssize_t handleServiceClientCallback(const std::string& serviceName, bool isCalledOnInterval);
-     // Also updates mHasClients (of what the last callback was)
-    void sendClientCallbackNotifications(const std::string& serviceName, bool hasClients);
+    // mLock must be held, the notifications must be sent after it is released
+    ssize_t handleServiceClientCallbackLocked(const std::string& serviceName,
+                                              bool isCalledOnInterval,
+                                              std::vector<ClientNotification>* notifications);
+    // Also updates mHasClients (of what the last callback was)
+    // mLock must be held, the notification must be sent after it is released
+    void queueClientCallbackNotificationsLocked(const std::string& serviceName, bool hasClients,
+                                                std::vector<ClientNotification>* notifications);
+    // mNotificationLock must be held, mLock must not be
+    void sendClientCallbackNotifications(const std::vector<ClientNotification>& notifications);
     // removes a callback from mNameToClientCallback, deleting the entry if the vector is empty
     // this updates the iterator to the next location
-    void removeClientCallback(const wp<IBinder>& who, ClientCallbackMap::iterator* it);
+    // mLock must be held
+    void removeClientCallbackLocked(const wp<IBinder>& who, ClientCallbackMap::iterator* it);
 
     sp<IBinder> tryGetService(const std::string& name, bool startIfNotFound);
 
+#ifndef VENDORSERVICEMANAGER
+    struct VintfDeclaration {
+        // first manifest this is declared in
+        const char* description;
+        // from the last manifest this is declared in
+        std::optional<std::string> updatableViaApex;
+        std::optional<std::string> ip;
+        std::optional<uint64_t> port;
+    };
+    struct VintfIndex {
+        // manifests this was built from
+        std::vector<std::shared_ptr<const vintf::HalManifest>> manifests;
+        // package.IFoo/instance -> declaration
+        std::unordered_map<std::string, VintfDeclaration> declarations;
+        // package.IFoo -> instances, in manifest order
+        std::unordered_map<std::string, std::vector<std::string>> instances;
+    };
+    // rebuilds mVintfIndex if the manifests changed
+    std::shared_ptr<const VintfIndex> getVintfIndex();
+
+    bool isVintfDeclared(const std::string& name);
+    std::optional<std::string> getVintfUpdatableApex(const std::string& name);
+    std::optional<ConnectionInfo> getVintfConnectionInfo(const std::string& name);
+    std::vector<std::string> getVintfInstances(const std::string& interface);
+    bool meetsDeclarationRequirements(const sp<IBinder>& binder, const std::string& name);
+
+    std::mutex mVintfIndexLock;
+    std::shared_ptr<const VintfIndex> mVintfIndex; // guarded by mVintfIndexLock
+#endif  // !VENDORSERVICEMANAGER
+
+    // Held while notifications are computed and sent, so that callbacks see them in the
+    // order the changes were made. Always taken before mLock.
+    std::mutex mNotificationLock;
+    // No binder calls are made while this is held, since a oneway call can process an
+    // incoming death notification on the same thread, which takes it again.
+    std::mutex mLock;
+    // only written with mLock held, always read atomically
+    std::array<std::shared_ptr<const ServiceSnapshotMap>, kServiceSnapshotShards>
+            mServicesSnapshots;
+
+    // guarded by mLock
     ServiceMap mNameToService;
     ServiceCallbackMap mNameToRegistrationCallback;
     ClientCallbackMap mNameToClientCallback;
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <binder/Binder.h>
+#include <binder/Stability.h>
+
+#include "Access.h"
+#include "ServiceManager.h"
+#include "test_manifest.h"
+
+using android::Access;
+using android::BBinder;
+using android::IBinder;
+using android::ServiceManager;
+using android::sp;
+using android::internal::Stability;
+
+class PermissiveAccess : public Access {
+public:
+    CallingContext getCallingContext() override { return {}; }
+    bool canFind(const CallingContext&, const std::string&) override { return true; }
+    bool canAdd(const CallingContext&, const std::string&) override { return true; }
+    bool canList(const CallingContext&) override { return true; }
+};
+
+// Declares |numServices| AIDL HALs, split between the device and framework
+// manifests, like a device has during boot.
+class BootStormServiceManager : public ServiceManager {
+public:
+    explicit BootStormServiceManager(size_t numServices)
+          : ServiceManager(std::make_unique<PermissiveAccess>()) {
+        std::string hals[2];
+        for (size_t i = 0; i < numServices; i++) {
+            hals[i % 2] +=
+                    makeAidlHal("android.hardware.boot" + std::to_string(i), "IBoot/default");
+        }
+        mManifests.push_back({makeManifest(hals[0]), "device"});
+        mManifests.push_back({makeManifest(hals[1]), "framework"});
+    }
+
+protected:
+    void tryStartService(const std::string&) override {}
+    std::vector<ManifestWithDescription> getManifestsWithDescription() override {
+        return mManifests;
+    }
+
+private:
+    std::vector<ManifestWithDescription> mManifests;
+};
+
+// Every declared service is registered, then looked up and checked for its
+// declaration a few times, as clients starting up do.
+void BM_bootStorm(benchmark::State& state) {
+    size_t numServices = static_cast<size_t>(state.range(0));
+    std::vector<std::string> names;
+    for (size_t i = 0; i < numServices; i++) {
+        names.push_back("android.hardware.boot" + std::to_string(i) + ".IBoot/default");
+    }
+
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        auto sm = sp<BootStormServiceManager>::make(numServices);
+        std::vector<sp<IBinder>> binders;
+        for (size_t i = 0; i < numServices; i++) {
+            sp<IBinder> binder = sp<BBinder>::make();
+            Stability::markVintf(binder.get());
+            binders.push_back(binder);
+        }
+        state.ResumeTiming();
+
+        for (size_t i = 0; i < numServices; i++) {
+            CHECK(sm->addService(names[i], binders[i], false /*allowIsolated*/,
+                                 ServiceManager::DUMP_FLAG_PRIORITY_DEFAULT)
+                          .isOk());
+        }
+        for (size_t round = 0; round < 3; round++) {
+            for (const std::string& name : names) {
+                bool declared;
+                CHECK(sm->isDeclared(name, &declared).isOk());
+                CHECK(declared);
+                sp<IBinder> out;
+                CHECK(sm->checkService(name, &out).isOk());
+                CHECK(out != nullptr);
+            }
+        }
+    }
+}
+BENCHMARK(BM_bootStorm)->Arg(100)->Arg(300)->Arg(500);
+
+BENCHMARK_MAIN();
@@ -36,6 +36,10 @@ using ::android::ServiceManager;
 using ::android::os::IServiceManager;
 using ::android::sp;
 
+// Binder threads which may be started in addition to the looper thread, so that
+// lookups are not queued behind each other.
+static constexpr size_t kMaxBinderThreads = 3;
+
 class BinderCallback : public LooperCallback {
 public:
     static sp<BinderCallback> setupTo(const sp<Looper>& looper) {
@@ -122,7 +126,7 @@ int main(int argc, char** argv) {
     const char* driver = argc == 2 ? argv[1] : "/dev/binder";
 
     sp<ProcessState> ps = ProcessState::initWithDriver(driver);
-    ps->setThreadPoolMaxThreadCount(0);
+    ps->setThreadPoolMaxThreadCount(kMaxBinderThreads);
     ps->setCallRestriction(ProcessState::CallRestriction::FATAL_IF_NOT_ONEWAY);
 
     sp<ServiceManager> manager = sp<ServiceManager>::make(std::make_unique<Access>());
@@ -132,6 +136,7 @@ int main(int argc, char** argv) {
 
     IPCThreadState::self()->setTheContextObject(manager);
     ps->becomeContextManager();
+    ps->startThreadPool();
 
     sp<Looper> looper = Looper::prepare(false /*allowNonCallbacks*/);
 
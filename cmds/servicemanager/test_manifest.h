@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/logging.h>
+#include <vintf/HalManifest.h>
+#include <vintf/constants.h>
+#include <vintf/parse_string.h>
+#include <vintf/parse_xml.h>
+
+#include <memory>
+#include <string>
+
+// Manifests for servicemanager_test and servicemanager_benchmark, which
+// declare services without reading the device's VINTF files.
+
+// The <hal> entry declaring an AIDL instance, e.g. ("a.b", "IFoo/default").
+static inline std::string makeAidlHal(const std::string& package, const std::string& fqname,
+                                      const std::string& attributes = "") {
+    return "<hal format=\"aidl\" " + attributes + "><name>" + package + "</name><fqname>" +
+            fqname + "</fqname></hal>";
+}
+
+// A device manifest holding |hals|. Aborts if they don't parse.
+static inline std::shared_ptr<const android::vintf::HalManifest> makeManifest(
+        const std::string& hals) {
+    auto manifest = std::make_shared<android::vintf::HalManifest>();
+    std::string xml = "<manifest version=\"" +
+            android::vintf::to_string(android::vintf::kMetaVersion) + "\" type=\"device\">" +
+            hals + "</manifest>";
+    std::string error;
+    CHECK(android::vintf::fromXml(manifest.get(), xml, &error)) << error;
+    return manifest;
+}
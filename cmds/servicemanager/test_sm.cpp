@@ -22,8 +22,12 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <atomic>
+#include <thread>
+
 #include "Access.h"
 #include "ServiceManager.h"
+#include "test_manifest.h"
 
 using android::sp;
 using android::Access;
@@ -34,6 +38,7 @@ using android::binder::Status;
 using android::os::BnServiceCallback;
 using android::os::IServiceManager;
 using testing::_;
+using testing::Contains;
 using testing::ElementsAre;
 using testing::NiceMock;
 using testing::Return;
@@ -59,8 +64,12 @@ public:
 
 class MockServiceManager : public ServiceManager {
  public:
+    using ManifestWithDescription = ServiceManager::ManifestWithDescription;
+
     MockServiceManager(std::unique_ptr<Access>&& access) : ServiceManager(std::move(access)) {}
     MOCK_METHOD1(tryStartService, void(const std::string& name));
+    // by default, nothing is declared in VINTF
+    MOCK_METHOD0(getManifestsWithDescription, std::vector<ManifestWithDescription>());
 };
 
 static sp<ServiceManager> getPermissiveServiceManager() {
@@ -167,6 +176,67 @@ TEST(AddService, NoPermissions) {
         IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
 }
 
+TEST(Vintf, DeclaredAcrossManifests) {
+    std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
+    ON_CALL(*access, getCallingContext()).WillByDefault(Return(Access::CallingContext{}));
+    ON_CALL(*access, canFind(_, _)).WillByDefault(Return(true));
+    auto sm = sp<NiceMock<MockServiceManager>>::make(std::move(access));
+
+    auto device = makeManifest(makeAidlHal("a.b", "IFoo/default",
+                                           "updatable-via-apex=\"com.android.foo\""));
+    auto framework = makeManifest(makeAidlHal("a.b", "IFoo/other") +
+                                  makeAidlHal("a.b", "IBar/default"));
+    ON_CALL(*sm, getManifestsWithDescription())
+            .WillByDefault(Return(std::vector<MockServiceManager::ManifestWithDescription>{
+                    {device, "device"}, {framework, "framework"}}));
+
+    bool declared;
+    EXPECT_TRUE(sm->isDeclared("a.b.IFoo/default", &declared).isOk());
+    EXPECT_TRUE(declared);
+    EXPECT_TRUE(sm->isDeclared("a.b.IFoo/other", &declared).isOk());
+    EXPECT_TRUE(declared);
+    EXPECT_TRUE(sm->isDeclared("a.b.IFoo/missing", &declared).isOk());
+    EXPECT_FALSE(declared);
+    EXPECT_TRUE(sm->isDeclared("not-a-vintf-name", &declared).isOk());
+    EXPECT_FALSE(declared);
+
+    std::vector<std::string> instances;
+    EXPECT_TRUE(sm->getDeclaredInstances("a.b.IFoo", &instances).isOk());
+    EXPECT_THAT(instances, ElementsAre("default", "other"));
+    EXPECT_TRUE(sm->getDeclaredInstances("a.b.IMissing", &instances).isOk());
+    EXPECT_THAT(instances, ElementsAre());
+
+    std::optional<std::string> apex;
+    EXPECT_TRUE(sm->updatableViaApex("a.b.IFoo/default", &apex).isOk());
+    EXPECT_EQ(std::make_optional<std::string>("com.android.foo"), apex);
+    EXPECT_TRUE(sm->updatableViaApex("a.b.IFoo/other", &apex).isOk());
+    EXPECT_EQ(std::nullopt, apex);
+}
+
+TEST(Vintf, ReindexedWhenManifestChanges) {
+    std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
+    ON_CALL(*access, getCallingContext()).WillByDefault(Return(Access::CallingContext{}));
+    ON_CALL(*access, canFind(_, _)).WillByDefault(Return(true));
+    auto sm = sp<NiceMock<MockServiceManager>>::make(std::move(access));
+
+    auto before = makeManifest(makeAidlHal("a.b", "IFoo/default"));
+    ON_CALL(*sm, getManifestsWithDescription())
+            .WillByDefault(Return(
+                    std::vector<MockServiceManager::ManifestWithDescription>{{before, "device"}}));
+
+    bool declared;
+    EXPECT_TRUE(sm->isDeclared("a.b.IFoo/new", &declared).isOk());
+    EXPECT_FALSE(declared);
+
+    auto after = makeManifest(makeAidlHal("a.b", "IFoo/default") + makeAidlHal("a.b", "IFoo/new"));
+    ON_CALL(*sm, getManifestsWithDescription())
+            .WillByDefault(Return(
+                    std::vector<MockServiceManager::ManifestWithDescription>{{after, "device"}}));
+
+    EXPECT_TRUE(sm->isDeclared("a.b.IFoo/new", &declared).isOk());
+    EXPECT_TRUE(declared);
+}
+
 TEST(GetService, HappyHappy) {
     auto sm = getPermissiveServiceManager();
     sp<IBinder> service = getBinder();
@@ -240,9 +310,7 @@ TEST(GetService, NotAllowedFromIsolated) {
             .uid = AID_ISOLATED_START,
         }));
     EXPECT_CALL(*access, canAdd(_, _)).WillOnce(Return(true));
-
-    // TODO(b/136023468): when security check is first, this should be called first
-    // EXPECT_CALL(*access, canFind(_, _)).WillOnce(Return(true));
+    EXPECT_CALL(*access, canFind(_, _)).WillOnce(Return(true));
 
     sp<ServiceManager> sm = sp<NiceMock<MockServiceManager>>::make(std::move(access));
 
@@ -287,6 +355,30 @@ TEST(ListServices, AllServices) {
     EXPECT_THAT(out, ElementsAre("sa", "sb", "sc", "sd"));
 }
 
+TEST(ListServices, ManyServicesInOrder) {
+    auto sm = getPermissiveServiceManager();
+
+    // enough services for every snapshot shard to hold several, added in reverse order
+    std::vector<std::string> names;
+    for (int i = 0; i < 500; i++) {
+        names.push_back("service" + std::to_string(1000 + i));
+    }
+    for (auto it = names.rbegin(); it != names.rend(); ++it) {
+        EXPECT_TRUE(sm->addService(*it, getBinder(), false /*allowIsolated*/,
+            IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+    }
+
+    std::vector<std::string> out;
+    EXPECT_TRUE(sm->listServices(IServiceManager::DUMP_FLAG_PRIORITY_ALL, &out).isOk());
+    EXPECT_EQ(names, out);
+
+    sp<IBinder> outBinder;
+    for (const std::string& name : names) {
+        EXPECT_TRUE(sm->checkService(name, &outBinder).isOk());
+        EXPECT_NE(nullptr, outBinder) << name;
+    }
+}
+
 TEST(ListServices, CriticalServices) {
     auto sm = getPermissiveServiceManager();
 
@@ -447,3 +539,102 @@ TEST(ServiceNotifications, GetMultipleNotification) {
     EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf", "asdfasdf"));
     EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf", "asdfasdf"));
 }
+
+// A death notification can be processed on the same thread while a oneway
+// notification is sent, so they must not be sent with the table locked.
+TEST(ServiceNotifications, DeathDuringNotification) {
+    auto sm = getPermissiveServiceManager();
+
+    class DyingCallback : public BnServiceCallback {
+    public:
+        explicit DyingCallback(ServiceManager* sm) : mSm(sm) {}
+        Status onRegistration(const std::string& name, const sp<IBinder>& binder) override {
+            mSm->binderDied(binder);
+            registrations.push_back(name);
+            return Status::ok();
+        }
+        android::status_t linkToDeath(const sp<DeathRecipient>&, void*, uint32_t) override {
+            return android::OK;
+        }
+
+        std::vector<std::string> registrations;
+
+    private:
+        ServiceManager* mSm;
+    };
+    sp<DyingCallback> cb = sp<DyingCallback>::make(sm.get());
+
+    sp<IBinder> service = getBinder();
+
+    EXPECT_TRUE(sm->registerForNotifications("asdfasdf", cb).isOk());
+    EXPECT_TRUE(sm->addService("asdfasdf", service,
+        false /*allowIsolated*/, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+
+    EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf"));
+    sp<IBinder> out;
+    EXPECT_TRUE(sm->checkService("asdfasdf", &out).isOk());
+    EXPECT_EQ(nullptr, out);
+}
+
+TEST(Concurrency, LookupsDuringMutations) {
+    auto sm = getPermissiveServiceManager();
+    constexpr size_t kNumServices = 20;
+    auto nameOf = [](size_t i) { return "foo" + std::to_string(i); };
+
+    sp<IBinder> registered = getBinder();
+    EXPECT_TRUE(sm->addService("registered", registered, false /*allowIsolated*/,
+        IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+
+    std::atomic<bool> done = false;
+    std::vector<std::thread> readers;
+    for (size_t reader = 0; reader < 4; reader++) {
+        readers.emplace_back([&] {
+            while (!done) {
+                sp<IBinder> out;
+                EXPECT_TRUE(sm->getService("registered", &out).isOk());
+                EXPECT_EQ(registered, out);
+
+                // may or may not be registered at the moment
+                for (size_t i = 0; i < kNumServices; i++) {
+                    EXPECT_TRUE(sm->checkService(nameOf(i), &out).isOk());
+                }
+
+                std::vector<std::string> names;
+                EXPECT_TRUE(sm->listServices(IServiceManager::DUMP_FLAG_PRIORITY_ALL, &names)
+                                    .isOk());
+                EXPECT_THAT(names, Contains("registered"));
+
+                bool declared = true;
+                EXPECT_TRUE(sm->isDeclared("android.hardware.foo.IFoo/default", &declared).isOk());
+                EXPECT_FALSE(declared);
+            }
+        });
+    }
+
+    for (size_t round = 0; round < 200; round++) {
+        std::vector<sp<IBinder>> binders;
+        for (size_t i = 0; i < kNumServices; i++) {
+            binders.push_back(getBinder());
+            EXPECT_TRUE(sm->addService(nameOf(i), binders.back(), false /*allowIsolated*/,
+                IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+        }
+        // overwrite half of them before they go away
+        for (size_t i = 0; i < kNumServices; i += 2) {
+            binders.push_back(getBinder());
+            EXPECT_TRUE(sm->addService(nameOf(i), binders.back(), false /*allowIsolated*/,
+                IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+        }
+        for (const sp<IBinder>& binder : binders) {
+            sm->binderDied(binder);
+        }
+    }
+
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    std::vector<std::string> names;
+    EXPECT_TRUE(sm->listServices(IServiceManager::DUMP_FLAG_PRIORITY_ALL, &names).isOk());
+    EXPECT_THAT(names, ElementsAre("registered"));
+}
@@ -17,7 +17,13 @@
 #include <binder/Binder.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
@@ -29,6 +35,7 @@
 #include <binder/Parcel.h>
 #include <binder/RpcServer.h>
 #include <private/android_filesystem_config.h>
+#include <utils/AndroidThreads.h>
 #include <utils/misc.h>
 
 #include <inttypes.h>
@@ -227,6 +234,75 @@ private:
     wp<BBinder> mBinder;
 };
 
+class BBinder::OnewayQueue
+{
+public:
+    struct Call {
+        // Keeps the object alive until the call has run.
+        sp<BBinder> target;
+        uint32_t code;
+        uint32_t flags;
+        int64_t callingIdentity;
+        uid_t workSource;
+        Parcel data;
+    };
+
+    // The calls of one priority.
+    struct Lane {
+        // In arrival order.
+        std::deque<std::unique_ptr<Call>> calls;
+        // Whether the worker is running a call it took off calls.
+        bool running = false;
+        // Runs the calls at the priority. Started with the first one.
+        std::thread worker;
+        // Kept once drainAndStop() takes the worker.
+        std::thread::id workerId;
+    };
+
+    // Stops the workers once they have run every queued call.
+    void drainAndStop() {
+        std::vector<std::thread> workers;
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            mStopping = true;
+            for (auto& [priority, lane] : mLanes) {
+                if (lane.worker.joinable()) workers.push_back(std::move(lane.worker));
+            }
+        }
+        mCondition.notify_all();
+        for (std::thread& worker : workers) {
+            if (worker.get_id() == std::this_thread::get_id()) {
+                // The worker dropped the last reference to the object. It
+                // holds a reference to this queue and exits on its own.
+                worker.detach();
+            } else {
+                worker.join();
+            }
+        }
+    }
+
+    bool isWorkerLocked() const {
+        for (const auto& [priority, lane] : mLanes) {
+            if (lane.workerId == std::this_thread::get_id()) return true;
+        }
+        return false;
+    }
+
+    // Whether no call of |priority| is queued or running.
+    bool isIdleLocked(int priority) const {
+        auto it = mLanes.find(priority);
+        return it == mLanes.end() || (it->second.calls.empty() && !it->second.running);
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    // By priority.
+    std::map<int, Lane> mLanes;
+    // Calls in all lanes, at most kMaxQueuedOnewayTransactions.
+    size_t mQueued = 0;
+    bool mStopping = false;
+};
+
 class BBinder::Extras
 {
 public:
@@ -236,9 +312,17 @@ public:
     sp<IBinder> mExtension;
     int mPolicy = SCHED_NORMAL;
     int mPriority = 0;
+    // see setOnewayTransactionPriority()
+    std::map<uint32_t, int> mOnewayPriorities;
+
+    ~Extras() {
+        // Queued calls keep the object alive, so none are left here.
+        if (mOnewayQueue != nullptr) mOnewayQueue->drainAndStop();
+    }
 
     // for below objects
     Mutex mLock;
+    std::shared_ptr<OnewayQueue> mOnewayQueue;
     std::set<sp<RpcServerLink>> mRpcServerLinks;
     BpBinder::ObjectManager mObjects;
 };
@@ -294,6 +378,9 @@ status_t BBinder::transact(
             break;
         }
         default:
+            if ((flags & FLAG_ONEWAY) && enqueueOnewayTransaction(code, data, flags)) {
+                break;
+            }
             err = onTransact(code, data, reply, flags);
             break;
     }
@@ -474,6 +561,160 @@ void BBinder::setInheritRt(bool inheritRt) {
     e->mInheritRt = inheritRt;
 }
 
+bool BBinder::isOnewayQueueEnabled() {
+    Extras* e = mExtras.load(std::memory_order_acquire);
+    if (e == nullptr) return false;
+
+    AutoMutex _l(e->mLock);
+    return e->mOnewayQueue != nullptr;
+}
+
+void BBinder::setOnewayQueueEnabled(bool enabled) {
+    LOG_ALWAYS_FATAL_IF(mParceled,
+                        "setOnewayQueueEnabled() should not be called after a binder object "
+                        "is parceled/sent to another process");
+
+    Extras* e = mExtras.load(std::memory_order_acquire);
+
+    if (!e) {
+        if (!enabled) {
+            return;
+        }
+
+        e = getOrCreateExtras();
+        if (!e) return; // out of memory
+    }
+
+    std::shared_ptr<OnewayQueue> stopped;
+    {
+        AutoMutex _l(e->mLock);
+        if (!enabled) {
+            stopped = std::move(e->mOnewayQueue);
+        } else if (e->mOnewayQueue == nullptr) {
+            e->mOnewayQueue = std::make_shared<OnewayQueue>();
+        }
+    }
+    // Outside the lock, since the queued calls may need it.
+    if (stopped != nullptr) stopped->drainAndStop();
+}
+
+void BBinder::setOnewayTransactionPriority(uint32_t code, int priority) {
+    LOG_ALWAYS_FATAL_IF(mParceled,
+                        "setOnewayTransactionPriority() should not be called after a binder "
+                        "object is parceled/sent to another process");
+    LOG_ALWAYS_FATAL_IF(priority < -20 || priority > 19,
+                        "Invalid priority for oneway transactions: %d", priority);
+
+    Extras* e = getOrCreateExtras();
+    if (!e) return; // out of memory
+
+    e->mOnewayPriorities[code] = priority;
+}
+
+bool BBinder::enqueueOnewayTransaction(uint32_t code, const Parcel& data, uint32_t flags) {
+    if (code < FIRST_CALL_TRANSACTION || code > LAST_CALL_TRANSACTION) return false;
+
+    Extras* e = mExtras.load(std::memory_order_acquire);
+    if (e == nullptr || e->mRequestingSid) return false;
+    if (data.isForRpc()) return false;
+    std::shared_ptr<OnewayQueue> queue;
+    {
+        AutoMutex _l(e->mLock);
+        queue = e->mOnewayQueue;
+    }
+    if (queue == nullptr) return false;
+    auto priorityIt = e->mOnewayPriorities.find(code);
+    const int priority = priorityIt == e->mOnewayPriorities.end() ? 0 : priorityIt->second;
+
+    auto call = std::make_unique<OnewayQueue::Call>();
+    if (call->data.appendFrom(&data, 0, data.dataSize()) != NO_ERROR) {
+        ALOGW("Failed to copy oneway transaction %u, dispatching it inline", code);
+        return false;
+    }
+    call->data.setDataPosition(0);
+    call->target = sp<BBinder>::fromExisting(this);
+    call->code = code;
+    call->flags = flags;
+    IPCThreadState* ipc = IPCThreadState::self();
+    call->callingIdentity = ipc->clearCallingIdentity();
+    ipc->restoreCallingIdentity(call->callingIdentity);
+    call->workSource = ipc->getCallingWorkSourceUid();
+
+    {
+        std::unique_lock<std::mutex> lock(queue->mLock);
+        // When the queue is full, or was disabled since it was looked up, run
+        // the call on this thread once the queued calls of its priority have
+        // run, so that it stays in order. Until then the driver keeps its
+        // buffer, and holds back further oneway transactions to this object.
+        // A call made from a worker could end up waiting for itself, so it
+        // runs right away instead, as it would without the queue.
+        if (queue->mStopping || queue->mQueued >= kMaxQueuedOnewayTransactions) {
+            if (!queue->isWorkerLocked()) {
+                queue->mCondition.wait(lock, [&] { return queue->isIdleLocked(priority); });
+            }
+            return false;
+        }
+        OnewayQueue::Lane& lane = queue->mLanes[priority];
+        lane.calls.push_back(std::move(call));
+        queue->mQueued++;
+        if (lane.workerId == std::thread::id()) {
+            lane.worker = std::thread(&BBinder::runOnewayQueue, queue, priority);
+            lane.workerId = lane.worker.get_id();
+        }
+    }
+    // notify_all(), since threads waiting for room share the condition.
+    queue->mCondition.notify_all();
+    return true;
+}
+
+void BBinder::runOnewayQueue(std::shared_ptr<OnewayQueue> queue, int priority) {
+    androidSetThreadName("binder:oneway");
+    // Set even for the default, since the thread starts out at the priority
+    // of the pooled thread which started it.
+    if (androidSetThreadPriority(0, priority) != 0) {
+        ALOGW("Failed to run queued oneway transactions at priority %d", priority);
+    }
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int64_t ownIdentity = ipc->clearCallingIdentity();
+
+    std::unique_lock<std::mutex> lock(queue->mLock);
+    // Lanes are never removed, so this stays valid.
+    OnewayQueue::Lane& lane = queue->mLanes[priority];
+    while (true) {
+        queue->mCondition.wait(lock, [&] { return queue->mStopping || !lane.calls.empty(); });
+        if (lane.calls.empty()) break;
+
+        std::unique_ptr<OnewayQueue::Call> call = std::move(lane.calls.front());
+        lane.calls.pop_front();
+        queue->mQueued--;
+        lane.running = true;
+        lock.unlock();
+
+        ipc->restoreCallingIdentity(call->callingIdentity);
+        ipc->setCallingWorkSourceUidWithoutPropagation(call->workSource);
+        // Same as IPCThreadState: handlers may write a reply, e.g. an error
+        // status, even for oneway transactions.
+        Parcel reply;
+        status_t err = call->target->onTransact(call->code, call->data, &reply, call->flags);
+        if (err != NO_ERROR) {
+            ALOGW("Queued oneway transaction %u failed: %s", call->code,
+                  statusToString(err).c_str());
+        }
+        ipc->clearCallingWorkSource();
+        ipc->restoreCallingIdentity(ownIdentity);
+        // Nothing else drives this thread's command queue.
+        ipc->flushCommands();
+        // This may drop the last reference to the object, which stops the
+        // queue.
+        call = nullptr;
+
+        lock.lock();
+        lane.running = false;
+        // Wakes a thread waiting for room, see enqueueOnewayTransaction().
+        queue->mCondition.notify_all();
+    }
+}
+
 pid_t BBinder::getDebugPid() {
     return getpid();
 }
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Places the allocations of a MemoryDealer in its heap.
+class HeapAllocator
+{
+public:
+    virtual ~HeapAllocator() {}
+
+    // returns the offset of the allocation, or NO_MEMORY
+    virtual size_t      allocate(size_t size, uint32_t flags = 0) = 0;
+    virtual status_t    deallocate(size_t offset) = 0;
+    virtual void        dump(const char* what) const = 0;
+};
+
+// Allocator of MemoryDealer::Policy::BUDDY.
+class BuddyAllocator : public HeapAllocator
+{
+public:
+    explicit BuddyAllocator(size_t size);
+
+    size_t      allocate(size_t size, uint32_t flags = 0) override;
+    // returns NAME_NOT_FOUND if |offset| isn't an allocation
+    status_t    deallocate(size_t offset) override;
+    void        dump(const char* what) const override;
+
+    // the smallest block, which is also the alignment of every block
+    static size_t minBlockSize();
+
+private:
+    static size_t blockSize(size_t order) { return minBlockSize() << order; }
+
+    mutable Mutex       mLock;
+    size_t              mHeapSize;
+    // offsets of the free blocks of each order, lowest first
+    std::vector<std::set<size_t>> mFreeBlocks;
+    // offsets of the allocated blocks, to their order
+    std::unordered_map<size_t, uint8_t> mAllocatedBlocks;
+    size_t              mAllocatedSize;
+};
+
+} // namespace android
@@ -43,6 +43,10 @@ bool FdTrigger::isTriggered() {
     return mWrite == -1;
 }
 
+base::borrowed_fd FdTrigger::readFd() const {
+    return mRead;
+}
+
 status_t FdTrigger::triggerablePoll(base::borrowed_fd fd, int16_t event) {
     LOG_ALWAYS_FATAL_IF(event == 0, "triggerablePoll %d with event 0 is not allowed", fd.get());
     pollfd pfd[]{{.fd = fd.get(), .events = static_cast<int16_t>(event), .revents = 0},
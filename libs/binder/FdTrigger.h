@@ -54,6 +54,13 @@ public:
      */
     [[nodiscard]] status_t triggerablePoll(base::borrowed_fd fd, int16_t event);
 
+    /**
+     * The read end of the pipe, which gets POLLHUP once triggered. This is for
+     * callers which wait on many FDs at once (e.g. with epoll) instead of
+     * calling triggerablePoll.
+     */
+    base::borrowed_fd readFd() const;
+
 private:
     base::unique_fd mWrite;
     base::unique_fd mRead;
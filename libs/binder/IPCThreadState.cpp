@@ -21,6 +21,7 @@
 #include <binder/Binder.h>
 #include <binder/BpBinder.h>
 #include <binder/TextOutput.h>
+#include <binder/TransactionStats.h>
 
 #include <android-base/macros.h>
 #include <cutils/sched_policy.h>
@@ -28,9 +29,12 @@
 #include <utils/Log.h>
 #include <utils/SystemClock.h>
 
+#include <algorithm>
 #include <atomic>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
@@ -513,6 +517,11 @@ bool IPCThreadState::flushIfNeeded()
     if (mIsLooper || mServingStackPointer != nullptr || mIsFlushing) {
         return false;
     }
+    if (mCommandBatchDepth > 0) {
+        // endCommandBatch() or the next transaction will take care of it.
+        mCommandBatchDeferredFlushes++;
+        return false;
+    }
     mIsFlushing = true;
     // In case this thread is not a looper and is not currently serving a binder transaction,
     // there's no guarantee that this thread will call back into the kernel driver any time
@@ -523,6 +532,86 @@ bool IPCThreadState::flushIfNeeded()
     return true;
 }
 
+void IPCThreadState::beginCommandBatch()
+{
+    mCommandBatchDepth++;
+}
+
+void IPCThreadState::endCommandBatch()
+{
+    LOG_ALWAYS_FATAL_IF(mCommandBatchDepth == 0, "endCommandBatch() without beginCommandBatch()");
+    if (--mCommandBatchDepth > 0) return;
+
+    size_t saved = mCommandBatchDeferredFlushes;
+    mCommandBatchDeferredFlushes = 0;
+    if (mOut.dataSize() > 0 && flushIfNeeded() && saved > 0) {
+        // one flush is still needed for whatever was queued last
+        saved--;
+    }
+    mCommandBatchStats.savedFlushes += saved;
+}
+
+IPCThreadState::CommandBatchStats IPCThreadState::getCommandBatchStats() const
+{
+    return mCommandBatchStats;
+}
+
+static int32_t oppositeRefCommand(int32_t cmd)
+{
+    switch (cmd) {
+        case BC_ACQUIRE:
+            return BC_RELEASE;
+        case BC_RELEASE:
+            return BC_ACQUIRE;
+        case BC_INCREFS:
+            return BC_DECREFS;
+        case BC_DECREFS:
+            return BC_INCREFS;
+    }
+    LOG_ALWAYS_FATAL("Not a reference count command: %d", cmd);
+}
+
+bool IPCThreadState::queueRefCommand(int32_t cmd, int32_t handle)
+{
+    const int32_t opposite = oppositeRefCommand(cmd);
+
+    // Only the most recent strong (or weak) command queued for this handle may
+    // be cancelled, so that the driver never sees a lower reference count than
+    // it would have without coalescing, other than the net result.
+    for (size_t i = mQueuedRefCommands.size(); i > 0; i--) {
+        const QueuedRefCommand queued = mQueuedRefCommands[i - 1];
+        if (queued.handle != handle || (queued.cmd != cmd && queued.cmd != opposite)) continue;
+        if (queued.cmd != opposite) break;
+
+        constexpr size_t kCommandSize = 2 * sizeof(int32_t);
+        const size_t outSize = mOut.dataSize();
+        uint8_t* out = const_cast<uint8_t*>(mOut.data());
+        int32_t written[2];
+        if (queued.offset + kCommandSize > outSize) break;
+        memcpy(written, out + queued.offset, kCommandSize);
+        if (written[0] != queued.cmd || written[1] != queued.handle) break;
+
+        memmove(out + queued.offset, out + queued.offset + kCommandSize,
+                outSize - queued.offset - kCommandSize);
+        mOut.setDataSize(outSize - kCommandSize);
+        mOut.setDataPosition(outSize - kCommandSize);
+
+        mQueuedRefCommands.erase(mQueuedRefCommands.begin() + (i - 1));
+        for (size_t j = i - 1; j < mQueuedRefCommands.size(); j++) {
+            mQueuedRefCommands[j].offset -= kCommandSize;
+        }
+        mCommandBatchStats.cancelledRefCommands += 2;
+        LOG_REMOTEREFS("IPCThreadState cancelled queued refcount command for handle %d\n",
+                       handle);
+        return false;
+    }
+
+    mQueuedRefCommands.push_back({cmd, handle, mOut.dataPosition()});
+    mOut.writeInt32(cmd);
+    mOut.writeInt32(handle);
+    return true;
+}
+
 void IPCThreadState::blockUntilThreadAvailable()
 {
     pthread_mutex_lock(&mProcess->mThreadCountLock);
@@ -554,6 +643,10 @@ status_t IPCThreadState::getAndExecuteCommand()
 
         pthread_mutex_lock(&mProcess->mThreadCountLock);
         mProcess->mExecutingThreadsCount++;
+        mProcess->mPeakExecutingThreads =
+                std::max(mProcess->mPeakExecutingThreads, mProcess->mExecutingThreadsCount);
+        mProcess->mMaxExecutingThreads =
+                std::max(mProcess->mMaxExecutingThreads, mProcess->mExecutingThreadsCount);
         if (mProcess->mExecutingThreadsCount >= mProcess->mMaxThreads &&
                 mProcess->mStarvationStartTimeMs == 0) {
             mProcess->mStarvationStartTimeMs = uptimeMillis();
@@ -571,6 +664,7 @@ status_t IPCThreadState::getAndExecuteCommand()
                 ALOGE("binder thread pool (%zu threads) starved for %" PRId64 " ms",
                       mProcess->mMaxThreads, starvationTimeMs);
             }
+            mProcess->onThreadPoolStarvedLocked(starvationTimeMs);
             mProcess->mStarvationStartTimeMs = 0;
         }
 
@@ -642,9 +736,36 @@ void IPCThreadState::joinThreadPool(bool isMain)
     mOut.writeInt32(isMain ? BC_ENTER_LOOPER : BC_REGISTER_LOOPER);
 
     mIsLooper = true;
-    status_t result;
+    pthread_mutex_lock(&mProcess->mThreadCountLock);
+    mProcess->mPoolThreadCount++;
+    pthread_mutex_unlock(&mProcess->mThreadCountLock);
+
+    status_t result = NO_ERROR;
     do {
         processPendingDerefs();
+
+        // Threads of an adaptive thread pool leave it once it has been idle for long
+        // enough, and only with no commands left to process. One of them waits for the
+        // driver with a timeout, so that the pool can shrink without transactions, the
+        // others block in the driver, see setThreadPoolAdaptive().
+        if (!isMain && mProcess->mAdaptiveThreadPool && mIn.dataPosition() >= mIn.dataSize()) {
+            if (mProcess->shouldRetirePooledThread()) {
+                LOG_THREADPOOL("**** THREAD %p (PID %d) IS RETIRING FROM THE THREAD POOL\n",
+                               (void*)pthread_self(), getpid());
+                break;
+            }
+            if (mProcess->startPollingForWork()) {
+                // BC_REGISTER_LOOPER must reach the driver before it hands this thread work
+                if (mOut.dataSize() > 0) flushCommands();
+                pollfd pfd{.fd = mProcess->mDriverFD, .events = POLLIN};
+                int timeoutMs = static_cast<int>(
+                        std::min<int64_t>(mProcess->mAdaptiveIdleTimeoutMs, INT_MAX));
+                int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeoutMs));
+                mProcess->stopPollingForWork();
+                if (ret == 0) continue;
+            }
+        }
+
         // now get the next command to be processed, waiting if necessary
         result = getAndExecuteCommand();
 
@@ -660,6 +781,10 @@ void IPCThreadState::joinThreadPool(bool isMain)
         }
     } while (result != -ECONNREFUSED && result != -EBADF);
 
+    pthread_mutex_lock(&mProcess->mThreadCountLock);
+    mProcess->mPoolThreadCount--;
+    pthread_mutex_unlock(&mProcess->mThreadCountLock);
+
     LOG_THREADPOOL("**** THREAD %p (PID %d) IS LEAVING THE THREAD POOL err=%d\n",
         (void*)pthread_self(), getpid(), result);
 
@@ -722,6 +847,7 @@ status_t IPCThreadState::transact(int32_t handle,
 
     LOG_ONEWAY(">>>> SEND from pid %d uid %d %s", getpid(), getuid(),
         (flags & TF_ONE_WAY) == 0 ? "READ REPLY" : "ONE WAY");
+    const nsecs_t startNs = TransactionStats::isEnabled() ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
     err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, nullptr);
 
     if (err != NO_ERROR) {
@@ -772,14 +898,22 @@ status_t IPCThreadState::transact(int32_t handle,
         err = waitForResponse(nullptr, nullptr);
     }
 
+    if (startNs != 0) {
+        TransactionStats::record(TransactionStats::Direction::OUTGOING, data.peekInterfaceToken(),
+                                 code, systemTime(SYSTEM_TIME_MONOTONIC) - startNs,
+                                 data.dataSize() + (reply ? reply->dataSize() : 0));
+    }
+
     return err;
 }
 
 void IPCThreadState::incStrongHandle(int32_t handle, BpBinder *proxy)
 {
     LOG_REMOTEREFS("IPCThreadState::incStrongHandle(%d)\n", handle);
-    mOut.writeInt32(BC_ACQUIRE);
-    mOut.writeInt32(handle);
+    if (!queueRefCommand(BC_ACQUIRE, handle)) {
+        // Cancelled a queued BC_RELEASE, the driver still holds that reference.
+        return;
+    }
     if (!flushIfNeeded()) {
         // Create a temp reference until the driver has handled this command.
         proxy->incStrong(mProcess.get());
@@ -790,16 +924,18 @@ void IPCThreadState::incStrongHandle(int32_t handle, BpBinder *proxy)
 void IPCThreadState::decStrongHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::decStrongHandle(%d)\n", handle);
-    mOut.writeInt32(BC_RELEASE);
-    mOut.writeInt32(handle);
-    flushIfNeeded();
+    if (queueRefCommand(BC_RELEASE, handle)) {
+        flushIfNeeded();
+    }
 }
 
 void IPCThreadState::incWeakHandle(int32_t handle, BpBinder *proxy)
 {
     LOG_REMOTEREFS("IPCThreadState::incWeakHandle(%d)\n", handle);
-    mOut.writeInt32(BC_INCREFS);
-    mOut.writeInt32(handle);
+    if (!queueRefCommand(BC_INCREFS, handle)) {
+        // Cancelled a queued BC_DECREFS, the driver still holds that reference.
+        return;
+    }
     if (!flushIfNeeded()) {
         // Create a temp reference until the driver has handled this command.
         proxy->getWeakRefs()->incWeak(mProcess.get());
@@ -810,9 +946,9 @@ void IPCThreadState::incWeakHandle(int32_t handle, BpBinder *proxy)
 void IPCThreadState::decWeakHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::decWeakHandle(%d)\n", handle);
-    mOut.writeInt32(BC_DECREFS);
-    mOut.writeInt32(handle);
-    flushIfNeeded();
+    if (queueRefCommand(BC_DECREFS, handle)) {
+        flushIfNeeded();
+    }
 }
 
 status_t IPCThreadState::attemptIncStrongHandle(int32_t handle)
@@ -871,6 +1007,8 @@ IPCThreadState::IPCThreadState()
         mPropagateWorkSource(false),
         mIsLooper(false),
         mIsFlushing(false),
+        mCommandBatchDepth(0),
+        mCommandBatchDeferredFlushes(0),
         mStrictModePolicy(0),
         mLastTransactionBinderFlags(0),
         mCallRestriction(mProcess->mCallRestriction) {
@@ -1078,6 +1216,7 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
                                  mOut.dataSize());
             else {
                 mOut.setDataSize(0);
+                mQueuedRefCommands.clear();
                 processPostWriteDerefs();
             }
         }
@@ -1274,6 +1413,8 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
 
             Parcel reply;
             status_t error;
+            const nsecs_t startNs =
+                    TransactionStats::isEnabled() ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
             IF_LOG_TRANSACTIONS() {
                 TextOutput::Bundle _b(alog);
                 alog << "BR_TRANSACTION thr " << (void*)pthread_self()
@@ -1304,6 +1445,14 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
             //ALOGI("<<<< TRANSACT from pid %d restore pid %d sid %s uid %d\n",
             //     mCallingPid, origPid, (origSid ? origSid : "<N/A>"), origUid);
 
+            if (startNs != 0) {
+                // The interface token has been read by the stub by now, if it has one.
+                TransactionStats::record(TransactionStats::Direction::INCOMING,
+                                         buffer.peekInterfaceToken(), tr.code,
+                                         systemTime(SYSTEM_TIME_MONOTONIC) - startNs,
+                                         buffer.dataSize() + reply.dataSize());
+            }
+
             if ((tr.flags & TF_ONE_WAY) == 0) {
                 LOG_ONEWAY("Sending reply to %d!", mCallingPid);
                 if (error < NO_ERROR) reply.setError(error);
@@ -21,10 +21,15 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <map>
+#include <set>
+
 #include <android/os/BnServiceCallback.h>
 #include <android/os/IServiceManager.h>
 #include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
+#include <binder/ProcessState.h>
 #include <utils/Log.h>
 #include <utils/String8.h>
 #include <utils/SystemClock.h>
@@ -65,6 +70,222 @@ const String16& IServiceManager::getInterfaceDescriptor() const {
 IServiceManager::IServiceManager() {}
 IServiceManager::~IServiceManager() {}
 
+static std::atomic<bool> gServiceLookupCacheEnabled = false;
+static std::atomic<uint64_t> gServiceLookupCacheHits = 0;
+static std::atomic<uint64_t> gServiceLookupCacheMisses = 0;
+
+void setServiceLookupCacheEnabled(bool enabled) {
+    gServiceLookupCacheEnabled = enabled;
+}
+
+ServiceLookupCacheStats getServiceLookupCacheStats() {
+    return {
+            .hits = gServiceLookupCacheHits,
+            .misses = gServiceLookupCacheMisses,
+    };
+}
+
+class ServiceLookupCache;
+
+class ServiceLookupCacheInvalidator : public android::os::BnServiceCallback {
+public:
+    explicit ServiceLookupCacheInvalidator(const wp<ServiceLookupCache>& cache) : mCache(cache) {}
+    Status onRegistration(const std::string& name, const sp<IBinder>& binder) override;
+
+private:
+    wp<ServiceLookupCache> mCache;
+};
+
+// Services found by ServiceManagerShim::checkService, see
+// setServiceLookupCacheEnabled. An entry is dropped when its service dies, or
+// when servicemanager notifies that a different binder is registered for it.
+//
+// Each cached entry holds one death link to its binder, and names with an
+// entry are registered for notifications. Both are undone when the entry is
+// dropped. Binder calls are never made while holding mLock.
+class ServiceLookupCache : public IBinder::DeathRecipient {
+public:
+    explicit ServiceLookupCache(const sp<AidlServiceManager>& serviceManager)
+          : mServiceManager(serviceManager) {}
+
+    void onFirstRef() override {
+        mInvalidator = sp<ServiceLookupCacheInvalidator>::make(wp<ServiceLookupCache>(this));
+    }
+
+    sp<IBinder> get(const std::string& name, uint64_t* generation) {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mServices.find(name);
+        if (it != mServices.end()) {
+            gServiceLookupCacheHits++;
+            return it->second;
+        }
+        gServiceLookupCacheMisses++;
+        *generation = mGeneration;
+        return nullptr;
+    }
+
+    // Caches the result of a lookup which started at |generation|, unless
+    // anything was invalidated since.
+    void put(const std::string& name, const sp<IBinder>& binder, uint64_t generation) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (!cachableLocked(name, generation)) return;
+        }
+
+        // local binders can't die
+        const bool remote = binder->remoteBinder() != nullptr;
+        if (remote && binder->linkToDeath(sp<DeathRecipient>::fromExisting(this)) != OK) {
+            return;
+        }
+
+        bool cached = false;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            // another lookup may have cached it meanwhile, with its own link
+            if (cachableLocked(name, generation) && mServices.count(name) == 0) {
+                mServices[name] = binder;
+                mSize = mServices.size();
+                cached = true;
+            }
+        }
+        if (!cached) {
+            if (remote) binder->unlinkToDeath(wp<DeathRecipient>(this));
+            return;
+        }
+
+        updateRegistration(name);
+    }
+
+    void onRegistration(const std::string& name, const sp<IBinder>& binder) {
+        sp<IBinder> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            auto it = mServices.find(name);
+            if (it == mServices.end() || it->second == binder) return;
+            eraseLocked(name, &dropped);
+        }
+        release(name, dropped);
+    }
+
+    void binderDied(const wp<IBinder>& who) override {
+        std::vector<std::string> names;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            for (auto it = mServices.begin(); it != mServices.end();) {
+                if (it->second.get() == who.unsafe_get()) {
+                    names.push_back(it->first);
+                    it = mServices.erase(it);
+                } else {
+                    it++;
+                }
+            }
+            mGeneration++;
+            mSize = mServices.size();
+        }
+        // the death links are gone with the binder
+        for (const std::string& name : names) updateRegistration(name);
+    }
+
+    // drop references held by the cache after it was disabled
+    void clearIfDisabled() {
+        if (mSize == 0) return;
+        std::map<std::string, sp<IBinder>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (gServiceLookupCacheEnabled) return;
+            dropped.swap(mServices);
+            mGeneration++;
+            mSize = 0;
+        }
+        for (const auto& [name, binder] : dropped) release(name, binder);
+    }
+
+private:
+    bool cachableLocked(const std::string& name, uint64_t generation) {
+        return generation == mGeneration && mUncachable.count(name) == 0;
+    }
+
+    // |dropped| keeps the binder alive until the lock is released
+    void eraseLocked(const std::string& name, sp<IBinder>* dropped) {
+        auto it = mServices.find(name);
+        if (it != mServices.end()) {
+            *dropped = std::move(it->second);
+            mServices.erase(it);
+        }
+        mGeneration++;
+        mSize = mServices.size();
+    }
+
+    // Undoes what put() did for an entry which was dropped.
+    void release(const std::string& name, const sp<IBinder>& binder) {
+        if (binder != nullptr && binder->remoteBinder() != nullptr) {
+            binder->unlinkToDeath(wp<DeathRecipient>(this));
+        }
+        updateRegistration(name);
+    }
+
+    // Registers for notifications about |name| if it is cached, and
+    // unregisters if it isn't. mRegistrationLock orders these calls, so the
+    // last one made matches whether |name| is cached.
+    void updateRegistration(const std::string& name) {
+        std::lock_guard<std::mutex> registrationLock(mRegistrationLock);
+        bool cached;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            cached = mServices.count(name) != 0;
+        }
+        const bool registered = mRegistered.count(name) != 0;
+        if (cached == registered) return;
+
+        if (!cached) {
+            mRegistered.erase(name);
+            Status status = mServiceManager->unregisterForNotifications(name, mInvalidator);
+            ALOGW_IF(!status.isOk(), "Failed to unregisterForNotifications for %s: %s",
+                     name.c_str(), status.toString8().c_str());
+            return;
+        }
+
+        if (Status status = mServiceManager->registerForNotifications(name, mInvalidator);
+            !status.isOk()) {
+            ALOGW("Not caching lookups of %s, failed to registerForNotifications: %s",
+                  name.c_str(), status.toString8().c_str());
+            sp<IBinder> dropped;
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+                mUncachable.insert(name);
+                eraseLocked(name, &dropped);
+            }
+            if (dropped != nullptr && dropped->remoteBinder() != nullptr) {
+                dropped->unlinkToDeath(wp<DeathRecipient>(this));
+            }
+            return;
+        }
+        mRegistered.insert(name);
+    }
+
+    const sp<AidlServiceManager> mServiceManager;
+    sp<ServiceLookupCacheInvalidator> mInvalidator;
+
+    std::mutex mLock;
+    std::map<std::string, sp<IBinder>> mServices;
+    std::set<std::string> mUncachable;
+    // incremented on every invalidation
+    uint64_t mGeneration = 0;
+    std::atomic<size_t> mSize = 0;
+
+    std::mutex mRegistrationLock;
+    // names registered for notifications, guarded by mRegistrationLock
+    std::set<std::string> mRegistered;
+};
+
+Status ServiceLookupCacheInvalidator::onRegistration(const std::string& name,
+                                                     const sp<IBinder>& binder) {
+    if (sp<ServiceLookupCache> cache = mCache.promote(); cache != nullptr) {
+        cache->onRegistration(name, binder);
+    }
+    return Status::ok();
+}
+
 // From the old libbinder IServiceManager interface to IServiceManager.
 class ServiceManagerShim : public IServiceManager
 {
@@ -111,6 +332,7 @@ public:
 
 protected:
     sp<AidlServiceManager> mTheRealServiceManager;
+    sp<ServiceLookupCache> mLookupCache;
     // AidlRegistrationCallback -> services that its been registered for
     // notifications.
     using LocalRegistrationAndWaiter =
@@ -252,8 +474,8 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid, bool logP
 // ----------------------------------------------------------------------
 
 ServiceManagerShim::ServiceManagerShim(const sp<AidlServiceManager>& impl)
- : mTheRealServiceManager(impl)
-{}
+      : mTheRealServiceManager(impl),
+        mLookupCache(sp<ServiceLookupCache>::make(impl)) {}
 
 // This implementation could be simplified and made more efficient by delegating
 // to waitForService. However, this changes the threading structure in some
@@ -303,12 +525,31 @@ sp<IBinder> ServiceManagerShim::getService(const String16& name) const
     return nullptr;
 }
 
-sp<IBinder> ServiceManagerShim::checkService(const String16& name) const
+sp<IBinder> ServiceManagerShim::checkService(const String16& name16) const
 {
+    const std::string name = String8(name16).c_str();
+
+    // Invalidations are delivered to the threadpool, so without one, entries
+    // could be stale.
+    bool useCache = gServiceLookupCacheEnabled &&
+            ProcessState::self()->getThreadPoolMaxThreadCount() != 0;
+    uint64_t generation = 0;
+    if (useCache) {
+        if (sp<IBinder> cached = mLookupCache->get(name, &generation); cached != nullptr) {
+            return cached;
+        }
+    } else {
+        mLookupCache->clearIfDisabled();
+    }
+
     sp<IBinder> ret;
-    if (!mTheRealServiceManager->checkService(String8(name).c_str(), &ret).isOk()) {
+    if (!mTheRealServiceManager->checkService(name, &ret).isOk()) {
         return nullptr;
     }
+
+    if (useCache && ret != nullptr) {
+        mLookupCache->put(name, ret, generation);
+    }
     return ret;
 }
 
@@ -24,6 +24,8 @@
 #include <utils/SortedVector.h>
 #include <utils/String8.h>
 
+#include <algorithm>
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,6 +39,8 @@
 #include <sys/mman.h>
 #include <sys/file.h>
 
+#include "BuddyAllocator.h"
+
 namespace android {
 // ----------------------------------------------------------------------------
 
@@ -119,19 +123,19 @@ private:
 
 // ----------------------------------------------------------------------------
 
-class SimpleBestFitAllocator
+class SimpleBestFitAllocator : public HeapAllocator
 {
     enum {
         PAGE_ALIGNED = 0x00000001
     };
 public:
     explicit SimpleBestFitAllocator(size_t size);
-    ~SimpleBestFitAllocator();
+    ~SimpleBestFitAllocator() override;
 
-    size_t      allocate(size_t size, uint32_t flags = 0);
-    status_t    deallocate(size_t offset);
+    size_t      allocate(size_t size, uint32_t flags = 0) override;
+    status_t    deallocate(size_t offset) override;
     size_t      size() const;
-    void        dump(const char* what) const;
+    void        dump(const char* what) const override;
     void        dump(String8& res, const char* what) const;
 
     static size_t getAllocationAlignment() { return kMemoryAlign; }
@@ -227,8 +231,21 @@ Allocation::~Allocation()
 // ----------------------------------------------------------------------------
 
 MemoryDealer::MemoryDealer(size_t size, const char* name, uint32_t flags)
-      : mHeap(sp<MemoryHeapBase>::make(size, flags, name)),
-        mAllocator(new SimpleBestFitAllocator(size)) {}
+      : MemoryDealer(size, name, flags, Policy::BEST_FIT) {}
+
+MemoryDealer::MemoryDealer(size_t size, const char* name, uint32_t flags, Policy policy)
+      : mHeap(sp<MemoryHeapBase>::make(size, flags, name)), mAllocator(nullptr) {
+    switch (policy) {
+        case Policy::BEST_FIT:
+            mAllocator = new SimpleBestFitAllocator(size);
+            break;
+        case Policy::BUDDY:
+            mAllocator = new BuddyAllocator(size);
+            break;
+    }
+    LOG_ALWAYS_FATAL_IF(mAllocator == nullptr, "Unknown MemoryDealer policy %d",
+                        static_cast<int>(policy));
+}
 
 MemoryDealer::~MemoryDealer()
 {
@@ -259,7 +276,7 @@ const sp<IMemoryHeap>& MemoryDealer::heap() const {
     return mHeap;
 }
 
-SimpleBestFitAllocator* MemoryDealer::allocator() const {
+HeapAllocator* MemoryDealer::allocator() const {
     return mAllocator;
 }
 
@@ -478,4 +495,104 @@ void SimpleBestFitAllocator::dump_l(String8& result,
 }
 
 
+// ----------------------------------------------------------------------------
+
+size_t BuddyAllocator::minBlockSize()
+{
+    return SimpleBestFitAllocator::getAllocationAlignment();
+}
+
+BuddyAllocator::BuddyAllocator(size_t size)
+    : mAllocatedSize(0)
+{
+    size_t pagesize = getpagesize();
+    mHeapSize = ((size + pagesize-1) & ~(pagesize-1));
+
+    size_t numOrders = 0;
+    while (blockSize(numOrders) <= mHeapSize) numOrders++;
+    mFreeBlocks.resize(numOrders);
+
+    // Heaps which aren't a power of two are covered by blocks of decreasing
+    // order, none of which has its buddy in the heap.
+    size_t offset = 0;
+    for (size_t order = numOrders; order-- > 0;) {
+        if (mHeapSize - offset >= blockSize(order)) {
+            mFreeBlocks[order].insert(offset);
+            offset += blockSize(order);
+        }
+    }
+}
+
+size_t BuddyAllocator::allocate(size_t size, uint32_t /*flags*/)
+{
+    if (size == 0) {
+        return 0;
+    }
+    if (size > mHeapSize) {
+        return NO_MEMORY;
+    }
+
+    size_t order = 0;
+    while (blockSize(order) < size) order++;
+
+    Mutex::Autolock _l(mLock);
+    size_t found = order;
+    while (found < mFreeBlocks.size() && mFreeBlocks[found].empty()) found++;
+    if (found == mFreeBlocks.size()) {
+        return NO_MEMORY;
+    }
+
+    size_t offset = *mFreeBlocks[found].begin();
+    mFreeBlocks[found].erase(mFreeBlocks[found].begin());
+
+    // give back the upper halves, until the block is just large enough
+    while (found > order) {
+        found--;
+        mFreeBlocks[found].insert(offset + blockSize(found));
+    }
+
+    mAllocatedBlocks[offset] = order;
+    mAllocatedSize += blockSize(order);
+    return offset;
+}
+
+status_t BuddyAllocator::deallocate(size_t offset)
+{
+    Mutex::Autolock _l(mLock);
+    auto it = mAllocatedBlocks.find(offset);
+    if (it == mAllocatedBlocks.end()) {
+        return NAME_NOT_FOUND;
+    }
+    size_t order = it->second;
+    mAllocatedBlocks.erase(it);
+    mAllocatedSize -= blockSize(order);
+
+    // merge with the buddy for as long as it is free as well
+    while (order + 1 < mFreeBlocks.size()) {
+        auto buddy = mFreeBlocks[order].find(offset ^ blockSize(order));
+        if (buddy == mFreeBlocks[order].end()) break;
+        offset = std::min(offset, *buddy);
+        mFreeBlocks[order].erase(buddy);
+        order++;
+    }
+    mFreeBlocks[order].insert(offset);
+    return NO_ERROR;
+}
+
+void BuddyAllocator::dump(const char* what) const
+{
+    Mutex::Autolock _l(mLock);
+    String8 result;
+    result.appendFormat("  %s (%p, size=%u, buddy)\n", what, this, (unsigned int)mHeapSize);
+    for (size_t order = 0; order < mFreeBlocks.size(); order++) {
+        if (mFreeBlocks[order].empty()) continue;
+        result.appendFormat("  free 0x%08X: %zu\n", (unsigned int)blockSize(order),
+                            mFreeBlocks[order].size());
+    }
+    result.appendFormat("  size allocated: %u (%u KB) in %zu blocks\n",
+                        (unsigned int)mAllocatedSize, (unsigned int)(mAllocatedSize / 1024),
+                        mAllocatedBlocks.size());
+    ALOGD("%s", result.string());
+}
+
 } // namespace android
@@ -89,6 +89,92 @@ static std::atomic<size_t> gParcelGlobalAllocSize;
 
 static size_t gMaxFds = 0;
 
+// When enabled, small data and objects buffers released by a Parcel are kept on a per-thread
+// freelist and handed to the next Parcel allocated on that thread, so that short transactions
+// do not need to go through malloc/free once the thread is warmed up.
+static std::atomic<bool> gParcelRecycleBuffers = false;
+
+// Largest buffer (in bytes) which is kept around for reuse.
+static constexpr size_t kRecycledBufferMaxSize = 1024;
+// Number of buffers of each kind (data, objects) which are cached per thread.
+static constexpr size_t kRecycledBuffersPerThread = 4;
+
+namespace {
+
+// Must stay trivially destructible, so that Parcels which are destroyed late in a thread's life
+// (e.g. statics on the main thread) can still safely look at it.
+struct ParcelBufferCache {
+    struct Entry {
+        void* data;
+        size_t capacity;
+    };
+    Entry entries[kRecycledBuffersPerThread];
+    size_t count;
+    bool threadExiting;
+
+    void drain() {
+        for (size_t i = 0; i < count; i++) {
+            free(entries[i].data);
+        }
+        count = 0;
+    }
+};
+
+thread_local ParcelBufferCache tParcelDataCache;
+thread_local ParcelBufferCache tParcelObjectsCache;
+
+// Releases the calling thread's cached buffers when that thread exits.
+struct ParcelBufferCacheReaper {
+    ~ParcelBufferCacheReaper() {
+        tParcelDataCache.drain();
+        tParcelDataCache.threadExiting = true;
+        tParcelObjectsCache.drain();
+        tParcelObjectsCache.threadExiting = true;
+    }
+};
+
+} // namespace
+
+// Returns a buffer of at least 'size' bytes, reusing one cached on this thread if possible.
+static void* allocParcelBuffer(ParcelBufferCache& cache, size_t size) {
+    if (size > 0 && size <= kRecycledBufferMaxSize &&
+        gParcelRecycleBuffers.load(std::memory_order_relaxed)) {
+        size_t best = cache.count;
+        for (size_t i = 0; i < cache.count; i++) {
+            if (cache.entries[i].capacity >= size &&
+                (best == cache.count || cache.entries[i].capacity < cache.entries[best].capacity)) {
+                best = i;
+            }
+        }
+        if (best != cache.count) {
+            void* data = cache.entries[best].data;
+            cache.entries[best] = cache.entries[--cache.count];
+            return data;
+        }
+    }
+    return malloc(size);
+}
+
+static void* reallocParcelBuffer(ParcelBufferCache& cache, void* data, size_t size) {
+    if (data == nullptr) return allocParcelBuffer(cache, size);
+    return realloc(data, size);
+}
+
+// 'capacity' may be smaller than the real size of the allocation, but never larger.
+static void releaseParcelBuffer(ParcelBufferCache& cache, void* data, size_t capacity) {
+    if (data == nullptr) return;
+    if (capacity > 0 && capacity <= kRecycledBufferMaxSize && !cache.threadExiting &&
+        gParcelRecycleBuffers.load(std::memory_order_relaxed)) {
+        static thread_local ParcelBufferCacheReaper reaper;
+        (void)reaper;
+        if (cache.count < kRecycledBuffersPerThread) {
+            cache.entries[cache.count++] = {data, capacity};
+            return;
+        }
+    }
+    free(data);
+}
+
 // Maximum size of a blob to transfer in-place.
 static const size_t BLOB_INPLACE_LIMIT = 16 * 1024;
 
@@ -323,6 +409,18 @@ size_t Parcel::getGlobalAllocCount() {
     return gParcelGlobalAllocCount.load();
 }
 
+void Parcel::setBufferRecyclingEnabled(bool enabled) {
+    gParcelRecycleBuffers.store(enabled);
+    if (!enabled) {
+        tParcelDataCache.drain();
+        tParcelObjectsCache.drain();
+    }
+}
+
+bool Parcel::isBufferRecyclingEnabled() {
+    return gParcelRecycleBuffers.load();
+}
+
 const uint8_t* Parcel::data() const
 {
     return mData;
@@ -478,8 +576,9 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
             if (mObjectsSize + numObjects > SIZE_MAX / 3) return NO_MEMORY; // overflow
             size_t newSize = ((mObjectsSize + numObjects)*3)/2;
             if (newSize > SIZE_MAX / sizeof(binder_size_t)) return NO_MEMORY; // overflow
-            binder_size_t *objects =
-                (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
+            binder_size_t* objects = (binder_size_t*)
+                    reallocParcelBuffer(tParcelObjectsCache, mObjects,
+                                        newSize * sizeof(binder_size_t));
             if (objects == (binder_size_t*)nullptr) {
                 return NO_MEMORY;
             }
@@ -725,6 +824,23 @@ uid_t Parcel::readCallingWorkSourceUid() const
     return uid;
 }
 
+std::u16string_view Parcel::peekInterfaceToken() const
+{
+    if (!mRequestHeaderPresent) {
+        return {};
+    }
+
+    const size_t initialPosition = dataPosition();
+    // The interface name follows the work source and the vendor header.
+    setDataPosition(mWorkSourceRequestHeaderPosition + sizeof(int32_t));
+    std::u16string_view token;
+    if (readInt32() != kHeader || readString16View(&token) != OK) {
+        token = {};
+    }
+    setDataPosition(initialPosition);
+    return token;
+}
+
 bool Parcel::checkInterface(IBinder* binder) const
 {
     return enforceInterface(binder->getInterfaceDescriptor());
@@ -1435,7 +1551,8 @@ restart_write:
         if ((mObjectsSize + 2) > SIZE_MAX / 3) return NO_MEMORY; // overflow
         size_t newSize = ((mObjectsSize+2)*3)/2;
         if (newSize > SIZE_MAX / sizeof(binder_size_t)) return NO_MEMORY; // overflow
-        binder_size_t* objects = (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
+        binder_size_t* objects = (binder_size_t*)
+                reallocParcelBuffer(tParcelObjectsCache, mObjects, newSize * sizeof(binder_size_t));
         if (objects == nullptr) return NO_MEMORY;
         mObjects = objects;
         mObjectsCapacity = newSize;
@@ -1859,6 +1976,18 @@ const char* Parcel::readString8Inplace(size_t* outLen) const
     return nullptr;
 }
 
+status_t Parcel::readString8View(std::string_view* pArg) const
+{
+    size_t len;
+    const char* str = readString8Inplace(&len);
+    if (str == nullptr) {
+        *pArg = std::string_view();
+        return UNEXPECTED_NULL;
+    }
+    *pArg = std::string_view(str, len);
+    return NO_ERROR;
+}
+
 String16 Parcel::readString16() const
 {
     size_t len;
@@ -1900,6 +2029,18 @@ const char16_t* Parcel::readString16Inplace(size_t* outLen) const
     return nullptr;
 }
 
+status_t Parcel::readString16View(std::u16string_view* pArg) const
+{
+    size_t len;
+    const char16_t* str = readString16Inplace(&len);
+    if (str == nullptr) {
+        *pArg = std::u16string_view();
+        return UNEXPECTED_NULL;
+    }
+    *pArg = std::u16string_view(str, len);
+    return NO_ERROR;
+}
+
 status_t Parcel::readStrongBinder(sp<IBinder>* val) const
 {
     status_t status = readNullableStrongBinder(val);
@@ -2355,10 +2496,13 @@ void Parcel::freeDataNoInit()
             gParcelGlobalAllocCount--;
             if (mDeallocZero) {
                 zeroMemory(mData, mDataSize);
+                free(mData);
+            } else {
+                releaseParcelBuffer(tParcelDataCache, mData, mDataCapacity);
             }
-            free(mData);
         }
-        if (mObjects) free(mObjects);
+        releaseParcelBuffer(tParcelObjectsCache, mObjects,
+                            mObjectsCapacity * sizeof(binder_size_t));
     }
 }
 
@@ -2380,7 +2524,7 @@ status_t Parcel::growData(size_t len)
 
 static uint8_t* reallocZeroFree(uint8_t* data, size_t oldCapacity, size_t newCapacity, bool zero) {
     if (!zero) {
-        return (uint8_t*)realloc(data, newCapacity);
+        return (uint8_t*)reallocParcelBuffer(tParcelDataCache, data, newCapacity);
     }
     uint8_t* newData = (uint8_t*)malloc(newCapacity);
     if (!newData) {
@@ -2433,7 +2577,7 @@ status_t Parcel::restartWrite(size_t desired)
     ALOGV("restartWrite Setting data size of %p to %zu", this, mDataSize);
     ALOGV("restartWrite Setting data pos of %p to %zu", this, mDataPos);
 
-    free(mObjects);
+    releaseParcelBuffer(tParcelObjectsCache, mObjects, mObjectsCapacity * sizeof(binder_size_t));
     mObjects = nullptr;
     mObjectsSize = mObjectsCapacity = 0;
     mNextObjectHint = 0;
@@ -2477,7 +2621,7 @@ status_t Parcel::continueWrite(size_t desired)
 
         // If there is a different owner, we need to take
         // posession.
-        uint8_t* data = (uint8_t*)malloc(desired);
+        uint8_t* data = (uint8_t*)allocParcelBuffer(tParcelDataCache, desired);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -2539,7 +2683,8 @@ status_t Parcel::continueWrite(size_t desired)
             }
 
             if (objectsSize == 0) {
-                free(mObjects);
+                releaseParcelBuffer(tParcelObjectsCache, mObjects,
+                                    mObjectsCapacity * sizeof(binder_size_t));
                 mObjects = nullptr;
                 mObjectsCapacity = 0;
             } else {
@@ -2582,7 +2727,7 @@ status_t Parcel::continueWrite(size_t desired)
 
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        uint8_t* data = (uint8_t*)allocParcelBuffer(tParcelDataCache, desired);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -17,6 +17,7 @@
 #define LOG_TAG "PermissionCache"
 
 #include <stdint.h>
+#include <string_view>
 #include <utils/Log.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
@@ -34,44 +35,82 @@ ANDROID_SINGLETON_STATIC_INSTANCE(PermissionCache)
 PermissionCache::PermissionCache() {
 }
 
+size_t PermissionCache::KeyHash::operator()(const Key& k) const {
+    size_t h = std::hash<std::u16string_view>()(
+            std::u16string_view(k.name.string(), k.name.size()));
+    return h ^ (std::hash<uid_t>()(k.uid) + 0x9e3779b9 + (h << 6) + (h >> 2));
+}
+
+PermissionCache::Shard& PermissionCache::shardFor(const Key& key) {
+    return mShards[KeyHash()(key) % kNumShards];
+}
+
 status_t PermissionCache::check(bool* granted,
-        const String16& permission, uid_t uid) const {
-    Mutex::Autolock _l(mLock);
-    Entry e;
-    e.name = permission;
-    e.uid  = uid;
-    ssize_t index = mCache.indexOf(e);
-    if (index >= 0) {
-        *granted = mCache.itemAt(index).granted;
-        return NO_ERROR;
+        const String16& permission, uid_t uid) {
+    Key key{permission, uid};
+    Shard& shard = shardFor(key);
+    nsecs_t now = systemTime();
+    {
+        std::shared_lock<std::shared_mutex> _l(shard.lock);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end() &&
+                shard.generation == mGeneration.load(std::memory_order_relaxed) &&
+                it->second.expiresAt > now) {
+            *granted = it->second.granted;
+            it->second.lastUsed.store(now, std::memory_order_relaxed);
+            shard.hits.fetch_add(1, std::memory_order_relaxed);
+            return NO_ERROR;
+        }
     }
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
     return NAME_NOT_FOUND;
 }
 
 void PermissionCache::cache(const String16& permission,
         uid_t uid, bool granted) {
-    Mutex::Autolock _l(mLock);
-    Entry e;
-    ssize_t index = mPermissionNamesPool.indexOf(permission);
-    if (index > 0) {
-        e.name = mPermissionNamesPool.itemAt(index);
-    } else {
-        mPermissionNamesPool.add(permission);
-        e.name = permission;
+    Key key{permission, uid};
+    Shard& shard = shardFor(key);
+    nsecs_t now = systemTime();
+    uint32_t generation = mGeneration.load(std::memory_order_relaxed);
+
+    std::unique_lock<std::shared_mutex> _l(shard.lock);
+    if (shard.generation != generation) {
+        shard.entries.clear();
+        shard.generation = generation;
+    }
+    if (shard.entries.size() >= mMaxEntriesPerShard && shard.entries.count(key) == 0) {
+        evictLocked(shard, now);
     }
     // note, we don't need to store the pid, which is not actually used in
     // permission checks
-    e.uid  = uid;
-    e.granted = granted;
-    index = mCache.indexOf(e);
-    if (index < 0) {
-        mCache.add(e);
+    Entry& entry = shard.entries[key];
+    entry.granted = granted;
+    entry.expiresAt = now + mEntryLifetime;
+    entry.lastUsed.store(now, std::memory_order_relaxed);
+}
+
+void PermissionCache::evictLocked(Shard& shard, nsecs_t now) {
+    auto lru = shard.entries.end();
+    for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (it->second.expiresAt <= now) {
+            it = shard.entries.erase(it);
+            continue;
+        }
+        if (lru == shard.entries.end() ||
+                it->second.lastUsed.load(std::memory_order_relaxed) <
+                        lru->second.lastUsed.load(std::memory_order_relaxed)) {
+            lru = it;
+        }
+        ++it;
+    }
+    if (shard.entries.size() >= mMaxEntriesPerShard && lru != shard.entries.end()) {
+        shard.entries.erase(lru);
     }
 }
 
 void PermissionCache::purge() {
-    Mutex::Autolock _l(mLock);
-    mCache.clear();
+    // entries are dropped lazily, when something is next cached in their shard
+    mGeneration.fetch_add(1, std::memory_order_relaxed);
 }
 
 bool PermissionCache::checkCallingPermission(const String16& permission) {
@@ -114,5 +153,19 @@ void PermissionCache::purgeCache() {
     pc.purge();
 }
 
+PermissionCache::Stats PermissionCache::stats() {
+    Stats stats = {};
+    for (Shard& shard : mShards) {
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.misses += shard.misses.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+PermissionCache::Stats PermissionCache::getStats() {
+    PermissionCache& pc(PermissionCache::getInstance());
+    return pc.stats();
+}
+
 // ---------------------------------------------------------------------------
 } // namespace android
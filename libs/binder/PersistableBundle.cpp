@@ -18,7 +18,12 @@
 
 #include <binder/PersistableBundle.h>
 
+#include <string.h>
+
+#include <algorithm>
 #include <limits>
+#include <string_view>
+#include <utility>
 
 #include <binder/IBinder.h>
 #include <binder/Parcel.h>
@@ -39,7 +44,6 @@ using android::binder::VAL_DOUBLEARRAY;
 using android::binder::VAL_STRINGARRAY;
 using android::binder::VAL_PERSISTABLEBUNDLE;
 
-using std::map;
 using std::set;
 using std::vector;
 
@@ -49,26 +53,6 @@ enum {
     BUNDLE_MAGIC_NATIVE = 0x4C444E44,
 };
 
-namespace {
-template <typename T>
-bool getValue(const android::String16& key, T* out, const map<android::String16, T>& map) {
-    const auto& it = map.find(key);
-    if (it == map.end()) return false;
-    *out = it->second;
-    return true;
-}
-
-template <typename T>
-set<android::String16> getKeys(const map<android::String16, T>& map) {
-    if (map.empty()) return set<android::String16>();
-    set<android::String16> keys;
-    for (const auto& key_value_pair : map) {
-        keys.emplace(key_value_pair.first);
-    }
-    return keys;
-}
-}  // namespace
-
 namespace android {
 
 namespace os {
@@ -91,6 +75,148 @@ namespace os {
          }                                                               \
     }
 
+namespace {
+status_t readValue(const Parcel* parcel, bool* out) {
+    return parcel->readBool(out);
+}
+status_t readValue(const Parcel* parcel, int32_t* out) {
+    return parcel->readInt32(out);
+}
+status_t readValue(const Parcel* parcel, int64_t* out) {
+    return parcel->readInt64(out);
+}
+status_t readValue(const Parcel* parcel, double* out) {
+    return parcel->readDouble(out);
+}
+status_t readValue(const Parcel* parcel, String16* out) {
+    return parcel->readString16(out);
+}
+status_t readValue(const Parcel* parcel, vector<bool>* out) {
+    return parcel->readBoolVector(out);
+}
+status_t readValue(const Parcel* parcel, vector<int32_t>* out) {
+    return parcel->readInt32Vector(out);
+}
+status_t readValue(const Parcel* parcel, vector<int64_t>* out) {
+    return parcel->readInt64Vector(out);
+}
+status_t readValue(const Parcel* parcel, vector<double>* out) {
+    return parcel->readDoubleVector(out);
+}
+status_t readValue(const Parcel* parcel, vector<String16>* out) {
+    return parcel->readString16Vector(out);
+}
+status_t readValue(const Parcel* parcel, PersistableBundle* out) {
+    *out = PersistableBundle();
+    return out->readFromParcelLazily(parcel);
+}
+
+status_t skipBytes(const Parcel* parcel, int32_t count, size_t elementSize) {
+    if (count < 0) return UNEXPECTED_NULL;
+    size_t size;
+    if (__builtin_mul_overflow(static_cast<size_t>(count), elementSize, &size)) return BAD_VALUE;
+    if (size > parcel->dataAvail()) return NOT_ENOUGH_DATA;
+    parcel->setDataPosition(parcel->dataPosition() + size);
+    return NO_ERROR;
+}
+
+status_t skipString16(const Parcel* parcel) {
+    size_t length;
+    if (parcel->readString16Inplace(&length) == nullptr) return BAD_VALUE;
+    return NO_ERROR;
+}
+
+status_t skipEntries(const Parcel* parcel);
+
+// Checks that a value of |valueType| can be read, without decoding it.
+status_t skipValue(const Parcel* parcel, int32_t valueType) {
+    int32_t count;
+    switch (valueType) {
+        case VAL_STRING:
+            return skipString16(parcel);
+        case VAL_INTEGER:
+        case VAL_BOOLEAN:
+            return parcel->readInt32(&count);
+        case VAL_LONG:
+        case VAL_DOUBLE: {
+            int64_t value;
+            return parcel->readInt64(&value);
+        }
+        case VAL_STRINGARRAY: {
+            RETURN_IF_FAILED(parcel->readInt32(&count));
+            if (count < 0) return UNEXPECTED_NULL;
+            for (; count > 0; --count) {
+                RETURN_IF_FAILED(skipString16(parcel));
+            }
+            return NO_ERROR;
+        }
+        case VAL_INTARRAY:
+        case VAL_BOOLEANARRAY:
+            RETURN_IF_FAILED(parcel->readInt32(&count));
+            return skipBytes(parcel, count, sizeof(int32_t));
+        case VAL_LONGARRAY:
+        case VAL_DOUBLEARRAY:
+            RETURN_IF_FAILED(parcel->readInt32(&count));
+            return skipBytes(parcel, count, sizeof(int64_t));
+        case VAL_PERSISTABLEBUNDLE: {
+            int32_t length;
+            RETURN_IF_FAILED(parcel->readInt32(&length));
+            if (length < 0) return UNEXPECTED_NULL;
+            if (length == 0) return NO_ERROR;
+            int32_t magic;
+            RETURN_IF_FAILED(parcel->readInt32(&magic));
+            if (magic != BUNDLE_MAGIC && magic != BUNDLE_MAGIC_NATIVE) {
+                ALOGE("Bad magic number for PersistableBundle: 0x%08x", magic);
+                return BAD_VALUE;
+            }
+            return skipEntries(parcel);
+        }
+        default:
+            ALOGE("Unrecognized type: %d", valueType);
+            return BAD_TYPE;
+    }
+}
+
+status_t skipEntries(const Parcel* parcel) {
+    int32_t num_entries;
+    RETURN_IF_FAILED(parcel->readInt32(&num_entries));
+    for (; num_entries > 0; --num_entries) {
+        int32_t value_type;
+        RETURN_IF_FAILED(skipString16(parcel));
+        RETURN_IF_FAILED(parcel->readInt32(&value_type));
+        RETURN_IF_FAILED(skipValue(parcel, value_type));
+    }
+    return NO_ERROR;
+}
+
+// where a value of a lazily read bundle is, relative to its bytes
+struct LazyEntry {
+    size_t keyOffset;
+    size_t keyLength; // in char16_t
+    int32_t valueType;
+    size_t valueOffset;
+    size_t valueSize;
+};
+}  // namespace
+
+struct PersistableBundle::LazyData {
+    std::u16string_view key(const LazyEntry& entry) const {
+        return std::u16string_view(reinterpret_cast<const char16_t*>(bytes.data() +
+                                                                     entry.keyOffset),
+                                   entry.keyLength);
+    }
+    // Orders |entries| by value type and key, for find(). Of entries with the
+    // same key and type, keeps the last one, like readFromParcel() does.
+    void sortAndDedupe();
+    // nullptr if |key| is not present with |valueType|
+    const LazyEntry* find(const String16& key, int32_t valueType) const;
+
+    // what was read after the magic number
+    vector<uint8_t> bytes;
+    int32_t magic = 0;
+    vector<LazyEntry> entries;
+};
+
 status_t PersistableBundle::writeToParcel(Parcel* parcel) const {
     /*
      * Keep implementation in sync with writeToParcelInner() in
@@ -103,6 +229,15 @@ status_t PersistableBundle::writeToParcel(Parcel* parcel) const {
         return NO_ERROR;
     }
 
+    if (mLazyData != nullptr) {
+        // the bytes are what was read after the magic number
+        const vector<uint8_t>& bytes = mLazyData->bytes;
+        RETURN_IF_FAILED(parcel->writeInt32(static_cast<int32_t>(bytes.size())));
+        RETURN_IF_FAILED(parcel->writeInt32(mLazyData->magic));
+        RETURN_IF_FAILED(parcel->write(bytes.data(), bytes.size()));
+        return NO_ERROR;
+    }
+
     size_t length_pos = parcel->dataPosition();
     RETURN_IF_FAILED(parcel->writeInt32(1));  // dummy, will hold length
     RETURN_IF_FAILED(parcel->writeInt32(BUNDLE_MAGIC_NATIVE));
@@ -137,11 +272,218 @@ status_t PersistableBundle::readFromParcel(const Parcel* parcel) {
     return readFromParcelInner(parcel, static_cast<size_t>(length));
 }
 
+status_t PersistableBundle::readFromParcelLazily(const Parcel* parcel) {
+    if (!empty()) return INVALID_OPERATION;
+
+    int32_t length = parcel->readInt32();
+    if (length < 0) {
+        ALOGE("Bad length in parcel: %d", length);
+        return UNEXPECTED_NULL;
+    }
+    if (length == 0) {
+        // Empty PersistableBundle or end of data.
+        return NO_ERROR;
+    }
+
+    int32_t magic;
+    RETURN_IF_FAILED(parcel->readInt32(&magic));
+    if (magic != BUNDLE_MAGIC && magic != BUNDLE_MAGIC_NATIVE) {
+        ALOGE("Bad magic number for PersistableBundle: 0x%08x", magic);
+        return BAD_VALUE;
+    }
+
+    // Find where every entry is, checking that it could be decoded.
+    size_t start_pos = parcel->dataPosition();
+    std::vector<LazyEntry> entries;
+    int32_t num_entries;
+    RETURN_IF_FAILED(parcel->readInt32(&num_entries));
+    for (; num_entries > 0; --num_entries) {
+        LazyEntry entry;
+        const char16_t* key = parcel->readString16Inplace(&entry.keyLength);
+        if (key == nullptr) return BAD_VALUE;
+        entry.keyOffset = reinterpret_cast<const uint8_t*>(key) - parcel->data() - start_pos;
+        RETURN_IF_FAILED(parcel->readInt32(&entry.valueType));
+        entry.valueOffset = parcel->dataPosition() - start_pos;
+        RETURN_IF_FAILED(skipValue(parcel, entry.valueType));
+        entry.valueSize = parcel->dataPosition() - start_pos - entry.valueOffset;
+        entries.push_back(entry);
+    }
+    size_t end_pos = parcel->dataPosition();
+
+    auto lazyData = std::make_shared<LazyData>();
+    lazyData->bytes.assign(parcel->data() + start_pos, parcel->data() + end_pos);
+    lazyData->magic = magic;
+    lazyData->entries = std::move(entries);
+    lazyData->sortAndDedupe();
+    mLazyData = std::move(lazyData);
+    return NO_ERROR;
+}
+
+void PersistableBundle::unparcel() {
+    if (mLazyData == nullptr) return;
+
+    std::shared_ptr<const LazyData> data = std::move(mLazyData);
+    mLazyData = nullptr;
+
+    Parcel parcel;
+    status_t status = parcel.setData(data->bytes.data(), data->bytes.size());
+    if (status == NO_ERROR) status = readEntriesFromParcel(&parcel);
+    // the data was checked when it was read, so this is not expected
+    ALOGE_IF(status != NO_ERROR, "Failed to decode lazily read PersistableBundle: %d", status);
+}
+
+void PersistableBundle::LazyData::sortAndDedupe() {
+    auto less = [this](const LazyEntry& lhs, const LazyEntry& rhs) {
+        if (lhs.valueType != rhs.valueType) return lhs.valueType < rhs.valueType;
+        return key(lhs) < key(rhs);
+    };
+    // stable, so that the last of the entries with the same key stays last
+    std::stable_sort(entries.begin(), entries.end(), less);
+    auto last = std::unique(entries.rbegin(), entries.rend(),
+                            [&](const LazyEntry& lhs, const LazyEntry& rhs) {
+                                return !less(lhs, rhs) && !less(rhs, lhs);
+                            });
+    entries.erase(entries.begin(), last.base());
+}
+
+const LazyEntry* PersistableBundle::LazyData::find(const String16& key,
+                                                   int32_t valueType) const {
+    std::u16string_view k(key.string(), key.size());
+    auto it = std::lower_bound(entries.begin(), entries.end(), std::make_pair(valueType, k),
+                               [this](const LazyEntry& entry,
+                                      const std::pair<int32_t, std::u16string_view>& target) {
+                                   if (entry.valueType != target.first) {
+                                       return entry.valueType < target.first;
+                                   }
+                                   return this->key(entry) < target.second;
+                               });
+    if (it == entries.end() || it->valueType != valueType || this->key(*it) != k) return nullptr;
+    return &*it;
+}
+
+template <typename T>
+bool PersistableBundle::getValue(const String16& key, int32_t valueType, T* out,
+                                 const FlatMap<T>& map) const {
+    if (mLazyData == nullptr) {
+        const T* value = map.find(key);
+        if (value == nullptr) return false;
+        *out = *value;
+        return true;
+    }
+
+    const LazyEntry* entry = mLazyData->find(key, valueType);
+    if (entry == nullptr) return false;
+    Parcel parcel;
+    if (parcel.setData(mLazyData->bytes.data() + entry->valueOffset, entry->valueSize) !=
+        NO_ERROR) {
+        return false;
+    }
+    return readValue(&parcel, out) == NO_ERROR;
+}
+
+template <typename T>
+set<String16> PersistableBundle::getKeys(int32_t valueType, const FlatMap<T>& map) const {
+    set<String16> keys;
+    if (mLazyData == nullptr) {
+        for (const auto& key_value_pair : map) {
+            keys.emplace(key_value_pair.first);
+        }
+        return keys;
+    }
+
+    for (const LazyEntry& entry : mLazyData->entries) {
+        if (entry.valueType != valueType) continue;
+        std::u16string_view key = mLazyData->key(entry);
+        keys.emplace(key.data(), key.size());
+    }
+    return keys;
+}
+
+template <typename T>
+const T* PersistableBundle::FlatMap<T>::find(const String16& key) const {
+    auto it = std::lower_bound(mEntries.begin(), mEntries.end(), key,
+                               [](const value_type& entry, const String16& k) {
+                                   return entry.first < k;
+                               });
+    if (it == mEntries.end() || it->first != key) return nullptr;
+    return &it->second;
+}
+
+template <typename T>
+T& PersistableBundle::FlatMap<T>::operator[](const String16& key) {
+    // keys are mostly written in order
+    if (mEntries.empty() || mEntries.back().first < key) {
+        return mEntries.emplace_back(key, T()).second;
+    }
+    auto it = std::lower_bound(mEntries.begin(), mEntries.end(), key,
+                               [](const value_type& entry, const String16& k) {
+                                   return entry.first < k;
+                               });
+    if (it == mEntries.end() || it->first != key) {
+        it = mEntries.emplace(it, key, T());
+    }
+    return it->second;
+}
+
+template <typename T>
+T& PersistableBundle::FlatMap<T>::append(const String16& key) {
+    return mEntries.emplace_back(key, T()).second;
+}
+
+template <typename T>
+void PersistableBundle::FlatMap<T>::sortAndDedupe() {
+    auto less = [](const value_type& lhs, const value_type& rhs) { return lhs.first < rhs.first; };
+    // keys are mostly written in order
+    if (std::adjacent_find(mEntries.begin(), mEntries.end(),
+                           [&](const value_type& lhs, const value_type& rhs) {
+                               return !less(lhs, rhs);
+                           }) == mEntries.end()) {
+        return;
+    }
+    // stable, so that the last of the entries with the same key stays last
+    std::stable_sort(mEntries.begin(), mEntries.end(), less);
+    auto last = std::unique(mEntries.rbegin(), mEntries.rend(),
+                            [](const value_type& lhs, const value_type& rhs) {
+                                return lhs.first == rhs.first;
+                            });
+    mEntries.erase(mEntries.begin(), last.base());
+}
+
+template <typename T>
+size_t PersistableBundle::FlatMap<T>::erase(const String16& key) {
+    auto it = std::lower_bound(mEntries.begin(), mEntries.end(), key,
+                               [](const value_type& entry, const String16& k) {
+                                   return entry.first < k;
+                               });
+    if (it == mEntries.end() || it->first != key) return 0;
+    mEntries.erase(it);
+    return 1;
+}
+
+bool operator==(const PersistableBundle& lhs, const PersistableBundle& rhs) {
+    if (lhs.mLazyData != nullptr || rhs.mLazyData != nullptr) {
+        PersistableBundle decodedLhs = lhs;
+        PersistableBundle decodedRhs = rhs;
+        decodedLhs.unparcel();
+        decodedRhs.unparcel();
+        return decodedLhs == decodedRhs;
+    }
+    return (lhs.mBoolMap == rhs.mBoolMap && lhs.mIntMap == rhs.mIntMap &&
+            lhs.mLongMap == rhs.mLongMap && lhs.mDoubleMap == rhs.mDoubleMap &&
+            lhs.mStringMap == rhs.mStringMap && lhs.mBoolVectorMap == rhs.mBoolVectorMap &&
+            lhs.mIntVectorMap == rhs.mIntVectorMap &&
+            lhs.mLongVectorMap == rhs.mLongVectorMap &&
+            lhs.mDoubleVectorMap == rhs.mDoubleVectorMap &&
+            lhs.mStringVectorMap == rhs.mStringVectorMap &&
+            lhs.mPersistableBundleMap == rhs.mPersistableBundleMap);
+}
+
 bool PersistableBundle::empty() const {
     return size() == 0u;
 }
 
 size_t PersistableBundle::size() const {
+    if (mLazyData != nullptr) return mLazyData->entries.size();
     return (mBoolMap.size() +
             mIntMap.size() +
             mLongMap.size() +
@@ -156,6 +498,7 @@ size_t PersistableBundle::size() const {
 }
 
 size_t PersistableBundle::erase(const String16& key) {
+    unparcel();
     RETURN_IF_ENTRY_ERASED(mBoolMap, key);
     RETURN_IF_ENTRY_ERASED(mIntMap, key);
     RETURN_IF_ENTRY_ERASED(mLongMap, key);
@@ -225,91 +568,91 @@ void PersistableBundle::putPersistableBundle(const String16& key, const Persista
 }
 
 bool PersistableBundle::getBoolean(const String16& key, bool* out) const {
-    return getValue(key, out, mBoolMap);
+    return getValue(key, VAL_BOOLEAN, out, mBoolMap);
 }
 
 bool PersistableBundle::getInt(const String16& key, int32_t* out) const {
-    return getValue(key, out, mIntMap);
+    return getValue(key, VAL_INTEGER, out, mIntMap);
 }
 
 bool PersistableBundle::getLong(const String16& key, int64_t* out) const {
-    return getValue(key, out, mLongMap);
+    return getValue(key, VAL_LONG, out, mLongMap);
 }
 
 bool PersistableBundle::getDouble(const String16& key, double* out) const {
-    return getValue(key, out, mDoubleMap);
+    return getValue(key, VAL_DOUBLE, out, mDoubleMap);
 }
 
 bool PersistableBundle::getString(const String16& key, String16* out) const {
-    return getValue(key, out, mStringMap);
+    return getValue(key, VAL_STRING, out, mStringMap);
 }
 
 bool PersistableBundle::getBooleanVector(const String16& key, vector<bool>* out) const {
-    return getValue(key, out, mBoolVectorMap);
+    return getValue(key, VAL_BOOLEANARRAY, out, mBoolVectorMap);
 }
 
 bool PersistableBundle::getIntVector(const String16& key, vector<int32_t>* out) const {
-    return getValue(key, out, mIntVectorMap);
+    return getValue(key, VAL_INTARRAY, out, mIntVectorMap);
 }
 
 bool PersistableBundle::getLongVector(const String16& key, vector<int64_t>* out) const {
-    return getValue(key, out, mLongVectorMap);
+    return getValue(key, VAL_LONGARRAY, out, mLongVectorMap);
 }
 
 bool PersistableBundle::getDoubleVector(const String16& key, vector<double>* out) const {
-    return getValue(key, out, mDoubleVectorMap);
+    return getValue(key, VAL_DOUBLEARRAY, out, mDoubleVectorMap);
 }
 
 bool PersistableBundle::getStringVector(const String16& key, vector<String16>* out) const {
-    return getValue(key, out, mStringVectorMap);
+    return getValue(key, VAL_STRINGARRAY, out, mStringVectorMap);
 }
 
 bool PersistableBundle::getPersistableBundle(const String16& key, PersistableBundle* out) const {
-    return getValue(key, out, mPersistableBundleMap);
+    return getValue(key, VAL_PERSISTABLEBUNDLE, out, mPersistableBundleMap);
 }
 
 set<String16> PersistableBundle::getBooleanKeys() const {
-    return getKeys(mBoolMap);
+    return getKeys(VAL_BOOLEAN, mBoolMap);
 }
 
 set<String16> PersistableBundle::getIntKeys() const {
-    return getKeys(mIntMap);
+    return getKeys(VAL_INTEGER, mIntMap);
 }
 
 set<String16> PersistableBundle::getLongKeys() const {
-    return getKeys(mLongMap);
+    return getKeys(VAL_LONG, mLongMap);
 }
 
 set<String16> PersistableBundle::getDoubleKeys() const {
-    return getKeys(mDoubleMap);
+    return getKeys(VAL_DOUBLE, mDoubleMap);
 }
 
 set<String16> PersistableBundle::getStringKeys() const {
-    return getKeys(mStringMap);
+    return getKeys(VAL_STRING, mStringMap);
 }
 
 set<String16> PersistableBundle::getBooleanVectorKeys() const {
-    return getKeys(mBoolVectorMap);
+    return getKeys(VAL_BOOLEANARRAY, mBoolVectorMap);
 }
 
 set<String16> PersistableBundle::getIntVectorKeys() const {
-    return getKeys(mIntVectorMap);
+    return getKeys(VAL_INTARRAY, mIntVectorMap);
 }
 
 set<String16> PersistableBundle::getLongVectorKeys() const {
-    return getKeys(mLongVectorMap);
+    return getKeys(VAL_LONGARRAY, mLongVectorMap);
 }
 
 set<String16> PersistableBundle::getDoubleVectorKeys() const {
-    return getKeys(mDoubleVectorMap);
+    return getKeys(VAL_DOUBLEARRAY, mDoubleVectorMap);
 }
 
 set<String16> PersistableBundle::getStringVectorKeys() const {
-    return getKeys(mStringVectorMap);
+    return getKeys(VAL_STRINGARRAY, mStringVectorMap);
 }
 
 set<String16> PersistableBundle::getPersistableBundleKeys() const {
-    return getKeys(mPersistableBundleMap);
+    return getKeys(VAL_PERSISTABLEBUNDLE, mPersistableBundleMap);
 }
 
 status_t PersistableBundle::writeToParcelInner(Parcel* parcel) const {
@@ -403,79 +746,100 @@ status_t PersistableBundle::readFromParcelInner(const Parcel* parcel, size_t len
         return BAD_VALUE;
     }
 
+    return readEntriesFromParcel(parcel);
+}
+
+status_t PersistableBundle::readEntriesFromParcel(const Parcel* parcel) {
     /*
      * To keep this implementation in sync with unparcel() in
      * frameworks/base/core/java/android/os/BaseBundle.java, the number of
      * key-value pairs must be read from the parcel before reading the key-value
      * pairs themselves.
      */
-    int32_t num_entries;
-    RETURN_IF_FAILED(parcel->readInt32(&num_entries));
-
-    for (; num_entries > 0; --num_entries) {
-        String16 key;
-        int32_t value_type;
-        RETURN_IF_FAILED(parcel->readString16(&key));
-        RETURN_IF_FAILED(parcel->readInt32(&value_type));
-
-        /*
-         * We assume that both the C++ and Java APIs ensure that all keys in a PersistableBundle
-         * are unique.
-         */
-        switch (value_type) {
-            case VAL_STRING: {
-                RETURN_IF_FAILED(parcel->readString16(&mStringMap[key]));
-                break;
-            }
-            case VAL_INTEGER: {
-                RETURN_IF_FAILED(parcel->readInt32(&mIntMap[key]));
-                break;
-            }
-            case VAL_LONG: {
-                RETURN_IF_FAILED(parcel->readInt64(&mLongMap[key]));
-                break;
-            }
-            case VAL_DOUBLE: {
-                RETURN_IF_FAILED(parcel->readDouble(&mDoubleMap[key]));
-                break;
-            }
-            case VAL_BOOLEAN: {
-                RETURN_IF_FAILED(parcel->readBool(&mBoolMap[key]));
-                break;
-            }
-            case VAL_STRINGARRAY: {
-                RETURN_IF_FAILED(parcel->readString16Vector(&mStringVectorMap[key]));
-                break;
-            }
-            case VAL_INTARRAY: {
-                RETURN_IF_FAILED(parcel->readInt32Vector(&mIntVectorMap[key]));
-                break;
-            }
-            case VAL_LONGARRAY: {
-                RETURN_IF_FAILED(parcel->readInt64Vector(&mLongVectorMap[key]));
-                break;
-            }
-            case VAL_BOOLEANARRAY: {
-                RETURN_IF_FAILED(parcel->readBoolVector(&mBoolVectorMap[key]));
-                break;
-            }
-            case VAL_PERSISTABLEBUNDLE: {
-                RETURN_IF_FAILED(mPersistableBundleMap[key].readFromParcel(parcel));
-                break;
-            }
-            case VAL_DOUBLEARRAY: {
-                RETURN_IF_FAILED(parcel->readDoubleVector(&mDoubleVectorMap[key]));
-                break;
-            }
-            default: {
-                ALOGE("Unrecognized type: %d", value_type);
-                return BAD_TYPE;
-                break;
+    // The maps are appended to in parcel order, and sorted once at the end.
+    auto readEntries = [&]() -> status_t {
+        int32_t num_entries;
+        RETURN_IF_FAILED(parcel->readInt32(&num_entries));
+
+        for (; num_entries > 0; --num_entries) {
+            String16 key;
+            int32_t value_type;
+            RETURN_IF_FAILED(parcel->readString16(&key));
+            RETURN_IF_FAILED(parcel->readInt32(&value_type));
+
+            /*
+             * Both the C++ and Java APIs ensure that all keys in a PersistableBundle are unique.
+             * Should one be repeated anyway, sortAndDedupe() keeps its last value.
+             */
+            switch (value_type) {
+                case VAL_STRING: {
+                    RETURN_IF_FAILED(parcel->readString16(&mStringMap.append(key)));
+                    break;
+                }
+                case VAL_INTEGER: {
+                    RETURN_IF_FAILED(parcel->readInt32(&mIntMap.append(key)));
+                    break;
+                }
+                case VAL_LONG: {
+                    RETURN_IF_FAILED(parcel->readInt64(&mLongMap.append(key)));
+                    break;
+                }
+                case VAL_DOUBLE: {
+                    RETURN_IF_FAILED(parcel->readDouble(&mDoubleMap.append(key)));
+                    break;
+                }
+                case VAL_BOOLEAN: {
+                    RETURN_IF_FAILED(parcel->readBool(&mBoolMap.append(key)));
+                    break;
+                }
+                case VAL_STRINGARRAY: {
+                    RETURN_IF_FAILED(parcel->readString16Vector(&mStringVectorMap.append(key)));
+                    break;
+                }
+                case VAL_INTARRAY: {
+                    RETURN_IF_FAILED(parcel->readInt32Vector(&mIntVectorMap.append(key)));
+                    break;
+                }
+                case VAL_LONGARRAY: {
+                    RETURN_IF_FAILED(parcel->readInt64Vector(&mLongVectorMap.append(key)));
+                    break;
+                }
+                case VAL_BOOLEANARRAY: {
+                    RETURN_IF_FAILED(parcel->readBoolVector(&mBoolVectorMap.append(key)));
+                    break;
+                }
+                case VAL_PERSISTABLEBUNDLE: {
+                    RETURN_IF_FAILED(mPersistableBundleMap.append(key).readFromParcel(parcel));
+                    break;
+                }
+                case VAL_DOUBLEARRAY: {
+                    RETURN_IF_FAILED(parcel->readDoubleVector(&mDoubleVectorMap.append(key)));
+                    break;
+                }
+                default: {
+                    ALOGE("Unrecognized type: %d", value_type);
+                    return BAD_TYPE;
+                    break;
+                }
             }
         }
-    }
 
-    return NO_ERROR;
+        return NO_ERROR;
+    };
+    status_t status = readEntries();
+
+    mBoolMap.sortAndDedupe();
+    mIntMap.sortAndDedupe();
+    mLongMap.sortAndDedupe();
+    mDoubleMap.sortAndDedupe();
+    mStringMap.sortAndDedupe();
+    mBoolVectorMap.sortAndDedupe();
+    mIntVectorMap.sortAndDedupe();
+    mLongVectorMap.sortAndDedupe();
+    mDoubleVectorMap.sortAndDedupe();
+    mStringVectorMap.sortAndDedupe();
+    mPersistableBundleMap.sortAndDedupe();
+    return status;
 }
 
 }  // namespace os
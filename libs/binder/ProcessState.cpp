@@ -28,13 +28,16 @@
 #include <utils/AndroidThreads.h>
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <utils/SystemClock.h>
 #include <utils/Thread.h>
 
 #include "Static.h"
 #include "binder_module.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
@@ -182,7 +185,7 @@ void ProcessState::startThreadPool()
 {
     AutoMutex _l(mLock);
     if (!mThreadPoolStarted) {
-        if (mMaxThreads == 0) {
+        if (mMaxThreads == 0 && !mAdaptiveThreadPool) {
             ALOGW("Extra binder thread started, but 0 threads requested. Do not use "
                   "*startThreadPool when zero threads are requested.");
         }
@@ -414,6 +417,118 @@ size_t ProcessState::getThreadPoolMaxThreadCount() const {
     return 0;
 }
 
+status_t ProcessState::setThreadPoolAdaptive(size_t minThreads, size_t maxThreads,
+                                             int64_t growAfterMs, int64_t idleTimeoutMs) {
+    LOG_ALWAYS_FATAL_IF(mThreadPoolStarted,
+                        "setThreadPoolAdaptive must be called before startThreadPool");
+    if (maxThreads == 0 || minThreads > maxThreads || growAfterMs < 0 || idleTimeoutMs <= 0) {
+        ALOGE("Invalid adaptive thread pool: min %zu, max %zu, grow after %" PRId64
+              " ms, idle timeout %" PRId64 " ms",
+              minThreads, maxThreads, growAfterMs, idleTimeoutMs);
+        return BAD_VALUE;
+    }
+    pthread_mutex_lock(&mThreadCountLock);
+    status_t result = NO_ERROR;
+    if (ioctl(mDriverFD, BINDER_SET_MAX_THREADS, &minThreads) != -1) {
+        mMaxThreads = minThreads;
+        mAdaptiveThreadPool = true;
+        mAdaptiveMinThreads = minThreads;
+        mAdaptiveMaxThreads = maxThreads;
+        mAdaptiveGrowAfterMs = growAfterMs;
+        mAdaptiveIdleTimeoutMs = idleTimeoutMs;
+        mPeakWindowStartMs = uptimeMillis();
+    } else {
+        result = -errno;
+        ALOGE("Binder ioctl to set max threads failed: %s", strerror(-result));
+    }
+    pthread_mutex_unlock(&mThreadCountLock);
+    return result;
+}
+
+void ProcessState::onThreadPoolStarvedLocked(int64_t starvationTimeMs) {
+    mStarvationCount++;
+    mTotalStarvationMs += starvationTimeMs;
+    mLongestStarvationMs = std::max(mLongestStarvationMs, starvationTimeMs);
+
+    if (!mAdaptiveThreadPool || starvationTimeMs < mAdaptiveGrowAfterMs ||
+        mMaxThreads >= mAdaptiveMaxThreads) {
+        return;
+    }
+    // The driver counts every thread it has asked for over the life of the
+    // process, including ones which have since exited, so retired threads
+    // are added back to the limit it is given.
+    size_t kernelMaxThreads = mMaxThreads + 1 + mThreadsRetired;
+    if (ioctl(mDriverFD, BINDER_SET_MAX_THREADS, &kernelMaxThreads) == -1) {
+        ALOGE("Binder ioctl to grow max threads failed: %s", strerror(errno));
+        return;
+    }
+    mMaxThreads++;
+    mThreadsGrown++;
+    ALOGV("Binder thread pool starved for %" PRId64 " ms, growing to %zu threads",
+          starvationTimeMs, mMaxThreads);
+}
+
+bool ProcessState::shouldRetirePooledThread() {
+    // Only set before the thread pool starts, so it can be read unlocked.
+    if (!mAdaptiveThreadPool) return false;
+
+    pthread_mutex_lock(&mThreadCountLock);
+    bool retire = false;
+    int64_t now = uptimeMillis();
+    if (now - mPeakWindowStartMs >= mAdaptiveIdleTimeoutMs) {
+        // If at most N threads were busy at once for a whole window, every
+        // thread beyond N sat idle for it. Threads are interchangeable, so
+        // the caller leaves in place of one of them; at most one per window,
+        // so that the pool shrinks gradually. Some other thread has to stay
+        // behind to read from the driver and ask for new threads.
+        retire = mPoolThreadCount > 1 && mPeakExecutingThreads < mPoolThreadCount &&
+                mMaxThreads > mAdaptiveMinThreads;
+        if (retire) {
+            // Dropping mMaxThreads while counting the retired thread leaves
+            // the limit given to the driver unchanged.
+            mMaxThreads--;
+            mThreadsRetired++;
+        }
+        mPeakWindowStartMs = now;
+        mPeakExecutingThreads = mExecutingThreadsCount;
+    }
+    pthread_mutex_unlock(&mThreadCountLock);
+    return retire;
+}
+
+bool ProcessState::startPollingForWork() {
+    pthread_mutex_lock(&mThreadCountLock);
+    // With several threads in poll(), the driver would wake all of them for
+    // each transaction.
+    bool poll = !mAdaptivePolling;
+    mAdaptivePolling = true;
+    pthread_mutex_unlock(&mThreadCountLock);
+    return poll;
+}
+
+void ProcessState::stopPollingForWork() {
+    pthread_mutex_lock(&mThreadCountLock);
+    mAdaptivePolling = false;
+    pthread_mutex_unlock(&mThreadCountLock);
+}
+
+ProcessState::ThreadPoolStats ProcessState::getThreadPoolStats() {
+    pthread_mutex_lock(&mThreadCountLock);
+    ThreadPoolStats stats = {
+            .threads = mPoolThreadCount,
+            .executingThreads = mExecutingThreadsCount,
+            .maxThreads = mMaxThreads,
+            .peakExecutingThreads = mMaxExecutingThreads,
+            .threadsGrown = mThreadsGrown,
+            .threadsRetired = mThreadsRetired,
+            .starvations = mStarvationCount,
+            .totalStarvationMs = mTotalStarvationMs,
+            .longestStarvationMs = mLongestStarvationMs,
+    };
+    pthread_mutex_unlock(&mThreadCountLock);
+    return stats;
+}
+
 #define DRIVER_FEATURES_PATH "/dev/binderfs/features/"
 bool ProcessState::isDriverFeatureEnabled(const DriverFeature feature) {
     static const char* const names[] = {
@@ -496,6 +611,21 @@ ProcessState::ProcessState(const char* driver)
         mWaitingForThreads(0),
         mMaxThreads(DEFAULT_MAX_BINDER_THREADS),
         mStarvationStartTimeMs(0),
+        mPoolThreadCount(0),
+        mPeakExecutingThreads(0),
+        mPeakWindowStartMs(0),
+        mMaxExecutingThreads(0),
+        mStarvationCount(0),
+        mTotalStarvationMs(0),
+        mLongestStarvationMs(0),
+        mAdaptiveThreadPool(false),
+        mAdaptiveMinThreads(0),
+        mAdaptiveMaxThreads(0),
+        mAdaptiveGrowAfterMs(0),
+        mAdaptiveIdleTimeoutMs(0),
+        mThreadsGrown(0),
+        mThreadsRetired(0),
+        mAdaptivePolling(false),
         mForked(false),
         mThreadPoolStarted(false),
         mThreadPoolSeq(1),
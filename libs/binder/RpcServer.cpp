@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -40,6 +41,11 @@
 namespace android {
 
 constexpr size_t kSessionIdBytes = 32;
+constexpr uint64_t kEventLoopStopId = 0;
+// How often connections with part of a command header are checked again, and
+// how long they may take to send the rest.
+constexpr int kPartialCommandPollMs = 10;
+constexpr std::chrono::seconds kPartialCommandTimeout(10);
 
 using base::ScopeGuard;
 using base::unique_fd;
@@ -117,6 +123,15 @@ size_t RpcServer::getMaxThreads() {
     return mMaxThreads;
 }
 
+void RpcServer::setEventLoopThreads(size_t threads) {
+    LOG_ALWAYS_FATAL_IF(mJoinThreadRunning, "Cannot set event loop threads while running");
+    mEventLoopThreads = threads;
+}
+
+size_t RpcServer::getEventLoopThreads() {
+    return mEventLoopThreads;
+}
+
 void RpcServer::setProtocolVersion(uint32_t version) {
     mProtocolVersion = version;
 }
@@ -173,6 +188,9 @@ void RpcServer::join() {
         mJoinThreadRunning = true;
         mShutdownTrigger = FdTrigger::make();
         LOG_ALWAYS_FATAL_IF(mShutdownTrigger == nullptr, "Cannot create join signaler");
+        if (mEventLoopThreads > 0) {
+            LOG_ALWAYS_FATAL_IF(startEventLoop() != OK, "Cannot start event loop");
+        }
     }
 
     status_t status;
@@ -234,6 +252,8 @@ bool RpcServer::shutdown() {
         }
     }
 
+    stopEventLoop(_l);
+
     // At this point, we know join() is about to exit, but the thread that calls
     // join() may not have exited yet.
     // If RpcServer owns the join thread (aka start() is called), make sure the thread exits;
@@ -352,10 +372,10 @@ void RpcServer::establishConnection(sp<RpcServer>&& server, base::unique_fd clie
         thisThread = std::move(threadId->second);
         ScopeGuard detachGuard = [&]() {
             thisThread.detach();
+            server->mConnectingThreads.erase(threadId);
             _l.unlock();
             server->mShutdownCv.notify_all();
         };
-        server->mConnectingThreads.erase(threadId);
 
         if (status != OK || server->mShutdownTrigger->isTriggered()) {
             return;
@@ -429,18 +449,303 @@ void RpcServer::establishConnection(sp<RpcServer>&& server, base::unique_fd clie
             return;
         }
 
+        // With an event loop, this thread is done once the connection is added to it. Until
+        // then, it stays in mConnectingThreads, so that shutdown() waits for it before the
+        // event loop is stopped.
         detachGuard.Disable();
-        session->preJoinThreadOwnership(std::move(thisThread));
+        if (server->mEventLoopThreads == 0) {
+            server->mConnectingThreads.erase(threadId);
+            session->preJoinThreadOwnership(std::move(thisThread));
+        }
     }
 
     auto setupResult = session->preJoinSetup(std::move(client));
 
+    if (server->mEventLoopThreads > 0) {
+        server->addToEventLoop(std::move(session), std::move(setupResult), clientFdForLog);
+        {
+            std::lock_guard<std::mutex> _l(server->mLock);
+            thisThread.detach();
+            server->mConnectingThreads.erase(std::this_thread::get_id());
+        }
+        server->mShutdownCv.notify_all();
+        return;
+    }
+
     // avoid strong cycle
     server = nullptr;
 
     RpcSession::join(std::move(session), std::move(setupResult));
 }
 
+static status_t epollCtl(base::borrowed_fd epollFd, int op, base::borrowed_fd fd, uint64_t id) {
+    epoll_event event{};
+    event.events = EPOLLIN | (id == kEventLoopStopId ? 0 : EPOLLONESHOT);
+    event.data.u64 = id;
+    if (0 != epoll_ctl(epollFd.get(), op, fd.get(), &event)) {
+        int savedErrno = errno;
+        ALOGE("Could not update event loop for fd %d: %s", fd.get(), strerror(savedErrno));
+        return -savedErrno;
+    }
+    return OK;
+}
+
+status_t RpcServer::startEventLoop() {
+    std::lock_guard<std::mutex> _l(mEventLoopLock);
+    mEpollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (!mEpollFd.ok()) {
+        int savedErrno = errno;
+        ALOGE("Could not create epoll instance: %s", strerror(savedErrno));
+        return -savedErrno;
+    }
+
+    mEventLoopTrigger = FdTrigger::make();
+    if (mEventLoopTrigger == nullptr) return UNKNOWN_ERROR;
+    // level-triggered, so that every thread in the pool sees it
+    if (status_t status =
+                epollCtl(mEpollFd, EPOLL_CTL_ADD, mEventLoopTrigger->readFd(), kEventLoopStopId);
+        status != OK) {
+        return status;
+    }
+
+    for (size_t i = 0; i < mEventLoopThreads; i++) {
+        mEventLoopPool.emplace_back(&RpcServer::eventLoopThread, this);
+    }
+    return OK;
+}
+
+void RpcServer::stopEventLoop(std::unique_lock<std::mutex>& lock) {
+    if (mEventLoopTrigger == nullptr) return;
+    // connecting threads add to the event loop, and the join thread starts them
+    LOG_ALWAYS_FATAL_IF(mJoinThreadRunning || !mConnectingThreads.empty(),
+                        "Stopping event loop while connections may still be added");
+
+    mEventLoopTrigger->trigger();
+    std::vector<std::thread> pool = std::move(mEventLoopPool);
+
+    // threads may be finishing a connection, which takes mLock
+    lock.unlock();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    lock.lock();
+
+    std::lock_guard<std::mutex> _l(mEventLoopLock);
+    LOG_ALWAYS_FATAL_IF(!mEventLoopSources.empty(),
+                        "Stopping event loop with %zu sources, but sessions are shut down",
+                        mEventLoopSources.size());
+    mEventLoopSessions.clear();
+    mEventLoopPartial.clear();
+    mEpollFd.reset();
+    mEventLoopTrigger = nullptr;
+}
+
+void RpcServer::addToEventLoop(sp<RpcSession>&& session,
+                               RpcSession::PreJoinSetupResult&& setupResult, int fd) {
+    const sp<RpcSession::RpcConnection>& connection = setupResult.connection;
+    if (setupResult.status != OK) {
+        ALOGE("Connection failed to init, closing with status %s",
+              statusToString(setupResult.status).c_str());
+        if (connection != nullptr) {
+            finishEventLoopConnection(EventLoopSource{.session = session,
+                                                      .connection = connection,
+                                                      .fd = fd});
+        }
+        return;
+    }
+    LOG_ALWAYS_FATAL_IF(!connection, "must have connection if setup succeeded");
+
+    session->releaseIncomingConnection(connection);
+
+    std::optional<EventLoopSource> failed;
+    {
+        std::lock_guard<std::mutex> _l(mEventLoopLock);
+        EventLoopSession& record = mEventLoopSessions[session.get()];
+        if (record.connections == 0) {
+            // if the session is already shut down, this fires right away
+            uint64_t triggerId = mNextEventLoopId++;
+            base::borrowed_fd triggerFd = session->mShutdownTrigger->readFd();
+            mEventLoopSources.emplace(triggerId,
+                                      EventLoopSource{.session = session,
+                                                      .connection = nullptr,
+                                                      .fd = triggerFd.get()});
+            if (OK == epollCtl(mEpollFd, EPOLL_CTL_ADD, triggerFd, triggerId)) {
+                record.triggerId = triggerId;
+            } else {
+                mEventLoopSources.erase(triggerId);
+            }
+        }
+        record.connections++;
+
+        uint64_t id = mNextEventLoopId++;
+        auto it = mEventLoopSources
+                          .emplace(id,
+                                   EventLoopSource{.session = session,
+                                                   .connection = connection,
+                                                   .fd = fd})
+                          .first;
+        if (record.triggerId == 0 || OK != epollCtl(mEpollFd, EPOLL_CTL_ADD, fd, id)) {
+            failed = removeEventLoopSourceLocked(it);
+        }
+    }
+
+    if (failed) finishEventLoopConnection(*failed);
+}
+
+void RpcServer::eventLoopThread() {
+    RpcSession::runIncomingThread([this] {
+        while (true) {
+            // one at a time, so that events are spread over the pool
+            int timeoutMs;
+            {
+                std::lock_guard<std::mutex> _l(mEventLoopLock);
+                timeoutMs = mEventLoopPartial.empty() ? -1 : kPartialCommandPollMs;
+            }
+            epoll_event event;
+            int ret = TEMP_FAILURE_RETRY(epoll_wait(mEpollFd.get(), &event, 1, timeoutMs));
+            LOG_ALWAYS_FATAL_IF(ret < 0, "epoll_wait failed: %s", strerror(errno));
+            if (ret == 0) {
+                recheckPartialEventLoopSources();
+                continue;
+            }
+
+            if (event.data.u64 == kEventLoopStopId) break;
+            handleEventLoopEvent(event.data.u64);
+        }
+    });
+}
+
+void RpcServer::handleEventLoopEvent(uint64_t id) {
+    std::vector<EventLoopSource> finished;
+
+    sp<RpcSession> session;
+    sp<RpcSession::RpcConnection> connection;
+    {
+        std::lock_guard<std::mutex> _l(mEventLoopLock);
+        auto it = mEventLoopSources.find(id);
+        // already removed by another thread while this event was pending
+        if (it == mEventLoopSources.end()) return;
+
+        if (it->second.connection == nullptr) {
+            // Session is shutting down. Drop its idle connections here.
+            // Connections which are being served are dropped by the serving
+            // thread once it is done.
+            RpcSession* shutdownSession = it->second.session.get();
+            std::vector<uint64_t> idle;
+            for (const auto& [sourceId, source] : mEventLoopSources) {
+                if (source.session.get() == shutdownSession && !source.busy) {
+                    idle.push_back(sourceId);
+                }
+            }
+            for (uint64_t sourceId : idle) {
+                auto source = mEventLoopSources.find(sourceId);
+                // the trigger is removed along with the last connection
+                if (source == mEventLoopSources.end()) continue;
+                if (std::optional<EventLoopSource> removed = removeEventLoopSourceLocked(source)) {
+                    finished.push_back(std::move(*removed));
+                }
+            }
+        } else {
+            it->second.busy = true;
+            session = it->second.session;
+            connection = it->second.connection;
+        }
+    }
+
+    if (connection != nullptr) {
+        // Don't wait on this thread for a peer which sends part of a command.
+        status_t status = RpcSession::peekIncomingCommand(connection);
+        if (status == OK) status = RpcSession::serveIncomingCommands(session, connection);
+
+        std::lock_guard<std::mutex> _l(mEventLoopLock);
+        auto it = mEventLoopSources.find(id);
+        LOG_ALWAYS_FATAL_IF(it == mEventLoopSources.end(), "Busy connection removed");
+        EventLoopSource& source = it->second;
+        source.busy = false;
+
+        // WOULD_BLOCK means the FD was readable but the transport holds
+        // nothing whole yet, e.g. part of a TLS record.
+        bool partial = false;
+        if (status == NOT_ENOUGH_DATA || status == WOULD_BLOCK) {
+            auto now = std::chrono::steady_clock::now();
+            if (!source.partialSince) source.partialSince = now;
+            if (now - *source.partialSince > kPartialCommandTimeout) {
+                ALOGW("Closing connection which sent part of a command header %lld s ago",
+                      static_cast<long long>(kPartialCommandTimeout.count()));
+                status = TIMED_OUT;
+            } else {
+                partial = true;
+                status = OK;
+            }
+        } else {
+            source.partialSince = std::nullopt;
+        }
+
+        if (partial && !session->mShutdownTrigger->isTriggered()) {
+            mEventLoopPartial.push_back(id);
+        } else if (status != OK || session->mShutdownTrigger->isTriggered() ||
+                   OK != epollCtl(mEpollFd, EPOLL_CTL_MOD, source.fd, id)) {
+            if (std::optional<EventLoopSource> removed = removeEventLoopSourceLocked(it)) {
+                finished.push_back(std::move(*removed));
+            }
+        }
+    }
+
+    for (const EventLoopSource& source : finished) {
+        finishEventLoopConnection(source);
+    }
+}
+
+void RpcServer::recheckPartialEventLoopSources() {
+    std::vector<uint64_t> partial;
+    {
+        std::lock_guard<std::mutex> _l(mEventLoopLock);
+        partial.swap(mEventLoopPartial);
+    }
+    // Removed connections are skipped by handleEventLoopEvent. Those in
+    // mEventLoopPartial are not armed, so no other thread handles them.
+    for (uint64_t id : partial) {
+        handleEventLoopEvent(id);
+    }
+}
+
+std::optional<RpcServer::EventLoopSource> RpcServer::removeEventLoopSourceLocked(
+        std::map<uint64_t, EventLoopSource>::iterator it) {
+    EventLoopSource source = std::move(it->second);
+    uint64_t id = it->first;
+    mEventLoopSources.erase(it);
+    // not registered if adding it failed
+    (void)epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, source.fd, nullptr);
+
+    auto record = mEventLoopSessions.find(source.session.get());
+    LOG_ALWAYS_FATAL_IF(record == mEventLoopSessions.end(), "Event loop source without session");
+
+    if (source.connection == nullptr) {
+        LOG_ALWAYS_FATAL_IF(record->second.triggerId != id, "Unknown session trigger");
+        record->second.triggerId = 0;
+        if (record->second.connections == 0) mEventLoopSessions.erase(record);
+        return std::nullopt;
+    }
+
+    if (--record->second.connections == 0) {
+        if (record->second.triggerId != 0) {
+            auto trigger = mEventLoopSources.find(record->second.triggerId);
+            LOG_ALWAYS_FATAL_IF(trigger == mEventLoopSources.end(), "Lost session trigger");
+            (void)epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, trigger->second.fd, nullptr);
+            mEventLoopSources.erase(trigger);
+        }
+        mEventLoopSessions.erase(record);
+    }
+    return source;
+}
+
+void RpcServer::finishEventLoopConnection(const EventLoopSource& source) {
+    // done after all cleanup, since session shutdown progresses via callbacks here
+    LOG_ALWAYS_FATAL_IF(!source.session->removeIncomingConnection(source.connection),
+                        "bad state: connection object guaranteed to be in list");
+    onSessionIncomingThreadEnded();
+}
+
 status_t RpcServer::setupSocketServer(const RpcSocketAddress& addr) {
     LOG_RPC_DETAIL("Setting up socket server %s", addr.toString().c_str());
     LOG_ALWAYS_FATAL_IF(hasServer(), "Each RpcServer can only have one server.");
@@ -107,6 +107,20 @@ size_t RpcSession::getMaxOutgoingThreads() {
     return mMaxOutgoingThreads;
 }
 
+void RpcSession::setMaxQueuedOnewayTransactions(size_t maxQueued) {
+    std::lock_guard<std::mutex> _l(mMutex);
+    LOG_ALWAYS_FATAL_IF(!mConnections.mOutgoing.empty() || !mConnections.mIncoming.empty(),
+                        "Must set max queued oneway transactions before setting up connections, "
+                        "but has %zu client(s) and %zu server(s)",
+                        mConnections.mOutgoing.size(), mConnections.mIncoming.size());
+    mMaxQueuedOnewayTransactions = maxQueued;
+}
+
+size_t RpcSession::getMaxQueuedOnewayTransactions() {
+    std::lock_guard<std::mutex> _l(mMutex);
+    return mMaxQueuedOnewayTransactions;
+}
+
 bool RpcSession::setProtocolVersion(uint32_t version) {
     if (version >= RPC_WIRE_PROTOCOL_VERSION_NEXT &&
         version != RPC_WIRE_PROTOCOL_VERSION_EXPERIMENTAL) {
@@ -228,6 +242,12 @@ bool RpcSession::shutdownAndWait(bool wait) {
 
 status_t RpcSession::transact(const sp<IBinder>& binder, uint32_t code, const Parcel& data,
                               Parcel* reply, uint32_t flags) {
+    // not locked, since this can't change after connections are set up
+    if ((flags & IBinder::FLAG_ONEWAY) && mMaxQueuedOnewayTransactions != 0) {
+        return state()->transactQueued(binder, code, data, sp<RpcSession>::fromExisting(this),
+                                       flags);
+    }
+
     ExclusiveConnection connection;
     status_t status =
             ExclusiveConnection::find(sp<RpcSession>::fromExisting(this),
@@ -425,6 +445,69 @@ void RpcSession::join(sp<RpcSession>&& session, PreJoinSetupResult&& setupResult
     }
 }
 
+void RpcSession::releaseIncomingConnection(const sp<RpcConnection>& connection) {
+    std::lock_guard<std::mutex> _l(mMutex);
+    LOG_ALWAYS_FATAL_IF(connection->exclusiveTid != gettid(),
+                        "Releasing connection not owned by this thread");
+    connection->exclusiveTid = std::nullopt;
+}
+
+status_t RpcSession::peekIncomingCommand(const sp<RpcConnection>& connection) {
+    RpcWireHeader header;
+    size_t size;
+    if (status_t status = connection->rpcTransport->peek(&header, sizeof(header), &size);
+        status != OK) {
+        return status;
+    }
+    if (size == 0) return DEAD_OBJECT;
+    return size < sizeof(header) ? NOT_ENOUGH_DATA : OK;
+}
+
+status_t RpcSession::serveIncomingCommands(const sp<RpcSession>& session,
+                                           const sp<RpcConnection>& connection) {
+    {
+        // must be registered to allow nested calls, same as for join
+        std::lock_guard<std::mutex> _l(session->mMutex);
+        LOG_ALWAYS_FATAL_IF(connection->exclusiveTid != std::nullopt,
+                            "Incoming connection served by two threads at once");
+        connection->exclusiveTid = gettid();
+    }
+
+    status_t status;
+    while (true) {
+        status = session->state()->getAndExecuteCommand(connection, session,
+                                                        RpcState::CommandType::ANY);
+        if (status != OK) break;
+
+        // The transport may have already read the next command off of the
+        // socket (e.g. TLS records), in which case the FD won't become
+        // readable again for it. Only a whole header is read here, so that a
+        // peer sending part of one doesn't hold up this thread; RpcServer
+        // waits for the rest.
+        status = peekIncomingCommand(connection);
+        if (status == WOULD_BLOCK || status == NOT_ENOUGH_DATA) {
+            status = OK;
+            break;
+        }
+        if (status != OK) break;
+    }
+
+    if (status != OK) {
+        LOG_RPC_DETAIL("Binder connection closing w/ status %s", statusToString(status).c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> _l(session->mMutex);
+        connection->exclusiveTid = std::nullopt;
+    }
+    return status;
+}
+
+void RpcSession::runIncomingThread(const std::function<void()>& serve) {
+    [[maybe_unused]] JavaThreadAttacher javaThreadAttacher;
+    serve();
+}
+
 sp<RpcServer> RpcSession::server() {
     RpcServer* unsafeServer = mForServer.unsafe_get();
     sp<RpcServer> server = mForServer.promote();
@@ -32,6 +32,10 @@
 
 #include <inttypes.h>
 
+#ifdef __GLIBC__
+extern "C" pid_t gettid();
+#endif
+
 namespace android {
 
 using base::ScopeGuard;
@@ -80,23 +84,29 @@ status_t RpcState::onBinderLeaving(const sp<RpcSession>& session, const sp<IBind
     std::lock_guard<std::mutex> _l(mNodeMutex);
     if (mTerminated) return DEAD_OBJECT;
 
-    // TODO(b/182939933): maybe move address out of BpBinder, and keep binder->address map
-    // in RpcState
-    for (auto& [addr, node] : mNodeForAddress) {
-        if (binder == node.binder) {
-            if (isRpc) {
-                // check integrity of data structure
-                uint64_t actualAddr = binder->remoteBinder()->getPrivateAccessor().rpcAddress();
-                LOG_ALWAYS_FATAL_IF(addr != actualAddr, "Address mismatch %" PRIu64 " vs %" PRIu64,
-                                    addr, actualAddr);
-            }
-            node.timesSent++;
-            node.sentRef = binder; // might already be set
-            *outAddress = addr;
-            return OK;
-        }
+    if (isRpc) {
+        uint64_t addr = binder->remoteBinder()->getPrivateAccessor().rpcAddress();
+        auto it = mNodeForAddress.find(addr);
+        LOG_ALWAYS_FATAL_IF(it == mNodeForAddress.end(),
+                            "RPC binder must have known address at this point");
+        // check integrity of data structure
+        LOG_ALWAYS_FATAL_IF(it->second.binder != binder, "Address mismatch %" PRIu64, addr);
+        it->second.timesSent++;
+        it->second.sentRef = binder; // might already be set
+        *outAddress = addr;
+        return OK;
+    }
+
+    if (auto addrIt = mAddressForLocalBinder.find(binder.get());
+        addrIt != mAddressForLocalBinder.end()) {
+        auto it = mNodeForAddress.find(addrIt->second);
+        LOG_ALWAYS_FATAL_IF(it == mNodeForAddress.end() || it->second.binder != binder,
+                            "Local binder index out of sync for %" PRIu64, addrIt->second);
+        it->second.timesSent++;
+        it->second.sentRef = binder; // might already be set
+        *outAddress = addrIt->second;
+        return OK;
     }
-    LOG_ALWAYS_FATAL_IF(isRpc, "RPC binder must have known address at this point");
 
     bool forServer = session->server() != nullptr;
 
@@ -129,6 +139,7 @@ status_t RpcState::onBinderLeaving(const sp<RpcSession>& session, const sp<IBind
                                                                 .timesSent = 1,
                                                         }});
         if (inserted) {
+            mAddressForLocalBinder[binder.get()] = it->first;
             *outAddress = it->first;
             return OK;
         }
@@ -255,6 +266,7 @@ void RpcState::clear() {
     }
 
     mNodeForAddress.clear();
+    mAddressForLocalBinder.clear();
 
     _l.unlock();
     tempHoldBinder.clear(); // explicit
@@ -300,7 +312,6 @@ RpcState::CommandData::CommandData(size_t size) : mSize(size) {
     // transaction (in some cases, additional fixed size amounts are added),
     // though for rough consistency, we should avoid cases where this data type
     // is used for multiple dynamic allocations for a single transaction.
-    constexpr size_t kMaxTransactionAllocation = 100 * 1000;
     if (size == 0) return;
     if (size > kMaxTransactionAllocation) {
         ALOGW("Transaction requested too much data allocation %zu", size);
@@ -448,6 +459,15 @@ status_t RpcState::getSessionId(const sp<RpcSession::RpcConnection>& connection,
 status_t RpcState::transact(const sp<RpcSession::RpcConnection>& connection,
                             const sp<IBinder>& binder, uint32_t code, const Parcel& data,
                             const sp<RpcSession>& session, Parcel* reply, uint32_t flags) {
+    if (status_t status = validateTransact(binder, code, data); status != OK) return status;
+
+    uint64_t address;
+    if (status_t status = onBinderLeaving(session, binder, &address); status != OK) return status;
+
+    return transactAddress(connection, address, code, data, session, reply, flags);
+}
+
+status_t RpcState::validateTransact(const sp<IBinder>& binder, uint32_t code, const Parcel& data) {
     if (!data.isForRpc()) {
         ALOGE("Refusing to send RPC with parcel not crafted for RPC call on binder %p code "
               "%" PRIu32,
@@ -462,10 +482,50 @@ status_t RpcState::transact(const sp<RpcSession::RpcConnection>& connection,
         return BAD_TYPE;
     }
 
-    uint64_t address;
-    if (status_t status = onBinderLeaving(session, binder, &address); status != OK) return status;
+    return OK;
+}
 
-    return transactAddress(connection, address, code, data, session, reply, flags);
+status_t RpcState::takeAsyncNumber(uint64_t address, uint32_t flags, uint64_t* asyncNumber,
+                                   bool* shutdown) {
+    *asyncNumber = 0;
+    *shutdown = false;
+    if (address == 0) return OK;
+
+    std::lock_guard<std::mutex> _l(mNodeMutex);
+    if (mTerminated) return DEAD_OBJECT; // avoid fatal only, otherwise races
+    auto it = mNodeForAddress.find(address);
+    LOG_ALWAYS_FATAL_IF(it == mNodeForAddress.end(),
+                        "Sending transact on unknown address %" PRIu64, address);
+
+    if (flags & IBinder::FLAG_ONEWAY) {
+        *asyncNumber = it->second.asyncNumber;
+        if (!nodeProgressAsyncNumber(&it->second)) {
+            *shutdown = true;
+            return DEAD_OBJECT;
+        }
+    }
+    return OK;
+}
+
+status_t RpcState::drainRefsWhileSending(const sp<RpcSession::RpcConnection>& connection,
+                                         const sp<RpcSession>& session, size_t* waitUs) {
+    constexpr size_t kWaitMaxUs = 1000000;
+    constexpr size_t kWaitLogUs = 10000;
+
+    if (*waitUs > kWaitLogUs) {
+        ALOGE("Cannot send command, trying to process pending refcounts. Waiting %zuus. Too "
+              "many oneway calls?",
+              *waitUs);
+    }
+
+    if (*waitUs > 0) {
+        usleep(*waitUs);
+        *waitUs = std::min(kWaitMaxUs, *waitUs * 2);
+    } else {
+        *waitUs = 1;
+    }
+
+    return drainCommands(connection, session, CommandType::CONTROL_ONLY);
 }
 
 status_t RpcState::transactAddress(const sp<RpcSession::RpcConnection>& connection,
@@ -474,23 +534,11 @@ status_t RpcState::transactAddress(const sp<RpcSession::RpcConnection>& connecti
     LOG_ALWAYS_FATAL_IF(!data.isForRpc());
     LOG_ALWAYS_FATAL_IF(data.objectsCount() != 0);
 
-    uint64_t asyncNumber = 0;
-
-    if (address != 0) {
-        std::unique_lock<std::mutex> _l(mNodeMutex);
-        if (mTerminated) return DEAD_OBJECT; // avoid fatal only, otherwise races
-        auto it = mNodeForAddress.find(address);
-        LOG_ALWAYS_FATAL_IF(it == mNodeForAddress.end(),
-                            "Sending transact on unknown address %" PRIu64, address);
-
-        if (flags & IBinder::FLAG_ONEWAY) {
-            asyncNumber = it->second.asyncNumber;
-            if (!nodeProgressAsyncNumber(&it->second)) {
-                _l.unlock();
-                (void)session->shutdownAndWait(false);
-                return DEAD_OBJECT;
-            }
-        }
+    uint64_t asyncNumber;
+    bool shutdown;
+    if (status_t status = takeAsyncNumber(address, flags, &asyncNumber, &shutdown); status != OK) {
+        if (shutdown) (void)session->shutdownAndWait(false);
+        return status;
     }
 
     LOG_ALWAYS_FATAL_IF(std::numeric_limits<int32_t>::max() - sizeof(RpcWireHeader) -
@@ -510,28 +558,12 @@ status_t RpcState::transactAddress(const sp<RpcSession::RpcConnection>& connecti
             .asyncNumber = asyncNumber,
     };
 
-    constexpr size_t kWaitMaxUs = 1000000;
-    constexpr size_t kWaitLogUs = 10000;
-    size_t waitUs = 0;
-
     // Oneway calls have no sync point, so if many are sent before, whether this
     // is a twoway or oneway transaction, they may have filled up the socket.
     // So, make sure we drain them before polling.
+    size_t waitUs = 0;
     std::function<status_t()> drainRefs = [&] {
-        if (waitUs > kWaitLogUs) {
-            ALOGE("Cannot send command, trying to process pending refcounts. Waiting %zuus. Too "
-                  "many oneway calls?",
-                  waitUs);
-        }
-
-        if (waitUs > 0) {
-            usleep(waitUs);
-            waitUs = std::min(kWaitMaxUs, waitUs * 2);
-        } else {
-            waitUs = 1;
-        }
-
-        return drainCommands(connection, session, CommandType::CONTROL_ONLY);
+        return drainRefsWhileSending(connection, session, &waitUs);
     };
 
     iovec iovs[]{
@@ -560,13 +592,120 @@ status_t RpcState::transactAddress(const sp<RpcSession::RpcConnection>& connecti
     return waitForReply(connection, session, reply);
 }
 
-static void cleanup_reply_data(Parcel* p, const uint8_t* data, size_t dataSize,
-                               const binder_size_t* objects, size_t objectsCount) {
-    (void)p;
-    delete[] const_cast<uint8_t*>(data - offsetof(RpcWireReply, data));
-    (void)dataSize;
-    LOG_ALWAYS_FATAL_IF(objects != nullptr);
-    LOG_ALWAYS_FATAL_IF(objectsCount != 0, "%zu objects remaining", objectsCount);
+status_t RpcState::transactQueued(const sp<IBinder>& binder, uint32_t code, const Parcel& data,
+                                  const sp<RpcSession>& session, uint32_t flags) {
+    LOG_ALWAYS_FATAL_IF(!(flags & IBinder::FLAG_ONEWAY), "Only oneway transactions are queued");
+
+    if (status_t status = validateTransact(binder, code, data); status != OK) return status;
+
+    uint64_t address;
+    if (status_t status = onBinderLeaving(session, binder, &address); status != OK) return status;
+
+    LOG_ALWAYS_FATAL_IF(std::numeric_limits<int32_t>::max() - sizeof(RpcWireHeader) -
+                                        sizeof(RpcWireTransaction) <
+                                data.dataSize(),
+                        "Too much data %zu", data.dataSize());
+
+    // serialized outside of the lock, since the asyncNumber is filled in last
+    std::vector<uint8_t> buffer(sizeof(RpcWireHeader) + sizeof(RpcWireTransaction) +
+                                data.dataSize());
+    RpcWireHeader command{
+            .command = RPC_COMMAND_TRANSACT,
+            .bodySize = static_cast<uint32_t>(sizeof(RpcWireTransaction) + data.dataSize()),
+    };
+    RpcWireTransaction transaction{
+            .address = RpcWireAddress::fromRaw(address),
+            .code = code,
+            .flags = flags,
+    };
+    memcpy(buffer.data() + sizeof(RpcWireHeader) + sizeof(RpcWireTransaction), data.data(),
+           data.dataSize());
+
+    size_t maxQueued = session->mMaxQueuedOnewayTransactions;
+
+    pid_t tid = gettid();
+
+    std::unique_lock<std::mutex> _l(mOnewayQueueMutex);
+    // A full queue always has a thread writing it out, which wakes us up as it
+    // makes progress, or when it fails. That thread may itself get here if
+    // processing refcounts while it is blocked drops the last reference to a
+    // binder making a oneway call, so it can't wait on itself.
+    while (mOnewayQueue.size() >= maxQueued && mOnewayQueueDrainer != tid) {
+        if (session->mShutdownTrigger->isTriggered()) return DEAD_OBJECT;
+        mOnewayQueueCv.wait(_l);
+    }
+
+    // the asyncNumber is taken with the queue locked, so that the order of
+    // the queue matches the order which nodeProgressAsyncNumber hands out
+    bool shutdown;
+    if (status_t status = takeAsyncNumber(address, flags, &transaction.asyncNumber, &shutdown);
+        status != OK) {
+        _l.unlock();
+        if (shutdown) (void)session->shutdownAndWait(false);
+        return status;
+    }
+    memcpy(buffer.data(), &command, sizeof(RpcWireHeader));
+    memcpy(buffer.data() + sizeof(RpcWireHeader), &transaction, sizeof(RpcWireTransaction));
+    mOnewayQueue.push_back(std::move(buffer));
+
+    if (mOnewayQueueDrainer != 0) {
+        LOG_RPC_DETAIL("Queued oneway transaction on binder %p, %zu queued", binder.get(),
+                       mOnewayQueue.size());
+        return OK;
+    }
+    mOnewayQueueDrainer = tid;
+    _l.unlock();
+
+    return drainOnewayQueue(session);
+}
+
+status_t RpcState::drainOnewayQueue(const sp<RpcSession>& session) {
+    // Number of queued transactions written out by a single rpcSend.
+    constexpr size_t kMaxBatch = 64;
+
+    RpcSession::ExclusiveConnection connection;
+    status_t status = RpcSession::ExclusiveConnection::find(session,
+                                                            RpcSession::ConnectionUse::CLIENT_ASYNC,
+                                                            &connection);
+    if (status != OK) {
+        ALOGE("Could not get connection to write queued oneway transactions: %s",
+              statusToString(status).c_str());
+    }
+
+    size_t waitUs = 0;
+    std::function<status_t()> drainRefs = [&] {
+        return drainRefsWhileSending(connection.get(), session, &waitUs);
+    };
+
+    std::unique_lock<std::mutex> _l(mOnewayQueueMutex);
+    while (!mOnewayQueue.empty()) {
+        std::vector<std::vector<uint8_t>> batch;
+        while (!mOnewayQueue.empty() && batch.size() < kMaxBatch) {
+            batch.push_back(std::move(mOnewayQueue.front()));
+            mOnewayQueue.pop_front();
+        }
+        _l.unlock();
+        mOnewayQueueCv.notify_all();
+
+        // After a failure, the rest of the queue is dropped, just like the
+        // transaction which failed.
+        // TODO(b/167966510): need to undo onBinderLeaving for dropped transactions
+        if (status == OK) {
+            iovec iovs[kMaxBatch];
+            for (size_t i = 0; i < batch.size(); i++) {
+                iovs[i] = {batch[i].data(), batch[i].size()};
+            }
+            status = rpcSend(connection.get(), session, "queued oneway transactions", iovs,
+                             batch.size(), drainRefs);
+        }
+
+        _l.lock();
+    }
+    mOnewayQueueDrainer = 0;
+    _l.unlock();
+    mOnewayQueueCv.notify_all();
+
+    return status;
 }
 
 status_t RpcState::waitForReply(const sp<RpcSession::RpcConnection>& connection,
@@ -585,27 +724,53 @@ status_t RpcState::waitForReply(const sp<RpcSession::RpcConnection>& connection,
             return status;
     }
 
-    CommandData data(command.bodySize);
-    if (!data.valid()) return NO_MEMORY;
-
-    iovec iov{data.data(), command.bodySize};
-    if (status_t status = rpcRec(connection, session, "reply body", &iov, 1); status != OK)
-        return status;
-
     if (command.bodySize < sizeof(RpcWireReply)) {
         ALOGE("Expecting %zu but got %" PRId32 " bytes for RpcWireReply. Terminating!",
               sizeof(RpcWireReply), command.bodySize);
         (void)session->shutdownAndWait(false);
         return BAD_VALUE;
     }
-    RpcWireReply* rpcReply = reinterpret_cast<RpcWireReply*>(data.data());
-    if (rpcReply->status != OK) return rpcReply->status;
+    if (command.bodySize > CommandData::kMaxTransactionAllocation) {
+        ALOGW("Transaction requested too much data allocation %" PRIu32, command.bodySize);
+        return NO_MEMORY;
+    }
+    size_t replySize = command.bodySize - sizeof(RpcWireReply);
+
+    // The reply data is received directly into a buffer owned by the reply
+    // Parcel, so it doesn't need to be copied if the Parcel is reused, and
+    // small replies come from the Parcel buffer cache. writeInplace pads the
+    // data to 4 bytes, so the capacity includes that padding in order not to
+    // grow the buffer again.
+    reply->freeData();
+    reply->markForRpc(session);
+    void* replyData = nullptr;
+    if (replySize > 0) {
+        size_t paddedSize = (replySize + 3) & ~static_cast<size_t>(3);
+        if (reply->setDataCapacity(paddedSize) != OK ||
+            (replyData = reply->writeInplace(replySize)) == nullptr) {
+            return NO_MEMORY;
+        }
+    }
+
+    RpcWireReply rpcReply;
+    iovec iovs[]{
+            {&rpcReply, sizeof(RpcWireReply)},
+            {replyData, replySize},
+    };
+    if (status_t status = rpcRec(connection, session, "reply body", iovs, arraysize(iovs));
+        status != OK)
+        return status;
 
-    data.release();
-    reply->ipcSetDataReference(rpcReply->data, command.bodySize - offsetof(RpcWireReply, data),
-                               nullptr, 0, cleanup_reply_data);
+    if (rpcReply.status != OK) {
+        reply->freeData();
+        return rpcReply.status;
+    }
 
-    reply->markForRpc(session);
+    // drop the padding
+    if (reply->dataSize() != replySize) {
+        if (status_t status = reply->setDataSize(replySize); status != OK) return status;
+    }
+    reply->setDataPosition(0);
 
     return OK;
 }
@@ -1022,7 +1187,7 @@ status_t RpcState::processDecStrong(const sp<RpcSession::RpcConnection>& connect
     return OK;
 }
 
-sp<IBinder> RpcState::tryEraseNode(std::map<uint64_t, BinderNode>::iterator& it) {
+sp<IBinder> RpcState::tryEraseNode(NodeMap::iterator& it) {
     sp<IBinder> ref;
 
     if (it->second.timesSent == 0) {
@@ -1031,6 +1196,12 @@ sp<IBinder> RpcState::tryEraseNode(std::map<uint64_t, BinderNode>::iterator& it)
         if (it->second.timesRecd == 0) {
             LOG_ALWAYS_FATAL_IF(!it->second.asyncTodo.empty(),
                                 "Can't delete binder w/ pending async transactions");
+            // only local binders are indexed, and the address of a dead
+            // binder may have been reused by one sent later
+            if (auto addrIt = mAddressForLocalBinder.find(it->second.binder.unsafe_get());
+                addrIt != mAddressForLocalBinder.end() && addrIt->second == it->first) {
+                mAddressForLocalBinder.erase(addrIt);
+            }
             mNodeForAddress.erase(it);
         }
     }
@@ -20,9 +20,12 @@
 #include <binder/Parcel.h>
 #include <binder/RpcSession.h>
 
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <optional>
 #include <queue>
+#include <unordered_map>
 
 #include <sys/uio.h>
 
@@ -86,6 +89,17 @@ public:
                                            const sp<RpcSession>& session, Parcel* reply,
                                            uint32_t flags);
 
+    /**
+     * Oneway transaction when pipelining is enabled, see
+     * RpcSession::setMaxQueuedOnewayTransactions. The transaction is appended
+     * to this session's oneway queue (blocking while it is full), and if no
+     * other thread is writing out the queue, this thread takes a connection
+     * and does so. Errors writing the queue are only returned to that thread.
+     */
+    [[nodiscard]] status_t transactQueued(const sp<IBinder>& address, uint32_t code,
+                                          const Parcel& data, const sp<RpcSession>& session,
+                                          uint32_t flags);
+
     /**
      * The ownership model here carries an implicit strong refcount whenever a
      * binder is sent across processes. Since we have a local strong count in
@@ -167,6 +181,9 @@ private:
     // Alternative to std::vector<uint8_t> that doesn't abort on allocation failure and caps
     // large allocations to avoid being requested from allocating too much data.
     struct CommandData {
+        // Largest allocation made on behalf of a remote transaction, see constructor.
+        static constexpr size_t kMaxTransactionAllocation = 100 * 1000;
+
         explicit CommandData(size_t size);
         bool valid() { return mSize == 0 || mData != nullptr; }
         size_t size() { return mSize; }
@@ -185,6 +202,19 @@ private:
                                   const sp<RpcSession>& session, const char* what, iovec* iovs,
                                   int niovs);
 
+    [[nodiscard]] status_t validateTransact(const sp<IBinder>& binder, uint32_t code,
+                                            const Parcel& data);
+    // if needed, takes the next asyncNumber of the node at address. If this
+    // fails with shutdown set, the caller must shut down the session once it
+    // no longer holds any locks.
+    [[nodiscard]] status_t takeAsyncNumber(uint64_t address, uint32_t flags,
+                                           uint64_t* asyncNumber, bool* shutdown);
+    // used as the altPoll of rpcSend, to process incoming refcounts while
+    // the socket is full. waitUs is the backoff state, initially 0.
+    [[nodiscard]] status_t drainRefsWhileSending(const sp<RpcSession::RpcConnection>& connection,
+                                                 const sp<RpcSession>& session, size_t* waitUs);
+    [[nodiscard]] status_t drainOnewayQueue(const sp<RpcSession>& session);
+
     [[nodiscard]] status_t waitForReply(const sp<RpcSession::RpcConnection>& connection,
                                         const sp<RpcSession>& session, Parcel* reply);
     [[nodiscard]] status_t processCommand(const sp<RpcSession::RpcConnection>& connection,
@@ -248,11 +278,13 @@ private:
         // (no additional data specific to remote binders)
     };
 
+    using NodeMap = std::unordered_map<uint64_t, BinderNode>;
+
     // checks if there is any reference left to a node and erases it. If erase
     // happens, and there is a strong reference to the binder kept by
     // binderNode, this returns that strong reference, so that it can be
     // dropped after any locks are removed.
-    sp<IBinder> tryEraseNode(std::map<uint64_t, BinderNode>::iterator& it);
+    sp<IBinder> tryEraseNode(NodeMap::iterator& it);
     // true - success
     // false - session shutdown, halt
     [[nodiscard]] bool nodeProgressAsyncNumber(BinderNode* node);
@@ -261,7 +293,19 @@ private:
     bool mTerminated = false;
     uint32_t mNextId = 0;
     // binders known by both sides of a session
-    std::map<uint64_t, BinderNode> mNodeForAddress;
+    NodeMap mNodeForAddress;
+    // reverse index of mNodeForAddress for local binders, since their address
+    // isn't stored in the binder itself (unlike RPC proxies)
+    std::unordered_map<IBinder*, uint64_t> mAddressForLocalBinder;
+
+    // Oneway transactions waiting to be written, each already serialized
+    // (header, RpcWireTransaction and data). Entries are appended in
+    // asyncNumber order, so mOnewayQueueMutex is taken before mNodeMutex.
+    std::mutex mOnewayQueueMutex;
+    std::condition_variable mOnewayQueueCv;
+    std::deque<std::vector<uint8_t>> mOnewayQueue;
+    // thread writing out mOnewayQueue, or 0
+    pid_t mOnewayQueueDrainer = 0;
 };
 
 } // namespace android
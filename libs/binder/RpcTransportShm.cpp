@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RpcShmTransport"
+#include <log/log.h>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/memfd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include <binder/RpcTransportShm.h>
+
+#include "FdTrigger.h"
+#include "RpcState.h"
+
+namespace android {
+
+namespace {
+
+// Must be a power of two, so that the free running indices wrap around
+// consistently.
+constexpr uint32_t kRingSize = 64 * 1024;
+static_assert((kRingSize & (kRingSize - 1)) == 0);
+
+// Single producer, single consumer byte ring. The indices count all bytes
+// ever written/read, and each is only written by one side. Both sides keep
+// their own index locally, and only read the index of the peer from here,
+// since the peer is not trusted.
+struct ShmRing {
+    // written by the producer
+    alignas(64) std::atomic<uint32_t> head;
+    // set by the producer before waiting for space, cleared by whoever wakes it
+    std::atomic<uint32_t> writerWaiting;
+
+    // written by the consumer
+    alignas(64) std::atomic<uint32_t> tail;
+    // set by the consumer before waiting for data, cleared by whoever wakes it
+    std::atomic<uint32_t> readerWaiting;
+
+    alignas(64) uint8_t data[kRingSize];
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared across processes");
+
+struct ShmRegion {
+    ShmRing clientToServer;
+    ShmRing serverToClient;
+};
+
+int memfdCreate(const char* name, unsigned int flags) {
+#ifdef __BIONIC__
+    return memfd_create(name, flags);
+#else
+    // not declared by older host libcs
+    return syscall(__NR_memfd_create, name, flags);
+#endif
+}
+
+ShmRegion* mapRegion(base::borrowed_fd memfd) {
+    void* addr = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED,
+                      memfd.get(), 0);
+    if (addr == MAP_FAILED) {
+        ALOGE("Could not map shared memory ring: %s", strerror(errno));
+        return nullptr;
+    }
+    return reinterpret_cast<ShmRegion*>(addr);
+}
+
+// RpcTransport which exchanges data through shared memory.
+class RpcTransportShm : public RpcTransport {
+public:
+    RpcTransportShm(android::base::unique_fd socket, ShmRegion* region, bool isServer)
+          : mSocket(std::move(socket)),
+            mRegion(region),
+            mTx(isServer ? &region->serverToClient : &region->clientToServer),
+            mRx(isServer ? &region->clientToServer : &region->serverToClient) {}
+    ~RpcTransportShm() { munmap(mRegion, sizeof(ShmRegion)); }
+
+    status_t peek(void* buf, size_t size, size_t* out_size) override {
+        uint32_t available;
+        if (status_t status = rxAvailable(&available); status != OK) return status;
+
+        if (available == 0) {
+            // The caller may wait for the socket to become readable (e.g. in
+            // an event loop), so ask the peer to wake us up when it writes.
+            status_t drainStatus = drainWakeups();
+            if (drainStatus != OK && drainStatus != DEAD_OBJECT) return drainStatus;
+
+            mRx->readerWaiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (status_t status = rxAvailable(&available); status != OK) return status;
+
+            if (available == 0) {
+                if (drainStatus == DEAD_OBJECT) {
+                    // same as recv(2) when the peer has shut down
+                    *out_size = 0;
+                    return OK;
+                }
+                return WOULD_BLOCK;
+            }
+            mRx->readerWaiting.store(0, std::memory_order_relaxed);
+        }
+
+        size_t todo = std::min<size_t>(size, available);
+        copyFromRing(static_cast<uint8_t*>(buf), todo);
+        *out_size = todo;
+        return OK;
+    }
+
+    status_t interruptableWriteFully(FdTrigger* fdTrigger, iovec* iovs, int niovs,
+                                     const std::function<status_t()>& altPoll) override {
+        MAYBE_WAIT_IN_FLAKE_MODE;
+
+        if (niovs < 0) return BAD_VALUE;
+        if (fdTrigger->isTriggered()) return DEAD_OBJECT;
+
+        for (int i = 0; i < niovs; i++) {
+            const uint8_t* buffer = reinterpret_cast<const uint8_t*>(iovs[i].iov_base);
+            size_t size = iovs[i].iov_len;
+            while (size > 0) {
+                uint32_t space;
+                if (status_t status = txSpace(&space); status != OK) return status;
+
+                if (space == 0) {
+                    if (status_t status = wait(fdTrigger, &mTx->writerWaiting,
+                                               [&] {
+                                                   uint32_t space;
+                                                   return txSpace(&space) != OK || space > 0;
+                                               },
+                                               altPoll);
+                        status != OK) {
+                        return status;
+                    }
+                    continue;
+                }
+
+                size_t todo = std::min<size_t>(size, space);
+                copyToRing(buffer, todo);
+                mTxHead += todo;
+                mTx->head.store(mTxHead, std::memory_order_release);
+                wake(&mTx->readerWaiting);
+
+                buffer += todo;
+                size -= todo;
+            }
+        }
+        return OK;
+    }
+
+    status_t interruptableReadFully(FdTrigger* fdTrigger, iovec* iovs, int niovs,
+                                    const std::function<status_t()>& altPoll) override {
+        MAYBE_WAIT_IN_FLAKE_MODE;
+
+        if (niovs < 0) return BAD_VALUE;
+        if (fdTrigger->isTriggered()) return DEAD_OBJECT;
+
+        for (int i = 0; i < niovs; i++) {
+            uint8_t* buffer = reinterpret_cast<uint8_t*>(iovs[i].iov_base);
+            size_t size = iovs[i].iov_len;
+            while (size > 0) {
+                uint32_t available;
+                if (status_t status = rxAvailable(&available); status != OK) return status;
+
+                if (available == 0) {
+                    if (status_t status = wait(fdTrigger, &mRx->readerWaiting,
+                                               [&] {
+                                                   uint32_t available;
+                                                   return rxAvailable(&available) != OK ||
+                                                           available > 0;
+                                               },
+                                               altPoll);
+                        status != OK) {
+                        return status;
+                    }
+                    continue;
+                }
+
+                size_t todo = std::min<size_t>(size, available);
+                copyFromRing(buffer, todo);
+                mRxTail += todo;
+                mRx->tail.store(mRxTail, std::memory_order_release);
+                wake(&mRx->writerWaiting);
+
+                buffer += todo;
+                size -= todo;
+            }
+        }
+        return OK;
+    }
+
+private:
+    status_t rxAvailable(uint32_t* available) {
+        *available = mRx->head.load(std::memory_order_acquire) - mRxTail;
+        if (*available > kRingSize) {
+            ALOGE("Peer corrupted shared memory ring (%" PRIu32 " bytes available)", *available);
+            return BAD_VALUE;
+        }
+        return OK;
+    }
+
+    status_t txSpace(uint32_t* space) {
+        uint32_t used = mTxHead - mTx->tail.load(std::memory_order_acquire);
+        if (used > kRingSize) {
+            ALOGE("Peer corrupted shared memory ring (%" PRIu32 " bytes used)", used);
+            return BAD_VALUE;
+        }
+        *space = kRingSize - used;
+        return OK;
+    }
+
+    void copyToRing(const uint8_t* buffer, size_t size) {
+        size_t offset = mTxHead & (kRingSize - 1);
+        size_t first = std::min<size_t>(size, kRingSize - offset);
+        memcpy(mTx->data + offset, buffer, first);
+        memcpy(mTx->data, buffer + first, size - first);
+    }
+
+    void copyFromRing(uint8_t* buffer, size_t size) {
+        size_t offset = mRxTail & (kRingSize - 1);
+        size_t first = std::min<size_t>(size, kRingSize - offset);
+        memcpy(buffer, mRx->data + offset, first);
+        memcpy(buffer + first, mRx->data, size - first);
+    }
+
+    // Wait until 'ready' returns true, or the peer may have changed the ring.
+    status_t wait(FdTrigger* fdTrigger, std::atomic<uint32_t>* waiting,
+                  const std::function<bool()>& ready, const std::function<status_t()>& altPoll) {
+        if (altPoll) {
+            if (status_t status = altPoll(); status != OK) return status;
+            if (fdTrigger->isTriggered()) return DEAD_OBJECT;
+            return OK;
+        }
+
+        // Either the peer sees this after it updates the ring, and wakes us
+        // up, or we see its update here.
+        waiting->store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ready()) {
+            waiting->store(0, std::memory_order_relaxed);
+            return OK;
+        }
+
+        status_t status = fdTrigger->triggerablePoll(mSocket, POLLIN);
+        waiting->store(0, std::memory_order_relaxed);
+        if (status != OK) return status;
+
+        status = drainWakeups();
+        // the peer may have written data right before shutting down
+        if (status == DEAD_OBJECT && ready()) return OK;
+        return status;
+    }
+
+    void wake(std::atomic<uint32_t>* waiting) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting->load(std::memory_order_relaxed) == 0) return;
+        if (waiting->exchange(0) == 0) return;
+
+        uint8_t wakeup = 0;
+        // If this fails, the peer is gone, or it already has wakeups queued.
+        (void)TEMP_FAILURE_RETRY(
+                send(mSocket.get(), &wakeup, sizeof(wakeup), MSG_DONTWAIT | MSG_NOSIGNAL));
+    }
+
+    // Consume queued wakeups. Returns DEAD_OBJECT if the peer has shut down.
+    status_t drainWakeups() {
+        uint8_t buf[64];
+        while (true) {
+            ssize_t ret = TEMP_FAILURE_RETRY(recv(mSocket.get(), buf, sizeof(buf), MSG_DONTWAIT));
+            if (ret == 0) return DEAD_OBJECT;
+            if (ret < 0) {
+                int savedErrno = errno;
+                if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK) return OK;
+                LOG_RPC_DETAIL("RpcTransport recv(): %s", strerror(savedErrno));
+                return -savedErrno;
+            }
+        }
+    }
+
+    base::unique_fd mSocket;
+    ShmRegion* const mRegion;
+    ShmRing* const mTx;
+    ShmRing* const mRx;
+    uint32_t mTxHead = 0;
+    uint32_t mRxTail = 0;
+};
+
+// The client creates the shared memory and passes it to the server with a
+// single byte of data.
+status_t sendRegion(FdTrigger* fdTrigger, base::borrowed_fd socket, base::borrowed_fd memfd) {
+    uint8_t byte = 0;
+    iovec iov{&byte, sizeof(byte)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+    };
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int fd = memfd.get();
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+    while (true) {
+        ssize_t ret = TEMP_FAILURE_RETRY(sendmsg(socket.get(), &msg, MSG_NOSIGNAL));
+        if (ret == sizeof(byte)) return OK;
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            int savedErrno = errno;
+            ALOGE("Could not send shared memory ring: %s", strerror(savedErrno));
+            return -savedErrno;
+        }
+        if (status_t status = fdTrigger->triggerablePoll(socket, POLLOUT); status != OK) {
+            return status;
+        }
+    }
+}
+
+status_t receiveRegion(FdTrigger* fdTrigger, base::borrowed_fd socket, base::unique_fd* memfd) {
+    uint8_t byte;
+    iovec iov{&byte, sizeof(byte)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+    };
+
+    while (true) {
+        ssize_t ret = TEMP_FAILURE_RETRY(recvmsg(socket.get(), &msg, MSG_CMSG_CLOEXEC));
+        if (ret == 0) return DEAD_OBJECT;
+        if (ret > 0) break;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            int savedErrno = errno;
+            ALOGE("Could not receive shared memory ring: %s", strerror(savedErrno));
+            return -savedErrno;
+        }
+        if (status_t status = fdTrigger->triggerablePoll(socket, POLLIN); status != OK) {
+            return status;
+        }
+    }
+
+    // take ownership of everything first, so nothing leaks if it's malformed
+    std::vector<base::unique_fd> fds;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            fds.emplace_back(fd);
+        }
+    }
+    if ((msg.msg_flags & MSG_CTRUNC) || fds.size() != 1) {
+        ALOGE("Expecting a shared memory ring from the client, but got %zu FDs", fds.size());
+        return BAD_VALUE;
+    }
+
+    struct stat st;
+    if (0 != fstat(fds[0].get(), &st)) {
+        int savedErrno = errno;
+        ALOGE("Could not stat shared memory ring: %s", strerror(savedErrno));
+        return -savedErrno;
+    }
+    if (static_cast<size_t>(st.st_size) != sizeof(ShmRegion)) {
+        ALOGE("Shared memory ring has size %jd but expecting %zu", static_cast<intmax_t>(st.st_size),
+              sizeof(ShmRegion));
+        return BAD_VALUE;
+    }
+#ifdef F_GET_SEALS
+    // otherwise, the client could truncate it while it's mapped
+    constexpr int kRequiredSeals = F_SEAL_SHRINK | F_SEAL_SEAL;
+    int seals = fcntl(fds[0].get(), F_GET_SEALS);
+    if (seals < 0 || (seals & kRequiredSeals) != kRequiredSeals) {
+        ALOGE("Shared memory ring must be sealed, but has seals %d", seals);
+        return BAD_VALUE;
+    }
+#endif
+
+    *memfd = std::move(fds[0]);
+    return OK;
+}
+
+// RpcTransportCtx which sets up shared memory for each connection.
+class RpcTransportCtxShm : public RpcTransportCtx {
+public:
+    explicit RpcTransportCtxShm(bool isServer) : mIsServer(isServer) {}
+
+    std::unique_ptr<RpcTransport> newTransport(android::base::unique_fd fd,
+                                               FdTrigger* fdTrigger) const override {
+        base::unique_fd memfd;
+        if (mIsServer) {
+            if (status_t status = receiveRegion(fdTrigger, fd, &memfd); status != OK) {
+                return nullptr;
+            }
+        } else {
+            memfd.reset(memfdCreate("RpcTransportShm", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+            if (!memfd.ok()) {
+                ALOGE("Could not create shared memory ring: %s", strerror(errno));
+                return nullptr;
+            }
+            if (0 != ftruncate(memfd.get(), sizeof(ShmRegion))) {
+                ALOGE("Could not size shared memory ring: %s", strerror(errno));
+                return nullptr;
+            }
+#ifdef F_ADD_SEALS
+            if (0 != fcntl(memfd.get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+                ALOGE("Could not seal shared memory ring: %s", strerror(errno));
+                return nullptr;
+            }
+#endif
+            if (status_t status = sendRegion(fdTrigger, fd, memfd); status != OK) {
+                return nullptr;
+            }
+        }
+
+        // new memfds are zeroed, which is the initial state of both rings
+        ShmRegion* region = mapRegion(memfd);
+        if (region == nullptr) return nullptr;
+        return std::make_unique<RpcTransportShm>(std::move(fd), region, mIsServer);
+    }
+    std::vector<uint8_t> getCertificate(RpcCertificateFormat) const override { return {}; }
+
+private:
+    const bool mIsServer;
+};
+
+} // namespace
+
+std::unique_ptr<RpcTransportCtx> RpcTransportCtxFactoryShm::newServerCtx() const {
+    return std::make_unique<RpcTransportCtxShm>(true /*isServer*/);
+}
+
+std::unique_ptr<RpcTransportCtx> RpcTransportCtxFactoryShm::newClientCtx() const {
+    return std::make_unique<RpcTransportCtxShm>(false /*isServer*/);
+}
+
+const char* RpcTransportCtxFactoryShm::toCString() const {
+    return "shm";
+}
+
+std::unique_ptr<RpcTransportCtxFactory> RpcTransportCtxFactoryShm::make() {
+    return std::unique_ptr<RpcTransportCtxFactoryShm>(new RpcTransportCtxFactoryShm());
+}
+
+} // namespace android
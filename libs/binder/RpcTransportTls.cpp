@@ -19,6 +19,8 @@
 
 #include <poll.h>
 
+#include <mutex>
+
 #include <openssl/bn.h>
 #include <openssl/ssl.h>
 
@@ -284,8 +286,15 @@ public:
                                     const std::function<status_t()>& altPoll) override;
 
 private:
+    status_t writeFully(FdTrigger* fdTrigger, const uint8_t* buffer, size_t size,
+                        const std::function<status_t()>& altPoll);
+
     android::base::unique_fd mSocket;
     Ssl mSsl;
+
+    // Small iovecs are copied here, so that they are sent as one TLS record
+    // instead of one record each.
+    std::vector<uint8_t> mWriteBuffer;
 };
 
 // Error code is errno.
@@ -318,38 +327,79 @@ status_t RpcTransportTls::interruptableWriteFully(FdTrigger* fdTrigger, iovec* i
     // once. The trigger is also checked via triggerablePoll() after every SSL_write().
     if (fdTrigger->isTriggered()) return DEAD_OBJECT;
 
+    // Every SSL_write() ends at least one TLS record, each of which has its own
+    // header, MAC and padding. So, rather than writing a command header and its
+    // body separately, iovecs are copied into a buffer of one record's size,
+    // and only data which would fill whole records by itself is written in
+    // place.
+    constexpr size_t kMaxRecord = SSL3_RT_MAX_PLAIN_LENGTH;
+    mWriteBuffer.clear();
+    mWriteBuffer.reserve(kMaxRecord);
+
     size_t size = 0;
     for (int i = 0; i < niovs; i++) {
         const iovec& iov = iovs[i];
-        if (iov.iov_len == 0) {
-            continue;
-        }
         size += iov.iov_len;
 
         auto buffer = reinterpret_cast<const uint8_t*>(iov.iov_base);
         const uint8_t* end = buffer + iov.iov_len;
         while (buffer < end) {
-            size_t todo = std::min<size_t>(end - buffer, std::numeric_limits<int>::max());
-            auto [writeSize, errorQueue] = mSsl.call(SSL_write, buffer, todo);
-            if (writeSize > 0) {
-                buffer += writeSize;
-                errorQueue.clear();
-                continue;
+            if (mWriteBuffer.empty() && static_cast<size_t>(end - buffer) >= kMaxRecord) {
+                if (status_t status = writeFully(fdTrigger, buffer, end - buffer, altPoll);
+                    status != OK) {
+                    return status;
+                }
+                break;
             }
-            // SSL_write() should never return 0 unless BIO_write were to return 0.
-            int sslError = mSsl.getError(writeSize);
-            // TODO(b/195788248): BIO should contain the FdTrigger, and send(2) / recv(2) should be
-            //   triggerablePoll()-ed. Then additionalEvent is no longer necessary.
-            status_t pollStatus = errorQueue.pollForSslError(mSocket.get(), sslError, fdTrigger,
-                                                             "SSL_write", POLLIN, altPoll);
-            if (pollStatus != OK) return pollStatus;
-            // Do not advance buffer. Try SSL_write() again.
+
+            size_t todo = std::min<size_t>(end - buffer, kMaxRecord - mWriteBuffer.size());
+            mWriteBuffer.insert(mWriteBuffer.end(), buffer, buffer + todo);
+            buffer += todo;
+
+            if (mWriteBuffer.size() == kMaxRecord) {
+                if (status_t status =
+                            writeFully(fdTrigger, mWriteBuffer.data(), mWriteBuffer.size(), altPoll);
+                    status != OK) {
+                    return status;
+                }
+                mWriteBuffer.clear();
+            }
+        }
+    }
+    if (!mWriteBuffer.empty()) {
+        if (status_t status =
+                    writeFully(fdTrigger, mWriteBuffer.data(), mWriteBuffer.size(), altPoll);
+            status != OK) {
+            return status;
         }
     }
     LOG_TLS_DETAIL("TLS: Sent %zu bytes!", size);
     return OK;
 }
 
+status_t RpcTransportTls::writeFully(FdTrigger* fdTrigger, const uint8_t* buffer, size_t size,
+                                     const std::function<status_t()>& altPoll) {
+    const uint8_t* end = buffer + size;
+    while (buffer < end) {
+        size_t todo = std::min<size_t>(end - buffer, std::numeric_limits<int>::max());
+        auto [writeSize, errorQueue] = mSsl.call(SSL_write, buffer, todo);
+        if (writeSize > 0) {
+            buffer += writeSize;
+            errorQueue.clear();
+            continue;
+        }
+        // SSL_write() should never return 0 unless BIO_write were to return 0.
+        int sslError = mSsl.getError(writeSize);
+        // TODO(b/195788248): BIO should contain the FdTrigger, and send(2) / recv(2) should be
+        //   triggerablePoll()-ed. Then additionalEvent is no longer necessary.
+        status_t pollStatus = errorQueue.pollForSslError(mSocket.get(), sslError, fdTrigger,
+                                                         "SSL_write", POLLIN, altPoll);
+        if (pollStatus != OK) return pollStatus;
+        // Do not advance buffer. Try SSL_write() again.
+    }
+    return OK;
+}
+
 status_t RpcTransportTls::interruptableReadFully(FdTrigger* fdTrigger, iovec* iovs, int niovs,
                                                  const std::function<status_t()>& altPoll) {
     MAYBE_WAIT_IN_FLAKE_MODE;
@@ -434,6 +484,8 @@ public:
 
 protected:
     static ssl_verify_result_t sslCustomVerify(SSL* ssl, uint8_t* outAlert);
+    static RpcTransportCtxTls* fromSslCtx(const SSL_CTX* ctx);
+    virtual void configureCtx(SSL_CTX*) {}
     virtual void preHandshake(Ssl* ssl) const = 0;
     bssl::UniquePtr<SSL_CTX> mCtx;
     std::shared_ptr<RpcCertificateVerifier> mCertVerifier;
@@ -450,11 +502,7 @@ ssl_verify_result_t RpcTransportCtxTls::sslCustomVerify(SSL* ssl, uint8_t* outAl
     LOG_ALWAYS_FATAL_IF(outAlert == nullptr);
     const char* logPrefix = SSL_is_server(ssl) ? "Server" : "Client";
 
-    auto ctx = SSL_get_SSL_CTX(ssl); // Does not set error queue
-    LOG_ALWAYS_FATAL_IF(ctx == nullptr);
-    // void* -> RpcTransportCtxTls*
-    auto rpcTransportCtxTls = reinterpret_cast<RpcTransportCtxTls*>(SSL_CTX_get_app_data(ctx));
-    LOG_ALWAYS_FATAL_IF(rpcTransportCtxTls == nullptr);
+    auto rpcTransportCtxTls = fromSslCtx(SSL_get_SSL_CTX(ssl)); // Does not set error queue
 
     status_t verifyStatus = rpcTransportCtxTls->mCertVerifier->verify(ssl, outAlert);
     if (verifyStatus == OK) {
@@ -465,6 +513,14 @@ ssl_verify_result_t RpcTransportCtxTls::sslCustomVerify(SSL* ssl, uint8_t* outAl
     return ssl_verify_invalid;
 }
 
+RpcTransportCtxTls* RpcTransportCtxTls::fromSslCtx(const SSL_CTX* ctx) {
+    LOG_ALWAYS_FATAL_IF(ctx == nullptr);
+    // void* -> RpcTransportCtxTls*
+    auto rpcTransportCtxTls = reinterpret_cast<RpcTransportCtxTls*>(SSL_CTX_get_app_data(ctx));
+    LOG_ALWAYS_FATAL_IF(rpcTransportCtxTls == nullptr);
+    return rpcTransportCtxTls;
+}
+
 // Common implementation for creating server and client contexts. The child class, |Impl|, is
 // provided as a template argument so that this function can initialize an |Impl| object.
 template <typename Impl, typename>
@@ -483,6 +539,9 @@ std::unique_ptr<RpcTransportCtxTls> RpcTransportCtxTls::create(
     // Client ignores SSL_VERIFY_FAIL_IF_NO_PEER_CERT flag.
     SSL_CTX_set_custom_verify(ctx.get(), SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
                               sslCustomVerify);
+    // Resumed sessions carry the peer's certificate. Ask the verifier about it
+    // again, so that a peer it no longer trusts can't resume its way back in.
+    SSL_CTX_set_reverify_on_resume(ctx.get(), 1);
 
     // Require at least TLS 1.3
     TEST_AND_RETURN(nullptr, SSL_CTX_set_min_proto_version(ctx.get(), TLS1_3_VERSION));
@@ -494,6 +553,7 @@ std::unique_ptr<RpcTransportCtxTls> RpcTransportCtxTls::create(
     auto ret = std::make_unique<Impl>();
     // RpcTransportCtxTls* -> void*
     TEST_AND_RETURN(nullptr, SSL_CTX_set_app_data(ctx.get(), reinterpret_cast<void*>(ret.get())));
+    ret->configureCtx(ctx.get());
     ret->mCtx = std::move(ctx);
     ret->mCertVerifier = std::move(verifier);
     return ret;
@@ -510,6 +570,9 @@ std::unique_ptr<RpcTransport> RpcTransportCtxTls::newTransport(android::base::un
     return std::make_unique<RpcTransportTls>(std::move(fd), std::move(wrapped));
 }
 
+// The server issues session tickets (BoringSSL does by default for TLS 1.3),
+// so that further connections to the same session can be resumed, see
+// RpcTransportCtxTlsClient.
 class RpcTransportCtxTlsServer : public RpcTransportCtxTls {
 protected:
     void preHandshake(Ssl* ssl) const override {
@@ -517,11 +580,45 @@ protected:
     }
 };
 
+// A client context belongs to a single RpcSession. The latest session ticket
+// it receives is used to resume the TLS session for every further connection
+// to the server, so only the first connection does a full handshake. The
+// verifier still checks the server's certificate on every connection, see
+// SSL_CTX_set_reverify_on_resume() in create().
 class RpcTransportCtxTlsClient : public RpcTransportCtxTls {
 protected:
+    void configureCtx(SSL_CTX* ctx) override {
+        // The internal cache is keyed by session ID, which tickets don't use.
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+        SSL_CTX_sess_set_new_cb(ctx, onNewSession);
+    }
+
     void preHandshake(Ssl* ssl) const override {
         ssl->call(SSL_set_connect_state).errorQueue.clear();
+
+        std::lock_guard<std::mutex> _l(mSessionMutex);
+        if (mSession == nullptr) return;
+        auto [ret, errorQueue] = ssl->call(SSL_set_session, mSession.get());
+        if (ret != 1) {
+            // Only costs a full handshake.
+            ALOGW("SSL_set_session(): %s", errorQueue.toString().c_str());
+            return;
+        }
+        errorQueue.clear();
     }
+
+private:
+    static int onNewSession(SSL* ssl, SSL_SESSION* session) {
+        auto client = static_cast<RpcTransportCtxTlsClient*>(fromSslCtx(SSL_get_SSL_CTX(ssl)));
+        LOG_TLS_DETAIL("Client: new session ticket (resumed: %d)", SSL_session_reused(ssl));
+
+        std::lock_guard<std::mutex> _l(client->mSessionMutex);
+        client->mSession.reset(session);
+        return 1; // takes ownership of session
+    }
+
+    mutable std::mutex mSessionMutex;
+    bssl::UniquePtr<SSL_SESSION> mSession;
 };
 
 } // namespace
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "TransactionStats"
+
+#include <binder/TransactionStats.h>
+
+#include <utils/String8.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace android {
+
+namespace {
+
+// Power of two, so that probing can wrap with a mask. The slots are only
+// allocated once recording is first enabled.
+constexpr size_t kNumSlots = 512;
+
+struct Slot {
+    // Hash of the pair, or 0 while the slot is free. Pairs with the same hash
+    // take different slots.
+    std::atomic<uint64_t> key;
+    // Set once the fields below the key have been written.
+    std::atomic<bool> ready;
+    uint32_t code;
+    TransactionStats::Direction direction;
+    // At most kMaxDescriptorLength characters.
+    std::u16string descriptor;
+
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalLatencyNs;
+    std::atomic<uint64_t> totalBytes;
+    std::atomic<uint64_t> latencyBuckets[TransactionStats::kNumBuckets];
+    std::atomic<uint64_t> sizeBuckets[TransactionStats::kNumBuckets];
+};
+
+std::once_flag gSlotsOnce;
+// null until recording is first enabled, never freed after
+std::atomic<Slot*> gSlots;
+std::atomic<uint64_t> gDropped;
+std::atomic<bool> gEnabled;
+
+uint64_t hashPair(TransactionStats::Direction direction, std::u16string_view descriptor,
+                  uint32_t code) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&](uint64_t value) {
+        hash ^= value;
+        hash *= 0x100000001b3ULL;
+    };
+    for (char16_t c : descriptor) mix(c);
+    mix(code);
+    mix(static_cast<uint64_t>(direction) + 1);
+    return hash == 0 ? 1 : hash;
+}
+
+// Returns null if every slot is taken by other pairs, or if this pair's slot
+// is still being written by another thread.
+Slot* findSlot(Slot* slots, TransactionStats::Direction direction,
+               std::u16string_view descriptor, uint32_t code) {
+    // The descriptor of an incoming call comes from the caller, so only so
+    // much of it is kept.
+    descriptor = descriptor.substr(0, TransactionStats::kMaxDescriptorLength);
+    const uint64_t key = hashPair(direction, descriptor, code);
+    for (size_t probe = 0; probe < kNumSlots; probe++) {
+        Slot& slot = slots[(key + probe) & (kNumSlots - 1)];
+        uint64_t current = slot.key.load(std::memory_order_acquire);
+        if (current == 0 && slot.key.compare_exchange_strong(current, key,
+                                                             std::memory_order_acq_rel)) {
+            slot.code = code;
+            slot.direction = direction;
+            slot.descriptor = descriptor;
+            slot.ready.store(true, std::memory_order_release);
+            return &slot;
+        }
+        if (current != key) continue;
+
+        // Claimed for this hash, but maybe not written yet. Rather than wait
+        // for the other thread, drop this sample.
+        if (!slot.ready.load(std::memory_order_acquire)) return nullptr;
+        if (slot.code == code && slot.direction == direction && slot.descriptor == descriptor) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+size_t bucketFor(uint64_t value) {
+    if (value < 2) return 0;
+    size_t log2 = 63 - __builtin_clzll(value);
+    return std::min(log2, TransactionStats::kNumBuckets - 1);
+}
+
+void dumpBuckets(int fd, const char* label,
+                 const std::array<uint64_t, TransactionStats::kNumBuckets>& buckets) {
+    dprintf(fd, "    %s:", label);
+    for (size_t i = 0; i < buckets.size(); i++) {
+        if (buckets[i] == 0) continue;
+        dprintf(fd, " %" PRIu64 "+:%" PRIu64, i == 0 ? 0 : uint64_t(1) << i, buckets[i]);
+    }
+    dprintf(fd, "\n");
+}
+
+} // namespace
+
+bool TransactionStats::isEnabled() {
+    return gEnabled.load(std::memory_order_relaxed);
+}
+
+void TransactionStats::setEnabled(bool enabled) {
+    if (enabled) {
+        std::call_once(gSlotsOnce,
+                       [] { gSlots.store(new Slot[kNumSlots](), std::memory_order_release); });
+    }
+    gEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void TransactionStats::record(Direction direction, std::u16string_view descriptor, uint32_t code,
+                              nsecs_t latencyNs, size_t bytes) {
+    Slot* slots = gSlots.load(std::memory_order_acquire);
+    // only called after isEnabled(), but it may have just been enabled
+    if (slots == nullptr) return;
+    Slot* slot = findSlot(slots, direction, descriptor, code);
+    if (slot == nullptr) {
+        gDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t latency = latencyNs > 0 ? static_cast<uint64_t>(latencyNs) : 0;
+    slot->count.fetch_add(1, std::memory_order_relaxed);
+    slot->totalLatencyNs.fetch_add(latency, std::memory_order_relaxed);
+    slot->totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+    slot->latencyBuckets[bucketFor(latency / 1000)].fetch_add(1, std::memory_order_relaxed);
+    slot->sizeBuckets[bucketFor(bytes)].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<TransactionStats::Entry> TransactionStats::getEntries() {
+    std::vector<Entry> entries;
+    Slot* slots = gSlots.load(std::memory_order_acquire);
+    if (slots == nullptr) return entries;
+    for (size_t index = 0; index < kNumSlots; index++) {
+        Slot& slot = slots[index];
+        if (!slot.ready.load(std::memory_order_acquire)) continue;
+        uint64_t count = slot.count.load(std::memory_order_relaxed);
+        if (count == 0) continue;
+
+        Entry entry;
+        entry.descriptor = String8(slot.descriptor.data(), slot.descriptor.size()).c_str();
+        entry.code = slot.code;
+        entry.direction = slot.direction;
+        entry.count = count;
+        entry.totalLatencyNs = slot.totalLatencyNs.load(std::memory_order_relaxed);
+        entry.totalBytes = slot.totalBytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kNumBuckets; i++) {
+            entry.latencyBuckets[i] = slot.latencyBuckets[i].load(std::memory_order_relaxed);
+            entry.sizeBuckets[i] = slot.sizeBuckets[i].load(std::memory_order_relaxed);
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+uint64_t TransactionStats::getDroppedCount() {
+    return gDropped.load(std::memory_order_relaxed);
+}
+
+void TransactionStats::reset() {
+    Slot* slots = gSlots.load(std::memory_order_acquire);
+    for (size_t index = 0; slots != nullptr && index < kNumSlots; index++) {
+        Slot& slot = slots[index];
+        slot.count.store(0, std::memory_order_relaxed);
+        slot.totalLatencyNs.store(0, std::memory_order_relaxed);
+        slot.totalBytes.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < kNumBuckets; i++) {
+            slot.latencyBuckets[i].store(0, std::memory_order_relaxed);
+            slot.sizeBuckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    gDropped.store(0, std::memory_order_relaxed);
+}
+
+void TransactionStats::dump(int fd) {
+    std::vector<Entry> entries = getEntries();
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.totalLatencyNs > b.totalLatencyNs;
+    });
+
+    dprintf(fd, "Binder transaction stats (%zu entries, %" PRIu64 " samples dropped):\n",
+            entries.size(), getDroppedCount());
+    for (const Entry& entry : entries) {
+        dprintf(fd, "  %s %s code %u: %" PRIu64 " calls, %" PRIu64 " us avg, %" PRIu64
+                " bytes avg\n",
+                entry.direction == Direction::OUTGOING ? "out" : "in",
+                entry.descriptor.empty() ? "<no interface token>" : entry.descriptor.c_str(),
+                entry.code, entry.count, entry.totalLatencyNs / entry.count / 1000,
+                entry.totalBytes / entry.count);
+        dumpBuckets(fd, "latency (us)", entry.latencyBuckets);
+        dumpBuckets(fd, "size (bytes)", entry.sizeBuckets);
+    }
+}
+
+} // namespace android
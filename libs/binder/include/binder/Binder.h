@@ -17,6 +17,7 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
 #include <stdint.h>
 #include <binder/IBinder.h>
 
@@ -91,6 +92,46 @@ public:
     // This must be called before the object is sent to another process. Not thread safe.
     void                setInheritRt(bool inheritRt);
 
+    // Most oneway transactions a queue holds, see setOnewayQueueEnabled().
+    static constexpr size_t kMaxQueuedOnewayTransactions = 32;
+
+    // Whether oneway transactions are dispatched through a per-object queue.
+    bool                isOnewayQueueEnabled();
+    // This must be called before the object is sent to another process. Not thread safe.
+    //
+    // By default, the driver delivers oneway transactions to a binder object
+    // one at a time, and each one occupies a pooled thread and the driver's
+    // async buffer until it has run, so a slow one holds up all that follow.
+    // When enabled, each oneway user transaction (FIRST_CALL_TRANSACTION to
+    // LAST_CALL_TRANSACTION) is copied into a queue owned by this object,
+    // which frees both right away.
+    //
+    // Queued transactions run on worker threads of this object, named
+    // "binder:oneway", one for each priority set with
+    // setOnewayTransactionPriority() and one for the codes without one. Each
+    // worker runs at its priority, and calls onTransact for its transactions
+    // in arrival order. Transactions of different priorities run
+    // concurrently, so a slow one only holds up those of its own priority.
+    // The driver runs oneway transactions at the default priority of this
+    // process rather than the sender's, which is why the priority comes from
+    // the code. Disabling the queue waits for the calls in it to run.
+    //
+    // Once kMaxQueuedOnewayTransactions are queued, the next one waits on
+    // its pooled thread until no other transaction of its priority is queued
+    // or running, and then runs there, so a sender cannot grow the queue
+    // past that, and the driver's flow control for oneway transactions
+    // applies again.
+    //
+    // Transactions keep the calling uid and pid, but getCallingSid() is not
+    // available on the queue thread, so objects requesting the SID, and RPC
+    // sessions, always dispatch inline.
+    void                setOnewayQueueEnabled(bool enabled);
+    // The priority queued oneway transactions with |code| run at, as a nice
+    // value (-20 <= priority <= 19), see setOnewayQueueEnabled(). Others run
+    // at 0. This must be called before the object is sent to another process.
+    // Not thread safe.
+    void                setOnewayTransactionPriority(uint32_t code, int priority);
+
     pid_t               getDebugPid();
 
     // Whether this binder has been sent to another process.
@@ -117,6 +158,7 @@ private:
             BBinder&    operator=(const BBinder& o);
 
     class RpcServerLink;
+    class OnewayQueue;
     class Extras;
 
     Extras*             getOrCreateExtras();
@@ -124,6 +166,9 @@ private:
     [[nodiscard]] status_t setRpcClientDebug(const Parcel& data);
     void removeRpcServerLink(const sp<RpcServerLink>& link);
 
+    bool enqueueOnewayTransaction(uint32_t code, const Parcel& data, uint32_t flags);
+    static void runOnewayQueue(std::shared_ptr<OnewayQueue> queue, int priority);
+
     std::atomic<Extras*> mExtras;
 
     friend ::android::internal::Stability;
@@ -152,6 +152,30 @@ sp<IServiceManager> defaultServiceManager();
  */
 void setDefaultServiceManager(const sp<IServiceManager>& sm);
 
+/**
+ * Cache services found by getService/checkService on defaultServiceManager()
+ * in this process, so that looking up the same service again doesn't need a
+ * call into servicemanager. A cached service is dropped when it dies or when a
+ * different binder is registered with its name. Since these notifications are
+ * delivered to the binder threadpool, nothing is cached until the threadpool
+ * is started.
+ *
+ * Cached services are held with strong references, so lazy services which
+ * are looked up stay running while this is enabled. After this is disabled,
+ * they are dropped on the next lookup. Off by default.
+ */
+void setServiceLookupCacheEnabled(bool enabled);
+
+struct ServiceLookupCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+/**
+ * Lookups served from the cache (hits) and sent to servicemanager while the
+ * cache was used (misses), since the process started.
+ */
+ServiceLookupCacheStats getServiceLookupCacheStats();
+
 template<typename INTERFACE>
 sp<INTERFACE> waitForService(const String16& name) {
     const sp<IServiceManager> sm = defaultServiceManager();
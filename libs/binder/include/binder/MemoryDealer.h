@@ -25,15 +25,27 @@
 namespace android {
 // ----------------------------------------------------------------------------
 
-class SimpleBestFitAllocator;
+class HeapAllocator;
 
 // ----------------------------------------------------------------------------
 
 class MemoryDealer : public RefBase
 {
 public:
+    // How allocations are placed in the heap.
+    enum class Policy {
+        // Best fit over every chunk of the heap. Wastes the least memory, but
+        // allocate and deallocate take time linear in the number of chunks.
+        BEST_FIT,
+        // Buddy system. Allocations are rounded up to a power of two, and
+        // take time logarithmic in the heap size. Suits heaps holding many
+        // small allocations.
+        BUDDY,
+    };
+
     explicit MemoryDealer(size_t size, const char* name = nullptr,
             uint32_t flags = 0 /* or bits such as MemoryHeapBase::READ_ONLY */ );
+    MemoryDealer(size_t size, const char* name, uint32_t flags, Policy policy);
 
     virtual sp<IMemory> allocate(size_t size);
     virtual void        dump(const char* what) const;
@@ -50,10 +62,10 @@ private:
     friend class Allocation;
     virtual void                deallocate(size_t offset);
     const sp<IMemoryHeap>&      heap() const;
-    SimpleBestFitAllocator*     allocator() const;
+    HeapAllocator*              allocator() const;
 
     sp<IMemoryHeap>             mHeap;
-    SimpleBestFitAllocator*     mAllocator;
+    HeapAllocator*              mAllocator;
 };
 
 
@@ -19,6 +19,7 @@
 #include <array>
 #include <map> // for legacy reasons
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
@@ -140,6 +141,11 @@ public:
                                          IPCThreadState* threadState = nullptr) const;
     bool                checkInterface(IBinder*) const;
 
+    // Returns the interface name in the binder header written by
+    // writeInterfaceToken() or read by enforceInterface(), without moving
+    // the data position. Empty if there is no such header.
+    std::u16string_view peekInterfaceToken() const;
+
     // Verify there are no bytes left to be read on the Parcel.
     // Returns Status(EX_BAD_PARCELABLE) when the Parcel is not consumed.
     binder::Status enforceNoDataAvail() const;
@@ -402,6 +408,13 @@ public:
     status_t            readString16(std::optional<String16>* pArg) const;
     status_t            readString16(std::unique_ptr<String16>* pArg) const __attribute__((deprecated("use std::optional version instead")));
     const char16_t*     readString16Inplace(size_t* outLen) const;
+
+    // Read a string without copying it out of the Parcel. The view borrows
+    // the Parcel's data, so it is only valid until the Parcel is modified
+    // or destroyed. Useful when the string is only compared or hashed.
+    status_t            readString8View(std::string_view* pArg) const;
+    status_t            readString16View(std::u16string_view* pArg) const;
+
     sp<IBinder>         readStrongBinder() const;
     status_t            readStrongBinder(sp<IBinder>* val) const;
     status_t            readNullableStrongBinder(sp<IBinder>* val) const;
@@ -584,6 +597,13 @@ public:
     static size_t       getGlobalAllocSize();
     static size_t       getGlobalAllocCount();
 
+    // Keep recently released small data and objects buffers on a per-thread
+    // freelist and reuse them for the next Parcel on that thread, so that
+    // short transactions do not need to allocate once a thread is warm.
+    // Disabling also drops the buffers cached by the calling thread.
+    static void         setBufferRecyclingEnabled(bool enabled);
+    static bool         isBufferRecyclingEnabled();
+
     bool                replaceCallingWorkSourceUid(uid_t uid);
     // Returns the work source provided by the caller. This can only be trusted for trusted calling
     // uid.
@@ -840,7 +860,31 @@ private:
             || std::is_same_v<T, uint64_t>
             || std::is_same_v<T, int64_t>
             || std::is_same_v<T, double>
-            || (std::is_enum_v<T> && (sizeof(T) == 1 || sizeof(T) == 4)); // size check not type
+            // size check not type. 8 byte enums are written elementwise as int64_t,
+            // which is the same layout as a packed array.
+            || (std::is_enum_v<T> && (sizeof(T) == 1 || sizeof(T) == 4 || sizeof(T) == 8));
+
+    // primitive types that are widened to an int32_t slot per element in arrays
+    template <typename T>
+    static inline constexpr bool is_int32_widened_array_v =
+            std::is_same_v<T, bool> || std::is_same_v<T, char16_t>;
+
+    // Bulk conversion between a packed array and its per element int32_t wire slots.
+    // These are plain indexed loops over non-aliasing pointers so that the compiler
+    // can vectorize them.
+    template <typename T>
+    static void widenToInt32(const T* __restrict src, size_t count, int32_t* __restrict dst) {
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = static_cast<int32_t>(src[i]);
+        }
+    }
+
+    template <typename T>
+    static void narrowFromInt32(const int32_t* __restrict src, size_t count, T* __restrict dst) {
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = static_cast<T>(src[i]);
+        }
+    }
 
     // allowed "nullable" types
     // These are nonintrusive containers std::optional, std::unique_ptr, std::shared_ptr.
@@ -978,7 +1022,8 @@ private:
         using T = first_template_type_t<CT>;  // The T in CT == C<T, ...>
         if (c.size() >  std::numeric_limits<int32_t>::max()) return BAD_VALUE;
         const auto size = static_cast<int32_t>(c.size());
-        writeData(size);
+        const status_t sizeStatus = writeData(size);
+        if (sizeStatus != OK) return sizeStatus;
         if constexpr (is_pointer_equivalent_array_v<T>) {
             constexpr size_t limit = std::numeric_limits<size_t>::max() / sizeof(T);
             if (c.size() > limit) return BAD_VALUE;
@@ -988,13 +1033,19 @@ private:
             // TODO: Padding of the write is suboptimal when the length of the
             // data is not a multiple of 4.  Consider improving the write() method.
             return write(c.data(), c.size() * sizeof(T));
-        } else if constexpr (std::is_same_v<T, bool>
-                || std::is_same_v<T, char16_t>) {
-            // reserve data space to write to
+        } else if constexpr (is_int32_widened_array_v<T>) {
+            constexpr size_t limit = std::numeric_limits<size_t>::max() / sizeof(int32_t);
+            if (c.size() > limit) return BAD_VALUE;
+            // reserve data space to write to, bounds checked once for the whole vector.
             auto data = reinterpret_cast<int32_t*>(writeInplace(c.size() * sizeof(int32_t)));
             if (data == nullptr) return BAD_VALUE;
-            for (const auto t: c) {
-                *data++ = static_cast<int32_t>(t);
+            if constexpr (std::is_same_v<T, bool>) {
+                // std::vector<bool> is bit packed, there is no contiguous array to widen.
+                for (const bool t : c) {
+                    *data++ = static_cast<int32_t>(t);
+                }
+            } else /* constexpr */ {
+                widenToInt32(c.data(), c.size(), data);
             }
         } else /* constexpr */ {
             for (const auto &t : c) {
@@ -1013,6 +1064,12 @@ private:
         if constexpr (is_pointer_equivalent_array_v<T>) {
             static_assert(N <= std::numeric_limits<size_t>::max() / sizeof(T));
             return write(val.data(), val.size() * sizeof(T));
+        } else if constexpr (is_int32_widened_array_v<T>) {
+            static_assert(N <= std::numeric_limits<size_t>::max() / sizeof(int32_t));
+            auto data = reinterpret_cast<int32_t*>(writeInplace(N * sizeof(int32_t)));
+            if (data == nullptr) return BAD_VALUE;
+            widenToInt32(val.data(), N, data);
+            return OK;
         } else /* constexpr */ {
             for (const auto& t : val) {
                 status = writeData(t);
@@ -1173,15 +1230,12 @@ private:
                     readInplace(static_cast<size_t>(size) * sizeof(T)));
             if (data == nullptr) return BAD_VALUE;
             c->insert(c->begin(), data, data + size); // insert should do a reserve().
-        } else if constexpr (std::is_same_v<T, bool>
-                || std::is_same_v<T, char16_t>) {
-            c->reserve(size); // avoids default initialization
+        } else if constexpr (is_int32_widened_array_v<T>) {
             auto data = reinterpret_cast<const int32_t*>(
                     readInplace(static_cast<size_t>(size) * sizeof(int32_t)));
             if (data == nullptr) return BAD_VALUE;
-            for (int32_t i = 0; i < size; ++i) {
-                c->emplace_back(static_cast<T>(*data++));
-            }
+            // range assign allocates once and converts each int32_t slot to T.
+            c->assign(data, data + size);
         } else if constexpr (is_specialization_v<T, sp>) {
             c->resize(size); // calls ctor
             if (readFlags & READ_FLAG_SP_NULLABLE) {
@@ -1217,6 +1271,10 @@ private:
             auto data = reinterpret_cast<const T*>(readInplace(N * sizeof(T)));
             if (data == nullptr) return BAD_VALUE;
             memcpy(val->data(), data, N * sizeof(T));
+        } else if constexpr (is_int32_widened_array_v<T>) {
+            auto data = reinterpret_cast<const int32_t*>(readInplace(N * sizeof(int32_t)));
+            if (data == nullptr) return BAD_VALUE;
+            narrowFromInt32(data, N, val->data());
         } else if constexpr (is_specialization_v<T, sp>) {
             for (auto& t : *val) {
                 if (readFlags & READ_FLAG_SP_NULLABLE) {
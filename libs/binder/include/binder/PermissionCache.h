@@ -21,9 +21,13 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+
 #include <utils/String16.h>
 #include <utils/Singleton.h>
-#include <utils/SortedVector.h>
+#include <utils/Timers.h>
 
 namespace android {
 // ---------------------------------------------------------------------------
@@ -31,8 +35,9 @@ namespace android {
 /*
  * PermissionCache caches permission checks for a given uid.
  *
- * Currently the cache is not updated when there is a permission change,
- * for instance when an application is uninstalled.
+ * The cache is not updated when there is a permission change, for instance
+ * when an application is uninstalled. Entries are only checked again once
+ * they expire, or after purgeCache().
  *
  * IMPORTANT: for the reason stated above, only system permissions are safe
  * to cache. This restriction may be lifted at a later time.
@@ -40,32 +45,66 @@ namespace android {
  */
 
 class PermissionCache : Singleton<PermissionCache> {
-    struct Entry {
+    struct Key {
         String16    name;
         uid_t       uid;
-        bool        granted;
-        inline bool operator < (const Entry& e) const {
-            return (uid == e.uid) ? (name < e.name) : (uid < e.uid);
+        inline bool operator == (const Key& k) const {
+            return uid == k.uid && name == k.name;
         }
     };
-    mutable Mutex mLock;
-    // we pool all the permission names we see, as many permissions checks
-    // will have identical names
-    SortedVector< String16 > mPermissionNamesPool;
-    // this is our cache per say. it stores pooled names.
-    SortedVector< Entry > mCache;
-
-    // free the whole cache, but keep the permission name pool
+    struct KeyHash {
+        size_t operator()(const Key& k) const;
+    };
+    struct Entry {
+        bool        granted;
+        nsecs_t     expiresAt;
+        // updated by hits, which only hold the lock shared
+        std::atomic<nsecs_t> lastUsed;
+    };
+    // Checks are spread over shards, so that binder threads checking
+    // different permissions or uids don't contend. A full shard drops its
+    // expired entries, or else its least recently used one, to make room.
+    // The cap leaves room for uneven hashing, so evictions only happen in
+    // processes which see many more uids than usual.
+    struct alignas(64) Shard {
+        std::shared_mutex lock;
+        // purge() invalidates the entries of older generations
+        uint32_t generation = 0; // guarded by lock
+        std::unordered_map<Key, Entry, KeyHash> entries; // guarded by lock
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+    };
+    static constexpr size_t kNumShards = 16;
+    static constexpr nsecs_t kEntryLifetime = s2ns(10 * 60);
+    static constexpr size_t kMaxEntriesPerShard = 256;
+
+    Shard mShards[kNumShards];
+    std::atomic<uint32_t> mGeneration = 0;
+    nsecs_t mEntryLifetime = kEntryLifetime;
+    size_t mMaxEntriesPerShard = kMaxEntriesPerShard;
+
+    friend class PermissionCacheTest;
+
+    Shard& shardFor(const Key& key);
+    // makes room for one more entry in a full shard, called with its lock held
+    void evictLocked(Shard& shard, nsecs_t now);
+
+    // invalidate the whole cache
     void purge();
 
     status_t check(bool* granted,
-            const String16& permission, uid_t uid) const;
+            const String16& permission, uid_t uid);
 
     void cache(const String16& permission, uid_t uid, bool granted);
 
 public:
     PermissionCache();
 
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+
     static bool checkCallingPermission(const String16& permission);
 
     static bool checkCallingPermission(const String16& permission,
@@ -75,6 +114,12 @@ public:
             pid_t pid, uid_t uid);
 
     static void purgeCache();
+
+    // Lookups for root and the calling process itself are not counted.
+    static Stats getStats();
+
+private:
+    Stats stats();
 };
 
 // ---------------------------------------------------------------------------
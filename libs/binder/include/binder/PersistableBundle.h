@@ -16,8 +16,9 @@
 
 #pragma once
 
-#include <map>
+#include <memory>
 #include <set>
+#include <utility>
 #include <vector>
 
 #include <binder/Parcelable.h>
@@ -41,6 +42,19 @@ public:
     status_t writeToParcel(Parcel* parcel) const override;
     status_t readFromParcel(const Parcel* parcel) override;
 
+    /*
+     * Like readFromParcel(), but only validates the bundle and keeps its bytes.
+     * Values are decoded each time they are asked for, and a bundle which is
+     * not modified is written back as it was read. This suits bundles which
+     * are forwarded, or queried for a few keys. Modifying the bundle decodes
+     * all of it.
+     *
+     * Unlike readFromParcel(), this doesn't merge into existing values: it
+     * returns INVALID_OPERATION, and reads nothing, if this bundle is not
+     * empty.
+     */
+    status_t readFromParcelLazily(const Parcel* parcel);
+
     bool empty() const;
     size_t size() const;
     size_t erase(const String16& key);
@@ -92,36 +106,75 @@ public:
     std::set<String16> getStringVectorKeys() const;
     std::set<String16> getPersistableBundleKeys() const;
 
-    friend bool operator==(const PersistableBundle& lhs, const PersistableBundle& rhs) {
-        return (lhs.mBoolMap == rhs.mBoolMap && lhs.mIntMap == rhs.mIntMap &&
-                lhs.mLongMap == rhs.mLongMap && lhs.mDoubleMap == rhs.mDoubleMap &&
-                lhs.mStringMap == rhs.mStringMap && lhs.mBoolVectorMap == rhs.mBoolVectorMap &&
-                lhs.mIntVectorMap == rhs.mIntVectorMap &&
-                lhs.mLongVectorMap == rhs.mLongVectorMap &&
-                lhs.mDoubleVectorMap == rhs.mDoubleVectorMap &&
-                lhs.mStringVectorMap == rhs.mStringVectorMap &&
-                lhs.mPersistableBundleMap == rhs.mPersistableBundleMap);
-    }
+    friend bool operator==(const PersistableBundle& lhs, const PersistableBundle& rhs);
 
     friend bool operator!=(const PersistableBundle& lhs, const PersistableBundle& rhs) {
         return !(lhs == rhs);
     }
 
 private:
+    /*
+     * A map kept as a vector sorted by key, which takes less memory and fewer
+     * allocations than a std::map for the few keys a bundle usually holds.
+     */
+    template <typename T>
+    class FlatMap {
+    public:
+        using value_type = std::pair<String16, T>;
+        using const_iterator = typename std::vector<value_type>::const_iterator;
+
+        const_iterator begin() const { return mEntries.begin(); }
+        const_iterator end() const { return mEntries.end(); }
+        size_t size() const { return mEntries.size(); }
+        bool empty() const { return mEntries.empty(); }
+
+        // nullptr if |key| is not present
+        const T* find(const String16& key) const;
+        // inserts a default value if |key| is not present
+        T& operator[](const String16& key);
+        size_t erase(const String16& key);
+
+        // Appends a default value for |key| without keeping the map sorted,
+        // to build it in one go. Call sortAndDedupe() once done.
+        T& append(const String16& key);
+        // sorts the map by key, keeping the value appended last for each key
+        void sortAndDedupe();
+
+        bool operator==(const FlatMap& other) const { return mEntries == other.mEntries; }
+
+    private:
+        std::vector<value_type> mEntries;
+    };
+
+    // the bytes of a lazily read bundle, and where its values are
+    struct LazyData;
+
     status_t writeToParcelInner(Parcel* parcel) const;
     status_t readFromParcelInner(const Parcel* parcel, size_t length);
-
-    std::map<String16, bool> mBoolMap;
-    std::map<String16, int32_t> mIntMap;
-    std::map<String16, int64_t> mLongMap;
-    std::map<String16, double> mDoubleMap;
-    std::map<String16, String16> mStringMap;
-    std::map<String16, std::vector<bool>> mBoolVectorMap;
-    std::map<String16, std::vector<int32_t>> mIntVectorMap;
-    std::map<String16, std::vector<int64_t>> mLongVectorMap;
-    std::map<String16, std::vector<double>> mDoubleVectorMap;
-    std::map<String16, std::vector<String16>> mStringVectorMap;
-    std::map<String16, PersistableBundle> mPersistableBundleMap;
+    status_t readEntriesFromParcel(const Parcel* parcel);
+
+    // decodes a lazily read bundle into the maps, before it is modified
+    void unparcel();
+    template <typename T>
+    bool getValue(const String16& key, int32_t valueType, T* out, const FlatMap<T>& map) const;
+    template <typename T>
+    std::set<String16> getKeys(int32_t valueType, const FlatMap<T>& map) const;
+
+    FlatMap<bool> mBoolMap;
+    FlatMap<int32_t> mIntMap;
+    FlatMap<int64_t> mLongMap;
+    FlatMap<double> mDoubleMap;
+    FlatMap<String16> mStringMap;
+    FlatMap<std::vector<bool>> mBoolVectorMap;
+    FlatMap<std::vector<int32_t>> mIntVectorMap;
+    FlatMap<std::vector<int64_t>> mLongVectorMap;
+    FlatMap<std::vector<double>> mDoubleVectorMap;
+    FlatMap<std::vector<String16>> mStringVectorMap;
+    FlatMap<PersistableBundle> mPersistableBundleMap;
+
+    // Set while this bundle is lazily read, in which case the maps are empty.
+    // Copies of the bundle share it.
+    std::shared_ptr<const LazyData> mLazyData;
 };
 
 }  // namespace os
@@ -90,6 +90,49 @@ public:
      */
     size_t getThreadPoolMaxThreadCount() const;
 
+    /**
+     * Sizes the thread pool to the load instead of to a fixed count. The
+     * kernel may start up to |minThreads| threads at first. Whenever every
+     * thread stayed busy for longer than |growAfterMs|, so incoming
+     * transactions had to queue for a looper, one more thread is allowed, up
+     * to |maxThreads|. When fewer threads than the pool holds were ever busy
+     * at once during an |idleTimeoutMs| window, one kernel-started thread
+     * leaves the pool, down to |minThreads|. A |growAfterMs| of 0 grows the
+     * pool on every starvation, however short.
+     *
+     * To be able to time out, one kernel-started thread at a time waits for
+     * work with poll() instead of blocking in the driver. The others block in
+     * the driver as usual, so it hands each transaction to one of them, and
+     * only wakes the polling thread when none is left. Blocked threads leave
+     * the pool when they run out of commands, so an idle pool shrinks by at
+     * most one thread per window while transactions still come in, and by
+     * the polling thread once they stop.
+     *
+     * Must be called before startThreadPool(), in place of
+     * setThreadPoolMaxThreadCount().
+     */
+    status_t setThreadPoolAdaptive(size_t minThreads, size_t maxThreads, int64_t growAfterMs,
+                                   int64_t idleTimeoutMs);
+
+    struct ThreadPoolStats {
+        // Threads currently in joinThreadPool().
+        size_t threads;
+        size_t executingThreads;
+        // Number of threads the kernel may currently start.
+        size_t maxThreads;
+        // Most threads executing a command at once.
+        size_t peakExecutingThreads;
+        // Times the adaptive pool allowed one more thread.
+        size_t threadsGrown;
+        // Threads which left the adaptive pool after being idle.
+        size_t threadsRetired;
+        // Periods during which every thread was busy.
+        size_t starvations;
+        int64_t totalStarvationMs;
+        int64_t longestStarvationMs;
+    };
+    ThreadPoolStats getThreadPoolStats();
+
     enum class DriverFeature {
         ONEWAY_SPAM_DETECTION,
     };
@@ -120,6 +163,19 @@ private:
 
     handle_entry* lookupHandleLocked(int32_t handle);
 
+    // Called with mThreadCountLock held when every thread has been busy for
+    // |starvationTimeMs|.
+    void onThreadPoolStarvedLocked(int64_t starvationTimeMs);
+    // Called by a kernel-started thread whenever it has no commands left, and
+    // by the polling thread at least once per idle timeout while it waits for
+    // one. Returns true if the thread should leave the pool.
+    bool shouldRetirePooledThread();
+    // Called by a kernel-started thread of an adaptive pool with no commands
+    // left. Returns true if it should wait for work in poll(), in which case
+    // it calls stopPollingForWork() once it is done waiting.
+    bool startPollingForWork();
+    void stopPollingForWork();
+
     String8 mDriverName;
     int mDriverFD;
     void* mVMStart;
@@ -136,6 +192,25 @@ private:
     size_t mMaxThreads;
     // Time when thread pool was emptied
     int64_t mStarvationStartTimeMs;
+    // Number of threads in joinThreadPool().
+    size_t mPoolThreadCount;
+    // Most threads executing at once, since mPeakWindowStartMs and overall.
+    size_t mPeakExecutingThreads;
+    int64_t mPeakWindowStartMs;
+    size_t mMaxExecutingThreads;
+    size_t mStarvationCount;
+    int64_t mTotalStarvationMs;
+    int64_t mLongestStarvationMs;
+    // Configuration from setThreadPoolAdaptive().
+    bool mAdaptiveThreadPool;
+    size_t mAdaptiveMinThreads;
+    size_t mAdaptiveMaxThreads;
+    int64_t mAdaptiveGrowAfterMs;
+    int64_t mAdaptiveIdleTimeoutMs;
+    size_t mThreadsGrown;
+    size_t mThreadsRetired;
+    // Whether a thread of the adaptive pool is waiting for work in poll().
+    bool mAdaptivePolling;
 
     mutable Mutex mLock; // protects everything below.
 
@@ -22,7 +22,9 @@
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
 
+#include <chrono>
 #include <mutex>
+#include <optional>
 #include <thread>
 
 namespace android {
@@ -106,6 +108,27 @@ public:
     void setMaxThreads(size_t threads);
     size_t getMaxThreads();
 
+    /**
+     * Serve incoming connections from a shared pool of |threads| threads,
+     * which wait for commands on all connections at once (using epoll),
+     * instead of from a dedicated thread per connection. This keeps the number
+     * of server threads fixed when there are many mostly idle sessions. A
+     * thread is still busy for as long as a command it is serving takes.
+     *
+     * A connection is only served once the header of its next command has
+     * arrived in full. Until then, the pool checks it again every few
+     * milliseconds, and closes it if the header is still incomplete after
+     * some seconds, so that peers sending commands a byte at a time can't
+     * hold up the pool.
+     *
+     * setMaxThreads still limits the number of connections each session may
+     * open. If this is 0 (the default), a thread is used per connection.
+     *
+     * This must be called before join().
+     */
+    void setEventLoopThreads(size_t threads);
+    size_t getEventLoopThreads();
+
     /**
      * By default, the latest protocol version which is supported by a client is
      * used. However, this can be used in order to prevent newer protocol
@@ -181,8 +204,42 @@ private:
                                     const sockaddr_storage addr, socklen_t addrLen);
     [[nodiscard]] status_t setupSocketServer(const RpcSocketAddress& address);
 
+    // A connection, or the shutdown trigger of a session, registered with the
+    // event loop. Each is armed with EPOLLONESHOT, so at most one thread
+    // handles it at a time.
+    struct EventLoopSource {
+        sp<RpcSession> session;
+        // nullptr for the session shutdown trigger
+        sp<RpcSession::RpcConnection> connection;
+        int fd;
+        // whether an event loop thread is currently serving this connection
+        bool busy = false;
+        // since when only part of the next command header has arrived
+        std::optional<std::chrono::steady_clock::time_point> partialSince;
+    };
+    struct EventLoopSession {
+        // 0 once the shutdown trigger is no longer registered
+        uint64_t triggerId = 0;
+        size_t connections = 0;
+    };
+
+    [[nodiscard]] status_t startEventLoop();
+    // lock holds mLock, and there must be no join or connecting threads left
+    void stopEventLoop(std::unique_lock<std::mutex>& lock);
+    void addToEventLoop(sp<RpcSession>&& session, RpcSession::PreJoinSetupResult&& setupResult,
+                        int fd);
+    void eventLoopThread();
+    void handleEventLoopEvent(uint64_t id);
+    // handles the connections in mEventLoopPartial again
+    void recheckPartialEventLoopSources();
+    // returns the connection to be finished once mEventLoopLock is released, if any
+    std::optional<EventLoopSource> removeEventLoopSourceLocked(
+            std::map<uint64_t, EventLoopSource>::iterator it);
+    void finishEventLoopConnection(const EventLoopSource& source);
+
     const std::unique_ptr<RpcTransportCtx> mCtx;
     size_t mMaxThreads = 1;
+    size_t mEventLoopThreads = 0;
     std::optional<uint32_t> mProtocolVersion;
     base::unique_fd mServer; // socket we are accepting sessions on
 
@@ -196,6 +253,19 @@ private:
     std::map<std::vector<uint8_t>, sp<RpcSession>> mSessions;
     std::unique_ptr<FdTrigger> mShutdownTrigger;
     std::condition_variable mShutdownCv;
+    std::vector<std::thread> mEventLoopPool;
+    std::unique_ptr<FdTrigger> mEventLoopTrigger; // stops mEventLoopPool
+
+    std::mutex mEventLoopLock; // for below
+    base::unique_fd mEpollFd;
+    uint64_t mNextEventLoopId = 1; // 0 is mEventLoopTrigger
+    std::map<uint64_t, EventLoopSource> mEventLoopSources;
+    std::map<RpcSession*, EventLoopSession> mEventLoopSessions;
+    // Connections with part of a command header, which are not armed in
+    // mEpollFd. Their FD may not become readable again for the rest of it
+    // (e.g. with TLS or shared memory), so they are handled again after a
+    // delay instead.
+    std::vector<uint64_t> mEventLoopPartial;
 };
 
 } // namespace android
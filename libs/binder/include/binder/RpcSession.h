@@ -81,6 +81,22 @@ public:
     void setMaxOutgoingThreads(size_t threads);
     size_t getMaxOutgoingThreads();
 
+    /**
+     * Set the maximum number of oneway transactions queued on this session.
+     * By default, this is 0, and each oneway transaction takes a connection
+     * and is written out by the calling thread before it returns.
+     *
+     * Otherwise, oneway transactions are appended to a queue for this session,
+     * which is written out, in order and several transactions at a time, by
+     * whichever calling thread finds it idle. Callers block while
+     * |maxQueued| transactions are already queued. Because of this, a oneway
+     * transaction which fails to be written only returns an error to the
+     * thread which was writing out the queue. This must be called before
+     * setting up this connection as a client.
+     */
+    void setMaxQueuedOnewayTransactions(size_t maxQueued);
+    size_t getMaxQueuedOnewayTransactions();
+
     /**
      * By default, the minimum of the supported versions of the client and the
      * server will be used. Usually, this API should only be used for debugging.
@@ -237,6 +253,23 @@ private:
     // join on thread passed to preJoinThreadOwnership
     static void join(sp<RpcSession>&& session, PreJoinSetupResult&& result);
 
+    // Instead of join, RpcServer may serve incoming connections from a shared
+    // pool of event loop threads. In this case, no thread is passed to
+    // preJoinThreadOwnership, and after preJoinSetup:
+    //
+    // release the connection from the thread which set it up
+    void releaseIncomingConnection(const sp<RpcConnection>& connection);
+    // whether a whole command header is buffered on the connection: OK if so,
+    // NOT_ENOUGH_DATA if only part of one is, WOULD_BLOCK if nothing is, and
+    // DEAD_OBJECT if the peer has closed it
+    [[nodiscard]] static status_t peekIncomingCommand(const sp<RpcConnection>& connection);
+    // on a pool thread, process commands until no whole command header is
+    // buffered, see peekIncomingCommand
+    [[nodiscard]] static status_t serveIncomingCommands(const sp<RpcSession>& session,
+                                                        const sp<RpcConnection>& connection);
+    // run a pool thread in the same environment as join
+    static void runIncomingThread(const std::function<void()>& serve);
+
     [[nodiscard]] status_t setupClient(
             const std::function<status_t(const std::vector<uint8_t>& sessionId, bool incoming)>&
                     connectAndInit);
@@ -324,6 +357,7 @@ private:
 
     size_t mMaxIncomingThreads = 0;
     size_t mMaxOutgoingThreads = kDefaultMaxOutgoingThreads;
+    size_t mMaxQueuedOnewayTransactions = 0;
     std::optional<uint32_t> mProtocolVersion;
 
     std::condition_variable mAvailableConnectionCv; // for mWaitingThreads
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+/**
+ * Histograms of binder transaction latency and size, kept for every
+ * (interface descriptor, transaction code) pair that this process sends or
+ * receives through the kernel driver. Descriptors come from the interface
+ * token of each transaction, cut to kMaxDescriptorLength characters since
+ * callers choose them; transactions without one are recorded under an empty
+ * descriptor.
+ *
+ * Recording is off until a process calls setEnabled(true), which also
+ * allocates the table. Recording is lock-free after that. Once every slot is
+ * taken, samples for new pairs are counted as dropped, and so are samples
+ * that find their pair's slot still being filled in by another thread.
+ */
+class TransactionStats {
+public:
+    enum class Direction : uint8_t {
+        OUTGOING,
+        INCOMING,
+    };
+
+    // Bucket i counts latencies of [2^i, 2^(i+1)) microseconds and sizes of
+    // [2^i, 2^(i+1)) bytes. The first bucket also counts anything smaller
+    // and the last anything larger.
+    static constexpr size_t kNumBuckets = 20;
+
+    // Longer descriptors are recorded under their first kMaxDescriptorLength
+    // characters.
+    static constexpr size_t kMaxDescriptorLength = 128;
+
+    struct Entry {
+        std::string descriptor;
+        uint32_t code;
+        Direction direction;
+        uint64_t count;
+        uint64_t totalLatencyNs;
+        uint64_t totalBytes;
+        std::array<uint64_t, kNumBuckets> latencyBuckets;
+        std::array<uint64_t, kNumBuckets> sizeBuckets;
+    };
+
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    // |bytes| is the size of the transaction data and its reply.
+    static void record(Direction direction, std::u16string_view descriptor, uint32_t code,
+                       nsecs_t latencyNs, size_t bytes);
+
+    static std::vector<Entry> getEntries();
+    // Samples not recorded because no slot was free for their pair.
+    static uint64_t getDroppedCount();
+    // Clears every histogram. Pairs keep their slots.
+    static void reset();
+    // Writes getEntries() as text, most total latency first, for dump().
+    static void dump(int fd);
+
+private:
+    TransactionStats() = delete;
+};
+
+} // namespace android
@@ -32,6 +32,7 @@
 #include <android/binder_parcel.h>
 
 #include <array>
+#include <cstring>
 #include <optional>
 #include <string>
 #include <type_traits>
@@ -97,6 +98,33 @@ struct is_fixed_array<std::array<T, N>> : std::true_type {};
 template <typename T>
 static inline constexpr bool is_fixed_array_v = is_fixed_array<T>::value;
 
+// Tells if T is an NDK parcelable whose object representation is exactly what it writes after
+// its size header, so that it can be copied into a parcel as is. Such a parcelable has only 32
+// and 64-bit integer or enum fields, without padding between them, and declares:
+//     static constexpr bool kTriviallyParcelable = true;
+// Declaring it on a type with padding bytes, or whose size isn't a multiple of 4, fails to
+// compile, since those bytes would be sent to the other process. Floating point fields can't be
+// told apart from padding this way, so types with them can't declare it. Neither can types with
+// bool, char or 8 and 16-bit fields: writeToParcel() widens those to 32 bits. That can't be
+// checked at compile time, so AParcel_writeTriviallyParcelableArray() checks the size that
+// writeToParcel() writes instead, and does not copy such types in bulk.
+template <typename T, typename = void>
+struct is_trivially_parcelable : std::false_type {};
+
+template <typename T>
+struct is_trivially_parcelable<T, std::void_t<decltype(T::kTriviallyParcelable)>>
+    : std::bool_constant<is_parcelable_v<T> && T::kTriviallyParcelable &&
+                         std::is_trivially_copyable_v<T>> {
+    static_assert(!T::kTriviallyParcelable || std::has_unique_object_representations_v<T>,
+                  "kTriviallyParcelable types must not have padding or floating point fields");
+    static_assert(!T::kTriviallyParcelable ||
+                          (sizeof(T) % sizeof(int32_t) == 0 && alignof(T) >= alignof(int32_t)),
+                  "kTriviallyParcelable types must only have 32 and 64-bit fields");
+};
+
+template <typename T>
+static inline constexpr bool is_trivially_parcelable_v = is_trivially_parcelable<T>::value;
+
 template <typename T>
 static inline constexpr bool dependent_false_v = false;
 }  // namespace
@@ -762,6 +790,146 @@ static inline binder_status_t AParcel_readNullableParcelable(const AParcel* parc
     }
 }
 
+/**
+ * Whether P::writeToParcel() writes its size header and then exactly sizeof(P) bytes, as
+ * AParcel_writeTriviallyParcelableArray() does. A field narrower than 32 bits passes the checks
+ * in is_trivially_parcelable, but writeToParcel() widens it, so the sizes differ. This is checked
+ * once per type, with a default-constructed P.
+ */
+template <typename P>
+static inline bool AParcel_writesTriviallyParcelableLayout() {
+#if __ANDROID_API__ >= 31
+#ifdef __ANDROID_UNAVAILABLE_SYMBOLS_ARE_WEAK__
+    if (__builtin_available(android 31, *)) {
+#else
+    if (__ANDROID_API__ >= 31) {
+#endif
+        static const bool kMatches = []() {
+            AParcel* scratch = AParcel_create();
+            if (scratch == nullptr) return false;
+            const P element{};
+            const bool matches = element.writeToParcel(scratch) == STATUS_OK &&
+                                 AParcel_getDataPosition(scratch) ==
+                                         static_cast<int32_t>(sizeof(int32_t) + sizeof(P));
+            AParcel_delete(scratch);
+            return matches;
+        }();
+        return kMatches;
+    }
+#endif
+    return false;
+}
+
+/**
+ * Writes an array of trivially parcelable objects with the same layout as
+ * AParcel_writeParcelableArray() of AParcel_writeParcelable(). The elements are laid out in a
+ * local buffer and written with a single AParcel_writeInt32Array() call, rather than several
+ * calls for every element.
+ *
+ * Returns STATUS_INVALID_OPERATION with the data position unchanged when this fails, or when
+ * P::writeToParcel() writes another layout (see AParcel_writesTriviallyParcelableLayout()), in
+ * which case the caller should write the elements one by one.
+ */
+template <typename P>
+static inline binder_status_t AParcel_writeTriviallyParcelableArray(AParcel* parcel,
+                                                                    const P* elements,
+                                                                    size_t count) {
+    static_assert(is_trivially_parcelable_v<P>);
+    if (!AParcel_writesTriviallyParcelableLayout<P>()) return STATUS_INVALID_OPERATION;
+    // non-null marker, size (which counts itself), then the fields
+    constexpr size_t kElementSize = 2 * sizeof(int32_t) + sizeof(P);
+    static_assert(kElementSize % sizeof(int32_t) == 0);
+    if (count > (INT32_MAX - sizeof(int32_t)) / kElementSize) return STATUS_BAD_VALUE;
+
+    std::vector<int32_t> words(count * kElementSize / sizeof(int32_t));
+    uint8_t* out = reinterpret_cast<uint8_t*>(words.data());
+    for (size_t i = 0; i < count; i++, out += kElementSize) {
+        const int32_t header[] = {1, static_cast<int32_t>(sizeof(int32_t) + sizeof(P))};
+        memcpy(out, header, sizeof(header));
+        memcpy(out + sizeof(header), &elements[i], sizeof(P));
+    }
+
+    // The int32 array has the same layout as the elements, except that its length counts words
+    // rather than elements, so the length is rewritten afterwards.
+    const int32_t start = AParcel_getDataPosition(parcel);
+    if (AParcel_writeInt32Array(parcel, words.data(), static_cast<int32_t>(words.size())) !=
+        STATUS_OK) {
+        (void)AParcel_setDataPosition(parcel, start);
+        return STATUS_INVALID_OPERATION;
+    }
+    const int32_t end = AParcel_getDataPosition(parcel);
+    if (AParcel_setDataPosition(parcel, start) != STATUS_OK ||
+        AParcel_writeInt32(parcel, static_cast<int32_t>(count)) != STATUS_OK) {
+        (void)AParcel_setDataPosition(parcel, start);
+        return STATUS_INVALID_OPERATION;
+    }
+    return AParcel_setDataPosition(parcel, end);
+}
+
+/**
+ * Reads an array written by AParcel_writeTriviallyParcelableArray(), or by writing each element
+ * with the same layout. 'resize' is called with the number of elements and returns where to
+ * store them, or nullptr to fail.
+ *
+ * Returns STATUS_INVALID_OPERATION with the data position unchanged when this isn't available,
+ * when the parcel holds objects, or when any element has another layout, e.g. because it was
+ * written by another version of the parcelable. The caller should then read the elements one by
+ * one.
+ */
+template <typename P, typename Resize>
+static inline binder_status_t AParcel_readTriviallyParcelableArray(const AParcel* parcel,
+                                                                   Resize resize) {
+    static_assert(is_trivially_parcelable_v<P>);
+#if __ANDROID_API__ >= 33
+#ifdef __ANDROID_UNAVAILABLE_SYMBOLS_ARE_WEAK__
+    if (__builtin_available(android 33, *)) {
+#else
+    if (__ANDROID_API__ >= 33) {
+#endif
+        constexpr size_t kElementSize = 2 * sizeof(int32_t) + sizeof(P);
+        const int32_t start = AParcel_getDataPosition(parcel);
+        auto fallBack = [&]() {
+            (void)AParcel_setDataPosition(parcel, start);
+            return STATUS_INVALID_OPERATION;
+        };
+
+        int32_t length;
+        if (AParcel_readInt32(parcel, &length) != STATUS_OK || length < 0 ||
+            static_cast<size_t>(length) > (INT32_MAX - sizeof(int32_t)) / kElementSize) {
+            return fallBack();
+        }
+        // Don't allocate more than the parcel could hold.
+        const int32_t available = AParcel_getDataSize(parcel) - AParcel_getDataPosition(parcel);
+        if (available < 0 ||
+            static_cast<size_t>(length) > static_cast<size_t>(available) / kElementSize) {
+            return fallBack();
+        }
+        const size_t size = static_cast<size_t>(length) * kElementSize;
+        std::vector<uint8_t> buffer(size);
+        if (AParcel_marshal(parcel, buffer.data(), start + sizeof(int32_t), size) != STATUS_OK) {
+            return fallBack();
+        }
+        P* elements = resize(length);
+        if (elements == nullptr) return fallBack();
+
+        const uint8_t* in = buffer.data();
+        for (int32_t i = 0; i < length; i++, in += kElementSize) {
+            int32_t header[2];
+            memcpy(header, in, sizeof(header));
+            if (header[0] != 1 || header[1] != static_cast<int32_t>(sizeof(int32_t) + sizeof(P))) {
+                return fallBack();
+            }
+            memcpy(&elements[i], in + sizeof(header), sizeof(P));
+        }
+        return AParcel_setDataPosition(parcel,
+                                       start + static_cast<int32_t>(sizeof(int32_t) + size));
+    }
+#endif
+    (void)parcel;
+    (void)resize;
+    return STATUS_INVALID_OPERATION;
+}
+
 // Forward decls
 template <typename T>
 static inline binder_status_t AParcel_writeData(AParcel* parcel, const T& value);
@@ -978,6 +1146,11 @@ static inline binder_status_t AParcel_writeVector(AParcel* parcel, const std::ve
         }
     } else {
         static_assert(!std::is_same_v<P, std::string>, "specialization should be used");
+        if constexpr (is_trivially_parcelable_v<P>) {
+            binder_status_t status =
+                    AParcel_writeTriviallyParcelableArray(parcel, vec.data(), vec.size());
+            if (status != STATUS_INVALID_OPERATION) return status;
+        }
         const void* vectorData = static_cast<const void*>(&vec);
         return AParcel_writeParcelableArray(parcel, vectorData, static_cast<int32_t>(vec.size()),
                                             AParcel_writeStdVectorParcelableElement<P>);
@@ -1002,6 +1175,15 @@ static inline binder_status_t AParcel_readVector(const AParcel* parcel, std::vec
         }
     } else {
         static_assert(!std::is_same_v<P, std::string>, "specialization should be used");
+        if constexpr (is_trivially_parcelable_v<P>) {
+            binder_status_t status = AParcel_readTriviallyParcelableArray<P>(
+                    parcel, [vec](int32_t length) -> P* {
+                        if (static_cast<size_t>(length) > vec->max_size()) return nullptr;
+                        vec->resize(static_cast<size_t>(length));
+                        return vec->data();
+                    });
+            if (status != STATUS_INVALID_OPERATION) return status;
+        }
         void* vectorData = static_cast<void*>(vec);
         return AParcel_readParcelableArray(parcel, vectorData,
                                            AParcel_stdVectorExternalAllocator<P>,
@@ -1457,9 +1639,10 @@ template <typename T, size_t N>
 static inline binder_status_t AParcel_writeFixedArray(AParcel* parcel,
                                                       const std::array<T, N>& arr) {
     if constexpr (std::is_same_v<T, bool>) {
-        const void* arrayData = static_cast<const void*>(&arr);
-        return AParcel_writeBoolArray(parcel, arrayData, static_cast<int32_t>(N),
-                                      &AParcel_stdArrayGetter<T, N>);
+        // Each bool is written as an int32_t, so they can be written as one int32_t array.
+        std::array<int32_t, N> values;
+        for (size_t i = 0; i < N; i++) values[i] = arr[i] ? 1 : 0;
+        return AParcel_writeInt32Array(parcel, values.data(), static_cast<int32_t>(N));
     } else if constexpr (std::is_same_v<T, uint8_t>) {
         return AParcel_writeByteArray(parcel, reinterpret_cast<const int8_t*>(arr.data()),
                                       static_cast<int32_t>(arr.size()));
@@ -1478,6 +1661,10 @@ static inline binder_status_t AParcel_writeFixedArray(AParcel* parcel,
         return AParcel_writeStringArray(parcel, arrayData, static_cast<int32_t>(N),
                                         &AParcel_stdArrayStringElementGetter<N>);
     } else {
+        if constexpr (is_trivially_parcelable_v<T>) {
+            binder_status_t status = AParcel_writeTriviallyParcelableArray(parcel, arr.data(), N);
+            if (status != STATUS_INVALID_OPERATION) return status;
+        }
         const void* arrayData = static_cast<const void*>(&arr);
         return AParcel_writeParcelableArray(parcel, arrayData, static_cast<int32_t>(N),
                                             &AParcel_writeStdArrayData<T, N>);
@@ -1523,8 +1710,12 @@ template <typename T, size_t N>
 static inline binder_status_t AParcel_readFixedArray(const AParcel* parcel, std::array<T, N>* arr) {
     void* arrayData = static_cast<void*>(arr);
     if constexpr (std::is_same_v<T, bool>) {
-        return AParcel_readBoolArray(parcel, arrayData, &AParcel_stdArrayExternalAllocator<N>,
-                                     &AParcel_stdArraySetter<T, N>);
+        std::array<int32_t, N> values;
+        binder_status_t status = AParcel_readInt32Array(parcel, static_cast<void*>(&values),
+                                                        &AParcel_stdArrayAllocator<int32_t, N>);
+        if (status != STATUS_OK) return status;
+        for (size_t i = 0; i < N; i++) (*arr)[i] = values[i] != 0;
+        return STATUS_OK;
     } else if constexpr (std::is_same_v<T, uint8_t>) {
         return AParcel_readByteArray(parcel, arrayData, &AParcel_stdArrayAllocator<int8_t, N>);
     } else if constexpr (std::is_same_v<T, char16_t>) {
@@ -1541,6 +1732,13 @@ static inline binder_status_t AParcel_readFixedArray(const AParcel* parcel, std:
         return AParcel_readStringArray(parcel, arrayData, &AParcel_stdArrayExternalAllocator<N>,
                                        &AParcel_stdArrayStringElementAllocator<N>);
     } else {
+        if constexpr (is_trivially_parcelable_v<T>) {
+            binder_status_t status = AParcel_readTriviallyParcelableArray<T>(
+                    parcel, [arr](int32_t length) -> T* {
+                        return static_cast<size_t>(length) == N ? arr->data() : nullptr;
+                    });
+            if (status != STATUS_INVALID_OPERATION) return status;
+        }
         return AParcel_readParcelableArray(parcel, arrayData, &AParcel_stdArrayExternalAllocator<N>,
                                            &AParcel_readStdArrayData<T, N>);
     }
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/logging.h>
+#include <android/binder_auto_utils.h>
+#include <android/binder_parcel_utils.h>
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "fixed_size_parcelables.h"
+
+// Compares vectors of a parcelable copied in bulk (TriviallyParcelablePoint)
+// with the same parcelable written and read one element at a time
+// (ParcelablePoint). Both have the same parcel layout.
+
+template <typename P>
+static std::vector<P> makePoints(size_t count) {
+    std::vector<P> points;
+    for (size_t i = 0; i < count; i++) points.push_back(makePoint<P>(static_cast<int32_t>(i)));
+    return points;
+}
+
+template <typename P>
+static void BM_writeVector(benchmark::State& state) {
+    const std::vector<P> points = makePoints<P>(state.range(0));
+    ndk::ScopedAParcel parcel(AParcel_create());
+    while (state.KeepRunning()) {
+        AParcel_reset(parcel.get());
+        CHECK_EQ(STATUS_OK, ndk::AParcel_writeVector(parcel.get(), points));
+    }
+    state.SetBytesProcessed(state.iterations() * AParcel_getDataSize(parcel.get()));
+}
+BENCHMARK_TEMPLATE(BM_writeVector, TriviallyParcelablePoint)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_writeVector, ParcelablePoint)->Arg(10000);
+
+template <typename P>
+static void BM_readVector(benchmark::State& state) {
+    ndk::ScopedAParcel parcel(AParcel_create());
+    CHECK_EQ(STATUS_OK, ndk::AParcel_writeVector(parcel.get(), makePoints<P>(state.range(0))));
+    std::vector<P> points;
+    while (state.KeepRunning()) {
+        AParcel_setDataPosition(parcel.get(), 0);
+        CHECK_EQ(STATUS_OK, ndk::AParcel_readVector(parcel.get(), &points));
+    }
+    state.SetBytesProcessed(state.iterations() * AParcel_getDataSize(parcel.get()));
+}
+BENCHMARK_TEMPLATE(BM_readVector, TriviallyParcelablePoint)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_readVector, ParcelablePoint)->Arg(10000);
+
+BENCHMARK_MAIN();
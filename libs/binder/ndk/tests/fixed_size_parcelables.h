@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/binder_parcel.h>
+
+#include <stdint.h>
+
+// A parcelable written the way the AIDL NDK backend writes a structured parcelable with these
+// fields. Only PointT<true> lets binder_parcel_utils.h copy arrays of it in bulk.
+template <bool kTrivial>
+struct PointT {
+    static constexpr bool kTriviallyParcelable = kTrivial;
+
+    int32_t x = 0;
+    int32_t y = 0;
+    int64_t timestampNs = 0;
+    int32_t pressure = 0;
+    int32_t flags = 0;
+
+    binder_status_t writeToParcel(AParcel* parcel) const {
+        int32_t start = AParcel_getDataPosition(parcel);
+        binder_status_t status = AParcel_writeInt32(parcel, 0);
+        if (status == STATUS_OK) status = AParcel_writeInt32(parcel, x);
+        if (status == STATUS_OK) status = AParcel_writeInt32(parcel, y);
+        if (status == STATUS_OK) status = AParcel_writeInt64(parcel, timestampNs);
+        if (status == STATUS_OK) status = AParcel_writeInt32(parcel, pressure);
+        if (status == STATUS_OK) status = AParcel_writeInt32(parcel, flags);
+        if (status != STATUS_OK) return status;
+        int32_t end = AParcel_getDataPosition(parcel);
+        AParcel_setDataPosition(parcel, start);
+        AParcel_writeInt32(parcel, end - start);
+        return AParcel_setDataPosition(parcel, end);
+    }
+
+    binder_status_t readFromParcel(const AParcel* parcel) {
+        int32_t start = AParcel_getDataPosition(parcel);
+        int32_t size;
+        binder_status_t status = AParcel_readInt32(parcel, &size);
+        if (status != STATUS_OK) return status;
+        if (size < 4 || start > INT32_MAX - size) return STATUS_BAD_VALUE;
+        // Fields missing from an older writer keep their defaults.
+        auto more = [&]() { return AParcel_getDataPosition(parcel) - start < size; };
+        if (more()) status = AParcel_readInt32(parcel, &x);
+        if (status == STATUS_OK && more()) status = AParcel_readInt32(parcel, &y);
+        if (status == STATUS_OK && more()) status = AParcel_readInt64(parcel, &timestampNs);
+        if (status == STATUS_OK && more()) status = AParcel_readInt32(parcel, &pressure);
+        if (status == STATUS_OK && more()) status = AParcel_readInt32(parcel, &flags);
+        if (status != STATUS_OK) return status;
+        return AParcel_setDataPosition(parcel, start + size);
+    }
+
+    template <bool kOther>
+    bool operator==(const PointT<kOther>& o) const {
+        return x == o.x && y == o.y && timestampNs == o.timestampNs && pressure == o.pressure &&
+                flags == o.flags;
+    }
+};
+
+using TriviallyParcelablePoint = PointT<true>;
+using ParcelablePoint = PointT<false>;
+
+static_assert(sizeof(TriviallyParcelablePoint) == 24, "fields must not be padded");
+
+template <typename P>
+static inline P makePoint(int32_t i) {
+    P p;
+    p.x = i;
+    p.y = -i;
+    p.timestampNs = int64_t(i) * 1000000;
+    p.pressure = i % 100;
+    p.flags = i & 0xf;
+    return p;
+}
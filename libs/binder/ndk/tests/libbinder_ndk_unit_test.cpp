@@ -33,14 +33,18 @@
 #include <binder/IResultReceiver.h>
 #include <binder/IServiceManager.h>
 #include <binder/IShellCallback.h>
+#include <binder/RpcServer.h>
+#include <binder/RpcSession.h>
 
 #include <sys/prctl.h>
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <iostream>
 #include <mutex>
 #include <thread>
 #include "android/binder_ibinder.h"
+#include "fixed_size_parcelables.h"
 
 using namespace android;
 
@@ -774,6 +778,210 @@ TEST(NdkBinder_ScopedAResource, Release) {
     EXPECT_EQ(deleteCount, 0);
 }
 
+// Returns the raw contents of |parcel|, which must hold no objects.
+static std::vector<uint8_t> parcelBytes(const AParcel* parcel) {
+    std::vector<uint8_t> bytes(AParcel_getDataSize(parcel));
+    EXPECT_EQ(STATUS_OK, AParcel_marshal(parcel, bytes.data(), 0, bytes.size()));
+    return bytes;
+}
+
+TEST(NdkBinder_ParcelUtils, TriviallyParcelableArraysKeepTheirLayout) {
+    std::vector<TriviallyParcelablePoint> trivial;
+    std::vector<ParcelablePoint> generic;
+    for (int32_t i = 0; i < 100; i++) {
+        trivial.push_back(makePoint<TriviallyParcelablePoint>(i));
+        generic.push_back(makePoint<ParcelablePoint>(i));
+    }
+
+    ndk::ScopedAParcel bulk(AParcel_create());
+    ndk::ScopedAParcel perElement(AParcel_create());
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(bulk.get(), trivial));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(perElement.get(), generic));
+    EXPECT_EQ(parcelBytes(perElement.get()), parcelBytes(bulk.get()));
+
+    // Each side reads what the other wrote.
+    std::vector<TriviallyParcelablePoint> trivialOut;
+    std::vector<ParcelablePoint> genericOut;
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(bulk.get(), 0));
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(perElement.get(), 0));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readVector(perElement.get(), &trivialOut));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readVector(bulk.get(), &genericOut));
+    EXPECT_EQ(trivial, trivialOut);
+    EXPECT_EQ(generic, genericOut);
+    EXPECT_EQ(AParcel_getDataSize(bulk.get()), AParcel_getDataPosition(bulk.get()));
+    EXPECT_EQ(AParcel_getDataSize(perElement.get()), AParcel_getDataPosition(perElement.get()));
+}
+
+TEST(NdkBinder_ParcelUtils, TriviallyParcelableFixedArrays) {
+    std::array<TriviallyParcelablePoint, 8> points;
+    for (int32_t i = 0; i < 8; i++) points[i] = makePoint<TriviallyParcelablePoint>(i);
+    std::array<bool, 5> bools = {true, false, false, true, true};
+
+    ndk::ScopedAParcel parcel(AParcel_create());
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeData(parcel.get(), points));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeData(parcel.get(), bools));
+
+    std::array<TriviallyParcelablePoint, 8> pointsOut;
+    std::array<bool, 5> boolsOut;
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(parcel.get(), 0));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readData(parcel.get(), &pointsOut));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readData(parcel.get(), &boolsOut));
+    EXPECT_EQ(points, pointsOut);
+    EXPECT_EQ(bools, boolsOut);
+
+    // A different length is still rejected.
+    std::array<TriviallyParcelablePoint, 4> tooShort;
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(parcel.get(), 0));
+    EXPECT_NE(STATUS_OK, ndk::AParcel_readData(parcel.get(), &tooShort));
+}
+
+// Written by a newer version of the parcelable, with one more field.
+struct ExtendedPoint {
+    ParcelablePoint point;
+    int32_t extra = 0;
+
+    binder_status_t writeToParcel(AParcel* parcel) const {
+        int32_t start = AParcel_getDataPosition(parcel);
+        binder_status_t status = point.writeToParcel(parcel);
+        if (status != STATUS_OK) return status;
+        // Grow the size header to cover the extra field.
+        int32_t end = AParcel_getDataPosition(parcel);
+        status = AParcel_writeInt32(parcel, extra);
+        if (status != STATUS_OK) return status;
+        AParcel_setDataPosition(parcel, start);
+        AParcel_writeInt32(parcel, end - start + static_cast<int32_t>(sizeof(int32_t)));
+        return AParcel_setDataPosition(parcel, end + static_cast<int32_t>(sizeof(int32_t)));
+    }
+    binder_status_t readFromParcel(const AParcel*) { return STATUS_INVALID_OPERATION; }
+};
+
+TEST(NdkBinder_ParcelUtils, TriviallyParcelableFallsBackForOtherLayouts) {
+    std::vector<ExtendedPoint> extended(10);
+    for (int32_t i = 0; i < 10; i++) {
+        extended[i].point = makePoint<ParcelablePoint>(i);
+        extended[i].extra = 42;
+    }
+    ndk::ScopedAParcel parcel(AParcel_create());
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(parcel.get(), extended));
+    ASSERT_EQ(STATUS_OK, AParcel_writeInt32(parcel.get(), 7));
+
+    std::vector<TriviallyParcelablePoint> out;
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(parcel.get(), 0));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readVector(parcel.get(), &out));
+    ASSERT_EQ(10u, out.size());
+    for (int32_t i = 0; i < 10; i++) EXPECT_EQ(extended[i].point, out[i]);
+    int32_t trailer;
+    ASSERT_EQ(STATUS_OK, AParcel_readInt32(parcel.get(), &trailer));
+    EXPECT_EQ(7, trailer);
+}
+
+// Passes the compile-time checks for kTriviallyParcelable, but writes its byte fields as int32s.
+template <bool kTrivial>
+struct NarrowFieldsT {
+    static constexpr bool kTriviallyParcelable = kTrivial;
+
+    int32_t id = 0;
+    int8_t flags[4] = {};
+
+    binder_status_t writeToParcel(AParcel* parcel) const {
+        int32_t start = AParcel_getDataPosition(parcel);
+        binder_status_t status = AParcel_writeInt32(parcel, 0);
+        if (status == STATUS_OK) status = AParcel_writeInt32(parcel, id);
+        for (int8_t flag : flags) {
+            if (status == STATUS_OK) status = AParcel_writeByte(parcel, flag);
+        }
+        if (status != STATUS_OK) return status;
+        int32_t end = AParcel_getDataPosition(parcel);
+        AParcel_setDataPosition(parcel, start);
+        AParcel_writeInt32(parcel, end - start);
+        return AParcel_setDataPosition(parcel, end);
+    }
+
+    binder_status_t readFromParcel(const AParcel* parcel) {
+        int32_t start = AParcel_getDataPosition(parcel);
+        int32_t size;
+        binder_status_t status = AParcel_readInt32(parcel, &size);
+        if (status == STATUS_OK) status = AParcel_readInt32(parcel, &id);
+        for (int8_t& flag : flags) {
+            if (status == STATUS_OK) status = AParcel_readByte(parcel, &flag);
+        }
+        if (status != STATUS_OK) return status;
+        return AParcel_setDataPosition(parcel, start + size);
+    }
+
+    template <bool kOther>
+    bool operator==(const NarrowFieldsT<kOther>& o) const {
+        return id == o.id && std::equal(std::begin(flags), std::end(flags), std::begin(o.flags));
+    }
+};
+
+TEST(NdkBinder_ParcelUtils, TriviallyParcelableNotUsedForNarrowFields) {
+    std::vector<NarrowFieldsT<true>> declared(10);
+    std::vector<NarrowFieldsT<false>> generic(10);
+    for (int32_t i = 0; i < 10; i++) {
+        declared[i].id = generic[i].id = i;
+        for (int8_t j = 0; j < 4; j++) declared[i].flags[j] = generic[i].flags[j] = -j;
+    }
+
+    ndk::ScopedAParcel written(AParcel_create());
+    ndk::ScopedAParcel perElement(AParcel_create());
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(written.get(), declared));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(perElement.get(), generic));
+    EXPECT_EQ(parcelBytes(perElement.get()), parcelBytes(written.get()));
+
+    std::vector<NarrowFieldsT<false>> out;
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(written.get(), 0));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readVector(written.get(), &out));
+    EXPECT_EQ(generic, out);
+}
+
+// RPC parcels can't take data appended from a parcel of another context, so the bulk path must
+// not rely on that.
+TEST(NdkBinder_ParcelUtils, TriviallyParcelableArraysOnRpcParcels) {
+    class RpcEmpty : public aidl::BnEmpty {};
+    std::shared_ptr<RpcEmpty> empty = ndk::SharedRefBase::make<RpcEmpty>();
+
+    std::string addr = std::string(getenv("TMPDIR") ?: "/tmp") + "/binderNdkUnitTestRpc";
+    unlink(addr.c_str());
+    auto server = android::RpcServer::make();
+    server->setRootObject(AIBinder_toPlatformBinder(empty->asBinder().get()));
+    ASSERT_EQ(android::OK, server->setupUnixDomainServer(addr.c_str()));
+    server->start();
+
+    auto session = android::RpcSession::make();
+    ASSERT_EQ(android::OK, session->setupUnixDomainClient(addr.c_str()));
+    ndk::SpAIBinder binder(AIBinder_fromPlatformBinder(session->getRootObject()));
+    // Associates the class, which preparing a transaction requires.
+    ASSERT_NE(nullptr, aidl::IEmpty::fromBinder(binder));
+
+    std::vector<TriviallyParcelablePoint> trivial;
+    std::vector<ParcelablePoint> generic;
+    for (int32_t i = 0; i < 50; i++) {
+        trivial.push_back(makePoint<TriviallyParcelablePoint>(i));
+        generic.push_back(makePoint<ParcelablePoint>(i));
+    }
+
+    AParcel* in = nullptr;
+    ASSERT_EQ(STATUS_OK, AIBinder_prepareTransaction(binder.get(), &in));
+    ndk::ScopedAParcel bulk(in);
+    ASSERT_EQ(STATUS_OK, AIBinder_prepareTransaction(binder.get(), &in));
+    ndk::ScopedAParcel perElement(in);
+
+    const int32_t start = AParcel_getDataPosition(bulk.get());
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(bulk.get(), trivial));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_writeVector(perElement.get(), generic));
+    EXPECT_EQ(parcelBytes(perElement.get()), parcelBytes(bulk.get()));
+
+    std::vector<ParcelablePoint> genericOut;
+    ASSERT_EQ(STATUS_OK, AParcel_setDataPosition(bulk.get(), start));
+    ASSERT_EQ(STATUS_OK, ndk::AParcel_readVector(bulk.get(), &genericOut));
+    EXPECT_EQ(generic, genericOut);
+    EXPECT_EQ(AParcel_getDataSize(bulk.get()), AParcel_getDataPosition(bulk.get()));
+
+    EXPECT_TRUE(session->shutdownAndWait(true));
+    EXPECT_TRUE(server->shutdown());
+}
+
 int main(int argc, char* argv[]) {
     ::testing::InitGoogleTest(&argc, argv);
 
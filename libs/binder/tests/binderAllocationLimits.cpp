@@ -15,6 +15,7 @@
  */
 
 #include <android-base/logging.h>
+#include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
 #include <binder/IServiceManager.h>
 #include <gtest/gtest.h>
@@ -175,6 +176,51 @@ TEST(BinderAllocation, SmallTransaction) {
     EXPECT_EQ(mallocs, 1);
 }
 
+TEST(BinderAllocation, EnforceInterface) {
+    const String16 descriptor = String16("android.os.IServiceManager");
+    Parcel p;
+    p.writeInterfaceToken(descriptor);
+    p.setDataPosition(0);
+    android::IPCThreadState::self(); // first call may alloc
+
+    const auto m = ScopeDisallowMalloc();
+    EXPECT_TRUE(p.enforceInterface(descriptor));
+}
+
+TEST(BinderAllocation, RecycledParcelWrite) {
+    const String16 descriptor = String16("android.os.IServiceManager");
+    Parcel::setBufferRecyclingEnabled(true);
+    {
+        // first parcel on this thread fills the cache
+        Parcel p;
+        p.writeInt32(1);
+    }
+    {
+        const auto m = ScopeDisallowMalloc();
+        for (size_t i = 0; i < 100; i++) {
+            Parcel p;
+            p.writeInterfaceToken(descriptor);
+            p.writeInt32(i);
+            imaginary_use = p.data();
+        }
+    }
+    Parcel::setBufferRecyclingEnabled(false);
+}
+
+TEST(BinderAllocation, RecycledSmallTransaction) {
+    String16 empty_descriptor = String16("");
+    sp<IServiceManager> manager = defaultServiceManager();
+
+    Parcel::setBufferRecyclingEnabled(true);
+    manager->checkService(empty_descriptor); // first call may alloc
+    {
+        const auto m = ScopeDisallowMalloc();
+        manager->checkService(empty_descriptor);
+        manager->checkService(empty_descriptor);
+    }
+    Parcel::setBufferRecyclingEnabled(false);
+}
+
 int main(int argc, char** argv) {
     if (getenv("LIBC_HOOKS_ENABLE") == nullptr) {
         CHECK(0 == setenv("LIBC_HOOKS_ENABLE", "1", true /*overwrite*/));
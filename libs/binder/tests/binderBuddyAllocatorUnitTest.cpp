@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "../BuddyAllocator.h"
+
+using android::BuddyAllocator;
+using android::NAME_NOT_FOUND;
+using android::NO_ERROR;
+using android::NO_MEMORY;
+
+namespace {
+
+// a power of two, so that the whole heap is a single block
+constexpr size_t kHeapSize = 64 * 1024;
+const size_t kFailed = static_cast<size_t>(NO_MEMORY);
+
+size_t roundedSize(size_t size) {
+    size_t block = BuddyAllocator::minBlockSize();
+    while (block < size) block <<= 1;
+    return block;
+}
+
+} // namespace
+
+TEST(BuddyAllocator, AllocationsDontOverlap) {
+    BuddyAllocator allocator(kHeapSize);
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<size_t> sizes(1, 2048);
+
+    // offset to end of every live allocation
+    std::map<size_t, size_t> live;
+    for (int i = 0; i < 1000; i++) {
+        if (!live.empty() && i % 3 == 0) {
+            auto it = std::next(live.begin(), rng() % live.size());
+            ASSERT_EQ(NO_ERROR, allocator.deallocate(it->first));
+            live.erase(it);
+            continue;
+        }
+        size_t size = sizes(rng);
+        size_t offset = allocator.allocate(size);
+        if (offset == kFailed) continue;
+        size_t end = offset + size;
+        ASSERT_LE(end, kHeapSize);
+
+        auto next = live.lower_bound(offset);
+        if (next != live.end()) EXPECT_LE(end, next->first);
+        if (next != live.begin()) EXPECT_LE(std::prev(next)->second, offset);
+        live[offset] = end;
+    }
+}
+
+TEST(BuddyAllocator, AllocationsAreAligned) {
+    BuddyAllocator allocator(kHeapSize);
+    for (size_t size : {1, 31, 32, 33, 100, 1000, 4096, 5000}) {
+        size_t offset = allocator.allocate(size);
+        ASSERT_NE(kFailed, offset) << size;
+        EXPECT_EQ(0u, offset % BuddyAllocator::minBlockSize()) << size;
+        // blocks are aligned to their own size
+        EXPECT_EQ(0u, offset % roundedSize(size)) << size;
+    }
+}
+
+TEST(BuddyAllocator, FreeingEverythingCoalesces) {
+    BuddyAllocator allocator(kHeapSize);
+    std::vector<size_t> offsets;
+    for (size_t offset; (offset = allocator.allocate(BuddyAllocator::minBlockSize())) != kFailed;) {
+        offsets.push_back(offset);
+    }
+    EXPECT_EQ(kHeapSize / BuddyAllocator::minBlockSize(), offsets.size());
+
+    // free in an order which leaves no buddies next to each other until the end
+    for (size_t i = 0; i < offsets.size(); i += 2) {
+        ASSERT_EQ(NO_ERROR, allocator.deallocate(offsets[i]));
+    }
+    EXPECT_EQ(kFailed, allocator.allocate(2 * BuddyAllocator::minBlockSize()));
+    for (size_t i = 1; i < offsets.size(); i += 2) {
+        ASSERT_EQ(NO_ERROR, allocator.deallocate(offsets[i]));
+    }
+
+    // only possible if the heap is a single free block again
+    EXPECT_EQ(0u, allocator.allocate(kHeapSize));
+}
+
+TEST(BuddyAllocator, FailsWhenExhausted) {
+    BuddyAllocator allocator(kHeapSize);
+    EXPECT_EQ(kFailed, allocator.allocate(kHeapSize + 1));
+
+    size_t half = allocator.allocate(kHeapSize / 2);
+    ASSERT_NE(kFailed, half);
+    size_t quarter = allocator.allocate(kHeapSize / 4);
+    ASSERT_NE(kFailed, quarter);
+    EXPECT_EQ(kFailed, allocator.allocate(kHeapSize / 2));
+
+    size_t lastQuarter = allocator.allocate(kHeapSize / 4);
+    ASSERT_NE(kFailed, lastQuarter);
+    EXPECT_EQ(kFailed, allocator.allocate(1));
+
+    ASSERT_EQ(NO_ERROR, allocator.deallocate(quarter));
+    EXPECT_EQ(quarter, allocator.allocate(kHeapSize / 4));
+}
+
+TEST(BuddyAllocator, DeallocateUnknownOffset) {
+    BuddyAllocator allocator(kHeapSize);
+    EXPECT_EQ(NAME_NOT_FOUND, allocator.deallocate(0));
+
+    size_t first = allocator.allocate(100);
+    ASSERT_NE(kFailed, first);
+    size_t second = allocator.allocate(100);
+    ASSERT_NE(kFailed, second);
+
+    // inside an allocation, and free space
+    EXPECT_EQ(NAME_NOT_FOUND, allocator.deallocate(first + BuddyAllocator::minBlockSize()));
+    EXPECT_EQ(NAME_NOT_FOUND, allocator.deallocate(kHeapSize / 2));
+    EXPECT_EQ(NAME_NOT_FOUND, allocator.deallocate(kHeapSize * 2));
+
+    ASSERT_EQ(NO_ERROR, allocator.deallocate(first));
+    EXPECT_EQ(NAME_NOT_FOUND, allocator.deallocate(first));
+
+    // the bad calls left the allocator intact
+    ASSERT_EQ(NO_ERROR, allocator.deallocate(second));
+    EXPECT_EQ(0u, allocator.allocate(kHeapSize));
+}
@@ -20,8 +20,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <thread>
 
 #include <gmock/gmock.h>
@@ -39,10 +43,12 @@
 #include <binder/IServiceManager.h>
 #include <binder/RpcServer.h>
 #include <binder/RpcSession.h>
+#include <binder/TransactionStats.h>
 
 #include <linux/sched.h>
 #include <sys/epoll.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -115,9 +121,20 @@ enum BinderLibTestTranscationCode {
     BINDER_LIB_TEST_ECHO_VECTOR,
     BINDER_LIB_TEST_REJECT_OBJECTS,
     BINDER_LIB_TEST_CAN_GET_SID,
+    BINDER_LIB_TEST_ONEWAY_CALL_BACKS,
+    BINDER_LIB_TEST_ADD_ADAPTIVE_SERVER,
+    BINDER_LIB_TEST_GET_THREAD_POOL_STATS,
 };
 
-pid_t start_server_process(int arg2, bool usePoll = false)
+// Thread pool of the servers started with BINDER_LIB_TEST_ADD_ADAPTIVE_SERVER. It grows on
+// every starvation, so that the tests don't depend on how long a call takes: with one thread,
+// each call starves the pool.
+constexpr size_t kAdaptiveMinThreads = 1;
+constexpr size_t kAdaptiveMaxThreads = 4;
+constexpr int64_t kAdaptiveGrowAfterMs = 0;
+constexpr int64_t kAdaptiveIdleTimeoutMs = 100;
+
+pid_t start_server_process(int arg2, bool usePoll = false, bool adaptivePool = false)
 {
     int ret;
     pid_t pid;
@@ -142,7 +159,7 @@ pid_t start_server_process(int arg2, bool usePoll = false)
 
     snprintf(stri, sizeof(stri), "%d", arg2);
     snprintf(strpipefd1, sizeof(strpipefd1), "%d", pipefd[1]);
-    snprintf(usepoll, sizeof(usepoll), "%d", usePoll ? 1 : 0);
+    snprintf(usepoll, sizeof(usepoll), "%d", usePoll ? 1 : adaptivePool ? 2 : 0);
 
     pid = fork();
     if (pid == -1)
@@ -270,6 +287,11 @@ class BinderLibTest : public ::testing::Test {
             return addServerEtc(idPtr, BINDER_LIB_TEST_ADD_POLL_SERVER);
         }
 
+        sp<IBinder> addAdaptiveServer(int32_t *idPtr = nullptr)
+        {
+            return addServerEtc(idPtr, BINDER_LIB_TEST_ADD_ADAPTIVE_SERVER);
+        }
+
         void waitForReadData(int fd, int timeout_ms) {
             int ret;
             pollfd pfd = pollfd();
@@ -456,6 +478,415 @@ TEST_F(BinderLibTest, NopTransaction) {
                 StatusEq(NO_ERROR));
 }
 
+TEST_F(BinderLibTest, CommandBatchPiggybacksFreeBuffer) {
+    IPCThreadState* ipc = IPCThreadState::self();
+    const uint64_t savedBefore = ipc->getCommandBatchStats().savedFlushes;
+
+    constexpr size_t kTransactions = 10;
+    ipc->beginCommandBatch();
+    for (size_t i = 0; i < kTransactions; i++) {
+        // BC_FREE_BUFFER for each reply is sent with the next transaction.
+        Parcel data, reply;
+        EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply),
+                    StatusEq(NO_ERROR));
+    }
+    ipc->endCommandBatch();
+
+    EXPECT_EQ(kTransactions - 1, ipc->getCommandBatchStats().savedFlushes - savedBefore);
+}
+
+static int32_t handleOf(const sp<IBinder>& binder) {
+    Parcel data;
+    data.writeStrongBinder(binder);
+    return ((struct flat_binder_object *)(data.data()))->handle;
+}
+
+TEST_F(BinderLibTest, CommandBatchCancelsAcquireRelease) {
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int32_t handle = handleOf(m_server);
+    const uint64_t cancelledBefore = ipc->getCommandBatchStats().cancelledRefCommands;
+
+    ipc->beginCommandBatch();
+    ipc->incStrongHandle(handle, m_server->remoteBinder());
+    ipc->decStrongHandle(handle);
+    ipc->incWeakHandle(handle, m_server->remoteBinder());
+    ipc->decWeakHandle(handle);
+    ipc->endCommandBatch();
+
+    EXPECT_EQ(4u, ipc->getCommandBatchStats().cancelledRefCommands - cancelledBefore);
+    // The driver still holds the strong reference the proxy took.
+    Parcel data, reply;
+    EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply),
+                StatusEq(NO_ERROR));
+}
+
+TEST_F(BinderLibTest, CommandBatchCancelsInterleavedHandles) {
+    sp<IBinder> server = addServer();
+    ASSERT_TRUE(server != nullptr);
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int32_t handleA = handleOf(m_server);
+    const int32_t handleB = handleOf(server);
+    ASSERT_NE(handleA, handleB);
+    const uint64_t cancelledBefore = ipc->getCommandBatchStats().cancelledRefCommands;
+
+    ipc->beginCommandBatch();
+    ipc->incStrongHandle(handleA, m_server->remoteBinder());
+    ipc->incStrongHandle(handleB, server->remoteBinder());
+    ipc->incWeakHandle(handleA, m_server->remoteBinder());
+    ipc->decStrongHandle(handleA);
+    ipc->decWeakHandle(handleA);
+    ipc->decStrongHandle(handleB);
+    ipc->endCommandBatch();
+
+    EXPECT_EQ(6u, ipc->getCommandBatchStats().cancelledRefCommands - cancelledBefore);
+    Parcel data, reply;
+    EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply),
+                StatusEq(NO_ERROR));
+    EXPECT_THAT(server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply),
+                StatusEq(NO_ERROR));
+}
+
+TEST_F(BinderLibTest, CommandBatchCancelsAroundOtherCommands) {
+    sp<IBinder> server = addServer();
+    ASSERT_TRUE(server != nullptr);
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int32_t handleA = handleOf(m_server);
+    const int32_t handleB = handleOf(server);
+    const uint64_t cancelledBefore = ipc->getCommandBatchStats().cancelledRefCommands;
+
+    auto reply = std::make_unique<Parcel>();
+    {
+        Parcel data;
+        ASSERT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, reply.get()),
+                    StatusEq(NO_ERROR));
+    }
+
+    ipc->beginCommandBatch();
+    ipc->incStrongHandle(handleA, m_server->remoteBinder());
+    // BC_FREE_BUFFER, which is not a multiple of the refcount command size on 64-bit
+    reply.reset();
+    ipc->incWeakHandle(handleB, server->remoteBinder());
+    ipc->incStrongHandle(handleB, server->remoteBinder());
+    // Cancelling these moves the commands queued after them.
+    ipc->decStrongHandle(handleA);
+    ipc->decStrongHandle(handleB);
+    ipc->endCommandBatch();
+
+    EXPECT_EQ(4u, ipc->getCommandBatchStats().cancelledRefCommands - cancelledBefore);
+
+    // BC_FREE_BUFFER and BC_INCREFS were sent. Had the stream been framed wrong, the driver
+    // would have rejected it, and these would fail along with it.
+    ipc->decWeakHandle(handleB);
+    Parcel data, reply2;
+    EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply2),
+                StatusEq(NO_ERROR));
+    EXPECT_THAT(server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply2),
+                StatusEq(NO_ERROR));
+}
+
+TEST_F(BinderLibTest, ThreadPoolStats) {
+    sp<ProcessState> proc = ProcessState::self();
+    ProcessState::ThreadPoolStats stats = proc->getThreadPoolStats();
+    EXPECT_GE(stats.threads, 1u);
+    EXPECT_LE(stats.executingThreads, stats.threads);
+    EXPECT_EQ(stats.maxThreads, proc->getThreadPoolMaxThreadCount());
+    EXPECT_EQ(stats.threadsRetired, 0u);
+}
+
+struct AdaptiveThreadPoolStats {
+    uint64_t maxThreads;
+    uint64_t threadsGrown;
+    uint64_t threadsRetired;
+};
+
+static AdaptiveThreadPoolStats getAdaptiveThreadPoolStats(const sp<IBinder>& server) {
+    Parcel data, reply;
+    EXPECT_THAT(server->transact(BINDER_LIB_TEST_GET_THREAD_POOL_STATS, data, &reply),
+                StatusEq(NO_ERROR));
+    AdaptiveThreadPoolStats stats{};
+    EXPECT_THAT(reply.readUint64(&stats.maxThreads), StatusEq(NO_ERROR));
+    EXPECT_THAT(reply.readUint64(&stats.threadsGrown), StatusEq(NO_ERROR));
+    EXPECT_THAT(reply.readUint64(&stats.threadsRetired), StatusEq(NO_ERROR));
+    return stats;
+}
+
+// Asks |server| for its thread pool stats until |done| returns true for them, for at most 10 s.
+// Each request is a call which the pool handles, so it also grows a pool with a single thread.
+template <typename Done>
+static AdaptiveThreadPoolStats waitForAdaptiveThreadPool(const sp<IBinder>& server, Done done) {
+    const auto deadline = std::chrono::steady_clock::now() + 10s;
+    AdaptiveThreadPoolStats stats = getAdaptiveThreadPoolStats(server);
+    while (!done(stats) && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(kAdaptiveIdleTimeoutMs / 4));
+        stats = getAdaptiveThreadPoolStats(server);
+    }
+    return stats;
+}
+
+TEST_F(BinderLibTest, ThreadPoolAdaptiveGrowsWhenStarved) {
+    sp<IBinder> server = addAdaptiveServer();
+    ASSERT_NE(nullptr, server);
+    EXPECT_EQ(kAdaptiveMinThreads, getAdaptiveThreadPoolStats(server).maxThreads);
+
+    AdaptiveThreadPoolStats stats =
+            waitForAdaptiveThreadPool(server, [](const AdaptiveThreadPoolStats& current) {
+                return current.threadsGrown > 0;
+            });
+    EXPECT_GT(stats.threadsGrown, 0u);
+    EXPECT_GT(stats.maxThreads, kAdaptiveMinThreads);
+    EXPECT_LE(stats.maxThreads, kAdaptiveMaxThreads);
+}
+
+TEST_F(BinderLibTest, ThreadPoolAdaptiveShrinksWhenIdle) {
+    sp<IBinder> server = addAdaptiveServer();
+    ASSERT_NE(nullptr, server);
+    const uint64_t grownMaxThreads =
+            waitForAdaptiveThreadPool(server, [](const AdaptiveThreadPoolStats& current) {
+                return current.maxThreads > kAdaptiveMinThreads;
+            }).maxThreads;
+    ASSERT_GT(grownMaxThreads, kAdaptiveMinThreads);
+
+    // Idle threads retire once an idle timeout passes, without any command waking them. The
+    // stats requests keep at most one thread busy, which leaves the others idle.
+    AdaptiveThreadPoolStats stats =
+            waitForAdaptiveThreadPool(server, [&](const AdaptiveThreadPoolStats& current) {
+                return current.threadsRetired > 0 && current.maxThreads < grownMaxThreads;
+            });
+    EXPECT_GT(stats.threadsRetired, 0u);
+    EXPECT_LT(stats.maxThreads, grownMaxThreads);
+    EXPECT_GE(stats.maxThreads, kAdaptiveMinThreads);
+}
+
+TEST_F(BinderLibTest, TransactionStatsRecordsInterfaceToken) {
+    constexpr char16_t kDescriptor[] = u"android.binder.test.ITransactionStats";
+    TransactionStats::setEnabled(true);
+    TransactionStats::reset();
+
+    constexpr size_t kTransactions = 5;
+    for (size_t i = 0; i < kTransactions; i++) {
+        Parcel data, reply;
+        data.writeInterfaceToken(String16(kDescriptor));
+        EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply),
+                    StatusEq(NO_ERROR));
+    }
+
+    size_t matches = 0;
+    for (const TransactionStats::Entry& entry : TransactionStats::getEntries()) {
+        if (entry.descriptor != String8(kDescriptor).c_str()) continue;
+        matches++;
+        EXPECT_EQ(TransactionStats::Direction::OUTGOING, entry.direction);
+        EXPECT_EQ(static_cast<uint32_t>(BINDER_LIB_TEST_NOP_TRANSACTION), entry.code);
+        EXPECT_EQ(kTransactions, entry.count);
+        EXPECT_GT(entry.totalBytes, 0u);
+        uint64_t bucketed = 0;
+        for (uint64_t n : entry.latencyBuckets) bucketed += n;
+        EXPECT_EQ(kTransactions, bucketed);
+    }
+    EXPECT_EQ(1u, matches);
+    TransactionStats::setEnabled(false);
+}
+
+TEST_F(BinderLibTest, TransactionStatsKeepsDescriptorsApart) {
+    // only the last character kept differs
+    const std::string prefix(TransactionStats::kMaxDescriptorLength - 1, 'a');
+    const std::string first = prefix + "1";
+    const std::string second = prefix + "2";
+    TransactionStats::setEnabled(true);
+    TransactionStats::reset();
+
+    for (const std::string& descriptor : {first, second, second}) {
+        TransactionStats::record(TransactionStats::Direction::INCOMING,
+                                 std::u16string(descriptor.begin(), descriptor.end()), 1, 1000,
+                                 4);
+    }
+
+    std::map<std::string, uint64_t> counts;
+    for (const TransactionStats::Entry& entry : TransactionStats::getEntries()) {
+        counts[entry.descriptor] += entry.count;
+    }
+    EXPECT_EQ(1u, counts[first]);
+    EXPECT_EQ(2u, counts[second]);
+    TransactionStats::setEnabled(false);
+}
+
+TEST_F(BinderLibTest, TransactionStatsCutsLongDescriptors) {
+    const std::string kept(TransactionStats::kMaxDescriptorLength, 'a');
+    TransactionStats::setEnabled(true);
+    TransactionStats::reset();
+
+    // Callers choose the descriptor, so these share one entry.
+    for (const std::string& descriptor : {kept + "1", kept + std::string(100000, '2')}) {
+        TransactionStats::record(TransactionStats::Direction::INCOMING,
+                                 std::u16string(descriptor.begin(), descriptor.end()), 1, 1000,
+                                 4);
+    }
+
+    std::vector<TransactionStats::Entry> entries = TransactionStats::getEntries();
+    ASSERT_EQ(1u, entries.size());
+    EXPECT_EQ(kept, entries[0].descriptor);
+    EXPECT_EQ(2u, entries[0].count);
+    TransactionStats::setEnabled(false);
+}
+
+class OnewayQueueRecorder : public BBinder {
+public:
+    static constexpr uint32_t kBlockTransaction = FIRST_CALL_TRANSACTION;
+
+    status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply, uint32_t) override {
+        // Generated stubs write their status into the reply, oneway or not.
+        reply->writeInt32(NO_ERROR);
+        std::unique_lock<std::mutex> lock(mLock);
+        mCalls.emplace_back(code, data.readInt32());
+        mPriorities[code] = getpriority(PRIO_PROCESS, 0);
+        mCv.notify_all();
+        if (code == kBlockTransaction) {
+            mCv.wait(lock, [&] { return mUnblocked; });
+        }
+        return NO_ERROR;
+    }
+
+    void unblock() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mUnblocked = true;
+        mCv.notify_all();
+    }
+
+    std::vector<std::pair<uint32_t, int32_t>> waitForCalls(size_t count) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mCv.wait_for(lock, 5s, [&] { return mCalls.size() >= count; });
+        return mCalls;
+    }
+
+    // The priority the last call with |code| ran at.
+    int priorityOf(uint32_t code) {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mPriorities[code];
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mUnblocked = false;
+    std::vector<std::pair<uint32_t, int32_t>> mCalls;
+    std::map<uint32_t, int> mPriorities;
+};
+
+static void sendQueuedOneway(const sp<IBinder>& binder, uint32_t code, int32_t value) {
+    Parcel data;
+    data.writeInt32(value);
+    EXPECT_THAT(binder->transact(code, data, nullptr, IBinder::FLAG_ONEWAY), StatusEq(NO_ERROR));
+}
+
+TEST_F(BinderLibTest, OnewayQueueDispatchesInOrder) {
+    auto binder = sp<OnewayQueueRecorder>::make();
+    binder->setOnewayQueueEnabled(true);
+    ASSERT_TRUE(binder->isOnewayQueueEnabled());
+
+    // Holds up the queue, without holding up this thread.
+    sendQueuedOneway(binder, OnewayQueueRecorder::kBlockTransaction, 0);
+    ASSERT_EQ(1u, binder->waitForCalls(1).size());
+
+    constexpr uint32_t kCode = FIRST_CALL_TRANSACTION + 1;
+    for (int32_t i = 1; i <= 4; i++) sendQueuedOneway(binder, kCode, i);
+
+    binder->unblock();
+    std::vector<std::pair<uint32_t, int32_t>> calls = binder->waitForCalls(5);
+    ASSERT_EQ(5u, calls.size());
+    std::vector<int32_t> order;
+    for (size_t i = 1; i < calls.size(); i++) order.push_back(calls[i].second);
+    EXPECT_THAT(order, testing::ElementsAre(1, 2, 3, 4));
+}
+
+TEST_F(BinderLibTest, OnewayQueueRunsPrioritiesApart) {
+    constexpr uint32_t kCode = FIRST_CALL_TRANSACTION + 1;
+    // Lowering the priority needs no permission.
+    constexpr int kPriority = 5;
+    auto binder = sp<OnewayQueueRecorder>::make();
+    binder->setOnewayTransactionPriority(kCode, kPriority);
+    binder->setOnewayQueueEnabled(true);
+
+    // Holds up the calls of the default priority only.
+    sendQueuedOneway(binder, OnewayQueueRecorder::kBlockTransaction, 0);
+    ASSERT_EQ(1u, binder->waitForCalls(1).size());
+    for (int32_t i = 1; i <= 3; i++) sendQueuedOneway(binder, kCode, i);
+
+    std::vector<std::pair<uint32_t, int32_t>> calls = binder->waitForCalls(4);
+    ASSERT_EQ(4u, calls.size());
+    EXPECT_EQ(3, calls.back().second);
+    EXPECT_EQ(kPriority, binder->priorityOf(kCode));
+    EXPECT_EQ(0, binder->priorityOf(OnewayQueueRecorder::kBlockTransaction));
+    binder->unblock();
+}
+
+TEST_F(BinderLibTest, OnewayQueueDrainsWhenDisabled) {
+    auto binder = sp<OnewayQueueRecorder>::make();
+    binder->setOnewayQueueEnabled(true);
+
+    sendQueuedOneway(binder, OnewayQueueRecorder::kBlockTransaction, 0);
+    ASSERT_EQ(1u, binder->waitForCalls(1).size());
+    constexpr uint32_t kCode = FIRST_CALL_TRANSACTION + 1;
+    for (int32_t i = 1; i <= 3; i++) sendQueuedOneway(binder, kCode, i);
+
+    // Disabling waits for the blocked call and the ones behind it.
+    std::thread disabler([&] { binder->setOnewayQueueEnabled(false); });
+    binder->unblock();
+    disabler.join();
+    EXPECT_FALSE(binder->isOnewayQueueEnabled());
+
+    std::vector<std::pair<uint32_t, int32_t>> calls = binder->waitForCalls(0);
+    ASSERT_EQ(4u, calls.size());
+    EXPECT_EQ(3, calls.back().second);
+}
+
+TEST_F(BinderLibTest, OnewayQueueIsBounded) {
+    auto binder = sp<OnewayQueueRecorder>::make();
+    binder->setOnewayQueueEnabled(true);
+
+    sendQueuedOneway(binder, OnewayQueueRecorder::kBlockTransaction, 0);
+    ASSERT_EQ(1u, binder->waitForCalls(1).size());
+    constexpr uint32_t kCode = FIRST_CALL_TRANSACTION + 1;
+    constexpr int32_t kQueued = BBinder::kMaxQueuedOnewayTransactions;
+    for (int32_t i = 1; i <= kQueued; i++) sendQueuedOneway(binder, kCode, i);
+
+    // The queue is full, so the next call waits for it to empty and then
+    // runs on the sending thread.
+    std::atomic<bool> sent = false;
+    std::thread sender([&] {
+        sendQueuedOneway(binder, kCode, kQueued + 1);
+        sent = true;
+    });
+    std::this_thread::sleep_for(100ms);
+    EXPECT_FALSE(sent);
+    binder->unblock();
+    sender.join();
+
+    std::vector<std::pair<uint32_t, int32_t>> calls = binder->waitForCalls(kQueued + 2);
+    ASSERT_EQ(static_cast<size_t>(kQueued + 2), calls.size());
+    for (int32_t i = 0; i < kQueued + 2; i++) {
+        EXPECT_EQ(i, calls[i].second);
+    }
+}
+
+TEST_F(BinderLibTest, OnewayQueueThroughDriver) {
+    auto binder = sp<OnewayQueueRecorder>::make();
+    binder->setOnewayQueueEnabled(true);
+
+    constexpr int32_t kCount = 20;
+    Parcel data, reply;
+    data.writeStrongBinder(binder);
+    data.writeInt32(kCount);
+    EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_ONEWAY_CALL_BACKS, data, &reply),
+                StatusEq(NO_ERROR));
+
+    // Sent from one thread, so they arrive and run in order.
+    std::vector<std::pair<uint32_t, int32_t>> calls = binder->waitForCalls(kCount);
+    ASSERT_EQ(static_cast<size_t>(kCount), calls.size());
+    for (int32_t i = 0; i < kCount; i++) {
+        EXPECT_EQ(static_cast<uint32_t>(IBinder::FIRST_CALL_TRANSACTION + 1), calls[i].first);
+        EXPECT_EQ(i, calls[i].second);
+    }
+}
+
 TEST_F(BinderLibTest, NopTransactionOneway) {
     Parcel data, reply;
     EXPECT_THAT(m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply, TF_ONE_WAY),
@@ -1234,6 +1665,33 @@ TEST(ServiceNotifications, Unregister) {
     EXPECT_EQ(sm->unregisterForNotifications(String16("RogerRafa"), cb), OK);
 }
 
+TEST(ServiceLookupCache, InvalidatedOnRegistration) {
+    auto sm = defaultServiceManager();
+    String16 name = String16("binderLibTest.lookupCache.") + String16(binderserversuffix);
+    sp<IBinder> first = sp<BBinder>::make();
+    ASSERT_EQ(OK, sm->addService(name, first));
+
+    setServiceLookupCacheEnabled(true);
+    ServiceLookupCacheStats before = getServiceLookupCacheStats();
+    EXPECT_EQ(first, sm->checkService(name));
+    EXPECT_EQ(first, sm->checkService(name));
+    ServiceLookupCacheStats after = getServiceLookupCacheStats();
+    EXPECT_GE(after.hits - before.hits, 1u);
+
+    // the notification arrives asynchronously
+    sp<IBinder> second = sp<BBinder>::make();
+    ASSERT_EQ(OK, sm->addService(name, second));
+    sp<IBinder> found;
+    for (size_t tries = 0; tries < 100; tries++) {
+        found = sm->checkService(name);
+        if (found == second) break;
+        usleep(10000);
+    }
+    EXPECT_EQ(second, found);
+
+    setServiceLookupCacheEnabled(false);
+}
+
 class BinderLibRpcTestBase : public BinderLibTest {
 public:
     void SetUp() override {
@@ -1378,6 +1836,7 @@ public:
                 return NO_ERROR;
             }
             case BINDER_LIB_TEST_ADD_POLL_SERVER:
+            case BINDER_LIB_TEST_ADD_ADAPTIVE_SERVER:
             case BINDER_LIB_TEST_ADD_SERVER: {
                 int ret;
                 int serverid;
@@ -1392,9 +1851,10 @@ public:
                     serverid = m_nextServerId++;
                     m_serverStartRequested = true;
                     bool usePoll = code == BINDER_LIB_TEST_ADD_POLL_SERVER;
+                    bool adaptivePool = code == BINDER_LIB_TEST_ADD_ADAPTIVE_SERVER;
 
                     pthread_mutex_unlock(&m_serverWaitMutex);
-                    ret = start_server_process(serverid, usePoll);
+                    ret = start_server_process(serverid, usePoll, adaptivePool);
                     pthread_mutex_lock(&m_serverWaitMutex);
                 }
                 if (ret > 0) {
@@ -1438,6 +1898,13 @@ public:
             case BINDER_LIB_TEST_GETPID:
                 reply->writeInt32(getpid());
                 return NO_ERROR;
+            case BINDER_LIB_TEST_GET_THREAD_POOL_STATS: {
+                ProcessState::ThreadPoolStats stats = ProcessState::self()->getThreadPoolStats();
+                reply->writeUint64(stats.maxThreads);
+                reply->writeUint64(stats.threadsGrown);
+                reply->writeUint64(stats.threadsRetired);
+                return NO_ERROR;
+            }
             case BINDER_LIB_TEST_NOP_TRANSACTION_WAIT:
                 usleep(5000);
                 [[fallthrough]];
@@ -1640,6 +2107,20 @@ public:
             case BINDER_LIB_TEST_CAN_GET_SID: {
                 return IPCThreadState::self()->getCallingSid() == nullptr ? BAD_VALUE : NO_ERROR;
             }
+            case BINDER_LIB_TEST_ONEWAY_CALL_BACKS: {
+                sp<IBinder> binder = data.readStrongBinder();
+                int32_t count = data.readInt32();
+                if (binder == nullptr) {
+                    return BAD_VALUE;
+                }
+                for (int32_t i = 0; i < count; i++) {
+                    Parcel data2;
+                    data2.writeInt32(i);
+                    binder->transact(IBinder::FIRST_CALL_TRANSACTION + 1, data2, nullptr,
+                                     TF_ONE_WAY);
+                }
+                return NO_ERROR;
+            }
             default:
                 return UNKNOWN_TRANSACTION;
         };
@@ -1657,7 +2138,7 @@ private:
     bool m_exitOnDestroy;
 };
 
-int run_server(int index, int readypipefd, bool usePoll)
+int run_server(int index, int readypipefd, bool usePoll, bool adaptivePool)
 {
     binderLibTestServiceName += String16(binderserversuffix);
 
@@ -1756,6 +2237,13 @@ int run_server(int index, int readypipefd, bool usePoll)
              }
         }
     } else {
+        if (adaptivePool) {
+            ret = ProcessState::self()->setThreadPoolAdaptive(kAdaptiveMinThreads,
+                                                              kAdaptiveMaxThreads,
+                                                              kAdaptiveGrowAfterMs,
+                                                              kAdaptiveIdleTimeoutMs);
+            if (ret != NO_ERROR) return 1;
+        }
         ProcessState::self()->startThreadPool();
         IPCThreadState::self()->joinThreadPool();
     }
@@ -1774,7 +2262,7 @@ int main(int argc, char **argv) {
 
     if (argc == 6 && !strcmp(argv[1], binderserverarg)) {
         binderserversuffix = argv[5];
-        return run_server(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]) == 1);
+        return run_server(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]) == 1, atoi(argv[4]) == 2);
     }
     binderserversuffix = new char[16];
     snprintf(binderserversuffix, 16, "%d", getpid());
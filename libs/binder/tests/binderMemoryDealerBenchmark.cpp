@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <binder/MemoryDealer.h>
+
+#include <random>
+#include <vector>
+
+// Usage: atest binderMemoryDealerBenchmark
+
+using android::IMemory;
+using android::MemoryDealer;
+using android::sp;
+
+static constexpr size_t kHeapSize = 4 * 1024 * 1024;
+static constexpr size_t kMaxAllocationSize = 1024;
+
+// Keeps |numLive| small allocations of random sizes in a heap, and replaces a
+// random one of them per iteration.
+void BM_churn(benchmark::State& state) {
+    auto policy = static_cast<MemoryDealer::Policy>(state.range(0));
+    size_t numLive = static_cast<size_t>(state.range(1));
+    auto dealer = sp<MemoryDealer>::make(kHeapSize, "churn", 0, policy);
+
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<size_t> sizes(1, kMaxAllocationSize);
+    std::vector<sp<IMemory>> live;
+    for (size_t i = 0; i < numLive; i++) {
+        live.push_back(dealer->allocate(sizes(rng)));
+    }
+
+    std::uniform_int_distribution<size_t> indexes(0, numLive - 1);
+    while (state.KeepRunning()) {
+        sp<IMemory>& memory = live[indexes(rng)];
+        memory.clear();
+        memory = dealer->allocate(sizes(rng));
+        if (memory == nullptr) {
+            state.SkipWithError("heap exhausted");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_churn)->ArgsProduct({
+        {static_cast<int64_t>(MemoryDealer::Policy::BEST_FIT),
+         static_cast<int64_t>(MemoryDealer::Policy::BUDDY)},
+        {100, 1000, 4000}});
+
+// After freeing every other allocation of a heap which was filled with random
+// sizes, counts how much more of it can be allocated.
+void BM_fragmentation(benchmark::State& state) {
+    auto policy = static_cast<MemoryDealer::Policy>(state.range(0));
+    size_t refilled = 0;
+
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        auto dealer = sp<MemoryDealer>::make(kHeapSize, "fragmentation", 0, policy);
+        std::mt19937 rng(0);
+        std::uniform_int_distribution<size_t> sizes(1, kMaxAllocationSize);
+        std::vector<sp<IMemory>> live;
+        while (sp<IMemory> memory = dealer->allocate(sizes(rng))) {
+            live.push_back(memory);
+        }
+        for (size_t i = 0; i < live.size(); i += 2) {
+            live[i].clear();
+        }
+        state.ResumeTiming();
+
+        refilled = 0;
+        while (sp<IMemory> memory = dealer->allocate(sizes(rng))) {
+            refilled += memory->size();
+            live.push_back(memory);
+        }
+
+        state.PauseTiming();
+        live.clear();
+        state.ResumeTiming();
+    }
+    state.counters["refilledBytes"] = refilled;
+}
+BENCHMARK(BM_fragmentation)->Arg(static_cast<int64_t>(MemoryDealer::Policy::BEST_FIT))
+        ->Arg(static_cast<int64_t>(MemoryDealer::Policy::BUDDY));
+
+BENCHMARK_MAIN();
@@ -36,6 +36,8 @@ void writeVector(android::Parcel &p, const V<T, Args...> &v) {
         p.writeInt32Vector(v);
     } else if constexpr (std::is_same_v<T, int64_t>) {
         p.writeInt64Vector(v);
+    } else if constexpr (std::is_same_v<T, float>) {
+        p.writeFloatVector(v);
     } else {
         static_assert(dependent_false_v<V<T>>);
     }
@@ -53,6 +55,8 @@ void readVector(android::Parcel &p, V<T, Args...> *v) {
         p.readInt32Vector(v);
     } else if constexpr (std::is_same_v<T, int64_t>) {
         p.readInt64Vector(v);
+    } else if constexpr (std::is_same_v<T, float>) {
+        p.readFloatVector(v);
     } else {
         static_assert(dependent_false_v<V<T>>);
     }
@@ -65,6 +69,14 @@ static void VectorArgs(benchmark::internal::Benchmark* b) {
     }
 }
 
+// Construct a series of args { 1 << 10, 1 << 12, ..., 1 << 20 } for bulk transfers
+// such as sensor batches or input histories.
+static void LargeVectorArgs(benchmark::internal::Benchmark* b) {
+    for (int i = 10; i <= 20; i += 2) {
+        b->Args({1 << i});
+    }
+}
+
 template <typename T>
 static void BM_ParcelVector(benchmark::State& state) {
     const size_t elements = state.range(0);
@@ -163,10 +175,41 @@ static void BM_Int64Vector(benchmark::State& state) {
     BM_ParcelVector<int64_t>(state);
 }
 
+static void BM_FloatVector(benchmark::State& state) {
+    BM_ParcelVector<float>(state);
+}
+
+/*
+  Construct, fill and destroy a small Parcel, the way a short AIDL call does
+  for its request. state.range(0) toggles per-thread buffer recycling.
+*/
+static void BM_SmallParcel(benchmark::State& state) {
+    const bool recycle = state.range(0) != 0;
+    const android::String16 descriptor("android.os.IServiceManager");
+
+    android::Parcel::setBufferRecyclingEnabled(recycle);
+    while (state.KeepRunning()) {
+        android::Parcel p;
+        p.writeInterfaceToken(descriptor);
+        p.writeInt32(42);
+        p.writeInt64(42);
+        benchmark::DoNotOptimize(p.data());
+    }
+    android::Parcel::setBufferRecyclingEnabled(false);
+}
+
+BENCHMARK(BM_SmallParcel)->Arg(0)->Arg(1);
 BENCHMARK(BM_BoolVector)->Apply(VectorArgs);
 BENCHMARK(BM_ByteVector)->Apply(VectorArgs);
 BENCHMARK(BM_CharVector)->Apply(VectorArgs);
 BENCHMARK(BM_Int32Vector)->Apply(VectorArgs);
 BENCHMARK(BM_Int64Vector)->Apply(VectorArgs);
+BENCHMARK(BM_FloatVector)->Apply(VectorArgs);
+
+BENCHMARK(BM_BoolVector)->Apply(LargeVectorArgs);
+BENCHMARK(BM_CharVector)->Apply(LargeVectorArgs);
+BENCHMARK(BM_Int32Vector)->Apply(LargeVectorArgs);
+BENCHMARK(BM_Int64Vector)->Apply(LargeVectorArgs);
+BENCHMARK(BM_FloatVector)->Apply(LargeVectorArgs);
 
 BENCHMARK_MAIN();
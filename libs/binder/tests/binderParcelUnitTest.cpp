@@ -65,6 +65,43 @@ TEST(Parcel, NonNullTerminatedString16) {
     EXPECT_EQ(output.size(), 0);
 }
 
+TEST(Parcel, NonNullTerminatedString16View) {
+    String16 kTestString = String16("test-is-good");
+
+    Parcel p;
+    p.writeString16(kTestString);
+    p.setDataPosition(0);
+    // BAD! assumption of wire format for test
+    // write over length of string
+    p.writeInt32(kTestString.size() - 2);
+
+    p.setDataPosition(0);
+    std::u16string_view output;
+    EXPECT_NE(OK, p.readString16View(&output));
+    EXPECT_EQ(output.size(), 0);
+}
+
+TEST(Parcel, StringViewsBorrowParcelData) {
+    const String8 kTestString8 = String8("test-is-good");
+    const String16 kTestString16 = String16("test-is-good");
+    Parcel p;
+    p.writeString8(kTestString8);
+    p.writeString16(kTestString16);
+    p.setDataPosition(0);
+
+    std::string_view view8;
+    ASSERT_EQ(OK, p.readString8View(&view8));
+    EXPECT_EQ(std::string_view(kTestString8.c_str(), kTestString8.size()), view8);
+    EXPECT_GE(reinterpret_cast<const uint8_t*>(view8.data()), p.data());
+    EXPECT_LT(reinterpret_cast<const uint8_t*>(view8.data()), p.data() + p.dataSize());
+
+    std::u16string_view view16;
+    ASSERT_EQ(OK, p.readString16View(&view16));
+    EXPECT_EQ(std::u16string_view(kTestString16.string(), kTestString16.size()), view16);
+    EXPECT_GE(reinterpret_cast<const uint8_t*>(view16.data()), p.data());
+    EXPECT_LT(reinterpret_cast<const uint8_t*>(view16.data()), p.data() + p.dataSize());
+}
+
 TEST(Parcel, EnforceNoDataAvail) {
     const int32_t kTestInt = 42;
     const String8 kTestString = String8("test-is-good");
@@ -199,6 +236,34 @@ TEST_READ_WRITE_INVERSE(char16_t, Char, {u'a', u'\0'});
 TEST_READ_WRITE_INVERSE(int8_t, Byte, {-1, 0, 1});
 TEST_READ_WRITE_INVERSE(String8, String8, {String8(), String8("a"), String8("asdf")});
 TEST_READ_WRITE_INVERSE(String16, String16, {String16(), String16("a"), String16("asdf")});
+TEST_READ_WRITE_INVERSE(std::vector<bool>, BoolVector, {{}, {true}, {true, false, true}});
+TEST_READ_WRITE_INVERSE(std::vector<char16_t>, CharVector, {{}, {u'a'}, {u'a', u'\0', u'z'}});
+
+TEST(Parcel, WidenedFixedArrayMatchesElementwiseLayout) {
+    const std::array<char16_t, 3> chars = {u'a', u'\0', u'z'};
+    const std::array<bool, 3> bools = {true, false, true};
+
+    Parcel bulk;
+    ASSERT_EQ(OK, bulk.writeFixedArray(chars));
+    ASSERT_EQ(OK, bulk.writeFixedArray(bools));
+
+    Parcel elementwise;
+    ASSERT_EQ(OK, elementwise.writeInt32(chars.size()));
+    for (char16_t c : chars) ASSERT_EQ(OK, elementwise.writeChar(c));
+    ASSERT_EQ(OK, elementwise.writeInt32(bools.size()));
+    for (bool b : bools) ASSERT_EQ(OK, elementwise.writeBool(b));
+
+    ASSERT_EQ(elementwise.dataSize(), bulk.dataSize());
+    EXPECT_EQ(0, memcmp(elementwise.data(), bulk.data(), bulk.dataSize()));
+
+    std::array<char16_t, 3> outChars;
+    std::array<bool, 3> outBools;
+    bulk.setDataPosition(0);
+    ASSERT_EQ(OK, bulk.readFixedArray(&outChars));
+    ASSERT_EQ(OK, bulk.readFixedArray(&outBools));
+    EXPECT_EQ(chars, outChars);
+    EXPECT_EQ(bools, outBools);
+}
 
 TEST(Parcel, GetOpenAshmemSize) {
     constexpr size_t kSize = 1024;
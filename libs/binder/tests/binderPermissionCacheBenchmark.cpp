@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <binder/PermissionCache.h>
+
+#include <iterator>
+
+// Usage: atest binderPermissionCacheBenchmark
+
+using android::PermissionCache;
+using android::String16;
+
+static const String16 kPermissions[] = {
+        String16("android.permission.DUMP"),
+        String16("android.permission.INTERNET"),
+};
+
+// checks come from apps, and never from ourselves
+static constexpr uid_t kFirstAppUid = 10000;
+static constexpr pid_t kOtherPid = 1;
+
+// Every thread checks the same |numUids| apps for each permission, like the
+// binder threads of a busy service. The first checks go to the permission
+// controller, and the rest are cached. The hits and misses counters are those
+// of the whole cache while the benchmark ran, averaged over its threads.
+void BM_checkPermission(benchmark::State& state) {
+    uid_t numUids = static_cast<uid_t>(state.range(0));
+    for (uid_t uid = kFirstAppUid; uid < kFirstAppUid + numUids; uid++) {
+        for (const String16& permission : kPermissions) {
+            PermissionCache::checkPermission(permission, kOtherPid, uid);
+        }
+    }
+
+    const PermissionCache::Stats before = PermissionCache::getStats();
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const String16& permission = kPermissions[i % std::size(kPermissions)];
+        uid_t uid = kFirstAppUid + (i / std::size(kPermissions)) % numUids;
+        benchmark::DoNotOptimize(PermissionCache::checkPermission(permission, kOtherPid, uid));
+        i++;
+    }
+    const PermissionCache::Stats after = PermissionCache::getStats();
+    state.counters["hits"] = benchmark::Counter(static_cast<double>(after.hits - before.hits),
+                                                benchmark::Counter::kAvgThreads);
+    state.counters["misses"] = benchmark::Counter(static_cast<double>(after.misses - before.misses),
+                                                  benchmark::Counter::kAvgThreads);
+}
+BENCHMARK(BM_checkPermission)->Arg(1)->Arg(16)->Arg(256)->ThreadRange(1, 8);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <binder/PermissionCache.h>
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <vector>
+
+#include <unistd.h>
+
+namespace android {
+
+static const String16 kPermission("android.permission.DUMP");
+static const String16 kOtherPermission("android.permission.INTERNET");
+static constexpr uid_t kUid = 10000;
+
+// Uses its own cache rather than the singleton, so that nothing is checked
+// with the permission controller.
+class PermissionCacheTest : public ::testing::Test {
+protected:
+    static constexpr size_t kNumShards = PermissionCache::kNumShards;
+
+    std::optional<bool> check(const String16& permission, uid_t uid) {
+        bool granted = false;
+        if (mCache.check(&granted, permission, uid) != NO_ERROR) return std::nullopt;
+        return granted;
+    }
+    void cache(const String16& permission, uid_t uid, bool granted) {
+        mCache.cache(permission, uid, granted);
+    }
+    void purge() { mCache.purge(); }
+    void setEntryLifetime(nsecs_t lifetime) { mCache.mEntryLifetime = lifetime; }
+    void setMaxEntriesPerShard(size_t max) { mCache.mMaxEntriesPerShard = max; }
+    PermissionCache::Stats stats() { return mCache.stats(); }
+
+    size_t size() {
+        size_t size = 0;
+        for (PermissionCache::Shard& shard : mCache.mShards) size += shard.entries.size();
+        return size;
+    }
+
+    // |count| uids whose checks of kPermission land in the same shard
+    std::vector<uid_t> uidsSharingShard(size_t count) {
+        std::vector<uid_t> uids;
+        PermissionCache::Shard* shard = nullptr;
+        for (uid_t uid = kUid; uids.size() < count; uid++) {
+            PermissionCache::Shard* s = &mCache.shardFor({kPermission, uid});
+            if (shard == nullptr) shard = s;
+            if (s == shard) uids.push_back(uid);
+        }
+        return uids;
+    }
+
+private:
+    PermissionCache mCache;
+};
+
+TEST_F(PermissionCacheTest, Hit) {
+    EXPECT_EQ(std::nullopt, check(kPermission, kUid));
+    cache(kPermission, kUid, true);
+    cache(kOtherPermission, kUid, false);
+
+    EXPECT_EQ(true, check(kPermission, kUid));
+    EXPECT_EQ(false, check(kOtherPermission, kUid));
+    EXPECT_EQ(std::nullopt, check(kPermission, kUid + 1));
+
+    PermissionCache::Stats s = stats();
+    EXPECT_EQ(2u, s.hits);
+    EXPECT_EQ(2u, s.misses);
+}
+
+TEST_F(PermissionCacheTest, Expiry) {
+    setEntryLifetime(ms2ns(50));
+    cache(kPermission, kUid, true);
+    EXPECT_EQ(true, check(kPermission, kUid));
+
+    usleep(100 * 1000);
+    EXPECT_EQ(std::nullopt, check(kPermission, kUid));
+
+    // checking again caches it again
+    cache(kPermission, kUid, false);
+    EXPECT_EQ(false, check(kPermission, kUid));
+}
+
+TEST_F(PermissionCacheTest, Purge) {
+    cache(kPermission, kUid, true);
+    cache(kOtherPermission, kUid, true);
+    purge();
+
+    EXPECT_EQ(std::nullopt, check(kPermission, kUid));
+    EXPECT_EQ(std::nullopt, check(kOtherPermission, kUid));
+
+    // entries cached after the purge are found, the others are still gone
+    cache(kPermission, kUid, false);
+    EXPECT_EQ(false, check(kPermission, kUid));
+    EXPECT_EQ(std::nullopt, check(kOtherPermission, kUid));
+}
+
+// Well below the cap, uneven hashing doesn't make entries evict each other.
+TEST_F(PermissionCacheTest, NoEvictionBelowCap) {
+    constexpr uid_t kNumUids = 256;
+    for (uid_t uid = kUid; uid < kUid + kNumUids; uid++) {
+        cache(kPermission, uid, uid % 2 == 0);
+        cache(kOtherPermission, uid, uid % 2 == 1);
+    }
+    for (uid_t uid = kUid; uid < kUid + kNumUids; uid++) {
+        EXPECT_EQ(uid % 2 == 0, check(kPermission, uid)) << uid;
+        EXPECT_EQ(uid % 2 == 1, check(kOtherPermission, uid)) << uid;
+    }
+    EXPECT_EQ(2 * kNumUids, stats().hits);
+    EXPECT_EQ(0u, stats().misses);
+}
+
+
+TEST_F(PermissionCacheTest, EvictsLeastRecentlyUsedPastCap) {
+    setMaxEntriesPerShard(4);
+    std::vector<uid_t> uids = uidsSharingShard(5);
+    for (size_t i = 0; i < 4; i++) cache(kPermission, uids[i], true);
+    // makes uids[1] the least recently used
+    EXPECT_EQ(true, check(kPermission, uids[0]));
+
+    cache(kPermission, uids[4], true);
+    EXPECT_EQ(true, check(kPermission, uids[0]));
+    EXPECT_EQ(std::nullopt, check(kPermission, uids[1]));
+    for (size_t i = 2; i < 5; i++) EXPECT_EQ(true, check(kPermission, uids[i])) << i;
+}
+
+TEST_F(PermissionCacheTest, EvictsExpiredFirst) {
+    setMaxEntriesPerShard(4);
+    std::vector<uid_t> uids = uidsSharingShard(6);
+    // expire right away
+    setEntryLifetime(0);
+    cache(kPermission, uids[0], true);
+    cache(kPermission, uids[1], true);
+    setEntryLifetime(s2ns(60));
+    cache(kPermission, uids[2], true);
+    cache(kPermission, uids[3], true);
+
+    // both expired entries make room, so nothing live is evicted
+    cache(kPermission, uids[4], true);
+    cache(kPermission, uids[5], true);
+    for (size_t i = 2; i < 6; i++) EXPECT_EQ(true, check(kPermission, uids[i])) << i;
+}
+
+TEST_F(PermissionCacheTest, SizeIsBounded) {
+    constexpr size_t kMax = 8;
+    setMaxEntriesPerShard(kMax);
+    for (uid_t uid = kUid; uid < kUid + 4096; uid++) {
+        cache(kPermission, uid, true);
+    }
+    EXPECT_LE(size(), kMax * kNumShards);
+
+    // the most recent entry is always kept
+    EXPECT_EQ(true, check(kPermission, kUid + 4095));
+}
+
+} // namespace android
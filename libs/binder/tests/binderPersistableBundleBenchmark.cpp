@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <binder/Parcel.h>
+#include <binder/PersistableBundle.h>
+
+#include <string>
+
+// Usage: atest binderPersistableBundleBenchmark
+
+using android::Parcel;
+using android::String16;
+using android::os::PersistableBundle;
+
+enum ReadMode {
+    EAGER,
+    LAZY,
+};
+
+// A bundle with |numKeys| values of a few types, as sent between services.
+static void writeBundle(size_t numKeys, Parcel* parcel) {
+    PersistableBundle bundle;
+    for (size_t i = 0; i < numKeys; i++) {
+        String16 key(("key" + std::to_string(i)).c_str());
+        switch (i % 4) {
+            case 0:
+                bundle.putInt(key, static_cast<int32_t>(i));
+                break;
+            case 1:
+                bundle.putString(key, String16("a value which is a little long"));
+                break;
+            case 2:
+                bundle.putLongVector(key, std::vector<int64_t>(8, static_cast<int64_t>(i)));
+                break;
+            case 3:
+                bundle.putStringVector(key, {String16("one"), String16("two")});
+                break;
+        }
+    }
+    CHECK_EQ(android::OK, bundle.writeToParcel(parcel));
+}
+
+static void readBundle(ReadMode mode, const Parcel& parcel, PersistableBundle* bundle) {
+    parcel.setDataPosition(0);
+    if (mode == LAZY) {
+        CHECK_EQ(android::OK, bundle->readFromParcelLazily(&parcel));
+    } else {
+        CHECK_EQ(android::OK, bundle->readFromParcel(&parcel));
+    }
+}
+
+// Reads a bundle, and gets one value out of it.
+void BM_readOneKey(benchmark::State& state) {
+    ReadMode mode = static_cast<ReadMode>(state.range(0));
+    size_t numKeys = static_cast<size_t>(state.range(1));
+    Parcel parcel;
+    writeBundle(numKeys, &parcel);
+    String16 key("key0");
+
+    while (state.KeepRunning()) {
+        PersistableBundle bundle;
+        readBundle(mode, parcel, &bundle);
+        int32_t value;
+        CHECK(bundle.getInt(key, &value));
+        benchmark::DoNotOptimize(value);
+    }
+}
+BENCHMARK(BM_readOneKey)->ArgsProduct({{EAGER, LAZY}, {4, 32, 256}});
+
+// Reads a bundle, and writes it to another parcel, as when forwarding it.
+void BM_roundTrip(benchmark::State& state) {
+    ReadMode mode = static_cast<ReadMode>(state.range(0));
+    size_t numKeys = static_cast<size_t>(state.range(1));
+    Parcel parcel;
+    writeBundle(numKeys, &parcel);
+
+    while (state.KeepRunning()) {
+        PersistableBundle bundle;
+        readBundle(mode, parcel, &bundle);
+        Parcel out;
+        CHECK_EQ(android::OK, bundle.writeToParcel(&out));
+        benchmark::DoNotOptimize(out.data());
+    }
+}
+BENCHMARK(BM_roundTrip)->ArgsProduct({{EAGER, LAZY}, {4, 32, 256}});
+
+BENCHMARK_MAIN();
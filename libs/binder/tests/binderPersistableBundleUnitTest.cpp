@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <binder/Parcel.h>
+#include <binder/PersistableBundle.h>
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <string>
+
+#include "../ParcelValTypes.h"
+
+using android::OK;
+using android::Parcel;
+using android::String16;
+using android::binder::VAL_INTEGER;
+using android::binder::VAL_STRING;
+using android::os::PersistableBundle;
+
+namespace {
+
+constexpr int32_t kBundleMagic = 0x4C444E42;
+
+PersistableBundle makeBundle() {
+    PersistableBundle inner;
+    inner.putInt(String16("inner"), 7);
+
+    PersistableBundle bundle;
+    bundle.putBoolean(String16("bool"), true);
+    bundle.putInt(String16("int"), 42);
+    bundle.putLong(String16("long"), 1ll << 40);
+    bundle.putDouble(String16("double"), 0.5);
+    bundle.putString(String16("string"), String16("value"));
+    bundle.putBooleanVector(String16("bools"), {true, false});
+    bundle.putIntVector(String16("ints"), {1, 2, 3});
+    bundle.putLongVector(String16("longs"), {4, 5});
+    bundle.putDoubleVector(String16("doubles"), {6.0});
+    bundle.putStringVector(String16("strings"), {String16("a"), String16("b")});
+    bundle.putPersistableBundle(String16("bundle"), inner);
+    // same key, different type
+    bundle.putString(String16("int"), String16("not an int"));
+    return bundle;
+}
+
+// Writes a bundle the way Java does, which allows repeated keys.
+void writeRawBundle(Parcel* parcel) {
+    size_t lengthPos = parcel->dataPosition();
+    parcel->writeInt32(0);
+    parcel->writeInt32(kBundleMagic);
+    size_t startPos = parcel->dataPosition();
+    parcel->writeInt32(4);
+    parcel->writeString16(String16("a"));
+    parcel->writeInt32(VAL_INTEGER);
+    parcel->writeInt32(1);
+    parcel->writeString16(String16("a"));
+    parcel->writeInt32(VAL_STRING);
+    parcel->writeString16(String16("first"));
+    parcel->writeString16(String16("a"));
+    parcel->writeInt32(VAL_INTEGER);
+    parcel->writeInt32(2);
+    parcel->writeString16(String16("a"));
+    parcel->writeInt32(VAL_STRING);
+    parcel->writeString16(String16("second"));
+    size_t endPos = parcel->dataPosition();
+    parcel->setDataPosition(lengthPos);
+    parcel->writeInt32(static_cast<int32_t>(endPos - startPos));
+    parcel->setDataPosition(endPos);
+}
+
+void expectSameContents(const PersistableBundle& expected, const PersistableBundle& actual) {
+    EXPECT_EQ(expected.size(), actual.size());
+    EXPECT_EQ(expected.getBooleanKeys(), actual.getBooleanKeys());
+    EXPECT_EQ(expected.getIntKeys(), actual.getIntKeys());
+    EXPECT_EQ(expected.getLongKeys(), actual.getLongKeys());
+    EXPECT_EQ(expected.getDoubleKeys(), actual.getDoubleKeys());
+    EXPECT_EQ(expected.getStringKeys(), actual.getStringKeys());
+    EXPECT_EQ(expected.getBooleanVectorKeys(), actual.getBooleanVectorKeys());
+    EXPECT_EQ(expected.getIntVectorKeys(), actual.getIntVectorKeys());
+    EXPECT_EQ(expected.getLongVectorKeys(), actual.getLongVectorKeys());
+    EXPECT_EQ(expected.getDoubleVectorKeys(), actual.getDoubleVectorKeys());
+    EXPECT_EQ(expected.getStringVectorKeys(), actual.getStringVectorKeys());
+    EXPECT_EQ(expected.getPersistableBundleKeys(), actual.getPersistableBundleKeys());
+
+    for (const String16& key : expected.getIntKeys()) {
+        int32_t e = 0, a = 0;
+        EXPECT_TRUE(expected.getInt(key, &e));
+        EXPECT_TRUE(actual.getInt(key, &a));
+        EXPECT_EQ(e, a);
+    }
+    for (const String16& key : expected.getStringKeys()) {
+        String16 e, a;
+        EXPECT_TRUE(expected.getString(key, &e));
+        EXPECT_TRUE(actual.getString(key, &a));
+        EXPECT_EQ(e, a);
+    }
+    EXPECT_TRUE(expected == actual);
+}
+
+} // namespace
+
+TEST(PersistableBundle, LazyReadMatchesEagerRead) {
+    Parcel p;
+    ASSERT_EQ(OK, makeBundle().writeToParcel(&p));
+
+    PersistableBundle eager;
+    p.setDataPosition(0);
+    ASSERT_EQ(OK, eager.readFromParcel(&p));
+    PersistableBundle lazy;
+    p.setDataPosition(0);
+    ASSERT_EQ(OK, lazy.readFromParcelLazily(&p));
+    EXPECT_EQ(p.dataSize(), p.dataPosition());
+
+    expectSameContents(eager, lazy);
+
+    int64_t l = 0;
+    EXPECT_TRUE(lazy.getLong(String16("long"), &l));
+    EXPECT_EQ(1ll << 40, l);
+    std::vector<String16> strings;
+    EXPECT_TRUE(lazy.getStringVector(String16("strings"), &strings));
+    EXPECT_EQ((std::vector<String16>{String16("a"), String16("b")}), strings);
+    PersistableBundle inner;
+    EXPECT_TRUE(lazy.getPersistableBundle(String16("bundle"), &inner));
+    int32_t i = 0;
+    EXPECT_TRUE(inner.getInt(String16("inner"), &i));
+    EXPECT_EQ(7, i);
+    double d = 0;
+    EXPECT_FALSE(lazy.getDouble(String16("missing"), &d));
+    EXPECT_FALSE(lazy.getDouble(String16("int"), &d));
+}
+
+TEST(PersistableBundle, LazyReadKeepsLastRepeatedKey) {
+    Parcel p;
+    writeRawBundle(&p);
+
+    PersistableBundle eager;
+    p.setDataPosition(0);
+    ASSERT_EQ(OK, eager.readFromParcel(&p));
+    PersistableBundle lazy;
+    p.setDataPosition(0);
+    ASSERT_EQ(OK, lazy.readFromParcelLazily(&p));
+
+    expectSameContents(eager, lazy);
+    EXPECT_EQ(2u, lazy.size());
+    int32_t i = 0;
+    EXPECT_TRUE(lazy.getInt(String16("a"), &i));
+    EXPECT_EQ(2, i);
+    String16 s;
+    EXPECT_TRUE(lazy.getString(String16("a"), &s));
+    EXPECT_EQ(String16("second"), s);
+}
+
+TEST(PersistableBundle, ReadsUnorderedRepeatedKeys) {
+    // keys written in reverse order, each one twice with a different value
+    constexpr int32_t kKeys = 100;
+    Parcel p;
+    size_t lengthPos = p.dataPosition();
+    p.writeInt32(0);
+    p.writeInt32(kBundleMagic);
+    size_t startPos = p.dataPosition();
+    p.writeInt32(2 * kKeys);
+    for (int32_t round = 0; round < 2; round++) {
+        for (int32_t i = kKeys - 1; i >= 0; i--) {
+            p.writeString16(String16(std::to_string(i).c_str()));
+            p.writeInt32(VAL_INTEGER);
+            p.writeInt32(round * kKeys + i);
+        }
+    }
+    size_t endPos = p.dataPosition();
+    p.setDataPosition(lengthPos);
+    p.writeInt32(static_cast<int32_t>(endPos - startPos));
+
+    PersistableBundle eager;
+    p.setDataPosition(0);
+    ASSERT_EQ(OK, eager.readFromParcel(&p));
+    PersistableBundle lazy;
+    p.setDataPosition(0);
+    ASSERT_EQ(OK, lazy.readFromParcelLazily(&p));
+
+    expectSameContents(eager, lazy);
+    EXPECT_EQ(static_cast<size_t>(kKeys), eager.size());
+    for (int32_t i = 0; i < kKeys; i++) {
+        int32_t value = 0;
+        EXPECT_TRUE(eager.getInt(String16(std::to_string(i).c_str()), &value));
+        EXPECT_EQ(kKeys + i, value);
+    }
+}
+
+TEST(PersistableBundle, LazyReadRoundTrips) {
+    Parcel p;
+    writeRawBundle(&p);
+    p.setDataPosition(0);
+    PersistableBundle lazy;
+    ASSERT_EQ(OK, lazy.readFromParcelLazily(&p));
+
+    // unmodified, the bytes are written back as they were read
+    Parcel p2;
+    ASSERT_EQ(OK, lazy.writeToParcel(&p2));
+    ASSERT_EQ(p.dataSize(), p2.dataSize());
+    EXPECT_EQ(0, memcmp(p.data(), p2.data(), p.dataSize()));
+    p2.setDataPosition(0);
+    PersistableBundle eager;
+    ASSERT_EQ(OK, eager.readFromParcel(&p2));
+    expectSameContents(eager, lazy);
+
+    // modified, the bundle is decoded and written out again
+    lazy.putLong(String16("b"), 3);
+    Parcel p3;
+    ASSERT_EQ(OK, lazy.writeToParcel(&p3));
+    p3.setDataPosition(0);
+    PersistableBundle reread;
+    ASSERT_EQ(OK, reread.readFromParcelLazily(&p3));
+    expectSameContents(lazy, reread);
+    int64_t l = 0;
+    EXPECT_TRUE(reread.getLong(String16("b"), &l));
+    EXPECT_EQ(3, l);
+}
+
+TEST(PersistableBundle, LazyReadRejectsNonEmptyBundle) {
+    Parcel p;
+    ASSERT_EQ(OK, makeBundle().writeToParcel(&p));
+    p.setDataPosition(0);
+
+    PersistableBundle bundle;
+    bundle.putInt(String16("existing"), 1);
+    EXPECT_EQ(android::INVALID_OPERATION, bundle.readFromParcelLazily(&p));
+    EXPECT_EQ(0u, p.dataPosition());
+    EXPECT_EQ(1u, bundle.size());
+}
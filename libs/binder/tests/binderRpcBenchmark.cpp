@@ -28,9 +28,11 @@
 #include <binder/RpcTlsTestUtils.h>
 #include <binder/RpcTlsUtils.h>
 #include <binder/RpcTransportRaw.h>
+#include <binder/RpcTransportShm.h>
 #include <binder/RpcTransportTls.h>
 #include <openssl/ssl.h>
 
+#include <mutex>
 #include <thread>
 
 #include <signal.h>
@@ -54,6 +56,7 @@ using android::RpcServer;
 using android::RpcSession;
 using android::RpcTransportCtxFactory;
 using android::RpcTransportCtxFactoryRaw;
+using android::RpcTransportCtxFactoryShm;
 using android::RpcTransportCtxFactoryTls;
 using android::sp;
 using android::status_t;
@@ -74,12 +77,30 @@ class MyBinderRpcBenchmark : public BnBinderRpcBenchmark {
         *out = bytes;
         return Status::ok();
     }
+    Status sendBytesOneway(const std::vector<uint8_t>& /*bytes*/) override {
+        return Status::ok();
+    }
+    Status holdBinders(const std::vector<sp<IBinder>>& binders) override {
+        std::lock_guard<std::mutex> _l(mLock);
+        mHeldBinders.insert(mHeldBinders.end(), binders.begin(), binders.end());
+        return Status::ok();
+    }
+    Status clearHeldBinders() override {
+        std::lock_guard<std::mutex> _l(mLock);
+        mHeldBinders.clear();
+        return Status::ok();
+    }
+
+private:
+    std::mutex mLock;
+    std::vector<sp<IBinder>> mHeldBinders;
 };
 
 enum Transport {
     KERNEL,
     RPC,
     RPC_TLS,
+    RPC_SHM,
 };
 
 static const std::initializer_list<int64_t> kTransportList = {
@@ -88,6 +109,7 @@ static const std::initializer_list<int64_t> kTransportList = {
 #endif
         Transport::RPC,
         Transport::RPC_TLS,
+        Transport::RPC_SHM,
 };
 
 std::unique_ptr<RpcTransportCtxFactory> makeFactoryTls() {
@@ -101,10 +123,28 @@ std::unique_ptr<RpcTransportCtxFactory> makeFactoryTls() {
     return RpcTransportCtxFactoryTls::make(verifier, std::move(auth));
 }
 
+// Same key and certificate each time, so that generating them isn't measured.
+std::unique_ptr<RpcTransportCtxFactory> makeFactoryTlsCached() {
+    static bssl::UniquePtr<EVP_PKEY> pkey = android::makeKeyPairForSelfSignedCert();
+    static bssl::UniquePtr<X509> cert =
+            android::makeSelfSignedCert(pkey.get(), android::kCertValidSeconds);
+    CHECK_NE(pkey.get(), nullptr);
+    CHECK_NE(cert.get(), nullptr);
+
+    EVP_PKEY_up_ref(pkey.get());
+    X509_up_ref(cert.get());
+    auto verifier = std::make_shared<RpcCertificateVerifierNoOp>(OK);
+    auto auth = std::make_unique<RpcAuthPreSigned>(bssl::UniquePtr<EVP_PKEY>(pkey.get()),
+                                                   bssl::UniquePtr<X509>(cert.get()));
+    return RpcTransportCtxFactoryTls::make(verifier, std::move(auth));
+}
+
 static sp<RpcSession> gSession = RpcSession::make();
 // Certificate validation happens during handshake and does not affect the result of benchmarks.
 // Skip certificate validation to simplify the setup process.
 static sp<RpcSession> gSessionTls = RpcSession::make(makeFactoryTls());
+static sp<RpcSession> gSessionShm = RpcSession::make(RpcTransportCtxFactoryShm::make());
+static sp<RpcSession> gSessionOnewayQueued = RpcSession::make();
 #ifdef __BIONIC__
 static const String16 kKernelBinderInstance = String16(u"binderRpcBenchmark-control");
 static sp<IBinder> gKernelBinder;
@@ -121,6 +161,8 @@ static sp<IBinder> getBinderForOptions(benchmark::State& state) {
             return gSession->getRootObject();
         case RPC_TLS:
             return gSessionTls->getRootObject();
+        case RPC_SHM:
+            return gSessionShm->getRootObject();
         default:
             LOG(FATAL) << "Unknown transport value: " << transport;
             return nullptr;
@@ -202,6 +244,137 @@ void BM_repeatBinder(benchmark::State& state) {
 }
 BENCHMARK(BM_repeatBinder)->ArgsProduct({kTransportList});
 
+void BM_repeatBinderWithManyKnown(benchmark::State& state) {
+    sp<IBinder> binder = getBinderForOptions(state);
+    CHECK(binder != nullptr);
+    sp<IBinderRpcBenchmark> iface = interface_cast<IBinderRpcBenchmark>(binder);
+    CHECK(iface != nullptr);
+
+    // Every binder sent by this process is looked up in the binders already
+    // known to the session, so make many of them known.
+    constexpr size_t kBatchSize = 1000;
+    size_t numKnown = static_cast<size_t>(state.range(1));
+    std::vector<sp<IBinder>> known;
+    for (size_t i = 0; i < numKnown; i += kBatchSize) {
+        std::vector<sp<IBinder>> batch;
+        for (size_t j = i; j < std::min(numKnown, i + kBatchSize); j++) {
+            batch.push_back(sp<BBinder>::make());
+        }
+        Status ret = iface->holdBinders(batch);
+        CHECK(ret.isOk()) << ret;
+        known.insert(known.end(), batch.begin(), batch.end());
+    }
+
+    while (state.KeepRunning()) {
+        // force creation of a new address
+        sp<IBinder> binder = sp<BBinder>::make();
+
+        sp<IBinder> out;
+        Status ret = iface->repeatBinder(binder, &out);
+        CHECK(ret.isOk()) << ret;
+    }
+
+    Status ret = iface->clearHeldBinders();
+    CHECK(ret.isOk()) << ret;
+}
+BENCHMARK(BM_repeatBinderWithManyKnown)->ArgsProduct({kTransportList, {10000}});
+
+#ifdef __BIONIC__
+// Like process startup, where the same few services are looked up many times
+void BM_repeatedServiceLookup(benchmark::State& state) {
+    android::setServiceLookupCacheEnabled(state.range(0) != 0);
+    sp<IServiceManager> sm = defaultServiceManager();
+    android::ServiceLookupCacheStats before = android::getServiceLookupCacheStats();
+
+    while (state.KeepRunning()) {
+        CHECK_NE(nullptr, sm->checkService(kKernelBinderInstance).get());
+    }
+
+    android::ServiceLookupCacheStats after = android::getServiceLookupCacheStats();
+    state.counters["cacheHits"] = after.hits - before.hits;
+    state.counters["cacheMisses"] = after.misses - before.misses;
+    android::setServiceLookupCacheEnabled(false);
+}
+BENCHMARK(BM_repeatedServiceLookup)->Arg(0)->Arg(1);
+#endif
+
+// Servers with several threads, so each session has several connections
+static std::string gSetupSessionAddr[RPC_SHM + 1];
+constexpr size_t kSetupSessionThreads = 4;
+
+void BM_setupSession(benchmark::State& state) {
+    Transport transport = static_cast<Transport>(state.range(0));
+    const std::string& addr = gSetupSessionAddr[transport];
+
+    while (state.KeepRunning()) {
+        sp<RpcSession> session = transport == RPC_TLS
+                ? RpcSession::make(makeFactoryTlsCached())
+                : RpcSession::make(RpcTransportCtxFactoryRaw::make());
+        status_t status = session->setupUnixDomainClient(addr.c_str());
+        CHECK_EQ(status, OK) << "Could not connect: " << statusToString(status).c_str();
+
+        state.PauseTiming();
+        CHECK(session->shutdownAndWait(true));
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_setupSession)->ArgsProduct({{RPC, RPC_TLS}});
+
+enum OnewayMode {
+    ONEWAY_DIRECT,
+    ONEWAY_QUEUED,
+};
+
+void BM_sendOnewayBurst(benchmark::State& state) {
+    sp<RpcSession> session = state.range(0) == ONEWAY_QUEUED ? gSessionOnewayQueued : gSession;
+    sp<IBinderRpcBenchmark> iface = interface_cast<IBinderRpcBenchmark>(session->getRootObject());
+    CHECK(iface != nullptr);
+
+    std::vector<uint8_t> bytes(64);
+    while (state.KeepRunning()) {
+        Status ret = iface->sendBytesOneway(bytes);
+        CHECK(ret.isOk()) << ret;
+    }
+}
+BENCHMARK(BM_sendOnewayBurst)->ArgsProduct({{ONEWAY_DIRECT, ONEWAY_QUEUED}})->ThreadRange(1, 8);
+
+enum ServerThreading {
+    THREAD_PER_CONNECTION,
+    EVENT_LOOP,
+};
+
+static std::string gManySessionsAddr[2];
+
+void BM_pingManySessions(benchmark::State& state) {
+    const std::string& addr = gManySessionsAddr[state.range(0)];
+    size_t numSessions = static_cast<size_t>(state.range(1));
+
+    // The server has one connection per session to serve. Only one of them is
+    // active at a time, the rest are idle, as is typical for many clients.
+    std::vector<sp<RpcSession>> sessions;
+    std::vector<sp<IBinder>> binders;
+    for (size_t i = 0; i < numSessions; i++) {
+        sp<RpcSession> session = RpcSession::make();
+        status_t status = session->setupUnixDomainClient(addr.c_str());
+        CHECK_EQ(status, OK) << "Could not connect: " << statusToString(status).c_str();
+        binders.push_back(session->getRootObject());
+        CHECK_NE(nullptr, binders.back().get());
+        sessions.push_back(std::move(session));
+    }
+
+    size_t next = 0;
+    while (state.KeepRunning()) {
+        CHECK_EQ(OK, binders[next]->pingBinder());
+        next = (next + 1) % binders.size();
+    }
+
+    binders.clear();
+    for (auto& session : sessions) {
+        CHECK(session->shutdownAndWait(true));
+    }
+}
+BENCHMARK(BM_pingManySessions)->ArgsProduct({{THREAD_PER_CONNECTION, EVENT_LOOP}, {1, 64, 512}});
+
 void forkRpcServer(const char* addr, const sp<RpcServer>& server) {
     if (0 == fork()) {
         prctl(PR_SET_PDEATHSIG, SIGHUP); // racey, okay
@@ -230,6 +403,7 @@ int main(int argc, char** argv) {
     std::cerr << "\t.../" << Transport::KERNEL << " is KERNEL" << std::endl;
     std::cerr << "\t.../" << Transport::RPC << " is RPC" << std::endl;
     std::cerr << "\t.../" << Transport::RPC_TLS << " is RPC with TLS" << std::endl;
+    std::cerr << "\t.../" << Transport::RPC_SHM << " is RPC with shared memory" << std::endl;
 
 #ifdef __BIONIC__
     if (0 == fork()) {
@@ -254,12 +428,56 @@ int main(int argc, char** argv) {
     (void)unlink(addr.c_str());
     forkRpcServer(addr.c_str(), RpcServer::make(RpcTransportCtxFactoryRaw::make()));
     setupClient(gSession, addr.c_str());
+    gSessionOnewayQueued->setMaxQueuedOnewayTransactions(64);
+    setupClient(gSessionOnewayQueued, addr.c_str());
 
     std::string tlsAddr = tmp + "/binderRpcTlsBenchmark";
     (void)unlink(tlsAddr.c_str());
     forkRpcServer(tlsAddr.c_str(), RpcServer::make(makeFactoryTls()));
     setupClient(gSessionTls, tlsAddr.c_str());
 
+    std::string shmAddr = tmp + "/binderRpcShmBenchmark";
+    (void)unlink(shmAddr.c_str());
+    forkRpcServer(shmAddr.c_str(), RpcServer::make(RpcTransportCtxFactoryShm::make()));
+    setupClient(gSessionShm, shmAddr.c_str());
+
+    for (Transport transport : {RPC, RPC_TLS}) {
+        std::string& setupAddr = gSetupSessionAddr[transport];
+        setupAddr = tmp + "/binderRpcSetupSessionBenchmark" + std::to_string(transport);
+        (void)unlink(setupAddr.c_str());
+        auto server = transport == RPC_TLS ? RpcServer::make(makeFactoryTlsCached())
+                                           : RpcServer::make(RpcTransportCtxFactoryRaw::make());
+        server->setMaxThreads(kSetupSessionThreads);
+        forkRpcServer(setupAddr.c_str(), server);
+        // wait for the server to come up
+        sp<RpcSession> probe = RpcSession::make(transport == RPC_TLS
+                                                        ? makeFactoryTlsCached()
+                                                        : RpcTransportCtxFactoryRaw::make());
+        setupClient(probe, setupAddr.c_str());
+        CHECK(probe->shutdownAndWait(true));
+    }
+
+    std::cerr << "\t.../" << OnewayMode::ONEWAY_DIRECT << " is a connection per oneway call "
+              << "(BM_sendOnewayBurst)" << std::endl;
+    std::cerr << "\t.../" << OnewayMode::ONEWAY_QUEUED << " is queued oneway calls "
+              << "(BM_sendOnewayBurst)" << std::endl;
+    std::cerr << "\t.../" << ServerThreading::THREAD_PER_CONNECTION << "/<sessions> is a thread "
+              << "per connection (BM_pingManySessions)" << std::endl;
+    std::cerr << "\t.../" << ServerThreading::EVENT_LOOP << "/<sessions> is an event loop "
+              << "(BM_pingManySessions)" << std::endl;
+    for (ServerThreading threading : {THREAD_PER_CONNECTION, EVENT_LOOP}) {
+        std::string& manyAddr = gManySessionsAddr[threading];
+        manyAddr = tmp + "/binderRpcManySessionsBenchmark" + std::to_string(threading);
+        (void)unlink(manyAddr.c_str());
+        auto server = RpcServer::make(RpcTransportCtxFactoryRaw::make());
+        if (threading == EVENT_LOOP) server->setEventLoopThreads(4);
+        forkRpcServer(manyAddr.c_str(), server);
+        // wait for the server to come up
+        sp<RpcSession> probe = RpcSession::make();
+        setupClient(probe, manyAddr.c_str());
+        CHECK(probe->shutdownAndWait(true));
+    }
+
     ::benchmark::RunSpecifiedBenchmarks();
     return 0;
 }
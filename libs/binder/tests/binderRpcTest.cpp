@@ -36,12 +36,16 @@
 #include <binder/RpcTlsUtils.h>
 #include <binder/RpcTransport.h>
 #include <binder/RpcTransportRaw.h>
+#include <binder/RpcTransportShm.h>
 #include <binder/RpcTransportTls.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 
@@ -66,10 +70,10 @@ static_assert(RPC_WIRE_PROTOCOL_VERSION + 1 == RPC_WIRE_PROTOCOL_VERSION_NEXT ||
               RPC_WIRE_PROTOCOL_VERSION == RPC_WIRE_PROTOCOL_VERSION_EXPERIMENTAL);
 const char* kLocalInetAddress = "127.0.0.1";
 
-enum class RpcSecurity { RAW, TLS };
+enum class RpcSecurity { RAW, TLS, SHM };
 
 static inline std::vector<RpcSecurity> RpcSecurityValues() {
-    return {RpcSecurity::RAW, RpcSecurity::TLS};
+    return {RpcSecurity::RAW, RpcSecurity::TLS, RpcSecurity::SHM};
 }
 
 static inline std::unique_ptr<RpcTransportCtxFactory> newFactory(
@@ -87,6 +91,8 @@ static inline std::unique_ptr<RpcTransportCtxFactory> newFactory(
             }
             return RpcTransportCtxFactoryTls::make(std::move(verifier), std::move(auth));
         }
+        case RpcSecurity::SHM:
+            return RpcTransportCtxFactoryShm::make();
         default:
             LOG_ALWAYS_FATAL("Unknown RpcSecurity %d", rpcSecurity);
     }
@@ -465,6 +471,12 @@ static inline std::string PrintToString(SocketType socketType) {
     }
 }
 
+// The shared memory transport needs unix domain sockets to pass the memory.
+static inline bool supportsSocketType(RpcSecurity rpcSecurity, SocketType socketType) {
+    if (rpcSecurity != RpcSecurity::SHM) return true;
+    return socketType == SocketType::UNIX || socketType == SocketType::PRECONNECTED;
+}
+
 static base::unique_fd connectTo(const RpcSocketAddress& addr) {
     base::unique_fd serverFd(
             TEMP_FAILURE_RETRY(socket(addr.addr()->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0)));
@@ -480,7 +492,8 @@ static base::unique_fd connectTo(const RpcSocketAddress& addr) {
     return serverFd;
 }
 
-class BinderRpc : public ::testing::TestWithParam<std::tuple<SocketType, RpcSecurity>> {
+// The last parameter serves connections from an event loop instead of a thread each.
+class BinderRpc : public ::testing::TestWithParam<std::tuple<SocketType, RpcSecurity, bool>> {
 public:
     struct Options {
         size_t numThreads = 1;
@@ -490,8 +503,9 @@ public:
     };
 
     static inline std::string PrintParamInfo(const testing::TestParamInfo<ParamType>& info) {
-        auto [type, security] = info.param;
-        return PrintToString(type) + "_" + newFactory(security)->toCString();
+        auto [type, security, eventLoop] = info.param;
+        return PrintToString(type) + "_" + newFactory(security)->toCString() +
+                (eventLoop ? "_eventLoop" : "");
     }
 
     static inline void writeString(android::base::borrowed_fd fd, std::string_view str) {
@@ -533,6 +547,7 @@ public:
 
         SocketType socketType = std::get<0>(GetParam());
         RpcSecurity rpcSecurity = std::get<1>(GetParam());
+        bool eventLoop = std::get<2>(GetParam());
 
         unsigned int vsockPort = allocateVsockPort();
         std::string addr = allocateSocketAddress();
@@ -544,6 +559,10 @@ public:
                     sp<RpcServer> server = RpcServer::make(newFactory(rpcSecurity, certVerifier));
 
                     server->setMaxThreads(options.numThreads);
+                    if (eventLoop) {
+                        // as many threads as there could be connections without it
+                        server->setEventLoopThreads(options.numThreads * options.numSessions);
+                    }
 
                     unsigned int outPort = 0;
 
@@ -1412,9 +1431,20 @@ static std::vector<SocketType> testSocketTypes(bool hasPreconnected = true) {
     return ret;
 }
 
-INSTANTIATE_TEST_CASE_P(PerSocket, BinderRpc,
-                        ::testing::Combine(::testing::ValuesIn(testSocketTypes()),
-                                           ::testing::ValuesIn(RpcSecurityValues())),
+static std::vector<BinderRpc::ParamType> binderRpcParams() {
+    std::vector<BinderRpc::ParamType> ret;
+    for (auto socketType : testSocketTypes()) {
+        for (auto rpcSecurity : RpcSecurityValues()) {
+            if (!supportsSocketType(rpcSecurity, socketType)) continue;
+            for (bool eventLoop : {false, true}) {
+                ret.emplace_back(socketType, rpcSecurity, eventLoop);
+            }
+        }
+    }
+    return ret;
+}
+
+INSTANTIATE_TEST_CASE_P(PerSocket, BinderRpc, ::testing::ValuesIn(binderRpcParams()),
                         BinderRpc::PrintParamInfo);
 
 class BinderRpcServerRootObject
@@ -1493,6 +1523,153 @@ TEST_P(BinderRpcSimple, Shutdown) {
             << "After server->shutdown() returns true, join() did not stop after 2s";
 }
 
+// Connections which are still being set up when the server shuts down must not be
+// added to a stopped event loop.
+TEST_P(BinderRpcSimple, ShutdownWhileConnectingToEventLoop) {
+    auto addr = allocateSocketAddress();
+    auto server = RpcServer::make(newFactory(GetParam()));
+    server->setEventLoopThreads(2);
+    server->setRootObject(sp<BBinder>::make());
+    ASSERT_EQ(OK, server->setupUnixDomainServer(addr.c_str()));
+    server->start();
+
+    std::atomic<bool> done = false;
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < 4; i++) {
+        clients.emplace_back([&] {
+            while (!done) {
+                auto session = RpcSession::make(newFactory(GetParam()));
+                // fails once the server is shut down
+                if (OK == session->setupUnixDomainClient(addr.c_str())) {
+                    (void)session->shutdownAndWait(false);
+                }
+            }
+        });
+    }
+
+    usleep(100 * 1000);
+    EXPECT_TRUE(server->shutdown());
+    done = true;
+    for (auto& client : clients) client.join();
+}
+
+TEST(BinderRpc, SharedMemoryTransport) {
+    auto addr = allocateSocketAddress();
+    auto server = RpcServer::make(RpcTransportCtxFactoryShm::make());
+    server->setRootObject(sp<BBinder>::make());
+    ASSERT_EQ(OK, server->setupUnixDomainServer(addr.c_str()));
+    server->start();
+
+    auto session = RpcSession::make(RpcTransportCtxFactoryShm::make());
+    ASSERT_EQ(OK, session->setupUnixDomainClient(addr.c_str()));
+    sp<IBinder> binder = session->getRootObject();
+    ASSERT_NE(nullptr, binder);
+
+    // enough to wrap around the rings many times
+    for (size_t i = 0; i < 10000; i++) {
+        ASSERT_EQ(OK, binder->pingBinder());
+    }
+
+    // more than fits in a ring at once
+    Parcel data;
+    data.markForBinder(binder);
+    std::vector<uint8_t> bytes(90 * 1000, 0xab);
+    ASSERT_EQ(OK, data.write(bytes.data(), bytes.size()));
+    Parcel reply;
+    EXPECT_EQ(UNKNOWN_TRANSACTION,
+              binder->transact(IBinder::FIRST_CALL_TRANSACTION, data, &reply));
+    EXPECT_EQ(OK, binder->pingBinder());
+
+    EXPECT_TRUE(session->shutdownAndWait(true));
+    EXPECT_TRUE(server->shutdown());
+}
+
+class OnewayOrderBinder : public BBinder {
+public:
+    static constexpr uint32_t ONEWAY = IBinder::FIRST_CALL_TRANSACTION;
+    static constexpr uint32_t GET_RECEIVED = IBinder::FIRST_CALL_TRANSACTION + 1;
+
+    status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                        uint32_t flags) override {
+        std::lock_guard<std::mutex> _l(mLock);
+        switch (code) {
+            case ONEWAY: {
+                int32_t sender = data.readInt32();
+                int32_t seq = data.readInt32();
+                if (mNextSeq[sender] != seq) mOutOfOrder = true;
+                mNextSeq[sender] = seq + 1;
+                mReceived++;
+                return OK;
+            }
+            case GET_RECEIVED:
+                reply->writeInt32(mReceived);
+                reply->writeBool(mOutOfOrder);
+                return OK;
+            default:
+                return BBinder::onTransact(code, data, reply, flags);
+        }
+    }
+
+private:
+    std::mutex mLock;
+    std::map<int32_t, int32_t> mNextSeq;
+    int32_t mReceived = 0;
+    bool mOutOfOrder = false;
+};
+
+TEST(BinderRpc, QueuedOnewayTransactionsStayInOrder) {
+    constexpr int32_t kSenders = 4;
+    constexpr int32_t kPerSender = 1000;
+
+    auto addr = allocateSocketAddress();
+    auto server = RpcServer::make(newFactory(RpcSecurity::RAW));
+    server->setMaxThreads(2);
+    server->setRootObject(sp<OnewayOrderBinder>::make());
+    ASSERT_EQ(OK, server->setupUnixDomainServer(addr.c_str()));
+    server->start();
+
+    auto session = RpcSession::make(newFactory(RpcSecurity::RAW));
+    // small, so senders are blocked and transactions are written in batches
+    session->setMaxQueuedOnewayTransactions(4);
+    ASSERT_EQ(OK, session->setupUnixDomainClient(addr.c_str()));
+    sp<IBinder> binder = session->getRootObject();
+    ASSERT_NE(nullptr, binder);
+
+    std::vector<std::thread> senders;
+    for (int32_t sender = 0; sender < kSenders; sender++) {
+        senders.emplace_back([&, sender] {
+            for (int32_t seq = 0; seq < kPerSender; seq++) {
+                Parcel data;
+                data.markForBinder(binder);
+                data.writeInt32(sender);
+                data.writeInt32(seq);
+                EXPECT_EQ(OK,
+                          binder->transact(OnewayOrderBinder::ONEWAY, data, nullptr,
+                                           IBinder::FLAG_ONEWAY));
+            }
+        });
+    }
+    for (auto& t : senders) t.join();
+
+    // queued transactions may still be on their way
+    int32_t received = 0;
+    bool outOfOrder = false;
+    for (size_t tries = 0; tries < 1000 && received != kSenders * kPerSender; tries++) {
+        Parcel data;
+        data.markForBinder(binder);
+        Parcel reply;
+        ASSERT_EQ(OK, binder->transact(OnewayOrderBinder::GET_RECEIVED, data, &reply));
+        received = reply.readInt32();
+        outOfOrder = reply.readBool();
+        if (received != kSenders * kPerSender) usleep(10000);
+    }
+    EXPECT_EQ(kSenders * kPerSender, received);
+    EXPECT_FALSE(outOfOrder);
+
+    EXPECT_TRUE(session->shutdownAndWait(true));
+    EXPECT_TRUE(server->shutdown());
+}
+
 TEST(BinderRpc, Java) {
 #if !defined(__ANDROID__)
     GTEST_SKIP() << "This test is only run on Android. Though it can technically run on host on"
@@ -1774,6 +1951,11 @@ public:
                         ret.emplace_back(socketType, rpcSecurity, RpcCertificateFormat::PEM);
                         ret.emplace_back(socketType, rpcSecurity, RpcCertificateFormat::DER);
                     } break;
+                    case RpcSecurity::SHM: {
+                        if (supportsSocketType(rpcSecurity, socketType)) {
+                            ret.emplace_back(socketType, rpcSecurity, std::nullopt);
+                        }
+                    } break;
                 }
             }
         }
@@ -1961,6 +2143,63 @@ INSTANTIATE_TEST_CASE_P(BinderRpc, RpcTransportTest,
                         ::testing::ValuesIn(RpcTransportTest::getRpcTranportTestParams()),
                         RpcTransportTest::PrintParamInfo);
 
+// Accepts the first |allowed| certificates that |inner| accepts, and rejects any after that.
+class RpcCertificateVerifierAllowFirst : public RpcCertificateVerifier {
+public:
+    RpcCertificateVerifierAllowFirst(std::shared_ptr<RpcCertificateVerifier> inner, size_t allowed)
+          : mInner(std::move(inner)), mAllowed(allowed) {}
+    status_t verify(const SSL* ssl, uint8_t* outAlert) override {
+        if (mCalls++ >= mAllowed) {
+            *outAlert = SSL_AD_CERTIFICATE_UNKNOWN;
+            return PERMISSION_DENIED;
+        }
+        return mInner->verify(ssl, outAlert);
+    }
+    size_t calls() const { return mCalls; }
+
+private:
+    std::shared_ptr<RpcCertificateVerifier> mInner;
+    const size_t mAllowed;
+    std::atomic<size_t> mCalls = 0;
+};
+
+TEST(BinderRpc, TlsResumedSessionIsVerifiedAgain) {
+    using Server = RpcTransportTestUtils::Server;
+    const RpcTransportTestUtils::Param param{SocketType::UNIX, RpcSecurity::TLS,
+                                             RpcCertificateFormat::PEM};
+    auto server = std::make_unique<Server>();
+    ASSERT_TRUE(server->setUp(param));
+
+    auto trustServer = std::make_shared<RpcCertificateVerifierSimple>();
+    auto verifier = std::make_shared<RpcCertificateVerifierAllowFirst>(trustServer, 1);
+    auto clientCtx = newFactory(RpcSecurity::TLS, verifier)->newClientCtx();
+    ASSERT_NE(nullptr, clientCtx);
+    ASSERT_EQ(OK,
+              trustServer->addTrustedPeerCertificate(RpcCertificateFormat::PEM,
+                                                     server->getCtx()->getCertificate(
+                                                             RpcCertificateFormat::PEM)));
+    ASSERT_EQ(OK,
+              server->getCertVerifier()
+                      ->addTrustedPeerCertificate(RpcCertificateFormat::PEM,
+                                                  clientCtx->getCertificate(
+                                                          RpcCertificateFormat::PEM)));
+    server->start();
+
+    // The first connection does a full handshake. Reading the server's message also reads the
+    // session ticket, which comes before it.
+    auto fdTrigger = FdTrigger::make();
+    auto first = clientCtx->newTransport(server->getConnectToServerFn()(), fdTrigger.get());
+    ASSERT_NE(nullptr, first);
+    std::string message(strlen(RpcTransportTestUtils::kMessage), '\0');
+    iovec messageIov{message.data(), message.size()};
+    ASSERT_EQ(OK, first->interruptableReadFully(fdTrigger.get(), &messageIov, 1, {}));
+    EXPECT_EQ(RpcTransportTestUtils::kMessage, message);
+
+    // The second connection resumes the session, but the verifier now rejects the server.
+    EXPECT_EQ(nullptr, clientCtx->newTransport(server->getConnectToServerFn()(), fdTrigger.get()));
+    EXPECT_EQ(2u, verifier->calls());
+}
+
 class RpcTransportTlsKeyTest
       : public testing::TestWithParam<std::tuple<SocketType, RpcCertificateFormat, RpcKeyFormat>> {
 public:
@@ -2,6 +2,7 @@
 #include <binder/IBinder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
+#include <binder/TransactionStats.h>
 #include <string>
 #include <cstring>
 #include <cstdlib>
@@ -273,11 +274,11 @@ void signal_all(vector<Pipe>& v)
     }
 }
 
-void run_main(int iterations,
-              int workers,
-              int payload_size,
-              int cs_pair,
-              bool training_round=false)
+double run_main(int iterations,
+                int workers,
+                int payload_size,
+                int cs_pair,
+                bool training_round=false)
 {
     vector<Pipe> pipes;
     // Create all the workers and wait for them to spawn.
@@ -327,6 +328,7 @@ void run_main(int iterations,
     } else {
             tot_results.dump();
     }
+    return iterations_per_sec;
 }
 
 int main(int argc, char *argv[])
@@ -336,6 +338,8 @@ int main(int argc, char *argv[])
     int payload_size = 0;
     bool cs_pair = false;
     bool training_round = false;
+    // budget for the cost of TransactionStats, in percent of throughput
+    double max_stats_overhead = -1;
     (void)argc;
     (void)argv;
 
@@ -345,6 +349,8 @@ int main(int argc, char *argv[])
             cout << "Usage: binderThroughputTest [OPTIONS]" << endl;
             cout << "\t-i N    : Specify number of iterations." << endl;
             cout << "\t-m N    : Specify expected max latency in microseconds." << endl;
+            cout << "\t-o N    : Fail if transaction stats cost over N% of throughput "
+                    "(off by default)." << endl;
             cout << "\t-p      : Split workers into client/server pairs." << endl;
             cout << "\t-s N    : Specify payload size." << endl;
             cout << "\t-t N    : Run training round." << endl;
@@ -376,6 +382,12 @@ int main(int argc, char *argv[])
             // to get an approximation of max latency.
             training_round = true;
         }
+        if (string(argv[i]) == "-o") {
+            // Compare runs with TransactionStats off and on.
+            max_stats_overhead = atof(argv[i+1]);
+            i++;
+            continue;
+        }
         if (string(argv[i]) == "-m") {
             // Caller specified the max latency in microseconds.
             // No need to run training round in this case.
@@ -396,6 +408,24 @@ int main(int argc, char *argv[])
         cout << "Completed training round" << endl << endl;
     }
 
+    if (max_stats_overhead >= 0) {
+        // Workers are forked, so they inherit the setting.
+        TransactionStats::setEnabled(false);
+        cout << "Run with transaction stats disabled" << endl;
+        double without_stats = run_main(iterations, workers, payload_size, cs_pair);
+        TransactionStats::setEnabled(true);
+        cout << "Run with transaction stats enabled" << endl;
+        double with_stats = run_main(iterations, workers, payload_size, cs_pair);
+
+        double overhead = 100.0 * (without_stats - with_stats) / without_stats;
+        cout << "transaction stats overhead: " << overhead << "%" << endl;
+        if (overhead > max_stats_overhead) {
+            cout << "over the budget of " << max_stats_overhead << "%" << endl;
+            return EXIT_FAILURE;
+        }
+        return 0;
+    }
+
     run_main(iterations, workers, payload_size, cs_pair);
     return 0;
 }
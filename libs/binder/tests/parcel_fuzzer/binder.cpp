@@ -349,6 +349,21 @@ std::vector<ParcelRead<::android::Parcel>> BINDER_PARCEL_READ_FUNCTIONS {
         status_t status = p.compareDataInRange(thisOffset, p, otherOffset, length, &result);
         FUZZ_LOG() << " status: " << status  << " result: " << result;
     },
+    [] (const ::android::Parcel& p, uint8_t /* data */) {
+        FUZZ_LOG() << "about to call PersistableBundle::readFromParcelLazily()";
+        android::os::PersistableBundle bundle;
+        status_t status = bundle.readFromParcelLazily(&p);
+        FUZZ_LOG() << "status: " << status << " size: " << bundle.size();
+        for (const auto& key : bundle.getStringKeys()) {
+            android::String16 value;
+            FUZZ_LOG() << "got string: " << bundle.getString(key, &value);
+        }
+        for (const auto& key : bundle.getPersistableBundleKeys()) {
+            android::os::PersistableBundle value;
+            FUZZ_LOG() << "got bundle: " << bundle.getPersistableBundle(key, &value);
+        }
+        bundle.erase(android::String16("key"));
+    },
 };
 // clang-format on
 #pragma clang diagnostic pop
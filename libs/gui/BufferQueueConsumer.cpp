@@ -81,6 +81,7 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
 
     int numDroppedBuffers = 0;
     sp<IProducerListener> listener;
+    bool wakeDequeuers = false;
     {
         std::unique_lock<std::mutex> lock(mCore->mMutex);
 
@@ -295,7 +296,7 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
         // We might have freed a slot while dropping old buffers, or the producer
         // may be blocked waiting for the number of buffers in the queue to
         // decrease.
-        mCore->mDequeueCondition.notify_all();
+        wakeDequeuers = mCore->mDequeueWaiters > 0;
 
         ATRACE_INT(mCore->mConsumerName.string(),
                 static_cast<int32_t>(mCore->mQueue.size()));
@@ -305,6 +306,12 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
         VALIDATE_CONSISTENCY();
     }
 
+    // Wake after unlocking, so that the producer does not wake up only to
+    // block on mCore->mMutex.
+    if (wakeDequeuers) {
+        mCore->mDequeueCondition.notify_all();
+    }
+
     if (listener != nullptr) {
         for (int i = 0; i < numDroppedBuffers; ++i) {
             listener->onBufferReleased();
@@ -453,6 +460,7 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
     }
 
     sp<IProducerListener> listener;
+    bool wakeDequeuers = false;
     { // Autolock scope
         std::lock_guard<std::mutex> lock(mCore->mMutex);
 
@@ -495,10 +503,14 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
         }
         BQ_LOGV("releaseBuffer: releasing slot %d", slot);
 
-        mCore->mDequeueCondition.notify_all();
+        wakeDequeuers = mCore->mDequeueWaiters > 0;
         VALIDATE_CONSISTENCY();
     } // Autolock scope
 
+    if (wakeDequeuers) {
+        mCore->mDequeueCondition.notify_all();
+    }
+
     // Call back without lock held
     if (listener != nullptr) {
         listener->onBufferReleased();
@@ -103,6 +103,7 @@ BufferQueueCore::BufferQueueCore()
         mUnusedSlots(),
         mActiveBuffers(),
         mDequeueCondition(),
+        mDequeueWaiters(0),
         mDequeueBufferCannotBlock(false),
         mQueueBufferCanDrop(false),
         mLegacyBufferDrop(true),
@@ -82,6 +82,7 @@ BufferQueueProducer::BufferQueueProducer(const sp<BufferQueueCore>& core,
     mNextCallbackTicket(0),
     mCurrentCallbackTicket(0),
     mCallbackCondition(),
+    mCallbackWaiters(0),
     mDequeueTimeout(-1),
     mDequeueWaitingForAllocation(false) {}
 
@@ -89,8 +90,25 @@ BufferQueueProducer::~BufferQueueProducer() {}
 
 status_t BufferQueueProducer::requestBuffer(int slot, sp<GraphicBuffer>* buf) {
     ATRACE_CALL();
-    BQ_LOGV("requestBuffer: slot %d", slot);
     std::lock_guard<std::mutex> lock(mCore->mMutex);
+    return requestBufferLocked(slot, buf);
+}
+
+status_t BufferQueueProducer::requestBuffers(const std::vector<int32_t>& slots,
+                                             std::vector<RequestBufferOutput>* outputs) {
+    ATRACE_CALL();
+    outputs->clear();
+    outputs->reserve(slots.size());
+    std::lock_guard<std::mutex> lock(mCore->mMutex);
+    for (int32_t slot : slots) {
+        RequestBufferOutput& output = outputs->emplace_back();
+        output.result = requestBufferLocked(static_cast<int>(slot), &output.buffer);
+    }
+    return NO_ERROR;
+}
+
+status_t BufferQueueProducer::requestBufferLocked(int slot, sp<GraphicBuffer>* buf) {
+    BQ_LOGV("requestBuffer: slot %d", slot);
 
     if (mCore->mIsAbandoned) {
         BQ_LOGE("requestBuffer: BufferQueue has been abandoned");
@@ -362,40 +380,55 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
                     (acquiredCount <= mCore->mMaxAcquiredBufferCount)) {
                 return WOULD_BLOCK;
             }
+            ++mCore->mDequeueWaiters;
+            std::cv_status result = std::cv_status::no_timeout;
             if (mDequeueTimeout >= 0) {
-                std::cv_status result = mCore->mDequeueCondition.wait_for(lock,
+                result = mCore->mDequeueCondition.wait_for(lock,
                         std::chrono::nanoseconds(mDequeueTimeout));
-                if (result == std::cv_status::timeout) {
-                    return TIMED_OUT;
-                }
             } else {
                 mCore->mDequeueCondition.wait(lock);
             }
+            --mCore->mDequeueWaiters;
+            if (result == std::cv_status::timeout) {
+                return TIMED_OUT;
+            }
         }
     } // while (tryAgain)
 
     return NO_ERROR;
 }
 
-status_t BufferQueueProducer::dequeueBuffer(int* outSlot, sp<android::Fence>* outFence,
-                                            uint32_t width, uint32_t height, PixelFormat format,
-                                            uint64_t usage, uint64_t* outBufferAge,
-                                            FrameEventHistoryDelta* outTimestamps) {
-    ATRACE_CALL();
-    { // Autolock scope
-        std::lock_guard<std::mutex> lock(mCore->mMutex);
-        mConsumerName = mCore->mConsumerName;
+// The parts of a dequeueBuffer call that dequeueBufferLocked hands on to the
+// steps that run without mCore->mMutex held.
+struct BufferQueueProducer::DequeuedBuffer {
+    int slot = BufferQueueCore::INVALID_BUFFER_SLOT;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    PixelFormat format = 0;
+    uint64_t usage = 0;
+    status_t returnFlags = NO_ERROR;
+    bool attachedByConsumer = false;
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    EGLSyncKHR eglFence = EGL_NO_SYNC_KHR;
+    uint64_t bufferAge = 0;
+};
+
+status_t BufferQueueProducer::dequeueBufferLocked(std::unique_lock<std::mutex>& lock,
+                                                  uint32_t width, uint32_t height,
+                                                  PixelFormat format, uint64_t usage,
+                                                  sp<android::Fence>* outFence,
+                                                  DequeuedBuffer* out) {
+    mConsumerName = mCore->mConsumerName;
 
-        if (mCore->mIsAbandoned) {
-            BQ_LOGE("dequeueBuffer: BufferQueue has been abandoned");
-            return NO_INIT;
-        }
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("dequeueBuffer: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
 
-        if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
-            BQ_LOGE("dequeueBuffer: BufferQueue has no connected producer");
-            return NO_INIT;
-        }
-    } // Autolock scope
+    if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
+        BQ_LOGE("dequeueBuffer: BufferQueue has no connected producer");
+        return NO_INIT;
+    }
 
     BQ_LOGV("dequeueBuffer: w=%u h=%u format=%#x, usage=%#" PRIx64, width, height, format, usage);
 
@@ -405,192 +438,197 @@ status_t BufferQueueProducer::dequeueBuffer(int* outSlot, sp<android::Fence>* ou
     }
 
     status_t returnFlags = NO_ERROR;
-    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
-    EGLSyncKHR eglFence = EGL_NO_SYNC_KHR;
-    bool attachedByConsumer = false;
 
-    { // Autolock scope
-        std::unique_lock<std::mutex> lock(mCore->mMutex);
-
-        // If we don't have a free buffer, but we are currently allocating, we wait until allocation
-        // is finished such that we don't allocate in parallel.
-        if (mCore->mFreeBuffers.empty() && mCore->mIsAllocating) {
-            mDequeueWaitingForAllocation = true;
-            mCore->waitWhileAllocatingLocked(lock);
-            mDequeueWaitingForAllocation = false;
-            mDequeueWaitingForAllocationCondition.notify_all();
-        }
+    // If we don't have a free buffer, but we are currently allocating, we wait until allocation
+    // is finished such that we don't allocate in parallel.
+    if (mCore->mFreeBuffers.empty() && mCore->mIsAllocating) {
+        mDequeueWaitingForAllocation = true;
+        mCore->waitWhileAllocatingLocked(lock);
+        mDequeueWaitingForAllocation = false;
+        mDequeueWaitingForAllocationCondition.notify_all();
+    }
 
-        if (format == 0) {
-            format = mCore->mDefaultBufferFormat;
-        }
+    if (format == 0) {
+        format = mCore->mDefaultBufferFormat;
+    }
 
-        // Enable the usage bits the consumer requested
-        usage |= mCore->mConsumerUsageBits;
+    // Enable the usage bits the consumer requested
+    usage |= mCore->mConsumerUsageBits;
 
-        const bool useDefaultSize = !width && !height;
-        if (useDefaultSize) {
-            width = mCore->mDefaultWidth;
-            height = mCore->mDefaultHeight;
-            if (mCore->mAutoPrerotation &&
-                (mCore->mTransformHintInUse & NATIVE_WINDOW_TRANSFORM_ROT_90)) {
-                std::swap(width, height);
-            }
+    const bool useDefaultSize = !width && !height;
+    if (useDefaultSize) {
+        width = mCore->mDefaultWidth;
+        height = mCore->mDefaultHeight;
+        if (mCore->mAutoPrerotation &&
+            (mCore->mTransformHintInUse & NATIVE_WINDOW_TRANSFORM_ROT_90)) {
+            std::swap(width, height);
         }
+    }
 
-        int found = BufferItem::INVALID_BUFFER_SLOT;
-        while (found == BufferItem::INVALID_BUFFER_SLOT) {
-            status_t status = waitForFreeSlotThenRelock(FreeSlotCaller::Dequeue, lock, &found);
-            if (status != NO_ERROR) {
-                return status;
-            }
+    int found = BufferItem::INVALID_BUFFER_SLOT;
+    while (found == BufferItem::INVALID_BUFFER_SLOT) {
+        status_t status = waitForFreeSlotThenRelock(FreeSlotCaller::Dequeue, lock, &found);
+        if (status != NO_ERROR) {
+            return status;
+        }
 
-            // This should not happen
-            if (found == BufferQueueCore::INVALID_BUFFER_SLOT) {
-                BQ_LOGE("dequeueBuffer: no available buffer slots");
-                return -EBUSY;
-            }
+        // This should not happen
+        if (found == BufferQueueCore::INVALID_BUFFER_SLOT) {
+            BQ_LOGE("dequeueBuffer: no available buffer slots");
+            return -EBUSY;
+        }
 
-            const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
+        const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
 
-            // If we are not allowed to allocate new buffers,
-            // waitForFreeSlotThenRelock must have returned a slot containing a
-            // buffer. If this buffer would require reallocation to meet the
-            // requested attributes, we free it and attempt to get another one.
-            if (!mCore->mAllowAllocation) {
-                if (buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage)) {
-                    if (mCore->mSharedBufferSlot == found) {
-                        BQ_LOGE("dequeueBuffer: cannot re-allocate a sharedbuffer");
-                        return BAD_VALUE;
-                    }
-                    mCore->mFreeSlots.insert(found);
-                    mCore->clearBufferSlotLocked(found);
-                    found = BufferItem::INVALID_BUFFER_SLOT;
-                    continue;
+        // If we are not allowed to allocate new buffers,
+        // waitForFreeSlotThenRelock must have returned a slot containing a
+        // buffer. If this buffer would require reallocation to meet the
+        // requested attributes, we free it and attempt to get another one.
+        if (!mCore->mAllowAllocation) {
+            if (buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage)) {
+                if (mCore->mSharedBufferSlot == found) {
+                    BQ_LOGE("dequeueBuffer: cannot re-allocate a sharedbuffer");
+                    return BAD_VALUE;
                 }
+                mCore->mFreeSlots.insert(found);
+                mCore->clearBufferSlotLocked(found);
+                found = BufferItem::INVALID_BUFFER_SLOT;
+                continue;
             }
         }
+    }
 
-        const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
-        if (mCore->mSharedBufferSlot == found &&
-                buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage)) {
-            BQ_LOGE("dequeueBuffer: cannot re-allocate a shared"
-                    "buffer");
-
-            return BAD_VALUE;
-        }
+    const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
+    if (mCore->mSharedBufferSlot == found &&
+            buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage)) {
+        BQ_LOGE("dequeueBuffer: cannot re-allocate a shared"
+                "buffer");
 
-        if (mCore->mSharedBufferSlot != found) {
-            mCore->mActiveBuffers.insert(found);
-        }
-        *outSlot = found;
-        ATRACE_BUFFER_INDEX(found);
-
-        attachedByConsumer = mSlots[found].mNeedsReallocation;
-        mSlots[found].mNeedsReallocation = false;
-
-        mSlots[found].mBufferState.dequeue();
-
-        if ((buffer == nullptr) ||
-                buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage))
-        {
-            mSlots[found].mAcquireCalled = false;
-            mSlots[found].mGraphicBuffer = nullptr;
-            mSlots[found].mRequestBufferCalled = false;
-            mSlots[found].mEglDisplay = EGL_NO_DISPLAY;
-            mSlots[found].mEglFence = EGL_NO_SYNC_KHR;
-            mSlots[found].mFence = Fence::NO_FENCE;
-            mCore->mBufferAge = 0;
-            mCore->mIsAllocating = true;
+        return BAD_VALUE;
+    }
 
-            returnFlags |= BUFFER_NEEDS_REALLOCATION;
-        } else {
-            // We add 1 because that will be the frame number when this buffer
-            // is queued
-            mCore->mBufferAge = mCore->mFrameCounter + 1 - mSlots[found].mFrameNumber;
-        }
+    if (mCore->mSharedBufferSlot != found) {
+        mCore->mActiveBuffers.insert(found);
+    }
+    ATRACE_BUFFER_INDEX(found);
 
-        BQ_LOGV("dequeueBuffer: setting buffer age to %" PRIu64,
-                mCore->mBufferAge);
+    out->attachedByConsumer = mSlots[found].mNeedsReallocation;
+    mSlots[found].mNeedsReallocation = false;
 
-        if (CC_UNLIKELY(mSlots[found].mFence == nullptr)) {
-            BQ_LOGE("dequeueBuffer: about to return a NULL fence - "
-                    "slot=%d w=%d h=%d format=%u",
-                    found, buffer->width, buffer->height, buffer->format);
-        }
+    mSlots[found].mBufferState.dequeue();
 
-        eglDisplay = mSlots[found].mEglDisplay;
-        eglFence = mSlots[found].mEglFence;
-        // Don't return a fence in shared buffer mode, except for the first
-        // frame.
-        *outFence = (mCore->mSharedBufferMode &&
-                mCore->mSharedBufferSlot == found) ?
-                Fence::NO_FENCE : mSlots[found].mFence;
+    if ((buffer == nullptr) ||
+            buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage))
+    {
+        mSlots[found].mAcquireCalled = false;
+        mSlots[found].mGraphicBuffer = nullptr;
+        mSlots[found].mRequestBufferCalled = false;
+        mSlots[found].mEglDisplay = EGL_NO_DISPLAY;
         mSlots[found].mEglFence = EGL_NO_SYNC_KHR;
         mSlots[found].mFence = Fence::NO_FENCE;
+        mCore->mBufferAge = 0;
+        mCore->mIsAllocating = true;
 
-        // If shared buffer mode has just been enabled, cache the slot of the
-        // first buffer that is dequeued and mark it as the shared buffer.
-        if (mCore->mSharedBufferMode && mCore->mSharedBufferSlot ==
-                BufferQueueCore::INVALID_BUFFER_SLOT) {
-            mCore->mSharedBufferSlot = found;
-            mSlots[found].mBufferState.mShared = true;
-        }
+        returnFlags |= BUFFER_NEEDS_REALLOCATION;
+    } else {
+        // We add 1 because that will be the frame number when this buffer
+        // is queued
+        mCore->mBufferAge = mCore->mFrameCounter + 1 - mSlots[found].mFrameNumber;
+    }
 
-        if (!(returnFlags & BUFFER_NEEDS_REALLOCATION)) {
-            if (mCore->mConsumerListener != nullptr) {
-                mCore->mConsumerListener->onFrameDequeued(mSlots[*outSlot].mGraphicBuffer->getId());
-            }
+    BQ_LOGV("dequeueBuffer: setting buffer age to %" PRIu64,
+            mCore->mBufferAge);
+
+    if (CC_UNLIKELY(mSlots[found].mFence == nullptr)) {
+        BQ_LOGE("dequeueBuffer: about to return a NULL fence - "
+                "slot=%d w=%d h=%d format=%u",
+                found, buffer->width, buffer->height, buffer->format);
+    }
+
+    out->eglDisplay = mSlots[found].mEglDisplay;
+    out->eglFence = mSlots[found].mEglFence;
+    // Don't return a fence in shared buffer mode, except for the first
+    // frame.
+    *outFence = (mCore->mSharedBufferMode &&
+            mCore->mSharedBufferSlot == found) ?
+            Fence::NO_FENCE : mSlots[found].mFence;
+    mSlots[found].mEglFence = EGL_NO_SYNC_KHR;
+    mSlots[found].mFence = Fence::NO_FENCE;
+
+    // If shared buffer mode has just been enabled, cache the slot of the
+    // first buffer that is dequeued and mark it as the shared buffer.
+    if (mCore->mSharedBufferMode && mCore->mSharedBufferSlot ==
+            BufferQueueCore::INVALID_BUFFER_SLOT) {
+        mCore->mSharedBufferSlot = found;
+        mSlots[found].mBufferState.mShared = true;
+    }
+
+    if (!(returnFlags & BUFFER_NEEDS_REALLOCATION)) {
+        if (mCore->mConsumerListener != nullptr) {
+            mCore->mConsumerListener->onFrameDequeued(mSlots[found].mGraphicBuffer->getId());
         }
-    } // Autolock scope
+    }
 
-    if (returnFlags & BUFFER_NEEDS_REALLOCATION) {
-        BQ_LOGV("dequeueBuffer: allocating a new buffer for slot %d", *outSlot);
-        sp<GraphicBuffer> graphicBuffer = new GraphicBuffer(
-                width, height, format, BQ_LAYER_COUNT, usage,
-                {mConsumerName.string(), mConsumerName.size()});
+    out->slot = found;
+    out->width = width;
+    out->height = height;
+    out->format = format;
+    out->usage = usage;
+    out->returnFlags = returnFlags;
+    out->bufferAge = mCore->mBufferAge;
+    return NO_ERROR;
+}
 
-        status_t error = graphicBuffer->initCheck();
+status_t BufferQueueProducer::allocateDequeuedBufferThenRelock(
+        std::unique_lock<std::mutex>& lock, const DequeuedBuffer& dequeued) {
+    const int slot = dequeued.slot;
+    BQ_LOGV("dequeueBuffer: allocating a new buffer for slot %d", slot);
 
-        { // Autolock scope
-            std::lock_guard<std::mutex> lock(mCore->mMutex);
-
-            if (error == NO_ERROR && !mCore->mIsAbandoned) {
-                graphicBuffer->setGenerationNumber(mCore->mGenerationNumber);
-                mSlots[*outSlot].mGraphicBuffer = graphicBuffer;
-                if (mCore->mConsumerListener != nullptr) {
-                    mCore->mConsumerListener->onFrameDequeued(
-                            mSlots[*outSlot].mGraphicBuffer->getId());
-                }
-            }
+    lock.unlock();
+    sp<GraphicBuffer> graphicBuffer = new GraphicBuffer(
+            dequeued.width, dequeued.height, dequeued.format, BQ_LAYER_COUNT, dequeued.usage,
+            {mConsumerName.string(), mConsumerName.size()});
 
-            mCore->mIsAllocating = false;
-            mCore->mIsAllocatingCondition.notify_all();
+    status_t error = graphicBuffer->initCheck();
+    lock.lock();
 
-            if (error != NO_ERROR) {
-                mCore->mFreeSlots.insert(*outSlot);
-                mCore->clearBufferSlotLocked(*outSlot);
-                BQ_LOGE("dequeueBuffer: createGraphicBuffer failed");
-                return error;
-            }
+    if (error == NO_ERROR && !mCore->mIsAbandoned) {
+        graphicBuffer->setGenerationNumber(mCore->mGenerationNumber);
+        mSlots[slot].mGraphicBuffer = graphicBuffer;
+        if (mCore->mConsumerListener != nullptr) {
+            mCore->mConsumerListener->onFrameDequeued(mSlots[slot].mGraphicBuffer->getId());
+        }
+    }
 
-            if (mCore->mIsAbandoned) {
-                mCore->mFreeSlots.insert(*outSlot);
-                mCore->clearBufferSlotLocked(*outSlot);
-                BQ_LOGE("dequeueBuffer: BufferQueue has been abandoned");
-                return NO_INIT;
-            }
+    mCore->mIsAllocating = false;
+    mCore->mIsAllocatingCondition.notify_all();
 
-            VALIDATE_CONSISTENCY();
-        } // Autolock scope
+    if (error != NO_ERROR) {
+        mCore->mFreeSlots.insert(slot);
+        mCore->clearBufferSlotLocked(slot);
+        BQ_LOGE("dequeueBuffer: createGraphicBuffer failed");
+        return error;
     }
 
-    if (attachedByConsumer) {
+    if (mCore->mIsAbandoned) {
+        mCore->mFreeSlots.insert(slot);
+        mCore->clearBufferSlotLocked(slot);
+        BQ_LOGE("dequeueBuffer: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
+
+    VALIDATE_CONSISTENCY();
+    return NO_ERROR;
+}
+
+status_t BufferQueueProducer::finishDequeue(const DequeuedBuffer& dequeued) {
+    status_t returnFlags = dequeued.returnFlags;
+    if (dequeued.attachedByConsumer) {
         returnFlags |= BUFFER_NEEDS_REALLOCATION;
     }
 
-    if (eglFence != EGL_NO_SYNC_KHR) {
-        EGLint result = eglClientWaitSyncKHR(eglDisplay, eglFence, 0,
+    if (dequeued.eglFence != EGL_NO_SYNC_KHR) {
+        EGLint result = eglClientWaitSyncKHR(dequeued.eglDisplay, dequeued.eglFence, 0,
                 1000000000);
         // If something goes wrong, log the error, but return the buffer without
         // synchronizing access to it. It's too late at this point to abort the
@@ -601,23 +639,102 @@ status_t BufferQueueProducer::dequeueBuffer(int* outSlot, sp<android::Fence>* ou
         } else if (result == EGL_TIMEOUT_EXPIRED_KHR) {
             BQ_LOGE("dequeueBuffer: timeout waiting for fence");
         }
-        eglDestroySyncKHR(eglDisplay, eglFence);
+        eglDestroySyncKHR(dequeued.eglDisplay, dequeued.eglFence);
     }
 
     BQ_LOGV("dequeueBuffer: returning slot=%d/%" PRIu64 " buf=%p flags=%#x",
-            *outSlot,
-            mSlots[*outSlot].mFrameNumber,
-            mSlots[*outSlot].mGraphicBuffer != nullptr ?
-            mSlots[*outSlot].mGraphicBuffer->handle : nullptr, returnFlags);
+            dequeued.slot,
+            mSlots[dequeued.slot].mFrameNumber,
+            mSlots[dequeued.slot].mGraphicBuffer != nullptr ?
+            mSlots[dequeued.slot].mGraphicBuffer->handle : nullptr, returnFlags);
+
+    return returnFlags;
+}
+
+status_t BufferQueueProducer::dequeueBuffer(int* outSlot, sp<android::Fence>* outFence,
+                                            uint32_t width, uint32_t height, PixelFormat format,
+                                            uint64_t usage, uint64_t* outBufferAge,
+                                            FrameEventHistoryDelta* outTimestamps) {
+    ATRACE_CALL();
+    DequeuedBuffer dequeued;
+    { // Autolock scope
+        std::unique_lock<std::mutex> lock(mCore->mMutex);
+
+        status_t status = dequeueBufferLocked(lock, width, height, format, usage, outFence,
+                                              &dequeued);
+        if (status != NO_ERROR) {
+            return status;
+        }
+
+        if (dequeued.returnFlags & BUFFER_NEEDS_REALLOCATION) {
+            status = allocateDequeuedBufferThenRelock(lock, dequeued);
+            if (status != NO_ERROR) {
+                return status;
+            }
+        }
+        *outSlot = dequeued.slot;
+    } // Autolock scope
+
+    status_t returnFlags = finishDequeue(dequeued);
 
     if (outBufferAge) {
-        *outBufferAge = mCore->mBufferAge;
+        *outBufferAge = dequeued.bufferAge;
     }
     addAndGetFrameTimestamps(nullptr, outTimestamps);
 
     return returnFlags;
 }
 
+status_t BufferQueueProducer::dequeueBuffers(const std::vector<DequeueBufferInput>& inputs,
+                                             std::vector<DequeueBufferOutput>* outputs) {
+    ATRACE_CALL();
+    outputs->clear();
+    outputs->resize(inputs.size());
+    std::vector<DequeuedBuffer> dequeued(inputs.size());
+
+    sp<IConsumerListener> listener;
+    { // Autolock scope
+        std::unique_lock<std::mutex> lock(mCore->mMutex);
+
+        // Buffers that need to be allocated are allocated one at a time with
+        // the lock dropped, so that this never waits for a free slot while
+        // other threads wait for mIsAllocating to clear.
+        for (size_t i = 0; i < inputs.size(); i++) {
+            const DequeueBufferInput& input = inputs[i];
+            DequeueBufferOutput& output = (*outputs)[i];
+            output.result = dequeueBufferLocked(lock, input.width, input.height, input.format,
+                                                input.usage, &output.fence, &dequeued[i]);
+            if (output.result != NO_ERROR) {
+                continue;
+            }
+            if (dequeued[i].returnFlags & BUFFER_NEEDS_REALLOCATION) {
+                output.result = allocateDequeuedBufferThenRelock(lock, dequeued[i]);
+                if (output.result != NO_ERROR) {
+                    // The slot was freed again, so don't hand it out.
+                    continue;
+                }
+            }
+            output.slot = dequeued[i].slot;
+            output.bufferAge = dequeued[i].bufferAge;
+        }
+        listener = mCore->mConsumerListener;
+    } // Autolock scope
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        DequeueBufferOutput& output = (*outputs)[i];
+        if (output.result == NO_ERROR) {
+            output.result = finishDequeue(dequeued[i]);
+        }
+        if (inputs[i].getTimestamps) {
+            FrameEventHistoryDelta* timestamps = &output.timestamps.emplace();
+            if (output.result >= 0 && listener != nullptr) {
+                listener->addAndGetFrameTimestamps(nullptr, timestamps);
+            }
+        }
+    }
+    return NO_ERROR;
+}
+
 status_t BufferQueueProducer::detachBuffer(int slot) {
     ATRACE_CALL();
     ATRACE_BUFFER_INDEX(slot);
@@ -806,238 +923,320 @@ status_t BufferQueueProducer::attachBuffer(int* outSlot,
     return returnFlags;
 }
 
-status_t BufferQueueProducer::queueBuffer(int slot,
-        const QueueBufferInput &input, QueueBufferOutput *output) {
-    ATRACE_CALL();
-    ATRACE_BUFFER_INDEX(slot);
-
-    int64_t requestedPresentTimestamp;
-    bool isAutoTimestamp;
-    android_dataspace dataSpace;
-    Rect crop(Rect::EMPTY_RECT);
-    int scalingMode;
-    uint32_t transform;
-    uint32_t stickyTransform;
+// The state of a queueBuffer call, carried from its checks through to the
+// consumer callbacks.
+struct BufferQueueProducer::QueuedFrame {
+    int64_t requestedPresentTimestamp = 0;
+    bool isAutoTimestamp = false;
+    android_dataspace dataSpace = HAL_DATASPACE_UNKNOWN;
+    Rect crop = Rect::EMPTY_RECT;
+    int scalingMode = 0;
+    uint32_t transform = 0;
+    uint32_t stickyTransform = 0;
     sp<Fence> acquireFence;
+    std::shared_ptr<FenceTime> acquireFenceTime;
     bool getFrameTimestamps = false;
-    input.deflate(&requestedPresentTimestamp, &isAutoTimestamp, &dataSpace,
-            &crop, &scalingMode, &transform, &acquireFence, &stickyTransform,
-            &getFrameTimestamps);
-    const Region& surfaceDamage = input.getSurfaceDamage();
-    const HdrMetadata& hdrMetadata = input.getHdrMetadata();
 
-    if (acquireFence == nullptr) {
+    uint64_t frameNumber = 0;
+    BufferItem item;
+    sp<IConsumerListener> frameAvailableListener;
+    sp<IConsumerListener> frameReplacedListener;
+};
+
+status_t BufferQueueProducer::prepareQueueBuffer(const QueueBufferInput& input,
+                                                 QueuedFrame* frame) const {
+    input.deflate(&frame->requestedPresentTimestamp, &frame->isAutoTimestamp,
+            &frame->dataSpace, &frame->crop, &frame->scalingMode, &frame->transform,
+            &frame->acquireFence, &frame->stickyTransform, &frame->getFrameTimestamps);
+
+    if (frame->acquireFence == nullptr) {
         BQ_LOGE("queueBuffer: fence is NULL");
         return BAD_VALUE;
     }
 
-    auto acquireFenceTime = std::make_shared<FenceTime>(acquireFence);
+    frame->acquireFenceTime = std::make_shared<FenceTime>(frame->acquireFence);
 
-    switch (scalingMode) {
+    switch (frame->scalingMode) {
         case NATIVE_WINDOW_SCALING_MODE_FREEZE:
         case NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW:
         case NATIVE_WINDOW_SCALING_MODE_SCALE_CROP:
         case NATIVE_WINDOW_SCALING_MODE_NO_SCALE_CROP:
             break;
         default:
-            BQ_LOGE("queueBuffer: unknown scaling mode %d", scalingMode);
+            BQ_LOGE("queueBuffer: unknown scaling mode %d", frame->scalingMode);
             return BAD_VALUE;
     }
+    return NO_ERROR;
+}
 
-    sp<IConsumerListener> frameAvailableListener;
-    sp<IConsumerListener> frameReplacedListener;
-    int callbackTicket = 0;
-    uint64_t currentFrameNumber = 0;
-    BufferItem item;
-    { // Autolock scope
-        std::lock_guard<std::mutex> lock(mCore->mMutex);
+status_t BufferQueueProducer::queueBufferLocked(int slot, const QueueBufferInput& input,
+                                                QueuedFrame* frame, QueueBufferOutput* output) {
+    const Region& surfaceDamage = input.getSurfaceDamage();
+    const HdrMetadata& hdrMetadata = input.getHdrMetadata();
+    const Rect& crop = frame->crop;
+    const uint32_t transform = frame->transform;
+    const int scalingMode = frame->scalingMode;
+    const sp<Fence>& acquireFence = frame->acquireFence;
+    android_dataspace dataSpace = frame->dataSpace;
+    BufferItem& item = frame->item;
 
-        if (mCore->mIsAbandoned) {
-            BQ_LOGE("queueBuffer: BufferQueue has been abandoned");
-            return NO_INIT;
-        }
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("queueBuffer: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
 
-        if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
-            BQ_LOGE("queueBuffer: BufferQueue has no connected producer");
-            return NO_INIT;
-        }
+    if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
+        BQ_LOGE("queueBuffer: BufferQueue has no connected producer");
+        return NO_INIT;
+    }
 
-        if (slot < 0 || slot >= BufferQueueDefs::NUM_BUFFER_SLOTS) {
-            BQ_LOGE("queueBuffer: slot index %d out of range [0, %d)",
-                    slot, BufferQueueDefs::NUM_BUFFER_SLOTS);
-            return BAD_VALUE;
-        } else if (!mSlots[slot].mBufferState.isDequeued()) {
-            BQ_LOGE("queueBuffer: slot %d is not owned by the producer "
-                    "(state = %s)", slot, mSlots[slot].mBufferState.string());
-            return BAD_VALUE;
-        } else if (!mSlots[slot].mRequestBufferCalled) {
-            BQ_LOGE("queueBuffer: slot %d was queued without requesting "
-                    "a buffer", slot);
-            return BAD_VALUE;
-        }
+    if (slot < 0 || slot >= BufferQueueDefs::NUM_BUFFER_SLOTS) {
+        BQ_LOGE("queueBuffer: slot index %d out of range [0, %d)",
+                slot, BufferQueueDefs::NUM_BUFFER_SLOTS);
+        return BAD_VALUE;
+    } else if (!mSlots[slot].mBufferState.isDequeued()) {
+        BQ_LOGE("queueBuffer: slot %d is not owned by the producer "
+                "(state = %s)", slot, mSlots[slot].mBufferState.string());
+        return BAD_VALUE;
+    } else if (!mSlots[slot].mRequestBufferCalled) {
+        BQ_LOGE("queueBuffer: slot %d was queued without requesting "
+                "a buffer", slot);
+        return BAD_VALUE;
+    }
 
-        // If shared buffer mode has just been enabled, cache the slot of the
-        // first buffer that is queued and mark it as the shared buffer.
-        if (mCore->mSharedBufferMode && mCore->mSharedBufferSlot ==
-                BufferQueueCore::INVALID_BUFFER_SLOT) {
-            mCore->mSharedBufferSlot = slot;
-            mSlots[slot].mBufferState.mShared = true;
-        }
+    // If shared buffer mode has just been enabled, cache the slot of the
+    // first buffer that is queued and mark it as the shared buffer.
+    if (mCore->mSharedBufferMode && mCore->mSharedBufferSlot ==
+            BufferQueueCore::INVALID_BUFFER_SLOT) {
+        mCore->mSharedBufferSlot = slot;
+        mSlots[slot].mBufferState.mShared = true;
+    }
 
-        BQ_LOGV("queueBuffer: slot=%d/%" PRIu64 " time=%" PRIu64 " dataSpace=%d"
-                " validHdrMetadataTypes=0x%x crop=[%d,%d,%d,%d] transform=%#x scale=%s",
-                slot, mCore->mFrameCounter + 1, requestedPresentTimestamp, dataSpace,
-                hdrMetadata.validTypes, crop.left, crop.top, crop.right, crop.bottom,
-                transform,
-                BufferItem::scalingModeName(static_cast<uint32_t>(scalingMode)));
-
-        const sp<GraphicBuffer>& graphicBuffer(mSlots[slot].mGraphicBuffer);
-        Rect bufferRect(graphicBuffer->getWidth(), graphicBuffer->getHeight());
-        Rect croppedRect(Rect::EMPTY_RECT);
-        crop.intersect(bufferRect, &croppedRect);
-        if (croppedRect != crop) {
-            BQ_LOGE("queueBuffer: crop rect is not contained within the "
-                    "buffer in slot %d", slot);
-            return BAD_VALUE;
-        }
+    BQ_LOGV("queueBuffer: slot=%d/%" PRIu64 " time=%" PRIu64 " dataSpace=%d"
+            " validHdrMetadataTypes=0x%x crop=[%d,%d,%d,%d] transform=%#x scale=%s",
+            slot, mCore->mFrameCounter + 1, frame->requestedPresentTimestamp, dataSpace,
+            hdrMetadata.validTypes, crop.left, crop.top, crop.right, crop.bottom,
+            transform,
+            BufferItem::scalingModeName(static_cast<uint32_t>(scalingMode)));
+
+    const sp<GraphicBuffer>& graphicBuffer(mSlots[slot].mGraphicBuffer);
+    Rect bufferRect(graphicBuffer->getWidth(), graphicBuffer->getHeight());
+    Rect croppedRect(Rect::EMPTY_RECT);
+    crop.intersect(bufferRect, &croppedRect);
+    if (croppedRect != crop) {
+        BQ_LOGE("queueBuffer: crop rect is not contained within the "
+                "buffer in slot %d", slot);
+        return BAD_VALUE;
+    }
 
-        // Override UNKNOWN dataspace with consumer default
-        if (dataSpace == HAL_DATASPACE_UNKNOWN) {
-            dataSpace = mCore->mDefaultBufferDataSpace;
-        }
+    // Override UNKNOWN dataspace with consumer default
+    if (dataSpace == HAL_DATASPACE_UNKNOWN) {
+        dataSpace = mCore->mDefaultBufferDataSpace;
+    }
 
-        mSlots[slot].mFence = acquireFence;
-        mSlots[slot].mBufferState.queue();
-
-        // Increment the frame counter and store a local version of it
-        // for use outside the lock on mCore->mMutex.
-        ++mCore->mFrameCounter;
-        currentFrameNumber = mCore->mFrameCounter;
-        mSlots[slot].mFrameNumber = currentFrameNumber;
-
-        item.mAcquireCalled = mSlots[slot].mAcquireCalled;
-        item.mGraphicBuffer = mSlots[slot].mGraphicBuffer;
-        item.mCrop = crop;
-        item.mTransform = transform &
-                ~static_cast<uint32_t>(NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY);
-        item.mTransformToDisplayInverse =
-                (transform & NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY) != 0;
-        item.mScalingMode = static_cast<uint32_t>(scalingMode);
-        item.mTimestamp = requestedPresentTimestamp;
-        item.mIsAutoTimestamp = isAutoTimestamp;
-        item.mDataSpace = dataSpace;
-        item.mHdrMetadata = hdrMetadata;
-        item.mFrameNumber = currentFrameNumber;
-        item.mSlot = slot;
-        item.mFence = acquireFence;
-        item.mFenceTime = acquireFenceTime;
-        item.mIsDroppable = mCore->mAsyncMode ||
-                (mConsumerIsSurfaceFlinger && mCore->mQueueBufferCanDrop) ||
-                (mCore->mLegacyBufferDrop && mCore->mQueueBufferCanDrop) ||
-                (mCore->mSharedBufferMode && mCore->mSharedBufferSlot == slot);
-        item.mSurfaceDamage = surfaceDamage;
-        item.mQueuedBuffer = true;
-        item.mAutoRefresh = mCore->mSharedBufferMode && mCore->mAutoRefresh;
-        item.mApi = mCore->mConnectedApi;
-
-        mStickyTransform = stickyTransform;
-
-        // Cache the shared buffer data so that the BufferItem can be recreated.
-        if (mCore->mSharedBufferMode) {
-            mCore->mSharedBufferCache.crop = crop;
-            mCore->mSharedBufferCache.transform = transform;
-            mCore->mSharedBufferCache.scalingMode = static_cast<uint32_t>(
-                    scalingMode);
-            mCore->mSharedBufferCache.dataspace = dataSpace;
-        }
+    mSlots[slot].mFence = acquireFence;
+    mSlots[slot].mBufferState.queue();
+
+    // Increment the frame counter and store a local version of it
+    // for use outside the lock on mCore->mMutex.
+    ++mCore->mFrameCounter;
+    frame->frameNumber = mCore->mFrameCounter;
+    mSlots[slot].mFrameNumber = frame->frameNumber;
+
+    item.mAcquireCalled = mSlots[slot].mAcquireCalled;
+    item.mGraphicBuffer = mSlots[slot].mGraphicBuffer;
+    item.mCrop = crop;
+    item.mTransform = transform &
+            ~static_cast<uint32_t>(NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY);
+    item.mTransformToDisplayInverse =
+            (transform & NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY) != 0;
+    item.mScalingMode = static_cast<uint32_t>(scalingMode);
+    item.mTimestamp = frame->requestedPresentTimestamp;
+    item.mIsAutoTimestamp = frame->isAutoTimestamp;
+    item.mDataSpace = dataSpace;
+    item.mHdrMetadata = hdrMetadata;
+    item.mFrameNumber = frame->frameNumber;
+    item.mSlot = slot;
+    item.mFence = acquireFence;
+    item.mFenceTime = frame->acquireFenceTime;
+    item.mIsDroppable = mCore->mAsyncMode ||
+            (mConsumerIsSurfaceFlinger && mCore->mQueueBufferCanDrop) ||
+            (mCore->mLegacyBufferDrop && mCore->mQueueBufferCanDrop) ||
+            (mCore->mSharedBufferMode && mCore->mSharedBufferSlot == slot);
+    item.mSurfaceDamage = surfaceDamage;
+    item.mQueuedBuffer = true;
+    item.mAutoRefresh = mCore->mSharedBufferMode && mCore->mAutoRefresh;
+    item.mApi = mCore->mConnectedApi;
+
+    mStickyTransform = frame->stickyTransform;
+
+    // Cache the shared buffer data so that the BufferItem can be recreated.
+    if (mCore->mSharedBufferMode) {
+        mCore->mSharedBufferCache.crop = crop;
+        mCore->mSharedBufferCache.transform = transform;
+        mCore->mSharedBufferCache.scalingMode = static_cast<uint32_t>(
+                scalingMode);
+        mCore->mSharedBufferCache.dataspace = dataSpace;
+    }
 
-        output->bufferReplaced = false;
-        if (mCore->mQueue.empty()) {
-            // When the queue is empty, we can ignore mDequeueBufferCannotBlock
-            // and simply queue this buffer
-            mCore->mQueue.push_back(item);
-            frameAvailableListener = mCore->mConsumerListener;
-        } else {
-            // When the queue is not empty, we need to look at the last buffer
-            // in the queue to see if we need to replace it
-            const BufferItem& last = mCore->mQueue.itemAt(
-                    mCore->mQueue.size() - 1);
-            if (last.mIsDroppable) {
-
-                if (!last.mIsStale) {
-                    mSlots[last.mSlot].mBufferState.freeQueued();
-
-                    // After leaving shared buffer mode, the shared buffer will
-                    // still be around. Mark it as no longer shared if this
-                    // operation causes it to be free.
-                    if (!mCore->mSharedBufferMode &&
-                            mSlots[last.mSlot].mBufferState.isFree()) {
-                        mSlots[last.mSlot].mBufferState.mShared = false;
-                    }
-                    // Don't put the shared buffer on the free list.
-                    if (!mSlots[last.mSlot].mBufferState.isShared()) {
-                        mCore->mActiveBuffers.erase(last.mSlot);
-                        mCore->mFreeBuffers.push_back(last.mSlot);
-                        output->bufferReplaced = true;
-                    }
+    output->bufferReplaced = false;
+    if (mCore->mQueue.empty()) {
+        // When the queue is empty, we can ignore mDequeueBufferCannotBlock
+        // and simply queue this buffer
+        mCore->mQueue.push_back(item);
+        frame->frameAvailableListener = mCore->mConsumerListener;
+    } else {
+        // When the queue is not empty, we need to look at the last buffer
+        // in the queue to see if we need to replace it
+        const BufferItem& last = mCore->mQueue.itemAt(
+                mCore->mQueue.size() - 1);
+        if (last.mIsDroppable) {
+
+            if (!last.mIsStale) {
+                mSlots[last.mSlot].mBufferState.freeQueued();
+
+                // After leaving shared buffer mode, the shared buffer will
+                // still be around. Mark it as no longer shared if this
+                // operation causes it to be free.
+                if (!mCore->mSharedBufferMode &&
+                        mSlots[last.mSlot].mBufferState.isFree()) {
+                    mSlots[last.mSlot].mBufferState.mShared = false;
                 }
-
-                // Make sure to merge the damage rect from the frame we're about
-                // to drop into the new frame's damage rect.
-                if (last.mSurfaceDamage.bounds() == Rect::INVALID_RECT ||
-                    item.mSurfaceDamage.bounds() == Rect::INVALID_RECT) {
-                    item.mSurfaceDamage = Region::INVALID_REGION;
-                } else {
-                    item.mSurfaceDamage |= last.mSurfaceDamage;
+                // Don't put the shared buffer on the free list.
+                if (!mSlots[last.mSlot].mBufferState.isShared()) {
+                    mCore->mActiveBuffers.erase(last.mSlot);
+                    mCore->mFreeBuffers.push_back(last.mSlot);
+                    output->bufferReplaced = true;
                 }
+            }
 
-                // Overwrite the droppable buffer with the incoming one
-                mCore->mQueue.editItemAt(mCore->mQueue.size() - 1) = item;
-                frameReplacedListener = mCore->mConsumerListener;
+            // Make sure to merge the damage rect from the frame we're about
+            // to drop into the new frame's damage rect.
+            if (last.mSurfaceDamage.bounds() == Rect::INVALID_RECT ||
+                item.mSurfaceDamage.bounds() == Rect::INVALID_RECT) {
+                item.mSurfaceDamage = Region::INVALID_REGION;
             } else {
-                mCore->mQueue.push_back(item);
-                frameAvailableListener = mCore->mConsumerListener;
+                item.mSurfaceDamage |= last.mSurfaceDamage;
             }
+
+            // Overwrite the droppable buffer with the incoming one
+            mCore->mQueue.editItemAt(mCore->mQueue.size() - 1) = item;
+            frame->frameReplacedListener = mCore->mConsumerListener;
+        } else {
+            mCore->mQueue.push_back(item);
+            frame->frameAvailableListener = mCore->mConsumerListener;
         }
+    }
 
-        mCore->mBufferHasBeenQueued = true;
-        mCore->mDequeueCondition.notify_all();
-        mCore->mLastQueuedSlot = slot;
+    mCore->mBufferHasBeenQueued = true;
+    mCore->mLastQueuedSlot = slot;
 
-        output->width = mCore->mDefaultWidth;
-        output->height = mCore->mDefaultHeight;
-        output->transformHint = mCore->mTransformHintInUse = mCore->mTransformHint;
-        output->numPendingBuffers = static_cast<uint32_t>(mCore->mQueue.size());
-        output->nextFrameNumber = mCore->mFrameCounter + 1;
+    output->width = mCore->mDefaultWidth;
+    output->height = mCore->mDefaultHeight;
+    output->transformHint = mCore->mTransformHintInUse = mCore->mTransformHint;
+    output->numPendingBuffers = static_cast<uint32_t>(mCore->mQueue.size());
+    output->nextFrameNumber = mCore->mFrameCounter + 1;
 
-        ATRACE_INT(mCore->mConsumerName.string(),
-                static_cast<int32_t>(mCore->mQueue.size()));
+    ATRACE_INT(mCore->mConsumerName.string(),
+            static_cast<int32_t>(mCore->mQueue.size()));
 #ifndef NO_BINDER
-        mCore->mOccupancyTracker.registerOccupancyChange(mCore->mQueue.size());
+    mCore->mOccupancyTracker.registerOccupancyChange(mCore->mQueue.size());
 #endif
-        // Take a ticket for the callback functions
-        callbackTicket = mNextCallbackTicket++;
-
-        VALIDATE_CONSISTENCY();
-    } // Autolock scope
+    return NO_ERROR;
+}
 
+void BufferQueueProducer::postQueuedFrame(const sp<IConsumerListener>& listener,
+                                          QueuedFrame* frame, QueueBufferOutput* output) {
     // It is okay not to clear the GraphicBuffer when the consumer is SurfaceFlinger because
     // it is guaranteed that the BufferQueue is inside SurfaceFlinger's process and
     // there will be no Binder call
     if (!mConsumerIsSurfaceFlinger) {
-        item.mGraphicBuffer.clear();
+        frame->item.mGraphicBuffer.clear();
     }
 
     // Update and get FrameEventHistory.
-    nsecs_t postedTime = systemTime(SYSTEM_TIME_MONOTONIC);
-    NewFrameEventsEntry newFrameEventsEntry = {
-        currentFrameNumber,
-        postedTime,
-        requestedPresentTimestamp,
-        std::move(acquireFenceTime)
-    };
-    addAndGetFrameTimestamps(&newFrameEventsEntry,
-            getFrameTimestamps ? &output->frameTimestamps : nullptr);
+    if (listener != nullptr) {
+        nsecs_t postedTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        NewFrameEventsEntry newFrameEventsEntry = {
+            frame->frameNumber,
+            postedTime,
+            frame->requestedPresentTimestamp,
+            std::move(frame->acquireFenceTime)
+        };
+        listener->addAndGetFrameTimestamps(&newFrameEventsEntry,
+                frame->getFrameTimestamps ? &output->frameTimestamps : nullptr);
+    }
+}
+
+void BufferQueueProducer::waitForCallbackTurnLocked(std::unique_lock<std::mutex>& lock,
+                                                    int callbackTicket) {
+    while (callbackTicket != mCurrentCallbackTicket) {
+        ++mCallbackWaiters;
+        mCallbackCondition.wait(lock);
+        --mCallbackWaiters;
+    }
+}
+
+void BufferQueueProducer::endCallbackTurnLocked() {
+    ++mCurrentCallbackTicket;
+    // Only concurrent queueBuffer calls wait for their turn, so there is
+    // usually nothing to wake.
+    if (mCallbackWaiters > 0) {
+        mCallbackCondition.notify_all();
+    }
+}
+
+void BufferQueueProducer::onFrameQueuedLocked(QueuedFrame* frame, sp<Fence>* outLastQueuedFence) {
+    if (frame->frameAvailableListener != nullptr) {
+        frame->frameAvailableListener->onFrameAvailable(frame->item);
+    } else if (frame->frameReplacedListener != nullptr) {
+        frame->frameReplacedListener->onFrameReplaced(frame->item);
+    }
+
+    *outLastQueuedFence = std::move(mLastQueueBufferFence);
+
+    mLastQueueBufferFence = std::move(frame->acquireFence);
+    mLastQueuedCrop = frame->item.mCrop;
+    mLastQueuedTransform = frame->item.mTransform;
+}
+
+status_t BufferQueueProducer::queueBuffer(int slot,
+        const QueueBufferInput &input, QueueBufferOutput *output) {
+    ATRACE_CALL();
+    ATRACE_BUFFER_INDEX(slot);
+
+    QueuedFrame frame;
+    status_t status = prepareQueueBuffer(input, &frame);
+    if (status != NO_ERROR) {
+        return status;
+    }
+
+    sp<IConsumerListener> listener;
+    int callbackTicket = 0;
+    bool wakeDequeuers = false;
+    { // Autolock scope
+        std::lock_guard<std::mutex> lock(mCore->mMutex);
+
+        status = queueBufferLocked(slot, input, &frame, output);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        wakeDequeuers = mCore->mDequeueWaiters > 0;
+        listener = mCore->mConsumerListener;
+
+        // Take a ticket for the callback functions
+        callbackTicket = mNextCallbackTicket++;
+
+        VALIDATE_CONSISTENCY();
+    } // Autolock scope
+
+    // Wake after unlocking, so that the dequeuer does not wake up only to
+    // block on mCore->mMutex.
+    if (wakeDequeuers) {
+        mCore->mDequeueCondition.notify_all();
+    }
+
+    postQueuedFrame(listener, &frame, output);
 
     // Call back without the main BufferQueue lock held, but with the callback
     // lock held so we can ensure that callbacks occur in order
@@ -1047,25 +1246,12 @@ status_t BufferQueueProducer::queueBuffer(int slot,
 
     { // scope for the lock
         std::unique_lock<std::mutex> lock(mCallbackMutex);
-        while (callbackTicket != mCurrentCallbackTicket) {
-            mCallbackCondition.wait(lock);
-        }
-
-        if (frameAvailableListener != nullptr) {
-            frameAvailableListener->onFrameAvailable(item);
-        } else if (frameReplacedListener != nullptr) {
-            frameReplacedListener->onFrameReplaced(item);
-        }
+        waitForCallbackTurnLocked(lock, callbackTicket);
 
+        onFrameQueuedLocked(&frame, &lastQueuedFence);
         connectedApi = mCore->mConnectedApi;
-        lastQueuedFence = std::move(mLastQueueBufferFence);
-
-        mLastQueueBufferFence = std::move(acquireFence);
-        mLastQueuedCrop = item.mCrop;
-        mLastQueuedTransform = item.mTransform;
 
-        ++mCurrentCallbackTicket;
-        mCallbackCondition.notify_all();
+        endCallbackTurnLocked();
     }
 
     // Wait without lock held
@@ -1079,6 +1265,83 @@ status_t BufferQueueProducer::queueBuffer(int slot,
     return NO_ERROR;
 }
 
+status_t BufferQueueProducer::queueBuffers(const std::vector<QueueBufferInput>& inputs,
+                                           std::vector<QueueBufferOutput>* outputs) {
+    ATRACE_CALL();
+    outputs->clear();
+    outputs->resize(inputs.size());
+    std::vector<QueuedFrame> frames(inputs.size());
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        (*outputs)[i].result = prepareQueueBuffer(inputs[i], &frames[i]);
+    }
+
+    sp<IConsumerListener> listener;
+    int callbackTicket = 0;
+    bool wakeDequeuers = false;
+    { // Autolock scope
+        std::lock_guard<std::mutex> lock(mCore->mMutex);
+
+        bool queued = false;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            QueueBufferOutput& output = (*outputs)[i];
+            if (output.result == NO_ERROR) {
+                output.result = queueBufferLocked(inputs[i].slot, inputs[i], &frames[i], &output);
+                queued |= output.result == NO_ERROR;
+            }
+        }
+        if (!queued) {
+            // Each entry has its error in its result, as with the default
+            // queueBuffers(); the call itself succeeded.
+            return NO_ERROR;
+        }
+
+        // Wake up the dequeuers once, and take one callback ticket for the
+        // whole batch.
+        wakeDequeuers = mCore->mDequeueWaiters > 0;
+        listener = mCore->mConsumerListener;
+        callbackTicket = mNextCallbackTicket++;
+
+        VALIDATE_CONSISTENCY();
+    } // Autolock scope
+
+    if (wakeDequeuers) {
+        mCore->mDequeueCondition.notify_all();
+    }
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if ((*outputs)[i].result == NO_ERROR) {
+            postQueuedFrame(listener, &frames[i], &(*outputs)[i]);
+        }
+    }
+
+    int connectedApi;
+    sp<Fence> lastQueuedFence;
+
+    { // scope for the lock
+        std::unique_lock<std::mutex> lock(mCallbackMutex);
+        waitForCallbackTurnLocked(lock, callbackTicket);
+
+        // The consumer still hears about every frame, in order.
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if ((*outputs)[i].result == NO_ERROR) {
+                onFrameQueuedLocked(&frames[i], &lastQueuedFence);
+            }
+        }
+        connectedApi = mCore->mConnectedApi;
+
+        endCallbackTurnLocked();
+    }
+
+    // Throttle once, on the frame queued before the last one of the batch,
+    // which is what the last of a sequence of queueBuffer calls waits for.
+    if (connectedApi == NATIVE_WINDOW_API_EGL) {
+        lastQueuedFence->waitForever("Throttling EGL Production");
+    }
+
+    return NO_ERROR;
+}
+
 status_t BufferQueueProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     ATRACE_CALL();
     BQ_LOGV("cancelBuffer: slot %d", slot);
@@ -1049,9 +1049,8 @@ status_t BnSurfaceComposer::onTransact(
             Vector<ComposerState> state;
             state.setCapacity(count);
             for (size_t i = 0; i < count; i++) {
-                ComposerState s;
+                ComposerState& s = state.editItemAt(state.add());
                 SAFE_PARCEL(s.read, data);
-                state.add(s);
             }
 
             SAFE_PARCEL_READ_SIZE(data.readUint32, &count, data.dataSize());
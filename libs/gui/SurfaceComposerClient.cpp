@@ -729,7 +729,7 @@ status_t SurfaceComposerClient::Transaction::readFromParcel(const Parcel* parcel
         if (composerState.read(*parcel) == BAD_VALUE) {
             return BAD_VALUE;
         }
-        composerStates[surfaceControlHandle] = composerState;
+        composerStates[surfaceControlHandle] = std::move(composerState);
     }
 
     InputWindowCommands inputWindowCommands;
@@ -747,7 +747,7 @@ status_t SurfaceComposerClient::Transaction::readFromParcel(const Parcel* parcel
     mFrameTimelineInfo = frameTimelineInfo;
     mDisplayStates = displayStates;
     mListenerCallbacks = listenerCallbacks;
-    mComposerStates = composerStates;
+    mComposerStates = std::move(composerStates);
     mInputWindowCommands = inputWindowCommands;
     mApplyToken = applyToken;
     return NO_ERROR;
@@ -826,14 +826,18 @@ void SurfaceComposerClient::Transaction::releaseBufferIfOverwriting(const layer_
 }
 
 SurfaceComposerClient::Transaction& SurfaceComposerClient::Transaction::merge(Transaction&& other) {
-    for (auto const& [handle, composerState] : other.mComposerStates) {
-        if (mComposerStates.count(handle) == 0) {
-            mComposerStates[handle] = composerState;
+    // |other| is cleared below, so states of layers that are new to this transaction are moved
+    // over, and the others are merged into the state already here.
+    for (auto& [handle, composerState] : other.mComposerStates) {
+        auto it = mComposerStates.find(handle);
+        if (it == mComposerStates.end()) {
+            mComposerStates.emplace(handle, std::move(composerState));
         } else {
+            layer_state_t& state = it->second.state;
             if (composerState.state.what & layer_state_t::eBufferChanged) {
-                releaseBufferIfOverwriting(mComposerStates[handle].state);
+                releaseBufferIfOverwriting(state);
             }
-            mComposerStates[handle].state.merge(composerState.state);
+            state.merge(composerState.state);
         }
     }
 
@@ -1003,8 +1007,9 @@ status_t SurfaceComposerClient::Transaction::apply(bool synchronous, bool oneWay
 
     mForceSynchronous |= synchronous;
 
-    for (auto const& kv : mComposerStates){
-        composerStates.add(kv.second);
+    composerStates.setCapacity(mComposerStates.size());
+    for (auto& [handle, composerState] : mComposerStates) {
+        composerStates.editItemAt(composerStates.add()) = std::move(composerState);
     }
 
     displayStates = std::move(mDisplayStates);
@@ -1123,17 +1128,14 @@ void SurfaceComposerClient::Transaction::setEarlyWakeupEnd() {
 layer_state_t* SurfaceComposerClient::Transaction::getLayerState(const sp<SurfaceControl>& sc) {
     auto handle = sc->getLayerStateHandle();
 
-    if (mComposerStates.count(handle) == 0) {
-        // we don't have it, add an initialized layer_state to our list
-        ComposerState s;
-
-        s.state.surface = handle;
-        s.state.layerId = sc->getLayerId();
-
-        mComposerStates[handle] = s;
+    auto [it, inserted] = mComposerStates.try_emplace(handle);
+    if (inserted) {
+        // we didn't have it, initialize the new layer_state
+        it->second.state.surface = handle;
+        it->second.state.layerId = sc->getLayerId();
     }
 
-    return &(mComposerStates[handle].state);
+    return &(it->second.state);
 }
 
 void SurfaceComposerClient::Transaction::registerSurfaceControlForCallback(
@@ -219,6 +219,12 @@ private:
     // synchronous mode.
     mutable std::condition_variable mDequeueCondition;
 
+    // mDequeueWaiters is the number of threads waiting on mDequeueCondition.
+    // Broadcasting a condition variable costs a futex wake even when nothing
+    // waits on it, so queueBuffer, acquireBuffer and releaseBuffer, which
+    // signal it every frame, only do so when this is non-zero.
+    int mDequeueWaiters;
+
     // mDequeueBufferCannotBlock indicates whether dequeueBuffer is allowed to
     // block. This flag is set during connect when both the producer and
     // consumer are controlled by the application.
@@ -23,6 +23,7 @@
 namespace android {
 
 class IBinder;
+class IConsumerListener;
 struct BufferSlot;
 
 #ifndef NO_BINDER
@@ -45,6 +46,10 @@ public:
     // flags indicating that previously-returned buffers are no longer valid.
     virtual status_t requestBuffer(int slot, sp<GraphicBuffer>* buf);
 
+    // See IGraphicBufferProducer::requestBuffers
+    virtual status_t requestBuffers(const std::vector<int32_t>& slots,
+                                    std::vector<RequestBufferOutput>* outputs) override;
+
     // see IGraphicsBufferProducer::setMaxDequeuedBufferCount
     virtual status_t setMaxDequeuedBufferCount(int maxDequeuedBuffers);
 
@@ -91,6 +96,12 @@ public:
                                    uint64_t* outBufferAge,
                                    FrameEventHistoryDelta* outTimestamps) override;
 
+    // See IGraphicBufferProducer::dequeueBuffers. The whole batch is dequeued
+    // under one acquisition of the BufferQueue lock, except that the lock is
+    // released to allocate buffers, as it is for dequeueBuffer.
+    virtual status_t dequeueBuffers(const std::vector<DequeueBufferInput>& inputs,
+                                    std::vector<DequeueBufferOutput>* outputs) override;
+
     // See IGraphicBufferProducer::detachBuffer
     virtual status_t detachBuffer(int slot);
 
@@ -119,6 +130,13 @@ public:
     virtual status_t queueBuffer(int slot,
             const QueueBufferInput& input, QueueBufferOutput* output);
 
+    // See IGraphicBufferProducer::queueBuffers. The whole batch is queued
+    // under one acquisition of the BufferQueue lock, waiting dequeuers are
+    // woken once, and the consumer callbacks for all of its frames are made
+    // in order with one callback ticket.
+    virtual status_t queueBuffers(const std::vector<QueueBufferInput>& inputs,
+                                  std::vector<QueueBufferOutput>* outputs) override;
+
     // cancelBuffer returns a dequeued buffer to the BufferQueue, but doesn't
     // queue it for use by the consumer.
     //
@@ -217,6 +235,55 @@ private:
     void addAndGetFrameTimestamps(const NewFrameEventsEntry* newTimestamps,
             FrameEventHistoryDelta* outDelta);
 
+    // requestBufferLocked does the work of requestBuffer. mCore->mMutex must
+    // be held.
+    status_t requestBufferLocked(int slot, sp<GraphicBuffer>* buf);
+
+    // dequeueBuffer is split into steps so that dequeueBuffers can run the
+    // steps that need mCore->mMutex for its whole batch under one lock.
+    //
+    // dequeueBufferLocked moves a slot to the DEQUEUED state and describes it
+    // in *out. Like waitForFreeSlotThenRelock, it may release the lock while
+    // it waits. If out->returnFlags has BUFFER_NEEDS_REALLOCATION set,
+    // mCore->mIsAllocating is set as well, and allocateDequeuedBufferThenRelock
+    // must be called before anything else is dequeued.
+    struct DequeuedBuffer;
+    status_t dequeueBufferLocked(std::unique_lock<std::mutex>& lock, uint32_t width,
+            uint32_t height, PixelFormat format, uint64_t usage, sp<Fence>* outFence,
+            DequeuedBuffer* out);
+    // allocateDequeuedBufferThenRelock releases mCore->mMutex to allocate the
+    // buffer of a dequeued slot, then takes the lock again to store it. If the
+    // allocation fails, the slot is freed.
+    status_t allocateDequeuedBufferThenRelock(std::unique_lock<std::mutex>& lock,
+            const DequeuedBuffer& dequeued);
+    // finishDequeue waits for the EGL fence of a dequeued slot and returns the
+    // flags for dequeueBuffer to return. mCore->mMutex must not be held.
+    status_t finishDequeue(const DequeuedBuffer& dequeued);
+
+    // queueBuffer is split into steps the same way, for queueBuffers.
+    //
+    // prepareQueueBuffer checks the parts of the input that do not depend on
+    // the BufferQueue state.
+    struct QueuedFrame;
+    status_t prepareQueueBuffer(const QueueBufferInput& input, QueuedFrame* frame) const;
+    // queueBufferLocked queues the buffer in slot. mCore->mMutex must be held.
+    // The caller notifies mCore->mDequeueCondition and takes a callback ticket.
+    status_t queueBufferLocked(int slot, const QueueBufferInput& input, QueuedFrame* frame,
+            QueueBufferOutput* output);
+    // postQueuedFrame records the timestamps of a queued frame with the
+    // consumer. mCore->mMutex must not be held.
+    void postQueuedFrame(const sp<IConsumerListener>& listener, QueuedFrame* frame,
+            QueueBufferOutput* output);
+    // onFrameQueuedLocked calls the consumer back about a queued frame.
+    // mCallbackMutex must be held, with the caller's callback ticket current.
+    void onFrameQueuedLocked(QueuedFrame* frame, sp<Fence>* outLastQueuedFence);
+
+    // waitForCallbackTurnLocked waits until callbackTicket is the current
+    // callback ticket, and endCallbackTurnLocked passes the turn on to the
+    // next ticket. mCallbackMutex must be held.
+    void waitForCallbackTurnLocked(std::unique_lock<std::mutex>& lock, int callbackTicket);
+    void endCallbackTurnLocked();
+
     // waitForFreeSlotThenRelock finds the oldest slot in the FREE state. It may
     // block if there are no available slots and we are not in non-blocking
     // mode (producer and consumer controlled by the application). If it blocks,
@@ -263,6 +330,7 @@ private:
     int mNextCallbackTicket; // Protected by mCore->mMutex
     int mCurrentCallbackTicket; // Protected by mCallbackMutex
     std::condition_variable mCallbackCondition;
+    int mCallbackWaiters; // Protected by mCallbackMutex
 
     // Sets how long dequeueBuffer or attachBuffer will block if a buffer or
     // slot is not yet available.
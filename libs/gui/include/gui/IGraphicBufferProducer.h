@@ -771,6 +771,8 @@ public:
     // This method behaves like a sequence of queueBuffer() calls.
     // The return value of the batched method will only be about the
     // transaction. For a local call, the return value will always be NO_ERROR.
+    // This holds even when no buffer was queued: whether an entry failed is
+    // only reported by its QueueBufferOutput::result.
     //
     // Note: QueueBufferInput::slot was added to QueueBufferInput to include the
     // `slot` input argument of the non-batched method queueBuffer().
@@ -194,6 +194,8 @@ struct layer_state_t {
     layer_state_t();
 
     void merge(const layer_state_t& other);
+    // Only the fields selected by |what| are parceled. read() leaves the other fields as they
+    // are, so it should be called on a newly constructed state.
     status_t write(Parcel& output) const;
     status_t read(const Parcel& input);
     bool hasBufferChanges() const;
@@ -224,7 +226,6 @@ struct layer_state_t {
     matrix22_t matrix;
     float cornerRadius;
     uint32_t backgroundBlurRadius;
-    sp<SurfaceControl> reparentSurfaceControl;
 
     sp<SurfaceControl> relativeLayerSurfaceControl;
 
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <gui/BufferItem.h>
+#include <gui/BufferQueue.h>
+#include <gui/IProducerListener.h>
+#include <system/window.h>
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+
+#include <vector>
+
+#include "MockConsumer.h"
+
+// Compares dequeueing, requesting and queueing N buffers with one call per
+// buffer against one batched call of each kind, on a BufferQueueProducer in
+// the same process.
+
+namespace android {
+namespace {
+
+using DequeueBufferInput = IGraphicBufferProducer::DequeueBufferInput;
+using DequeueBufferOutput = IGraphicBufferProducer::DequeueBufferOutput;
+using QueueBufferInput = IGraphicBufferProducer::QueueBufferInput;
+using QueueBufferOutput = IGraphicBufferProducer::QueueBufferOutput;
+using RequestBufferOutput = IGraphicBufferProducer::RequestBufferOutput;
+
+constexpr uint32_t kWidth = 64;
+constexpr uint32_t kHeight = 64;
+constexpr PixelFormat kFormat = PIXEL_FORMAT_RGBA_8888;
+constexpr uint64_t kUsage = GraphicBuffer::USAGE_SW_WRITE_OFTEN;
+
+QueueBufferInput makeQueueBufferInput(int slot) {
+    return QueueBufferInput(0, true, HAL_DATASPACE_UNKNOWN, Rect(kWidth, kHeight),
+                            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE, 0, false,
+                            slot);
+}
+
+class BufferQueueFixture {
+public:
+    explicit BufferQueueFixture(int bufferCount) {
+        BufferQueue::createBufferQueue(&mProducer, &mConsumer);
+        CHECK_EQ(OK, mConsumer->consumerConnect(new MockConsumer, false));
+        QueueBufferOutput output;
+        CHECK_EQ(OK,
+                 mProducer->connect(new StubProducerListener, NATIVE_WINDOW_API_CPU, false,
+                                    &output));
+        CHECK_EQ(OK, mProducer->setMaxDequeuedBufferCount(bufferCount));
+    }
+
+    const sp<IGraphicBufferProducer>& producer() const { return mProducer; }
+
+    // Acquires and releases everything queued, so that the producer can
+    // dequeue the buffers again.
+    void drain() {
+        BufferItem item;
+        while (mConsumer->acquireBuffer(&item, 0) == OK) {
+            mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber, EGL_NO_DISPLAY,
+                                     EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+        }
+    }
+
+private:
+    sp<IGraphicBufferProducer> mProducer;
+    sp<IGraphicBufferConsumer> mConsumer;
+};
+
+void cycleSingle(BufferQueueFixture& bq, int count) {
+    const sp<IGraphicBufferProducer>& producer = bq.producer();
+    int slots[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    for (int i = 0; i < count; i++) {
+        sp<Fence> fence;
+        status_t result = producer->dequeueBuffer(&slots[i], &fence, kWidth, kHeight, kFormat,
+                                                  kUsage, nullptr, nullptr);
+        CHECK_GE(result, 0);
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            CHECK_EQ(OK, producer->requestBuffer(slots[i], &buffer));
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        QueueBufferOutput output;
+        CHECK_EQ(OK, producer->queueBuffer(slots[i], makeQueueBufferInput(slots[i]), &output));
+    }
+    bq.drain();
+}
+
+void cycleBatched(BufferQueueFixture& bq, int count) {
+    const sp<IGraphicBufferProducer>& producer = bq.producer();
+    DequeueBufferInput dequeueInput;
+    dequeueInput.width = kWidth;
+    dequeueInput.height = kHeight;
+    dequeueInput.format = kFormat;
+    dequeueInput.usage = kUsage;
+    dequeueInput.getTimestamps = false;
+    const std::vector<DequeueBufferInput> dequeueInputs(count, dequeueInput);
+    std::vector<DequeueBufferOutput> dequeueOutputs;
+    CHECK_EQ(OK, producer->dequeueBuffers(dequeueInputs, &dequeueOutputs));
+
+    std::vector<int32_t> requestSlots;
+    std::vector<QueueBufferInput> queueInputs;
+    queueInputs.reserve(count);
+    for (const DequeueBufferOutput& output : dequeueOutputs) {
+        CHECK_GE(output.result, 0);
+        if (output.result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            requestSlots.push_back(output.slot);
+        }
+        queueInputs.push_back(makeQueueBufferInput(output.slot));
+    }
+    if (!requestSlots.empty()) {
+        std::vector<RequestBufferOutput> requestOutputs;
+        CHECK_EQ(OK, producer->requestBuffers(requestSlots, &requestOutputs));
+    }
+
+    std::vector<QueueBufferOutput> queueOutputs;
+    CHECK_EQ(OK, producer->queueBuffers(queueInputs, &queueOutputs));
+    for (const QueueBufferOutput& output : queueOutputs) {
+        CHECK_EQ(OK, output.result);
+    }
+    bq.drain();
+}
+
+// Both variants include the same consumer work to hand the buffers back.
+void BM_dequeueQueue(benchmark::State& state, void (*cycle)(BufferQueueFixture&, int)) {
+    const int count = static_cast<int>(state.range(0));
+    BufferQueueFixture bq(count);
+    // Allocate the buffers outside of the measurement.
+    cycle(bq, count);
+    while (state.KeepRunning()) {
+        cycle(bq, count);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK_CAPTURE(BM_dequeueQueue, single, cycleSingle)->DenseRange(2, 8);
+BENCHMARK_CAPTURE(BM_dequeueQueue, batched, cycleBatched)->DenseRange(2, 8);
+
+} // namespace
+} // namespace android
+
+BENCHMARK_MAIN();
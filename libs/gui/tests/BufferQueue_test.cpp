@@ -1224,4 +1224,49 @@ TEST_F(BufferQueueTest, TestProducerConnectDisconnect) {
     ASSERT_EQ(NO_INIT, mProducer->disconnect(NATIVE_WINDOW_API_CPU));
 }
 
+TEST_F(BufferQueueTest, ReleaseWakesBlockedDequeue) {
+    createBufferQueue();
+    sp<MockConsumer> mc(new MockConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(mc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK,
+              mProducer->connect(new StubProducerListener, NATIVE_WINDOW_API_CPU, false, &output));
+    // Fail instead of hanging if the release does not wake the dequeue.
+    const auto TIMEOUT = ms2ns(5000);
+    ASSERT_EQ(OK, mProducer->setDequeueTimeout(TIMEOUT));
+
+    // With one buffer acquired and one queued, both buffers are in use and the
+    // next dequeue blocks.
+    IGraphicBufferProducer::QueueBufferInput input(0ull, true, HAL_DATASPACE_UNKNOWN,
+                                                   Rect::INVALID_RECT,
+                                                   NATIVE_WINDOW_SCALING_MODE_FREEZE, 0,
+                                                   Fence::NO_FENCE);
+    BufferItem item;
+    for (int i = 0; i < 2; ++i) {
+        int slot = BufferQueue::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        sp<GraphicBuffer> buffer;
+        ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+                  mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0, 0, nullptr, nullptr));
+        ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+        if (i == 0) {
+            ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+        }
+    }
+
+    std::thread releaser([&]() {
+        std::this_thread::sleep_for(100ms);
+        mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                                 Fence::NO_FENCE);
+    });
+    int slot = BufferQueue::INVALID_BUFFER_SLOT;
+    sp<Fence> fence;
+    const auto startTime = systemTime();
+    EXPECT_EQ(OK, mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0, 0, nullptr, nullptr));
+    EXPECT_LT(systemTime() - startTime, TIMEOUT);
+    EXPECT_EQ(item.mSlot, slot);
+    releaser.join();
+}
+
 } // namespace android
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <binder/Binder.h>
+#include <binder/Parcel.h>
+
+#include <gui/LayerState.h>
+#include <gui/SurfaceComposerClient.h>
+#include <gui/SurfaceControl.h>
+
+namespace android {
+
+namespace test {
+
+TEST(LayerState, ParcellingOnlyChangedFields) {
+    layer_state_t s;
+    s.surface = new BBinder();
+    s.layerId = 7;
+    s.what = layer_state_t::ePositionChanged | layer_state_t::eAlphaChanged;
+    s.x = 12.5f;
+    s.y = -3.0f;
+    s.alpha = 0.25f;
+    // Not flagged, so not parceled.
+    s.cornerRadius = 8.0f;
+    s.crop = Rect(1, 2, 3, 4);
+
+    Parcel p;
+    ASSERT_EQ(OK, s.write(p));
+    p.setDataPosition(0);
+
+    layer_state_t s2;
+    ASSERT_EQ(OK, s2.read(p));
+    ASSERT_EQ(p.dataSize(), p.dataPosition());
+    ASSERT_EQ(s.surface, s2.surface);
+    ASSERT_EQ(s.layerId, s2.layerId);
+    ASSERT_EQ(s.what, s2.what);
+    ASSERT_EQ(s.x, s2.x);
+    ASSERT_EQ(s.y, s2.y);
+    ASSERT_EQ(s.alpha, s2.alpha);
+    ASSERT_EQ(0.0f, s2.cornerRadius);
+    ASSERT_EQ(Rect::INVALID_RECT, s2.crop);
+
+    // Flagging more fields puts them on the wire.
+    Parcel p2;
+    s.what |= layer_state_t::eCornerRadiusChanged | layer_state_t::eCropChanged;
+    ASSERT_EQ(OK, s.write(p2));
+    ASSERT_LT(p.dataSize(), p2.dataSize());
+}
+
+TEST(LayerState, ParcellingAllFields) {
+    layer_state_t s;
+    s.surface = new BBinder();
+    s.layerId = 3;
+    s.what = ~0ull;
+    s.x = 1.0f;
+    s.y = 2.0f;
+    s.z = 3;
+    s.w = 40;
+    s.h = 50;
+    s.layerStack = ui::LayerStack::fromValue(6);
+    s.alpha = 0.5f;
+    s.flags = layer_state_t::eLayerOpaque;
+    s.mask = layer_state_t::eLayerOpaque | layer_state_t::eLayerHidden;
+    s.matrix.dsdx = 2.0f;
+    s.crop = Rect(10, 20, 30, 40);
+    s.color = half3(0.25f, 0.5f, 0.75f);
+    gui::WindowInfo info;
+    info.name = "input";
+    s.windowInfoHandle = new gui::WindowInfoHandle(info);
+    s.transparentRegion = Region(Rect(5, 5, 15, 15));
+    s.transform = 4;
+    s.transformToDisplayInverse = true;
+    s.dataspace = ui::Dataspace::SRGB;
+    s.surfaceDamageRegion = Region(Rect(0, 0, 8, 8));
+    s.api = 2;
+    s.cornerRadius = 9.0f;
+    s.backgroundBlurRadius = 11;
+    s.metadata.setInt32(1, 42);
+    s.bgColorAlpha = 0.125f;
+    s.bgColorDataspace = ui::Dataspace::DISPLAY_P3;
+    s.colorSpaceAgnostic = true;
+    s.listeners.emplace_back(new BBinder(),
+                             std::vector<CallbackId>{
+                                     CallbackId(5, CallbackId::Type::ON_COMPLETE)});
+    s.shadowRadius = 13.0f;
+    s.frameRateSelectionPriority = 2;
+    s.frameRate = 60.0f;
+    s.fixedTransformHint = ui::Transform::ROT_90;
+    s.autoRefresh = true;
+    s.dimmingEnabled = false;
+    s.blurRegions.push_back({4, 1.0f, 2.0f, 3.0f, 4.0f, 0.5f, 1, 2, 3, 4});
+    s.bufferCrop = Rect(1, 1, 2, 2);
+    s.destinationFrame = Rect(3, 3, 4, 4);
+    s.isTrustedOverlay = true;
+    s.dropInputMode = gui::DropInputMode::ALL;
+
+    Parcel p;
+    ASSERT_EQ(OK, s.write(p));
+    p.setDataPosition(0);
+
+    layer_state_t s2;
+    ASSERT_EQ(OK, s2.read(p));
+    ASSERT_EQ(p.dataSize(), p.dataPosition());
+    ASSERT_EQ(s.what, s2.what);
+    ASSERT_EQ(s.x, s2.x);
+    ASSERT_EQ(s.y, s2.y);
+    ASSERT_EQ(s.z, s2.z);
+    ASSERT_EQ(s.w, s2.w);
+    ASSERT_EQ(s.h, s2.h);
+    ASSERT_EQ(s.layerStack, s2.layerStack);
+    ASSERT_EQ(s.alpha, s2.alpha);
+    ASSERT_EQ(s.flags, s2.flags);
+    ASSERT_EQ(s.mask, s2.mask);
+    ASSERT_EQ(s.matrix.dsdx, s2.matrix.dsdx);
+    ASSERT_EQ(s.crop, s2.crop);
+    ASSERT_EQ(s.color, s2.color);
+    ASSERT_EQ("input", s2.windowInfoHandle->getInfo()->name);
+    ASSERT_TRUE(s.transparentRegion.hasSameRects(s2.transparentRegion));
+    ASSERT_EQ(s.transform, s2.transform);
+    ASSERT_EQ(s.transformToDisplayInverse, s2.transformToDisplayInverse);
+    ASSERT_EQ(s.dataspace, s2.dataspace);
+    ASSERT_TRUE(s.surfaceDamageRegion.hasSameRects(s2.surfaceDamageRegion));
+    ASSERT_EQ(s.api, s2.api);
+    ASSERT_EQ(s.cornerRadius, s2.cornerRadius);
+    ASSERT_EQ(s.backgroundBlurRadius, s2.backgroundBlurRadius);
+    ASSERT_EQ(42, s2.metadata.getInt32(1, 0));
+    ASSERT_EQ(s.bgColorAlpha, s2.bgColorAlpha);
+    ASSERT_EQ(s.bgColorDataspace, s2.bgColorDataspace);
+    ASSERT_EQ(s.colorSpaceAgnostic, s2.colorSpaceAgnostic);
+    ASSERT_EQ(1u, s2.listeners.size());
+    ASSERT_EQ(s.listeners[0].callbackIds, s2.listeners[0].callbackIds);
+    ASSERT_EQ(s.shadowRadius, s2.shadowRadius);
+    ASSERT_EQ(s.frameRateSelectionPriority, s2.frameRateSelectionPriority);
+    ASSERT_EQ(s.frameRate, s2.frameRate);
+    ASSERT_EQ(s.fixedTransformHint, s2.fixedTransformHint);
+    ASSERT_EQ(s.autoRefresh, s2.autoRefresh);
+    ASSERT_EQ(s.dimmingEnabled, s2.dimmingEnabled);
+    ASSERT_EQ(s.blurRegions, s2.blurRegions);
+    ASSERT_EQ(s.bufferCrop, s2.bufferCrop);
+    ASSERT_EQ(s.destinationFrame, s2.destinationFrame);
+    ASSERT_EQ(s.isTrustedOverlay, s2.isTrustedOverlay);
+    ASSERT_EQ(s.dropInputMode, s2.dropInputMode);
+    ASSERT_EQ(nullptr, s2.bufferData);
+}
+
+TEST(LayerState, TransactionParcellingRoundTrips) {
+    sp<SurfaceControl> first = new SurfaceControl(nullptr, new BBinder(), nullptr, 1);
+    sp<SurfaceControl> second = new SurfaceControl(nullptr, new BBinder(), nullptr, 2);
+
+    SurfaceComposerClient::Transaction t;
+    t.setPosition(first, 1.0f, 2.0f).setAlpha(first, 0.5f);
+    SurfaceComposerClient::Transaction other;
+    other.setCrop(second, Rect(0, 0, 10, 10)).setCornerRadius(first, 4.0f);
+    t.merge(std::move(other));
+
+    Parcel p;
+    ASSERT_EQ(OK, t.writeToParcel(&p));
+    p.setDataPosition(0);
+    std::unique_ptr<SurfaceComposerClient::Transaction> t2 =
+            SurfaceComposerClient::Transaction::createFromParcel(&p);
+    ASSERT_NE(nullptr, t2);
+    ASSERT_EQ(p.dataSize(), p.dataPosition());
+
+    Parcel p2;
+    ASSERT_EQ(OK, t2->writeToParcel(&p2));
+    ASSERT_EQ(p.dataSize(), p2.dataSize());
+}
+
+} // namespace test
+} // namespace android
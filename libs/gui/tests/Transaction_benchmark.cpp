@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <binder/Binder.h>
+#include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+#include <gui/ISurfaceComposerClient.h>
+#include <gui/SurfaceComposerClient.h>
+#include <gui/SurfaceControl.h>
+#include <utils/String8.h>
+
+#include <vector>
+
+// Parcels, merges and applies transactions that change N layers the way an
+// animation frame does: a new position and alpha for every layer. The
+// "bytes" counter is the size of one parcelled transaction.
+//
+// BM_apply needs SurfaceFlinger and is skipped where it is not running.
+
+namespace android {
+namespace {
+
+using Transaction = SurfaceComposerClient::Transaction;
+
+std::vector<sp<SurfaceControl>> makeLocalLayers(int count) {
+    std::vector<sp<SurfaceControl>> layers;
+    for (int i = 0; i < count; i++) {
+        layers.push_back(new SurfaceControl(nullptr, new BBinder(), nullptr, i));
+    }
+    return layers;
+}
+
+void animate(Transaction& t, const std::vector<sp<SurfaceControl>>& layers, int frame) {
+    for (const sp<SurfaceControl>& layer : layers) {
+        t.setPosition(layer, static_cast<float>(frame), static_cast<float>(frame) * 0.5f);
+        t.setAlpha(layer, 1.0f / static_cast<float>(frame % 8 + 1));
+    }
+}
+
+void BM_writeToParcel(benchmark::State& state) {
+    const std::vector<sp<SurfaceControl>> layers = makeLocalLayers(state.range(0));
+    Transaction t;
+    animate(t, layers, 1);
+    Parcel parcel;
+    while (state.KeepRunning()) {
+        parcel.setDataSize(0);
+        CHECK_EQ(OK, t.writeToParcel(&parcel));
+    }
+    state.counters["bytes"] = parcel.dataSize();
+    state.SetBytesProcessed(state.iterations() * parcel.dataSize());
+}
+BENCHMARK(BM_writeToParcel)->Arg(1)->Arg(10)->Arg(100);
+
+void BM_readFromParcel(benchmark::State& state) {
+    const std::vector<sp<SurfaceControl>> layers = makeLocalLayers(state.range(0));
+    Transaction t;
+    animate(t, layers, 1);
+    Parcel parcel;
+    CHECK_EQ(OK, t.writeToParcel(&parcel));
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        CHECK_EQ(OK, t.readFromParcel(&parcel));
+    }
+    state.counters["bytes"] = parcel.dataSize();
+    state.SetBytesProcessed(state.iterations() * parcel.dataSize());
+}
+BENCHMARK(BM_readFromParcel)->Arg(1)->Arg(10)->Arg(100);
+
+// About half of the layers of each merged transaction are already in the
+// target.
+void BM_merge(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    const std::vector<sp<SurfaceControl>> layers = makeLocalLayers(count * 3 / 2);
+    const std::vector<sp<SurfaceControl>> first(layers.begin(), layers.begin() + count);
+    const std::vector<sp<SurfaceControl>> second(layers.end() - count, layers.end());
+    int frame = 0;
+    while (state.KeepRunning()) {
+        Transaction t;
+        animate(t, first, ++frame);
+        Transaction other;
+        animate(other, second, frame);
+        t.merge(std::move(other));
+        benchmark::DoNotOptimize(t);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_merge)->Arg(1)->Arg(10)->Arg(100);
+
+void BM_apply(benchmark::State& state) {
+    sp<SurfaceComposerClient> client = new SurfaceComposerClient;
+    if (client->initCheck() != NO_ERROR) {
+        state.SkipWithError("SurfaceFlinger is not available");
+        return;
+    }
+    std::vector<sp<SurfaceControl>> layers;
+    for (int i = 0; i < state.range(0); i++) {
+        sp<SurfaceControl> layer =
+                client->createSurface(String8::format("Transaction_benchmark#%d", i), 0, 0,
+                                      PIXEL_FORMAT_RGBA_8888,
+                                      ISurfaceComposerClient::eFXSurfaceEffect);
+        CHECK(layer != nullptr);
+        layers.push_back(layer);
+    }
+    // Block once so that the layers exist before the measurement.
+    Transaction().apply(true);
+
+    int frame = 0;
+    while (state.KeepRunning()) {
+        Transaction t;
+        animate(t, layers, ++frame);
+        CHECK_EQ(OK, t.apply());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_apply)->Arg(1)->Arg(10)->Arg(100);
+
+} // namespace
+} // namespace android
+
+int main(int argc, char** argv) {
+    android::ProcessState::self()->startThreadPool();
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
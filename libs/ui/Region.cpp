@@ -19,6 +19,8 @@
 #include <inttypes.h>
 #include <limits.h>
 
+#include <atomic>
+
 #include <android-base/stringprintf.h>
 
 #include <utils/Log.h>
@@ -35,6 +37,9 @@
 // in Android.bp. Do not #define VALIDATE_REGIONS here as it requires extra libs.
 
 #define VALIDATE_WITH_CORECG    (false)
+
+// Rects that fit in a Region's mStorage without allocating.
+static constexpr size_t kInlineRects = 4;
 // ----------------------------------------------------------------------------
 
 #if defined(VALIDATE_REGIONS)
@@ -71,9 +76,12 @@ Region::Region() {
 }
 
 Region::Region(const Region& rhs)
+    : mShared(rhs.mShared)
 {
     mStorage.clear();
-    mStorage.insert(mStorage.begin(), rhs.mStorage.begin(), rhs.mStorage.end());
+    if (!mShared) {
+        mStorage.insert(mStorage.begin(), rhs.mStorage.begin(), rhs.mStorage.end());
+    }
 #if defined(VALIDATE_REGIONS)
     validate(rhs, "rhs copy-ctor");
 #endif
@@ -210,6 +218,7 @@ Region Region::createTJunctionFreeRegion(const Region& r) {
                                    outputRegion.mStorage, direction_LTR);
     outputRegion.mStorage.push_back(
             r.getBounds()); // to make region valid, mStorage must end with bounds
+    outputRegion.shareLargeStorage();
 
 #if defined(VALIDATE_REGIONS)
     validate(outputRegion, "T-Junction free region");
@@ -229,17 +238,19 @@ Region& Region::operator = (const Region& rhs)
         return *this;
     }
 
+    mShared = rhs.mShared;
     mStorage.clear();
-    mStorage.insert(mStorage.begin(), rhs.mStorage.begin(), rhs.mStorage.end());
+    if (!mShared) {
+        mStorage.insert(mStorage.begin(), rhs.mStorage.begin(), rhs.mStorage.end());
+    }
     return *this;
 }
 
 Region& Region::makeBoundsSelf()
 {
-    if (mStorage.size() >= 2) {
+    if (storage().size() >= 2) {
         const Rect bounds(getBounds());
-        mStorage.clear();
-        mStorage.push_back(bounds);
+        resetStorage().push_back(bounds);
     }
     return *this;
 }
@@ -262,26 +273,22 @@ bool Region::contains(int x, int y) const {
 
 void Region::clear()
 {
-    mStorage.clear();
-    mStorage.push_back(Rect(0, 0));
+    resetStorage().push_back(Rect(0, 0));
 }
 
 void Region::set(const Rect& r)
 {
-    mStorage.clear();
-    mStorage.push_back(r);
+    resetStorage().push_back(r);
 }
 
 void Region::set(int32_t w, int32_t h)
 {
-    mStorage.clear();
-    mStorage.push_back(Rect(w, h));
+    resetStorage().push_back(Rect(w, h));
 }
 
 void Region::set(uint32_t w, uint32_t h)
 {
-    mStorage.clear();
-    mStorage.push_back(Rect(w, h));
+    resetStorage().push_back(Rect(w, h));
 }
 
 bool Region::isTriviallyEqual(const Region& region) const {
@@ -307,7 +314,61 @@ bool Region::hasSameRects(const Region& other) const {
 void Region::addRectUnchecked(int l, int t, int r, int b)
 {
     Rect rect(l,t,r,b);
-    mStorage.insert(mStorage.end() - 1, rect);
+    FatVector<Rect>& rects = editStorage();
+    rects.insert(rects.end() - 1, rect);
+}
+
+// ----------------------------------------------------------------------------
+
+// Whether no other Region holds |rects|, so that it can be written to.
+// use_count() is a relaxed load, which doesn't order this thread's writes
+// after another thread's reads of a copy it has since released. The fence
+// pairs with the release of that copy's reference.
+static bool isExclusive(const std::shared_ptr<FatVector<Rect>>& rects)
+{
+    if (rects.use_count() > 1) return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+FatVector<Rect>& Region::editStorage()
+{
+    if (mShared && !isExclusive(mShared)) {
+        // Copying into mStorage allocates once, where a new mShared would
+        // also allocate its control block. The rects are shared again the
+        // next time they are rewritten, see resetStorage().
+        mStorage.clear();
+        // room for addRectUnchecked()
+        mStorage.reserve(mShared->size() + 1);
+        mStorage.insert(mStorage.begin(), mShared->begin(), mShared->end());
+        mShared.reset();
+    }
+    return mShared ? *mShared : mStorage;
+}
+
+FatVector<Rect>& Region::resetStorage(size_t count)
+{
+    mStorage.clear();
+    if (count <= kInlineRects) {
+        mShared.reset();
+        return mStorage;
+    }
+    if (!mShared || !isExclusive(mShared)) {
+        mShared = std::make_shared<FatVector<Rect>>();
+    }
+    mShared->clear();
+    mShared->reserve(count);
+    return *mShared;
+}
+
+void Region::shareLargeStorage()
+{
+    // Past its inline buffer, mStorage costs an allocation to copy anyway.
+    if (mShared || mStorage.size() <= kInlineRects) return;
+    std::shared_ptr<FatVector<Rect>> rects = std::make_shared<FatVector<Rect>>();
+    rects->insert(rects->begin(), mStorage.begin(), mStorage.end());
+    mShared = std::move(rects);
+    mStorage.clear();
 }
 
 // ----------------------------------------------------------------------------
@@ -364,8 +425,8 @@ Region& Region::translateSelf(int x, int y) {
 }
 
 Region& Region::scaleSelf(float sx, float sy) {
-    size_t count = mStorage.size();
-    Rect* rects = mStorage.data();
+    Rect* rects = editStorage().data();
+    size_t count = storage().size();
     while (count) {
         rects->left = static_cast<int32_t>(static_cast<float>(rects->left) * sx + 0.5f);
         rects->right = static_cast<int32_t>(static_cast<float>(rects->right) * sx + 0.5f);
@@ -476,8 +537,8 @@ class Region::rasterizer : public region_operator<Rect>::region_rasterizer
     FatVector<Rect> span;
     Rect* cur;
 public:
-    explicit rasterizer(Region& reg)
-        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(), cur() {
+    rasterizer(Region& reg, size_t count)
+        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.resetStorage(count)), head(), tail(), cur() {
         storage.clear();
     }
 
@@ -565,7 +626,7 @@ void Region::rasterizer::flushSpan()
 
 bool Region::validate(const Region& reg, const char* name, bool silent)
 {
-    if (reg.mStorage.empty()) {
+    if (reg.storage().empty()) {
         ALOGE_IF(!silent, "%s: mStorage is empty, which is never valid", name);
         // return immediately as the code below assumes mStorage is non-empty
         return false;
@@ -630,7 +691,7 @@ bool Region::validate(const Region& reg, const char* name, bool silent)
                 reg.getBounds().left, reg.getBounds().top, 
                 reg.getBounds().right, reg.getBounds().bottom);
     }
-    if (reg.mStorage.size() == 2) {
+    if (reg.storage().size() == 2) {
         result = false;
         ALOGE_IF(!silent, "%s: mStorage size is 2, which is never valid", name);
     }
@@ -659,13 +720,17 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     size_t rhs_count;
     Rect const * const rhs_rects = rhs.getArray(&rhs_count);
 
+    // A guess at the size of the result, bounds included.
+    const size_t dst_count = lhs_count + rhs_count + 1;
+
     region_operator<Rect>::region lhs_region(lhs_rects, lhs_count);
     region_operator<Rect>::region rhs_region(rhs_rects, rhs_count, dx, dy);
     region_operator<Rect> operation(op, lhs_region, rhs_region);
     { // scope for rasterizer (dtor has side effects)
-        rasterizer r(dst);
+        rasterizer r(dst, dst_count);
         operation(r);
     }
+    dst.shareLargeStorage();
 
 #if defined(VALIDATE_REGIONS)
     validate(lhs, "boolean_operation: lhs");
@@ -770,13 +835,17 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
+    // A guess at the size of the result, bounds included.
+    const size_t dst_count = lhs_count + 2;
+
     region_operator<Rect>::region lhs_region(lhs_rects, lhs_count);
     region_operator<Rect>::region rhs_region(&rhs, 1, dx, dy);
     region_operator<Rect> operation(op, lhs_region, rhs_region);
     { // scope for rasterizer (dtor has side effects)
-        rasterizer r(dst);
+        rasterizer r(dst, dst_count);
         operation(r);
     }
+    dst.shareLargeStorage();
 
 #endif
 }
@@ -799,8 +868,8 @@ void Region::translate(Region& reg, int dx, int dy)
 #if defined(VALIDATE_REGIONS)
         validate(reg, "translate (before)");
 #endif
-        size_t count = reg.mStorage.size();
-        Rect* rects = reg.mStorage.data();
+        Rect* rects = reg.editStorage().data();
+        size_t count = reg.storage().size();
         while (count) {
             rects->offsetBy(dx, dy);
             rects++;
@@ -821,7 +890,7 @@ void Region::translate(Region& dst, const Region& reg, int dx, int dy)
 // ----------------------------------------------------------------------------
 
 size_t Region::getFlattenedSize() const {
-    return sizeof(uint32_t) + mStorage.size() * sizeof(Rect);
+    return sizeof(uint32_t) + storage().size() * sizeof(Rect);
 }
 
 status_t Region::flatten(void* buffer, size_t size) const {
@@ -833,8 +902,8 @@ status_t Region::flatten(void* buffer, size_t size) const {
     }
     // Cast to uint32_t since the size of a size_t can vary between 32- and
     // 64-bit processes
-    FlattenableUtils::write(buffer, size, static_cast<uint32_t>(mStorage.size()));
-    for (auto rect : mStorage) {
+    FlattenableUtils::write(buffer, size, static_cast<uint32_t>(storage().size()));
+    for (auto rect : storage()) {
         status_t result = rect.flatten(buffer, size);
         if (result != NO_ERROR) {
             return result;
@@ -880,25 +949,26 @@ status_t Region::unflatten(void const* buffer, size_t size) {
         ALOGE("Region::unflatten() failed, invalid region");
         return BAD_VALUE;
     }
-    mStorage.clear();
-    mStorage.insert(mStorage.begin(), result.mStorage.begin(), result.mStorage.end());
+    result.shareLargeStorage();
+    *this = result;
     return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
 
 Region::const_iterator Region::begin() const {
-    return mStorage.data();
+    return storage().data();
 }
 
 Region::const_iterator Region::end() const {
     // Workaround for b/77643177
     // mStorage should never be empty, but somehow it is and it's causing
     // an abort in ubsan
-    if (mStorage.empty()) return mStorage.data();
+    const FatVector<Rect>& rects = storage();
+    if (rects.empty()) return rects.data();
 
-    size_t numRects = isRect() ? 1 : mStorage.size() - 1;
-    return mStorage.data() + numRects;
+    size_t numRects = isRect() ? 1 : rects.size() - 1;
+    return rects.data() + numRects;
 }
 
 Rect const* Region::getArray(size_t* count) const {
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <memory>
 #include <ostream>
 
 #include <math/HashCombine.h>
@@ -49,9 +50,9 @@ public:
         Region& operator = (const Region& rhs);
 
     inline  bool        isEmpty() const     { return getBounds().isEmpty(); }
-    inline  bool        isRect() const      { return mStorage.size() == 1; }
+    inline  bool        isRect() const      { return storage().size() == 1; }
 
-    inline  Rect        getBounds() const   { return mStorage[mStorage.size() - 1]; }
+    inline  Rect        getBounds() const   { return storage()[storage().size() - 1]; }
     inline  Rect        bounds() const      { return getBounds(); }
 
             bool        contains(const Point& point) const;
@@ -177,11 +178,29 @@ private:
     static bool validate(const Region& reg,
             const char* name, bool silent = false);
 
+    // The rects of the region, see mStorage.
+    inline const FatVector<Rect>& storage() const { return mShared ? *mShared : mStorage; }
+    // The rects to change in place; copied to mStorage first if other regions
+    // share them.
+    FatVector<Rect>& editStorage();
+    // Empty storage to write all of the rects to, about |count| of them.
+    FatVector<Rect>& resetStorage(size_t count = 1);
+    // Moves rects that outgrew mStorage's inline buffer to mShared.
+    void shareLargeStorage();
+
     // mStorage is a (manually) sorted array of Rects describing the region
     // with an extra Rect as the last element which is set to the
     // bounds of the region. However, if the region is
     // a simple Rect then mStorage contains only that rect.
     FatVector<Rect> mStorage;
+
+    // When set, holds the rects instead of mStorage. Regions written with
+    // more rects than mStorage holds inline keep them here, so that copies of
+    // the region share them rather than copy them. Shared rects are never
+    // changed; a region changing them in place gets its own in mStorage
+    // first. Copies may live on other threads, so whether the rects are still
+    // shared is checked with acquire ordering.
+    std::shared_ptr<FatVector<Rect>> mShared;
 };
 
 
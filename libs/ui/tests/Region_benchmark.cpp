@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <vector>
+
+using android::Rect;
+using android::Region;
+
+namespace {
+
+struct Layer {
+    Rect bounds;
+    bool opaque;
+};
+
+// Layers are listed bottom to top, the way SurfaceFlinger sorts them by z.
+
+std::vector<Layer> phoneLayout() {
+    std::vector<Layer> layers = {
+            {Rect(0, 0, 1080, 2400), true},     // wallpaper
+            {Rect(0, 0, 1080, 2400), true},     // launcher
+            {Rect(0, 0, 1080, 2400), true},     // app
+            {Rect(0, 1400, 1080, 2280), true},  // keyboard
+            {Rect(90, 700, 990, 1500), false},  // dialog with rounded corners
+            {Rect(0, 0, 1080, 2400), false},    // dim layer
+            {Rect(240, 1900, 840, 2040), false}, // toast
+            {Rect(0, 0, 1080, 80), false},      // status bar
+            {Rect(0, 2280, 1080, 2400), false}, // navigation bar
+    };
+    // Status bar icons and notification dots.
+    for (int i = 0; i < 24; i++) {
+        layers.push_back({Rect(20 + i * 42, 20, 56 + i * 42, 60), false});
+    }
+    // Rounded corner overlays.
+    layers.push_back({Rect(0, 0, 60, 60), false});
+    layers.push_back({Rect(1020, 0, 1080, 60), false});
+    layers.push_back({Rect(0, 2340, 60, 2400), false});
+    layers.push_back({Rect(1020, 2340, 1080, 2400), false});
+    return layers;
+}
+
+std::vector<Layer> tabletFreeformLayout() {
+    std::vector<Layer> layers = {
+            {Rect(0, 0, 2560, 1600), true}, // wallpaper
+            {Rect(0, 0, 2560, 1600), true}, // launcher
+    };
+    // Cascaded freeform windows, each with a caption and a shadow.
+    for (int i = 0; i < 16; i++) {
+        const int left = 80 + i * 97;
+        const int top = 60 + i * 53;
+        layers.push_back({Rect(left - 24, top - 24, left + 924, top + 624), false});
+        layers.push_back({Rect(left, top, left + 900, top + 600), true});
+        layers.push_back({Rect(left, top, left + 900, top + 48), false});
+    }
+    layers.push_back({Rect(0, 1520, 2560, 1600), false}); // taskbar
+    layers.push_back({Rect(0, 0, 2560, 48), false});      // status bar
+    return layers;
+}
+
+std::vector<Layer> splitScreenLayout() {
+    std::vector<Layer> layers = {
+            {Rect(0, 0, 2560, 1600), true},    // wallpaper
+            {Rect(0, 0, 1276, 1600), true},    // left app
+            {Rect(1284, 0, 2560, 1600), true}, // right app
+            {Rect(1276, 0, 1284, 1600), true}, // divider
+            {Rect(1900, 1100, 2460, 1415), true}, // picture-in-picture
+    };
+    // Tiles of two grid-based apps, such as photo galleries.
+    for (int side = 0; side < 2; side++) {
+        for (int i = 0; i < 24; i++) {
+            const int left = side * 1284 + 16 + (i % 4) * 314;
+            const int top = 120 + (i / 4) * 240;
+            layers.push_back({Rect(left, top, left + 300, top + 224), true});
+        }
+    }
+    layers.push_back({Rect(0, 0, 2560, 48), false}); // status bar
+    return layers;
+}
+
+// The region math SurfaceFlinger does for every layer of a frame: walking
+// from the top layer down, what each layer shows, what is hidden, and what
+// is dirty.
+void computeVisibleRegions(const std::vector<Layer>& layers) {
+    Region aboveOpaque;
+    Region aboveCovered;
+    Region dirty;
+    for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+        const Region bounds(it->bounds);
+        Region visible = bounds.subtract(aboveOpaque);
+        Region covered = aboveCovered.intersect(bounds);
+        aboveCovered.orSelf(bounds);
+        if (it->opaque) {
+            aboveOpaque.orSelf(bounds);
+        }
+        dirty.orSelf(visible);
+        dirty.orSelf(covered.intersect(visible));
+        benchmark::DoNotOptimize(visible);
+    }
+    benchmark::DoNotOptimize(dirty);
+}
+
+void BM_computeVisibleRegions(benchmark::State& state, std::vector<Layer> (*layout)()) {
+    const std::vector<Layer> layers = layout();
+    while (state.KeepRunning()) {
+        computeVisibleRegions(layers);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(layers.size()));
+}
+BENCHMARK_CAPTURE(BM_computeVisibleRegions, phone, phoneLayout);
+BENCHMARK_CAPTURE(BM_computeVisibleRegions, tabletFreeform, tabletFreeformLayout);
+BENCHMARK_CAPTURE(BM_computeVisibleRegions, splitScreen, splitScreenLayout);
+
+// Single operations on the complex regions the windows cover, leaving out the
+// full screen layers.
+Region coverage(const std::vector<Layer>& layers, bool opaqueOnly) {
+    Region region;
+    for (const Layer& layer : layers) {
+        if (layer.bounds == layers.front().bounds) continue;
+        if (layer.opaque || !opaqueOnly) region.orSelf(layer.bounds);
+    }
+    return region;
+}
+
+void BM_operation(benchmark::State& state, Region (*operation)(const Region&, const Region&)) {
+    const std::vector<Layer> layers = tabletFreeformLayout();
+    const Region lhs = coverage(layers, false);
+    const Region rhs = coverage(layers, true).translate(7, 5);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(operation(lhs, rhs));
+    }
+}
+BENCHMARK_CAPTURE(BM_operation, merge, [](const Region& lhs, const Region& rhs) {
+    return lhs.merge(rhs);
+});
+BENCHMARK_CAPTURE(BM_operation, intersect, [](const Region& lhs, const Region& rhs) {
+    return lhs.intersect(rhs);
+});
+BENCHMARK_CAPTURE(BM_operation, subtract, [](const Region& lhs, const Region& rhs) {
+    return lhs.subtract(rhs);
+});
+BENCHMARK_CAPTURE(BM_operation, mergeExclusive, [](const Region& lhs, const Region& rhs) {
+    return lhs.mergeExclusive(rhs);
+});
+
+} // namespace
+
+BENCHMARK_MAIN();
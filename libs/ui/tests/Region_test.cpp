@@ -17,6 +17,10 @@
 #define LOG_TAG "RegionTest"
 
 #include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
 #include <ui/Region.h>
 #include <ui/Rect.h>
 #include <gtest/gtest.h>
@@ -53,6 +57,46 @@ protected:
         }
         EXPECT_TRUE((original ^ modified).isEmpty());
     }
+
+    // Checks that |r| is in the canonical form region_operator produces:
+    // bands sorted top to bottom, spans in a band neither overlapping nor
+    // touching, and no two touching bands with the same spans.
+    void verifyCanonical(const Region& r) {
+        if (r.isEmpty()) return;
+
+        const Rect* const end = r.end();
+        const Rect* prevBand = nullptr;
+        const Rect* prevBandEnd = nullptr;
+        Rect bounds(INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN);
+        for (const Rect* band = r.begin(); band != end;) {
+            const Rect* bandEnd = band;
+            while (bandEnd != end && bandEnd->top == band->top) {
+                EXPECT_EQ(band->bottom, bandEnd->bottom);
+                EXPECT_LT(bandEnd->left, bandEnd->right);
+                if (bandEnd != band) {
+                    EXPECT_GT(bandEnd->left, (bandEnd - 1)->right);
+                }
+                bandEnd++;
+            }
+            if (prevBand != nullptr) {
+                EXPECT_GE(band->top, prevBand->bottom);
+                if (band->top == prevBand->bottom) {
+                    EXPECT_FALSE(std::equal(band, bandEnd, prevBand, prevBandEnd,
+                                            [](const Rect& a, const Rect& b) {
+                                                return a.left == b.left && a.right == b.right;
+                                            }));
+                }
+            }
+            bounds.left = std::min(bounds.left, band->left);
+            bounds.top = std::min(bounds.top, band->top);
+            bounds.right = std::max(bounds.right, (bandEnd - 1)->right);
+            bounds.bottom = std::max(bounds.bottom, band->bottom);
+            prevBand = band;
+            prevBandEnd = bandEnd;
+            band = bandEnd;
+        }
+        EXPECT_EQ(bounds, r.getBounds());
+    }
 };
 
 TEST_F(RegionTest, MinimalDivision_TJunction) {
@@ -152,6 +196,61 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+TEST_F(RegionTest, Random_BooleanOperations) {
+    srandom(54321);
+
+    auto randomRegion = []() {
+        Region r;
+        for (int i = random() % 6; i > 0; i--) {
+            const int left = static_cast<int>(random() % X_MAX);
+            const int top = static_cast<int>(random() % Y_MAX);
+            const Rect rect(left, top, left + 1 + static_cast<int>(random() % X_MAX),
+                            top + 1 + static_cast<int>(random() % Y_MAX));
+            if (random() % 3) {
+                r.orSelf(rect);
+            } else {
+                r.subtractSelf(rect);
+            }
+        }
+        return r;
+    };
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        const Region lhs = randomRegion();
+        const Region rhs = randomRegion();
+        const int dx = static_cast<int>(random() % 5) - 2;
+        const int dy = static_cast<int>(random() % 5) - 2;
+
+        const Region results[] = {lhs.merge(rhs, dx, dy), lhs.intersect(rhs, dx, dy),
+                                  lhs.subtract(rhs, dx, dy), lhs.mergeExclusive(rhs, dx, dy)};
+        for (const Region& result : results) {
+            verifyCanonical(result);
+        }
+        for (int x = -3; x < 2 * X_MAX + 3; x++) {
+            for (int y = -3; y < 2 * Y_MAX + 3; y++) {
+                const bool inLhs = lhs.contains(x, y);
+                const bool inRhs = rhs.contains(x - dx, y - dy);
+                EXPECT_EQ(inLhs || inRhs, results[0].contains(x, y));
+                EXPECT_EQ(inLhs && inRhs, results[1].contains(x, y));
+                EXPECT_EQ(inLhs && !inRhs, results[2].contains(x, y));
+                EXPECT_EQ(inLhs != inRhs, results[3].contains(x, y));
+            }
+        }
+    }
+}
+
+TEST_F(RegionTest, SideBySideAndStackedRectsMerge) {
+    Region r(Rect(0, 0, 10, 10));
+    r.orSelf(Rect(10, 0, 20, 10));
+    r.orSelf(Rect(0, 10, 20, 20));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(0, 0, 20, 20), r.getBounds());
+
+    r.subtractSelf(Rect(5, 5, 15, 15));
+    EXPECT_EQ(4, r.end() - r.begin());
+    verifyCanonical(r);
+}
+
 TEST_F(RegionTest, EqualsToSelf) {
     Region touchableRegion;
     touchableRegion.orSelf(Rect(0, 0, 100, 100));
@@ -167,6 +266,38 @@ TEST_F(RegionTest, EqualsToSelf) {
     ASSERT_TRUE(touchableRegion.contains(50, 50));
 }
 
+TEST_F(RegionTest, CopiesShareLargeStorage) {
+    Region region;
+    for (int i = 0; i < 8; i++) {
+        region.orSelf(Rect(i * 10, i * 10, i * 10 + 50, i * 10 + 50));
+    }
+    const std::vector<Rect> rects(region.begin(), region.end());
+    ASSERT_GT(rects.size(), 4u);
+
+    Region copy(region);
+    Region assigned;
+    assigned = region;
+    EXPECT_TRUE(copy.isTriviallyEqual(region));
+    EXPECT_TRUE(assigned.isTriviallyEqual(region));
+
+    // Changing a copy leaves the other regions as they were.
+    copy.translateSelf(5, 5);
+    assigned.orSelf(Rect(500, 500, 600, 600));
+    EXPECT_FALSE(copy.isTriviallyEqual(region));
+    EXPECT_FALSE(assigned.isTriviallyEqual(region));
+    EXPECT_EQ(rects, std::vector<Rect>(region.begin(), region.end()));
+    EXPECT_TRUE(copy.hasSameRects(region.translate(5, 5)));
+    EXPECT_TRUE(assigned.contains(550, 550));
+    EXPECT_FALSE(region.contains(550, 550));
+
+    // So does changing the original, in place or not.
+    Region other(region);
+    region.addRectUnchecked(1000, 1000, 1010, 1010);
+    EXPECT_FALSE(other.contains(1005, 1005));
+    region.clear();
+    EXPECT_EQ(rects, std::vector<Rect>(other.begin(), other.end()));
+}
+
 TEST_F(RegionTest, RegionHash) {
     Region region1;
     region1.addRectUnchecked(10, 20, 30, 40);
@@ -33,6 +33,12 @@
 
 #include <aidl/android/hardware/graphics/composer3/Composition.h>
 
+#include <atomic>
+
+#if __has_feature(address_sanitizer)
+#include <sanitizer/allocator_interface.h>
+#endif
+
 using aidl::android::hardware::graphics::composer3::Composition;
 
 namespace android::compositionengine {
@@ -55,6 +61,28 @@ constexpr auto TR_ROT_270 = TR_ROT_90 | TR_ROT_180;
 
 const std::string kOutputName{"Test Output"};
 
+std::atomic<size_t> gAllocationCount{0};
+
+#if __has_feature(address_sanitizer)
+void onAllocation(const volatile void*, size_t) {
+    gAllocationCount++;
+}
+
+void onFree(const volatile void*) {}
+#endif
+
+// Starts counting allocations in gAllocationCount. Returns false if they can't be counted, which
+// takes the address sanitizer. This test is built with it, see Android.bp.
+bool countAllocations() {
+#if __has_feature(address_sanitizer)
+    static const bool counting =
+            __sanitizer_install_malloc_and_free_hooks(onAllocation, onFree) != 0;
+    return counting;
+#else
+    return false;
+#endif
+}
+
 MATCHER_P(ColorEq, expected, "") {
     *result_listener << "Colors are not equal\n";
     *result_listener << "expected " << expected.r << " " << expected.g << " " << expected.b << " "
@@ -123,6 +151,43 @@ struct OutputLayerTest : public testing::Test {
 
 TEST_F(OutputLayerTest, canInstantiateOutputLayer) {}
 
+/*
+ * Copying OutputLayerCompositionState
+ */
+
+TEST_F(OutputLayerTest, copyingStateSharesRegions) {
+    if (!countAllocations()) {
+        GTEST_SKIP() << "Allocations are only counted under the address sanitizer";
+    }
+
+    // More rects than a Region stores without allocating.
+    Region region;
+    for (int i = 0; i < 8; i++) {
+        region.orSelf(Rect(i * 10, i * 10, i * 10 + 50, i * 10 + 50));
+    }
+    auto& state = mOutputLayer.editState();
+    state.visibleRegion = region;
+    state.visibleNonTransparentRegion = region;
+    state.coveredRegion = region;
+    state.outputSpaceVisibleRegion = region;
+    state.shadowRegion = region;
+
+    // Copying the regions used to allocate once for each of them.
+    size_t allocationsBefore = gAllocationCount;
+    const impl::OutputLayerCompositionState copy = state;
+    EXPECT_EQ(allocationsBefore, gAllocationCount);
+    EXPECT_TRUE(copy.visibleRegion.isTriviallyEqual(region));
+    EXPECT_TRUE(copy.shadowRegion.isTriviallyEqual(region));
+    EXPECT_THAT(copy.visibleRegion, RegionEq(region));
+
+    // Changing a copy in place costs the one allocation its deep copy used to.
+    Region translated = copy.coveredRegion;
+    allocationsBefore = gAllocationCount;
+    translated.translateSelf(10, 10);
+    EXPECT_EQ(allocationsBefore + 1, gAllocationCount);
+    EXPECT_THAT(copy.coveredRegion, RegionEq(region));
+}
+
 /*
  * OutputLayer::setHwcLayer()
  */